@@ -4,3 +4,4 @@
  * @brief Signal header  
  */ 
 void ctrl_c_handler(int signal);
+void trace_dump_handler(int signal);
@@ -0,0 +1,78 @@
+#ifndef BAND_POWER_H
+#define BAND_POWER_H
+/**
+ * @file band_power.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Band power features. Each window of the stream (one page) is tapered
+ *        and transformed with a real FFT, channel by channel, and the power in
+ *        each frequency band is published as a feature vector in a second
+ *        shared memory ring.
+ */
+
+#include <stdint.h>
+
+#include "data_output.h"
+#include "xml.h"
+#include "pipeline.h"
+
+/*bins of a band, inclusive*/
+typedef struct band_bins_s {
+	int first;
+	int last;
+} band_bins_t;
+
+typedef struct band_power_s {
+
+	int nb_channels; /*values per sample*/
+	int nb_analyzed; /*leading channels analyzed*/
+	int window_size; /*samples per window*/
+	int rate; /*sampling rate (Hz)*/
+
+	/*transform, precomputed at init*/
+	int fft_size; /*N, power of 2, the window is zero padded*/
+	int half_size; /*M=N/2, size of the complex transform*/
+	float* taper; /*hann window, window_size coefficients*/
+	float* twiddle_re; /*exp(-2*pi*i*k/M), k<M/2*/
+	float* twiddle_im;
+	float* post_re; /*exp(-2*pi*i*k/N), k<M, splits the complex transform*/
+	float* post_im;
+	int* bit_reverse; /*permutation of the complex transform input*/
+	float* bin_scale; /*converts |X[k]|^2 to power, k<=M*/
+
+	/*bands*/
+	int nb_bands;
+	band_bins_t bins[MAX_FEATURE_BANDS];
+
+	/*window being filled, channel after channel*/
+	float* window;
+	int window_fill;
+	uint64_t window_first_sample;
+	int64_t window_timestamp_ns;
+	double sample_period_ns;
+
+	/*work buffers of the transform*/
+	float* work_re;
+	float* work_im;
+	float* bin_power; /*power of each bin, k<=M*/
+
+	/*the feature vector, band after band for each channel*/
+	float* features;
+
+} band_power_t;
+
+/*stage computing the features, the stream goes through unchanged*/
+typedef struct band_power_stage_s {
+	band_power_t* band_power;
+	void* feature_ring; /*shm output of the feature vectors*/
+} band_power_stage_t;
+
+band_power_t* band_power_init(int nb_channels, int nb_analyzed, int window_size, int rate,
+                              feature_band_t* bands, int nb_bands);
+int band_power_process(band_power_t* band_power, data_block_t* input, data_block_t* features);
+void band_power_cleanup(band_power_t* band_power);
+
+void* band_power_stage_init(appconfig_t* config, stage_format_t* format);
+int band_power_stage_process(void* stage, data_block_t* input, data_block_t* output);
+void band_power_stage_cleanup(void* stage);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+/**
+ * @file capture.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Capture of the raw bytes received from the hardware, for an offline
+ *        replay of a session. The reading thread copies each buffer received
+ *        in a single producer/single consumer ring, a writer thread appends
+ *        the ring to the capture file. When the ring is full, the buffer is
+ *        dropped and counted, the reading thread never waits.
+ *
+ *        Capture file: a capture_file_header_t, then for each buffer received
+ *        a capture_record_t followed by its length bytes. A record of length
+ *        0 only reports buffers dropped at the end of the capture.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define CAPTURE_MAGIC 0x50414345 /*"ECAP"*/
+#define CAPTURE_VERSION 1
+#define CAPTURE_DEVICE_LENGTH 32
+
+#define CAPTURE_RING_SIZE (1<<20) /*bytes, power of 2*/
+#define CAPTURE_WRITER_PERIOD_NS 20000000 /*the writer empties the ring every 20 ms*/
+
+/*at the start of the capture file*/
+typedef struct capture_file_header_s {
+	uint32_t magic; /*CAPTURE_MAGIC*/
+	uint32_t version; /*CAPTURE_VERSION*/
+	char device[CAPTURE_DEVICE_LENGTH]; /*device type of the config (MUSE, ...)*/
+	int64_t start_ns; /*host time of the capture start (CLOCK_MONOTONIC_RAW)*/
+} capture_file_header_t;
+
+/*one buffer received*/
+typedef struct capture_record_s {
+	int64_t timestamp_ns; /*host time of the reception (CLOCK_MONOTONIC_RAW)*/
+	uint32_t length; /*bytes following the record*/
+	uint32_t nb_dropped; /*buffers dropped (ring full) right before this one*/
+} capture_record_t;
+
+typedef struct capture_s {
+
+	FILE* file;
+	pthread_t writer;
+	volatile char running;
+
+	/*ring of records, the producer moves head, the consumer moves tail*/
+	uint64_t head;
+	uint64_t tail;
+	uint32_t nb_dropped; /*producer side, since the last record*/
+	uint8_t ring[CAPTURE_RING_SIZE];
+
+} capture_t;
+
+int capture_init(capture_t* capture, char* filename, char* device);
+void capture_write(capture_t* capture, const uint8_t* buffer, int length, int64_t timestamp_ns);
+void capture_cleanup(capture_t* capture);
+
+#endif
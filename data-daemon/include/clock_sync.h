@@ -0,0 +1,41 @@
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+/**
+ * @file clock_sync.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Estimates the relation between the device sample index and the host
+ *        clock (CLOCK_MONOTONIC_RAW). A line is fitted on (sample index, arrival time)
+ *        pairs with exponentially weighted least squares. Late arrivals (bluetooth
+ *        bursts) are down-weighted, so the fit follows the earliest arrivals and
+ *        the timestamps it predicts are free of the burst jitter.
+ */
+
+#include <stdint.h>
+
+typedef struct clock_sync_s {
+
+	double nominal_period_ns; /*sampling period announced by the device*/
+
+	/*reference point on which the sums are centered (latest observation)*/
+	uint64_t ref_idx;
+	int64_t ref_ns;
+
+	/*exponentially weighted sums of the fit*/
+	double s0, sx, sy, sxx, sxy;
+
+	/*current model: t = ref_ns + intercept_ns + (idx-ref_idx)*period_ns*/
+	double intercept_ns;
+	double period_ns;
+
+	double spread_ns; /*running mean of the absolute residuals*/
+	int nb_obs; /*number of observations so far*/
+
+} clock_sync_t;
+
+void clock_sync_init(clock_sync_t* clock_sync, double nominal_rate);
+void clock_sync_update(clock_sync_t* clock_sync, uint64_t sample_idx, int64_t host_ns);
+int64_t clock_sync_predict(clock_sync_t* clock_sync, uint64_t sample_idx);
+double clock_sync_period(clock_sync_t* clock_sync);
+int64_t clock_sync_now_ns(void);
+
+#endif
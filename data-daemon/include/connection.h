@@ -0,0 +1,53 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+/**
+ * @file connection.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief State of the link to a device. The connection is given up after
+ *        <connect_timeout_ms>, the attempts that fail are spaced by a backoff
+ *        that doubles from CONN_BACKOFF_MIN_MS up to <backoff_max_ms>, and a
+ *        link that brings no data for <stall_timeout_ms> is taken as lost.
+ *        The first data after a connection is given <connect_timeout_ms>,
+ *        the device takes time to start its stream.
+ *
+ *        DISCONNECTED -> CONNECTING -> CONNECTED -> (lost) -> BACKOFF -> CONNECTING
+ *                             \-> (failed) -> BACKOFF
+ */
+
+#include <stdint.h>
+
+#include "xml.h"
+
+typedef enum { CONN_DISCONNECTED, CONN_CONNECTING, CONN_CONNECTED, CONN_BACKOFF } conn_state_t;
+typedef enum { CONN_DATA, CONN_STALLED, CONN_HUNG_UP, CONN_STOPPED } conn_event_t;
+
+#define CONN_DEFAULT_CONNECT_TIMEOUT_MS 5000
+#define CONN_DEFAULT_STALL_TIMEOUT_MS 500
+#define CONN_DEFAULT_BACKOFF_MAX_MS 5000
+#define CONN_BACKOFF_MIN_MS 100
+
+typedef struct conn_s {
+
+	volatile conn_state_t state;
+	int nb_failures; /*attempts failed in a row, for the backoff*/
+	int64_t retry_ns; /*end of the backoff*/
+	int64_t last_data_ns;
+	char receiving; /*data came since the connection*/
+	int64_t lost_ns; /*when the link was lost, 0 if it never was*/
+
+	int connect_timeout_ms;
+	int stall_timeout_ms;
+	int backoff_max_ms;
+
+} conn_t;
+
+void conn_init(conn_t* conn, appconfig_t* config);
+void conn_connecting(conn_t* conn);
+void conn_connected(conn_t* conn);
+void conn_failed(conn_t* conn);
+void conn_lost(conn_t* conn);
+void conn_wait_retry(conn_t* conn);
+conn_event_t conn_wait(conn_t* conn, int fd);
+void conn_data(conn_t* conn);
+
+#endif
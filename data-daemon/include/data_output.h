@@ -15,6 +15,9 @@
 		
 #define COPY_DATA_IN(param, input) \
 		_COPY_DATA_IN(param, input)
+
+#define COPY_BLOCK_IN(param, input) \
+		_COPY_BLOCK_IN(param, input)
 		
 #define TERMINATE_DATA_OUTPUT_FC(param) \
 		_TERMINATE_DATA_OUTPUT_FC(param)
@@ -25,6 +28,7 @@ typedef void* (*initfunctionPtr_t) (void *);
 typedef int (*inputfunctionPtr_t) (void *,void *);
 initfunctionPtr_t _INIT_DATA_OUTPUT_FC;
 inputfunctionPtr_t _COPY_DATA_IN;
+inputfunctionPtr_t _COPY_BLOCK_IN;
 functionPtr_t _TERMINATE_DATA_OUTPUT_FC;
 
 /*Structure containing the configuration of the hardware*/
@@ -40,10 +44,53 @@ typedef struct shm_mem_options_s {
 	int nb_pages;
 	int page_size;
 	int buffer_size;
+
+	/*description of the stream, read at init*/
+	int rate; /*sampling rate (Hz)*/
+	char* channel_names; /*nb_data_channels names of SHM_CHANNEL_NAME_LENGTH chars, NULL if unknown*/
+	int sample_format; /*SHM_SAMPLE_* format of the values in the pages*/
+	float* scale; /*nb_data_channels values of one step, NULL for physical units*/
+	float* offset; /*nb_data_channels values of code 0*/
+
+	/*semaphores of the ring (shsem_def.h)*/
+	int sem_page_free; /*posted by the reader when a page can be written*/
+	int sem_page_written; /*posted by the writer when a page is filled*/
+	char sem_owner; /*the ring owns the set: it initialises and removes it*/
 	
 } shm_mem_options_t;
 
 
+/*Structure containing the configuration of the recording (BINARY_OUTPUT)*/
+typedef struct rec_file_options_s {
+
+	char* filename;
+	int nb_data_channels;
+
+	/*description of the stream, read at init*/
+	int rate; /*sampling rate (Hz)*/
+	char* channel_names; /*nb_data_channels names of SHM_CHANNEL_NAME_LENGTH chars, NULL if unknown*/
+	float* scale; /*value of one ADC code step of each channel, 0 if unknown*/
+	float* offset; /*value of code 0 of each channel*/
+	char raw_codes; /*the values are already ADC codes (sample_format INT16)*/
+
+} rec_file_options_t;
+
+
+/*flags qualifying the samples of a block*/
+#define BLOCK_GAP_FILL 0x01 /*samples were synthesized to fill dropped samples*/
+
+/*Structure containing a block of consecutive samples*/
+typedef struct data_block_s {
+	int nb_samples; /*number of samples in the block*/
+	int nb_data; /*number of values per sample*/
+	float* ptr; /*values, sample after sample (nb_samples*nb_data)*/
+	uint64_t first_sample; /*stream index of the first sample*/
+	int64_t timestamp_ns; /*host time of the first sample (CLOCK_MONOTONIC_RAW), 0 if unknown*/
+	double sample_period_ns; /*estimated sampling period, 0 if unknown*/
+	int flags; /*BLOCK_* flags*/
+} data_block_t;
+
+
 /*Structure containing the reference to all output interface*/
 /*primarily use if you need to output to SHM and CSV at the same time*/
 typedef struct output_interface_array_s {
@@ -0,0 +1,32 @@
+#ifndef EEG_CODEC_H
+#define EEG_CODEC_H
+/**
+ * @file eeg_codec.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Lossless codec for blocks of integer samples (ADC codes). Each channel
+ *        of a block is predicted by a fixed polynomial predictor (order 0 to 3,
+ *        the one giving the smallest residuals), the residuals are zigzag
+ *        mapped and Rice coded with one parameter per channel and block.
+ *
+ *        Encoded channel, byte aligned:
+ *        - 1 byte: order (bits 5-6) and Rice parameter k (bits 0-4)
+ *        - order warm-up samples, 32 bits each
+ *        - nb_samples-order residuals: q=u>>k in unary (q ones and a zero),
+ *          then the k low bits of u. A quotient of EEG_CODEC_ESCAPE or more is
+ *          written as EEG_CODEC_ESCAPE ones followed by u on 32 bits.
+ *        Bits are written most significant first.
+ */
+
+#include <stdint.h>
+
+#define EEG_CODEC_MAX_ORDER 3
+#define EEG_CODEC_MAX_SAMPLES 4096 /*samples per channel and block*/
+#define EEG_CODEC_ESCAPE 24 /*longest unary quotient*/
+
+/*upper bound of the size of an encoded channel, in bytes*/
+#define EEG_CODEC_MAX_BYTES(nb_samples) (1+4*EEG_CODEC_MAX_ORDER+((nb_samples)*(EEG_CODEC_ESCAPE+32)+7)/8)
+
+int eeg_codec_encode(const int32_t* samples, int nb_samples, uint8_t* output);
+int eeg_codec_decode(const uint8_t* input, int length, int32_t* samples, int nb_samples);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef ENVELOPE_H
+#define ENVELOPE_H
+/**
+ * @file envelope.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Min/max envelope pyramid. The stream is reduced to the min and max of
+ *        each channel over 16, 256 and 4096 samples, kept in rings in shared
+ *        memory, so a viewer can draw a long span at any zoom in time
+ *        proportional to its width.
+ */
+
+#include <stdint.h>
+
+#include "data_output.h"
+#include "shm_page_def.h"
+#include "pipeline.h"
+
+#define ENVELOPE_DEFAULT_DURATION 600 /*seconds kept in each level*/
+
+typedef struct envelope_s {
+
+	int nb_channels;
+
+	/*the segment, header followed by the rings*/
+	int shmid;
+	char* segment;
+	shm_envelope_header_t* header;
+
+	/*entry in progress of each level, in the layout of the entries*/
+	float* acc[SHM_ENVELOPE_LEVELS];
+	int acc_count[SHM_ENVELOPE_LEVELS]; /*samples (first level) or entries of the level below*/
+	char started;
+
+} envelope_t;
+
+envelope_t* envelope_init(int shm_key, int nb_channels, int rate, int duration, char* channel_names);
+void envelope_process(envelope_t* envelope, data_block_t* input);
+void envelope_cleanup(envelope_t* envelope);
+
+void* envelope_stage_init(appconfig_t* config, stage_format_t* format);
+int envelope_stage_process(void* stage, data_block_t* input, data_block_t* output);
+void envelope_stage_cleanup(void* stage);
+
+#endif
@@ -4,6 +4,11 @@
  * @brief Header for fake muse hardware 
  */
 
+#define FAKE_MUSE_PERIOD_NS 4000000 /*one packet every 4 ms*/
+#define FAKE_MUSE_SAMPLING_RATE (1000000000/FAKE_MUSE_PERIOD_NS) /*Hz*/
+#define FAKE_MUSE_REFRESH_PERIOD 10 /*compressed packets between two uncompressed packets*/
+#define FAKE_MUSE_CHANNEL_BITS 128 /*bits per channel of a compressed packet, the blinks are quantized*/
+
 int fake_muse_connect_dev(void *param);
 int fake_muse_init_hardware(void *param);
 int fake_muse_read_pkt(void *param);
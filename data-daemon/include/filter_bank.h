@@ -0,0 +1,66 @@
+#ifndef FILTER_BANK_H
+#define FILTER_BANK_H
+/**
+ * @file filter_bank.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Cascade of biquad filters (notch, high-pass, band-pass) applied to every
+ *        channel of the stream. The channels are processed in the lanes of SIMD
+ *        vectors.
+ */
+
+#include "data_output.h"
+#include "simd.h"
+#include "pipeline.h"
+
+#define FILTER_BANK_MAX_SECTIONS 8 /*biquads in the cascade*/
+#define FILTER_BANK_MAX_IN PIPELINE_BLOCK_SIZE /*input samples processed per call*/
+#define FILTER_BANK_NOTCH_Q 30.0 /*quality factor of the notch, ~2 Hz wide at 60 Hz*/
+
+/*coefficients of a biquad, normalized by a0, in every lane*/
+typedef struct biquad_s {
+	v4sf b0;
+	v4sf b1;
+	v4sf b2;
+	v4sf a1;
+	v4sf a2;
+	v4sf dc_gain; /*gain at 0 Hz, to start in steady state*/
+} biquad_t;
+
+/*filters applied, 0 disables a filter*/
+typedef struct filter_options_s {
+	int notch_freq; /*line frequency (Hz)*/
+	float highpass_freq; /*cutoff of the high-pass (Hz)*/
+	float bandpass_low; /*pass band of the band-pass (Hz)*/
+	float bandpass_high;
+} filter_options_t;
+
+typedef struct filter_bank_s {
+
+	biquad_t sections[FILTER_BANK_MAX_SECTIONS];
+	int nb_sections;
+
+	int nb_channels; /*values per sample*/
+	int nb_filtered; /*leading channels filtered, the others are copied*/
+	int nb_vectors; /*vectors covering the filtered channels*/
+
+	/*state of the transposed direct form II, 2 vectors per section per group of channels*/
+	v4sf* state;
+	v4si* primed; /*lanes whose state was initialized, one mask per group of channels*/
+
+	/*one sample, padded to the vectors*/
+	v4sf* work;
+
+	/*output buffer, sample after sample*/
+	float* out_buf;
+
+} filter_bank_t;
+
+filter_bank_t* filter_bank_init(int nb_channels, int nb_filtered, int rate, filter_options_t* options);
+int filter_bank_process(filter_bank_t* filter_bank, data_block_t* input, data_block_t* output);
+void filter_bank_cleanup(filter_bank_t* filter_bank);
+
+void* filter_bank_stage_init(appconfig_t* config, stage_format_t* format);
+int filter_bank_stage_process(void* stage, data_block_t* input, data_block_t* output);
+void filter_bank_stage_cleanup(void* stage);
+
+#endif
@@ -46,3 +46,9 @@ typedef struct param_s {
 } param_t;
 
 int init_hardware(char *hardware_type);
+char *get_hardware_source(char *hardware_type);
+int get_hardware_sampling_rate(char *hardware_type);
+int get_hardware_keep_alive_period(char *hardware_type);
+int get_hardware_channel_name(char *hardware_type, int channel, char *name, int length);
+int get_hardware_range(char *hardware_type, int channel, float *min, float *max, float *lsb);
+int get_hardware_drl_ref(char *hardware_type, float *drl, float *ref);
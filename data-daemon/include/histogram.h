@@ -0,0 +1,32 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+/**
+ * @file histogram.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Log-linear histogram of durations (ns), in the spirit of HdrHistogram.
+ *        Each power of 2 is split in 2^HISTOGRAM_SUB_BITS buckets, so a value
+ *        is known within 1/16 (6%) from 1 ns to the range of 64 bits, with a
+ *        fixed size and no allocation: recording is an index computation and
+ *        an increment.
+ */
+
+#include <stdint.h>
+
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1<<HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_NB_BUCKETS ((64-HISTOGRAM_SUB_BITS+1)*HISTOGRAM_SUB_BUCKETS)
+
+typedef struct histogram_s {
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum; /*of the values, for the mean and the time spent*/
+	uint64_t buckets[HISTOGRAM_NB_BUCKETS];
+} histogram_t;
+
+void histogram_init(histogram_t* histogram);
+void histogram_record(histogram_t* histogram, int64_t value);
+void histogram_merge(histogram_t* histogram, const histogram_t* other);
+uint64_t histogram_percentile(const histogram_t* histogram, double percentile);
+
+#endif
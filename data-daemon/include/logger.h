@@ -0,0 +1,53 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+/**
+ * @file logger.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Logging of the data path. The threads of the data path must not
+ *        block on stdout: they push a fixed size record (message, up to
+ *        LOGGER_NB_ARGS integers) in a ring, without lock. A thread of the
+ *        logger formats the records, lets LOGGER_BURST of each message out
+ *        per LOGGER_PERIOD_MS and coalesces the others in a count, and writes
+ *        them to stderr or to syslog (<log_output>).
+ *
+ *        A full ring drops the records, the count of lost records is logged.
+ *        Before logger_init(), the records wait in the ring.
+ */
+
+#include <stdint.h>
+
+#include "xml.h"
+
+/*messages, their level and text are in logger.c*/
+typedef enum {
+	LOGGER_SAMPLES_DROPPED, /*number of samples*/
+	LOGGER_PREPARSE_ERROR, /*offset in the buffer, byte found*/
+	LOGGER_BIT_LENGTH_MISMATCH, /*bits expected, bits parsed*/
+	LOGGER_PACKET_TOO_SMALL, /*length*/
+	LOGGER_MERGE_NO_TIMESTAMP, /*source*/
+	LOGGER_MERGE_BAD_FORMAT, /*source, sample_format of the ring*/
+	LOGGER_MERGE_BAD_CHANNELS, /*source, channels of the ring, channels configured*/
+	LOGGER_MERGE_BAD_LAYOUT, /*source, size of the ring, size configured*/
+	LOGGER_LINK_STALLED, /*ms without data*/
+	LOGGER_LINK_HUNG_UP, /*errno*/
+	LOGGER_LINK_RESTORED, /*ms without link, attempts, samples filled*/
+	LOGGER_LINK_CLOSED, /*socket*/
+	LOGGER_NB_MESSAGES
+} logger_message_t;
+
+typedef enum { LOGGER_STDERR, LOGGER_SYSLOG } logger_output_t;
+
+#define LOGGER_NB_ARGS 3
+#define LOGGER_RING_SIZE 1024 /*records, a power of 2*/
+#define LOGGER_BURST 5 /*records of a message written per period, the others are counted*/
+#define LOGGER_PERIOD_MS 1000
+#define LOGGER_DRAIN_PERIOD_MS 50
+
+#define LOGGER_RECORD(message, arg0, arg1, arg2) \
+		logger_record(message, (int32_t)(arg0), (int32_t)(arg1), (int32_t)(arg2))
+
+int logger_init(appconfig_t* config);
+void logger_record(logger_message_t message, int32_t arg0, int32_t arg1, int32_t arg2);
+void logger_cleanup(void);
+
+#endif
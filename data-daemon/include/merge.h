@@ -0,0 +1,67 @@
+#ifndef MERGE_H
+#define MERGE_H
+/**
+ * @file merge.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Header for the merge pseudo-hardware. It reads the shared memory rings
+ *        of several data interfaces and resamples them on a common host-clock
+ *        timeline, producing one wide multi-device stream.
+ */
+
+#include <stdint.h>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+
+#include "xml.h"
+#include "shm_page_def.h"
+
+#define MERGE_HISTORY_PAGES 4 /*pages of history kept per source*/
+#define MERGE_BLOCK_SIZE 32 /*grid samples pushed per output block*/
+#define MERGE_POLL_NS 2000000 /*polling period of the sources, 2 ms*/
+#define MERGE_STARTUP_TIMEOUT_NS 5000000000LL /*start without the silent sources after 5 s*/
+#define MERGE_DEFAULT_LATENCY_NS 1000000000LL /*max latency of a source that never delivered*/
+
+/*state of a device ring feeding the merge*/
+typedef struct merge_input_s {
+
+	merge_source_t options; /*ring options, from the configuration*/
+	int page_size;
+
+	/*shared memory and semaphores of the ring*/
+	int shmid;
+	int semid;
+	char* shm_buf;
+	shm_page_meta_t* page_meta;
+	struct sembuf *sops;
+	int read_page; /*next page to be read*/
+
+	/*history of samples, a ring of MERGE_HISTORY_PAGES pages*/
+	int capacity;
+	float* values;
+	int64_t* timestamps;
+	uint64_t head; /*number of samples ingested*/
+	uint64_t cursor; /*sample preceding the last grid point*/
+	double period_ns; /*sampling period of the device*/
+	int64_t max_latency_ns; /*after that delay, missing data is declared invalid*/
+
+	int channel_offset; /*position of the device channels in the merged sample*/
+	char rejected; /*its ring does not match the configuration, never read*/
+
+} merge_input_t;
+
+/*a page read from one of the inputs*/
+typedef struct merge_page_s {
+	int input_idx;
+	int page_idx;
+} merge_page_t;
+
+int merge_connect_dev(void *param);
+int merge_init_hardware(void *param);
+int merge_read_pkt(void *output);
+int merge_send_keep_alive_pkt(void *param);
+int merge_send_pkt(void *param);
+int merge_translate_pkt(void *packet, void* output);
+int merge_process_pkt(void *packet, void *output);
+int merge_cleanup(void *param);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef MONTAGE_H
+#define MONTAGE_H
+/**
+ * @file montage.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Montage stage. Each output channel (derivation) is a weighted sum of the
+ *        input channels: the stream is multiplied by a matrix of nb_outputs rows
+ *        by nb_inputs columns. Covers re-referencing (common average, linked
+ *        reference) and bipolar derivations.
+ */
+
+#include "data_output.h"
+#include "pipeline.h"
+
+#define MONTAGE_SPARSE_DENSITY 0.5 /*matrices with less non-zero weights use the sparse kernel*/
+
+typedef struct montage_s {
+
+	int nb_inputs; /*signals in*/
+	int nb_outputs; /*derivations out*/
+	int nb_flags; /*channels copied after the derivations*/
+	int nb_channels; /*values per sample out*/
+	int sparse; /*kernel used*/
+
+	/*sparse kernel, the non-zero weights row after row*/
+	int* row_start; /*nb_outputs+1 positions in cols and weights*/
+	int* cols;
+	float* weights;
+
+	/*dense kernel, rows padded to a multiple of 8*/
+	int row_length;
+	float* matrix;
+	float* work; /*one sample, padded*/
+
+	/*output buffer, sample after sample*/
+	float* out_buf;
+
+} montage_t;
+
+montage_t* montage_init(int nb_channels, int nb_inputs, int nb_outputs, const float* matrix);
+int montage_process(montage_t* montage, data_block_t* input, data_block_t* output);
+void montage_cleanup(montage_t* montage);
+
+void* montage_stage_init(appconfig_t* config, stage_format_t* format);
+int montage_stage_process(void* stage, data_block_t* input, data_block_t* output);
+void montage_stage_cleanup(void* stage);
+
+#endif
@@ -21,8 +21,15 @@
 #define MUSE_DRLREF_PKT  0x9	 //DRL/REF
 #define MUSE_INVALID  0x0	 //Invalid
 
+#define MUSE_SAMPLING_RATE 220 /*Hz*/
 #define MUSE_NB_CHANNELS 4
+#define MUSE_CHANNEL_NAMES { "TP9", "AF7", "AF8", "TP10" } /*electrodes, in packet order*/
+#define MUSE_ADC_MAX 1023 /*values are on 10 bits*/
+#define MUSE_FULL_SCALE 1682.0 /*microvolts at MUSE_ADC_MAX*/
+#define MUSE_CODE_STEP ((float)(MUSE_FULL_SCALE/MUSE_ADC_MAX)) /*microvolts per code*/
 #define MUSE_NB_DELTAS 16
+#define MUSE_MAX_DROPPED 0xFFFF /*dropped samples count is on 16 bits*/
+#define MUSE_KEEP_ALIVE_PERIOD_MS 9000
 
 typedef enum { MUSE_RAW_EEG, MUSE_COMP_MUSE_EEG, MUSE_UNCOMP_MUSE_EEG, MUSE_SYNC, MUSE_DRL_REF, MUSE_ERROR, 
 	MUSE_ACCEL, MUSE_BATT } muse_pkt_type_t;
@@ -30,6 +37,7 @@ typedef enum { MUSE_RAW_EEG, MUSE_COMP_MUSE_EEG, MUSE_UNCOMP_MUSE_EEG, MUSE_SYNC
 typedef struct muse_translt_pkt_s {
 	muse_pkt_type_t type;
 	uint8_t nb_samples;
+	uint16_t nb_dropped; /*samples dropped by the headset before this packet*/
 	int* eeg_data;
 } muse_translt_pkt_t;
 
@@ -42,3 +50,7 @@ int muse_send_pkt(void *output);
 int muse_translate_pkt(void *packet, void* output);
 int muse_process_pkt(void *packet, void *output);
 int muse_cleanup(void *param);
+int muse_get_drl_ref(float *drl, float *ref);
+void muse_init_code_value(void);
+float muse_code_value(int code);
+void muse_update_clock(int64_t read_ns);
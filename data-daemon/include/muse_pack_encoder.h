@@ -0,0 +1,75 @@
+#ifndef MUSE_PACK_ENCODER_H
+#define MUSE_PACK_ENCODER_H
+/**
+ * @file muse_pack_encoder.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Encoder of the Muse bluetooth packets, the reverse of
+ *        muse_pack_parser.c. It builds the buffers the headset sends (sync,
+ *        DRL/REF, compressed and uncompressed EEG) from a stream of 10 bits
+ *        codes, to feed the real decoder from a synthetic or recorded signal.
+ *
+ *        The deltas of a compressed packet are computed from the values the
+ *        decoder rebuilds, not from the input, so a lossy quantization does
+ *        not drift. An uncompressed packet every refresh_period compressed
+ *        packets resets the decoder, like the headset does.
+ */
+
+#include <stdint.h>
+
+#define MUSE_ENCODER_NB_CHANNELS 4
+#define MUSE_ENCODER_NB_DELTAS 16
+#define MUSE_ENCODER_ADC_MAX 1023 /*codes are on 10 bits*/
+
+#define MUSE_SYNC_PKT_LENGTH 4
+#define MUSE_DRLREF_PKT_LENGTH 4
+#define MUSE_UNCOMPRESS_PKT_LENGTH 6 /*8 with the dropped samples count*/
+#define MUSE_COMPRESSED_HEADER_LENGTH 8 /*the deltas follow*/
+
+#define MUSE_MAX_MEDIAN 63 /*medians are on 6 bits*/
+#define MUSE_MAX_QUANTIZATION_POWER 10 /*quantization of 2^10, all 4 bits set*/
+
+/*longest buffer built by the encoder, with slack for the decoder that reads*/
+/*one byte past the end of a compressed packet*/
+#define MUSE_ENCODER_MAX_BUFFER 512
+
+typedef struct muse_encoder_s {
+
+	/*configuration*/
+	int refresh_period; /*compressed packets between two uncompressed packets, 0 for none*/
+	int sync_period; /*samples between two sync packets, 0 for none*/
+	int max_channel_bits; /*bits allowed to a channel of a compressed packet, 0 for lossless*/
+
+	/*values rebuilt by the decoder, the deltas are taken from them*/
+	int values[MUSE_ENCODER_NB_CHANNELS];
+
+	/*samples waiting for a compressed packet, sample-major*/
+	int samples[MUSE_ENCODER_NB_DELTAS*MUSE_ENCODER_NB_CHANNELS];
+	int nb_pending;
+
+	int nb_compressed; /*compressed packets since the last uncompressed*/
+	int nb_dropped; /*samples dropped since the last packet*/
+	char started;
+
+	uint64_t nb_samples; /*samples pushed or dropped*/
+	uint64_t next_sync; /*a sync packet goes in the first buffer past this sample*/
+
+	/*DRL/REF codes sent with the sync packets*/
+	int drl;
+	int ref;
+
+} muse_encoder_t;
+
+void muse_encoder_init(muse_encoder_t* encoder, int refresh_period, int sync_period, int max_channel_bits);
+void muse_encoder_set_drl_ref(muse_encoder_t* encoder, int drl, int ref);
+void muse_encoder_drop(muse_encoder_t* encoder, int nb_samples);
+void muse_encoder_lost(muse_encoder_t* encoder, int nb_samples);
+int muse_encoder_push(muse_encoder_t* encoder, const int* sample, unsigned char* buffer);
+
+int encode_sync_packet(unsigned char* packet);
+int encode_drlref_packet(int drl, int ref, unsigned char* packet);
+int encode_uncompressed_packet(const int* values, int nb_dropped, unsigned char* packet);
+int encode_compressed_packet(const int* deltas, const int* quantization_powers, unsigned char* packet);
+
+void muse_synth_sample(uint64_t n, double sampling_rate, int* sample);
+
+#endif
@@ -32,16 +32,32 @@
 
 #define MAX_NB_SOFT_PACKETS 10
 
+#define DROPPED_SAMPLES_OFFSET 1 /*byte offset of the dropped samples count, when flagged*/
+#define DROPPED_SAMPLES_LENGTH 2 /*length in bytes of the dropped samples count*/
+
+/*details of the last error met by the parser, reported by the caller*/
+typedef struct muse_parse_errors_s {
+	int position; /*offset of the invalid byte, on a pre-parsing error*/
+	unsigned char byte; /*the invalid byte*/
+	int expected_bits_length; /*on a bit length mismatch*/
+	int parsed_bits_length;
+} muse_parse_errors_t;
+
 int get_packet_type(unsigned char packet_header);
 
-int preparse_packet(unsigned char* raw_packet_header, int packet_length, int *soft_packet_headers, int *soft_packet_types);
+int preparse_packet(unsigned char* raw_packet_header, int packet_length, int *soft_packet_headers, int *soft_packet_types,
+                    muse_parse_errors_t* errors);
 
-int parse_compressed_packet(unsigned char* packet_header, int* deltas);
+int parse_compressed_packet(unsigned char* packet_header, int* deltas, muse_parse_errors_t* errors);
 
 void parse_uncompressed_packet(unsigned char* values_header, int* values);
 
+void parse_drlref_packet(unsigned char* packet_header, int* drl, int* ref);
+
 int get_flag_value(unsigned char first_byte);
 
+int get_dropped_samples(unsigned char* packet_header);
+
 
 
 
@@ -9,6 +9,11 @@
 #define OPENBCI_HALT_TRANSMISSION "s" // halt data transmission
 #define OPENBCI_RESET "v" // request device information
 
+#define OPENBCI_SAMPLING_RATE 250 /*Hz*/
+#define OPENBCI_NB_EEG_CHANNELS 8
+#define OPENBCI_FULL_SCALE (4.5/24) /*volts, reference of 4.5V at a gain of 24*/
+#define OPENBCI_ADC_MAX 8388607 /*values are signed on 24 bits*/
+
 #define STATUS_PACKET_LENGTH 84
 #define DATA_PACKET_LENGTH 33
 
@@ -26,3 +31,4 @@ int openbci_translate_pkt(void *packet,void* output);
 int openbci_process_pkt(void *packet,void* output);
 int openbci_connect_dev(void *param);
 int openbci_cleanup(void *param);
+void openbci_update_clock(int64_t read_ns);
@@ -0,0 +1,50 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+/**
+ * @file perf_counters.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Hardware counters of the decoder stages (perf_event_open). Each
+ *        thread opens its own group (cycles, instructions, branch misses,
+ *        cache misses), counting in user space only. A stage is bracketed by
+ *        two samples of the group and the difference is added to the
+ *        statistics page, by stage and by type of soft packet.
+ *
+ *        The counters are set by <perf_counters>TRUE</perf_counters>. When they
+ *        are off, a sample is a load and a branch. When they are on, a sample
+ *        is a read() of the group; its own cost, measured when the group is
+ *        opened, is taken off the differences.
+ */
+
+#include <stdint.h>
+
+#include "shm_page_def.h"
+
+typedef enum { PERF_PREPARSE, PERF_PARSE, PERF_TRANSLATE, PERF_NB_STAGES } perf_stage_t;
+typedef enum { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_BRANCH_MISSES, PERF_CACHE_MISSES, PERF_NB_COUNTERS } perf_counter_t;
+typedef enum { PERF_OFF, PERF_COUNTING, PERF_UNAVAILABLE } perf_status_t;
+
+#define PERF_STAGE_NAMES { "preparse", "parse", "translate" }
+#define PERF_COUNTER_NAMES { "cycles", "instructions", "branch_misses", "cache_misses" }
+
+#define PERF_CALIBRATION_READS 32 /*back to back samples, the least is the cost of a sample*/
+
+/*counters of the thread at one point*/
+typedef struct perf_sample_s {
+	uint64_t values[PERF_NB_COUNTERS];
+	char valid;
+} perf_sample_t;
+
+#define PERF_SAMPLE(sample) \
+		do { if (perf_enabled) perf_sample(sample); } while (0)
+
+#define PERF_RECORD(stage, packet_type, begin, end, share) \
+		do { if (perf_enabled) perf_record(stage, packet_type, begin, end, share); } while (0)
+
+extern int perf_enabled;
+
+int perf_init(int enabled);
+void perf_sample(perf_sample_t* sample);
+void perf_record(perf_stage_t stage, int packet_type, const perf_sample_t* begin, const perf_sample_t* end, int share);
+void perf_cleanup(void);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+/**
+ * @file pipeline.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Chain of processing stages between the translation of the packets and
+ *        the data output. The hardware pushes its blocks in the chain as if it
+ *        was the output; each stage processes blocks of at most
+ *        PIPELINE_BLOCK_SIZE samples and hands its result to the next one.
+ */
+
+#include <stdint.h>
+
+#include "data_output.h"
+#include "shm_page_def.h"
+#include "xml.h"
+
+#define PIPELINE_BLOCK_SIZE 256 /*samples given to a stage per call*/
+
+/*format of the stream between two stages*/
+typedef struct stage_format_s {
+	int nb_channels; /*values per sample*/
+	int nb_signals; /*leading channels holding signals, the others are flags (merge validity mask)*/
+	int rate; /*sampling rate (Hz)*/
+	char channel_names[SHM_MAX_CHANNELS][SHM_CHANNEL_NAME_LENGTH];
+} stage_format_t;
+
+/*stage callbacks*/
+typedef void* (*stageinitPtr_t) (appconfig_t *, stage_format_t *); /*format: in, the input; out, the output of the stage*/
+typedef int (*stageprocessPtr_t) (void *, data_block_t *, data_block_t *); /*returns the number of output samples*/
+typedef int (*stageflushPtr_t) (void *, data_block_t *); /*returns the number of output samples*/
+typedef void (*stagecleanupPtr_t) (void *);
+
+typedef struct stage_ops_s {
+	stageinitPtr_t init;
+	stageprocessPtr_t process_block;
+	stageflushPtr_t flush; /*NULL when the stage holds no samples*/
+	stagecleanupPtr_t cleanup;
+} stage_ops_t;
+
+typedef struct pipeline_s {
+
+	int nb_stages;
+	stage_ops_t ops[MAX_PIPELINE_STAGES];
+	void* stages[MAX_PIPELINE_STAGES];
+
+	stage_format_t format; /*output of the chain*/
+
+	/*the output receiving the processed stream*/
+	void* next;
+	inputfunctionPtr_t next_copy_block;
+	functionPtr_t next_terminate;
+
+	uint64_t next_sample; /*stream index of the next sample*/
+
+} pipeline_t;
+
+pipeline_t* pipeline_init(appconfig_t* config, stage_format_t* format);
+void pipeline_connect(pipeline_t* pipeline, void* next);
+int pipeline_write_in_buf(void *param, void *input);
+int pipeline_write_block_in_buf(void *param, void *input);
+int pipeline_cleanup(void *param);
+
+#endif
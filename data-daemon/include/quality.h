@@ -0,0 +1,86 @@
+#ifndef QUALITY_H
+#define QUALITY_H
+/**
+ * @file quality.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Online signal quality. Running statistics of each channel (mean and
+ *        variance, line noise power, samples at the rails, flat runs), updated
+ *        sample by sample and published a few times per second in a small
+ *        shared memory status page.
+ */
+
+#include <stdint.h>
+
+#include "data_output.h"
+#include "shm_page_def.h"
+#include "pipeline.h"
+
+#define QUALITY_TIME_CONSTANT 1.0 /*seconds, weighting of the mean and variance*/
+#define QUALITY_DEFAULT_LINE_FREQ 60 /*Hz, when no notch frequency is set*/
+#define QUALITY_FLAT_TIME 1.0 /*seconds without change to flag a channel flat*/
+
+/*running state of a channel*/
+typedef struct quality_channel_state_s {
+
+	/*exponentially weighted mean and variance*/
+	double mean;
+	double variance;
+	char started;
+
+	/*goertzel filter at the line frequency, on the signal minus its mean*/
+	double s1;
+	double s2;
+	int nb_goertzel;
+
+	/*rails of the hardware, when known*/
+	char has_range;
+	float min;
+	float max;
+	float flat_tolerance; /*difference under which two samples are equal*/
+
+	/*counts of the current update*/
+	uint32_t nb_saturated;
+	uint32_t nb_flat;
+	uint32_t flat_run;
+	float prev;
+	char has_prev;
+
+} quality_channel_state_t;
+
+typedef struct quality_s {
+
+	int nb_channels; /*values per sample*/
+	int nb_signals; /*leading channels analyzed*/
+	int rate;
+	double alpha; /*weight of a new sample in the mean and variance*/
+	double coeff; /*2cos(w) of the goertzel filter, w the line frequency*/
+	uint32_t flat_samples; /*run of equal samples flagged flat*/
+
+	int update_samples; /*samples between two updates*/
+	int nb_pending; /*samples since the last update*/
+
+	quality_channel_state_t* channels;
+
+	/*last update, in the layout of the status page*/
+	shm_quality_page_t status;
+
+} quality_t;
+
+/*quality stage, publishing in the status page*/
+typedef struct quality_stage_s {
+	quality_t* quality;
+	char* hardware_type; /*for the DRL/REF*/
+	int shmid;
+	shm_quality_page_t* page;
+} quality_stage_t;
+
+quality_t* quality_init(int nb_channels, int nb_signals, int rate, float line_freq, int update_rate);
+void quality_set_range(quality_t* quality, int channel, float min, float max, float lsb);
+int quality_process(quality_t* quality, data_block_t* input, char* updated);
+void quality_cleanup(quality_t* quality);
+
+void* quality_stage_init(appconfig_t* config, stage_format_t* format);
+int quality_stage_process(void* stage, data_block_t* input, data_block_t* output);
+void quality_stage_cleanup(void* stage);
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef REC_FILE_DEF_H
+#define REC_FILE_DEF_H
+
+#include <stdint.h>
+
+#include "shm_page_def.h"
+
+/*this layout must be shared between the recorder and the tools reading the
+ *recordings.
+ *
+ * A recording is a file header followed by blocks. Each block holds up to
+ * block_size samples of every channel, encoded channel after channel by the
+ * codec of eeg_codec.h. A channel stored as ADC codes reads
+ * REC_CODE_VALUE(offset, scale, code), and is stored so only when this gives
+ * back every float written to the bit; a channel whose values are off the
+ * grid of the hardware (processed, filled with nan, flags, converted another
+ * way) is stored as the bits of its floats.
+ *
+ * The payload of a block is padded to REC_BLOCK_ALIGN bytes, so every block
+ * header is aligned in a mapping of the file. When the recording is closed,
+ * a sparse index (one entry every REC_INDEX_INTERVAL blocks) and a footer
+ * follow the last block. A recording without footer (crash) is still read by
+ * scanning the blocks from their sync marker.
+ */
+
+#define REC_FILE_MAGIC 0x52474545 /*"EEGR"*/
+#define REC_FILE_VERSION 2
+#define REC_BLOCK_SYNC 0x4B4C4245 /*"EBLK", starts every block*/
+#define REC_INDEX_MAGIC 0x58444945 /*"EIDX", at the start of the footer*/
+
+#define REC_BLOCK_ALIGN 8
+#define REC_INDEX_INTERVAL 16 /*blocks per index entry*/
+
+/*value of a code, in float arithmetic, the same for the recorder and the readers*/
+#define REC_CODE_VALUE(offset, scale, code) ((float)((offset)+(float)(code)*(scale)))
+
+/*bytes taken by a block in the file*/
+#define REC_BLOCK_FILE_SIZE(payload_size) \
+	(sizeof(rec_block_header_t)+(((payload_size)+REC_BLOCK_ALIGN-1)&~(uint64_t)(REC_BLOCK_ALIGN-1)))
+
+/*description of the recording, at the start of the file*/
+typedef struct rec_file_header_s {
+	uint32_t magic; /*REC_FILE_MAGIC*/
+	uint32_t version; /*REC_FILE_VERSION*/
+	uint32_t nb_channels; /*values per sample*/
+	uint32_t rate; /*sampling rate (Hz), 0 if not sampled at a fixed rate*/
+	uint32_t block_size; /*samples per block, the last block may hold less*/
+	uint32_t reserved;
+	float scale[SHM_MAX_CHANNELS]; /*value of one code step, 0 if the channel is never coded*/
+	float offset[SHM_MAX_CHANNELS]; /*value of code 0*/
+	char channel_names[SHM_MAX_CHANNELS][SHM_CHANNEL_NAME_LENGTH];
+} rec_file_header_t;
+
+/*header of a block, followed by payload_size bytes of encoded channels*/
+typedef struct rec_block_header_s {
+	uint32_t sync; /*REC_BLOCK_SYNC*/
+	uint32_t payload_size; /*bytes*/
+	uint64_t first_sample; /*stream index of the first sample*/
+	int64_t timestamp_ns; /*host time of the first sample (CLOCK_MONOTONIC_RAW), 0 if unknown*/
+	double sample_period_ns; /*estimated sampling period, 0 if unknown*/
+	uint64_t float_channels; /*bit c set when channel c holds float bits instead of codes*/
+	uint32_t nb_samples; /*samples per channel*/
+	uint32_t flags; /*BLOCK_* flags of the samples*/
+} rec_block_header_t;
+
+/*entry of the index, locates a block*/
+typedef struct rec_index_entry_s {
+	uint64_t first_sample; /*of the block*/
+	int64_t timestamp_ns; /*of the block, 0 if unknown*/
+	uint64_t offset; /*of the block header, from the start of the file*/
+} rec_index_entry_t;
+
+/*last bytes of a closed recording, the index is right before it*/
+typedef struct rec_file_footer_s {
+	uint32_t magic; /*REC_INDEX_MAGIC*/
+	uint32_t interval; /*blocks per index entry*/
+	uint64_t index_offset; /*of the first entry, the blocks end there*/
+	uint64_t nb_entries;
+	uint64_t end_sample; /*stream index following the last sample*/
+} rec_file_footer_t;
+
+#endif
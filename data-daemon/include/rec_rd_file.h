@@ -0,0 +1,50 @@
+#ifndef REC_RD_FILE_H
+#define REC_RD_FILE_H
+/**
+ * @file rec_rd_file.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Reader of the recordings (BINARY_OUTPUT). The file is mapped, the
+ *        blocks are returned in place and located with the sparse index of
+ *        the footer, or with an index rebuilt by scanning the blocks when the
+ *        recording was not closed.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "rec_file_def.h"
+
+typedef struct rec_rd_s {
+
+	int fd;
+	const uint8_t* map;
+	size_t size;
+
+	const rec_file_header_t* header;
+	uint64_t data_end; /*offset following the last complete block*/
+	uint64_t end_sample; /*stream index following the last sample*/
+
+	/*sparse index, in the mapping or rebuilt*/
+	const rec_index_entry_t* index;
+	uint64_t nb_entries;
+	char index_rebuilt; /*the index is allocated, the footer is missing*/
+
+	uint64_t pos; /*offset of the next block returned*/
+
+} rec_rd_t;
+
+/*block of the recording, in the mapping*/
+typedef struct rec_rd_block_s {
+	const rec_block_header_t* header;
+	const uint8_t* payload;
+} rec_rd_block_t;
+
+rec_rd_t* rec_rd_open(const char* filename);
+int rec_rd_seek_sample(rec_rd_t* rec_rd, uint64_t sample);
+int rec_rd_seek_time(rec_rd_t* rec_rd, int64_t timestamp_ns);
+int rec_rd_next_block(rec_rd_t* rec_rd, rec_rd_block_t* block);
+int rec_rd_decode_block(rec_rd_t* rec_rd, rec_rd_block_t* block, float* values);
+int rec_rd_write_index(rec_rd_t* rec_rd, const char* filename);
+void rec_rd_close(rec_rd_t* rec_rd);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef REC_WRT_FILE_H
+#define REC_WRT_FILE_H
+/**
+ * @file rec_wrt_file.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Recording output (BINARY_OUTPUT). The stream is written in blocks
+ *        compressed without loss, in the layout of rec_file_def.h.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "data_output.h"
+#include "rec_file_def.h"
+
+#define REC_BLOCK_SIZE 256 /*samples per block*/
+
+typedef struct rec_wrt_s {
+
+	FILE* file;
+	rec_file_header_t header;
+
+	/*block in progress, sample after sample*/
+	float* samples;
+	int nb_samples;
+	uint64_t first_sample;
+	int64_t timestamp_ns;
+	double sample_period_ns;
+	int flags;
+	uint64_t sample_idx; /*stream index of the next sample*/
+	char raw_codes; /*the samples are ADC codes, not physical values*/
+
+	/*sparse index, written on close*/
+	uint64_t offset; /*file offset of the next block*/
+	uint64_t nb_blocks;
+	rec_index_entry_t* index;
+	uint64_t nb_entries;
+	uint64_t index_capacity;
+
+	/*encoding buffers*/
+	int32_t* codes; /*one channel*/
+	uint8_t* payload;
+
+} rec_wrt_t;
+
+void* rec_wrt_init(void *param);
+int rec_wrt_write_in_buf(void *param, void *input);
+int rec_wrt_write_block_in_buf(void *param, void *input);
+int rec_wrt_cleanup(void *param);
+
+#endif
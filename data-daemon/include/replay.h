@@ -0,0 +1,13 @@
+/**
+ * @file replay.h
+ * @author Frederic Simard (frederic.simard.1@outlook.com)
+ * @brief Header for the replay of captured sessions (REPLAY hardware)
+ */
+
+int replay_connect_dev(void *param);
+int replay_init_hardware(void *param);
+int replay_read_pkt(void *param);
+int replay_send_keep_alive_pkt(void *param);
+int replay_send_pkt(void *param);
+int replay_cleanup(void *param);
+char *replay_get_device(void);
@@ -0,0 +1,60 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+/**
+ * @file resampler.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Rational polyphase FIR resampler. Changes the rate of a multi-channel
+ *        stream by up/down, with a Kaiser windowed sinc low-pass filter. Only the
+ *        phase needed by each output sample is computed.
+ */
+
+#include <stdint.h>
+
+#include "data_output.h"
+#include "pipeline.h"
+
+#define RESAMPLER_ZERO_CROSSINGS 8 /*zero crossings of the sinc on each side*/
+#define RESAMPLER_KAISER_BETA 8.0 /*~80 dB of stop band attenuation*/
+#define RESAMPLER_PASSBAND 0.9 /*fraction of the lowest nyquist kept*/
+#define RESAMPLER_MAX_IN PIPELINE_BLOCK_SIZE /*input samples processed per call*/
+
+typedef struct resampler_s {
+
+	int nb_channels;
+	int nb_signals; /*leading channels filtered, the others take the nearest sample*/
+	int up; /*interpolation factor (L)*/
+	int down; /*decimation factor (M)*/
+	int nb_taps; /*taps per phase, multiple of 8*/
+	float* coefs; /*up phases of nb_taps coefficients, reversed*/
+
+	/*history of the input, channel after channel*/
+	float* history;
+	int history_len; /*capacity per channel*/
+	int history_fill; /*samples in the history*/
+	int64_t history_idx; /*stream index of the first sample of the history*/
+	uint64_t acc; /*position of the next output, in up-rate units from the history start*/
+
+	/*timing*/
+	uint64_t out_idx; /*stream index of the next output*/
+	double delay; /*group delay, in input samples*/
+	uint64_t in_ts_idx; /*timing of the input: sample in_ts_idx at in_ts_ns*/
+	int64_t in_ts_ns;
+	double in_period_ns;
+
+	/*output buffer, sample after sample*/
+	float* out_buf;
+	int out_capacity;
+
+} resampler_t;
+
+resampler_t* resampler_init(int nb_channels, int in_rate, int out_rate);
+int resampler_process(resampler_t* resampler, data_block_t* input, data_block_t* output);
+int resampler_max_output(resampler_t* resampler, int nb_input);
+void resampler_cleanup(resampler_t* resampler);
+
+void* resampler_stage_init(appconfig_t* config, stage_format_t* format);
+int resampler_stage_process(void* stage, data_block_t* input, data_block_t* output);
+int resampler_stage_flush(void* stage, data_block_t* output);
+void resampler_stage_cleanup(void* stage);
+
+#endif
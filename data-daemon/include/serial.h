@@ -3,6 +3,9 @@
  * @author Ron Brash (ron.brash@gmail.com)
  * @brief Header for serial functions etc...
  */
+
+#define SERIAL_DEFAULT_DEVICE "/dev/ttyUSB0"
+
 int get_serial_fd(void);
 void set_serial_fd(int fd);
 int setup_serial(unsigned char dev_name[]);
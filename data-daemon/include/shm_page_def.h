@@ -0,0 +1,201 @@
+#ifndef SHM_PAGE_DEF_H
+#define SHM_PAGE_DEF_H
+
+#include <stdint.h>
+
+/*this layout must be shared between the following processes:
+ * - DATA_interface
+ * - DATA_preprocessing
+ * - application software
+ *
+ * The shared segment holds the data pages, followed by one metadata
+ * record per page, then by the header describing the stream. Page offsets
+ * are unchanged, so readers that ignore the metadata keep working.
+ */
+
+#define SHM_STREAM_MAGIC 0x4D525453 /*"STRM", the stream header is written*/
+#define SHM_MAX_CHANNELS 64
+#define SHM_CHANNEL_NAME_LENGTH 16
+
+/*format of the values in the pages*/
+#define SHM_SAMPLE_FLOAT32 0 /*float, in physical units*/
+#define SHM_SAMPLE_INT16 1 /*int16_t, raw codes of the hardware, see scale and offset*/
+#define SHM_INT16_MISSING INT16_MIN /*int16_t value of a missing sample (nan)*/
+
+/*metadata describing the content of one page*/
+typedef struct shm_page_meta_s {
+	uint64_t first_sample; /*stream index of the first sample of the page*/
+	uint32_t nb_samples; /*number of valid samples in the page*/
+	uint32_t nb_gaps; /*number of distinct gaps filled in the page*/
+	uint32_t gap_start; /*position in the page of the first filled sample*/
+	uint32_t nb_gap_samples; /*total number of filled samples in the page*/
+	int64_t timestamp_ns; /*drift-corrected host time of the first sample (CLOCK_MONOTONIC_RAW), 0 if unknown*/
+	double sample_period_ns; /*estimated sampling period, the time of sample i is timestamp_ns+i*sample_period_ns*/
+} shm_page_meta_t;
+
+/*description of the stream, written once by the interface*/
+typedef struct shm_stream_header_s {
+	uint32_t magic; /*SHM_STREAM_MAGIC once the header is written*/
+	uint32_t nb_channels; /*values per sample*/
+	uint32_t rate; /*sampling rate (Hz), 0 if not sampled at a fixed rate*/
+	uint32_t sample_format; /*SHM_SAMPLE_* format of the values in the pages*/
+	char channel_names[SHM_MAX_CHANNELS][SHM_CHANNEL_NAME_LENGTH]; /*names of the channels, null terminated*/
+	float scale[SHM_MAX_CHANNELS]; /*value of a channel: offset+sample*scale*/
+	float offset[SHM_MAX_CHANNELS];
+} shm_stream_header_t;
+
+/*signal quality status page, in its own segment (<quality_shm_key>)*/
+#define SHM_QUALITY_MAGIC 0x4C415551 /*"QUAL", the static fields are written*/
+
+#define QUALITY_SATURATED 0x01 /*samples at the rails of the hardware during the last update*/
+#define QUALITY_FLAT 0x02 /*the channel did not move for a second or more*/
+#define QUALITY_NO_DATA 0x04 /*no valid sample during the last update*/
+
+/*statistics of one channel*/
+typedef struct shm_quality_channel_s {
+	char name[SHM_CHANNEL_NAME_LENGTH];
+	float mean; /*exponentially weighted, ~1s time constant*/
+	float std; /*exponentially weighted standard deviation*/
+	float line_noise; /*power at the line frequency during the last update (unit^2, A^2/2 for a sine)*/
+	uint32_t nb_saturated; /*samples at the rails during the last update*/
+	uint32_t nb_flat; /*samples equal to the previous one during the last update*/
+	uint32_t flat_run; /*length of the current run of equal samples*/
+	uint32_t flags; /*QUALITY_* flags*/
+} shm_quality_channel_t;
+
+/*the status page is protected by a sequence lock: the writer makes sequence
+ *odd, updates the page, then makes it even. A reader copies the page between
+ *two reads of sequence, and retries if they differ or are odd.*/
+typedef struct shm_quality_page_s {
+	uint32_t magic; /*SHM_QUALITY_MAGIC once the static fields are written*/
+	volatile uint32_t sequence;
+	uint32_t nb_channels; /*channels described*/
+	uint32_t rate; /*sampling rate of the analyzed stream (Hz)*/
+	float line_freq; /*frequency of the line noise measured (Hz)*/
+	uint32_t update_samples; /*samples between two updates*/
+	uint64_t last_sample; /*stream index of the last sample analyzed*/
+	int64_t timestamp_ns; /*host time of the last sample (CLOCK_MONOTONIC_RAW), 0 if unknown*/
+	uint32_t drl_ref_valid; /*1 when the hardware reports its DRL/REF (Muse)*/
+	float drl; /*last DRL value*/
+	float ref; /*last REF value*/
+	uint32_t reserved;
+	shm_quality_channel_t channels[SHM_MAX_CHANNELS];
+} shm_quality_page_t;
+
+/*min/max envelope pyramid, in its own segment (<envelope_shm_key>)*/
+#define SHM_ENVELOPE_MAGIC 0x50564E45 /*"ENVP", the header is written*/
+#define SHM_ENVELOPE_LEVELS 3 /*levels of the pyramid*/
+#define SHM_ENVELOPE_FACTOR 16 /*decimation between two levels, the first level is x16*/
+
+/*one level of the pyramid, a ring of entries. Entry k covers the samples
+ *first_sample+k*decimation to first_sample+(k+1)*decimation-1 and holds the
+ *min then the max of each channel (nan if the samples were all missing). It is
+ *stored at offset+(k%capacity)*SHM_ENVELOPE_ENTRY_SIZE(nb_channels).
+ *nb_written is incremented after the entry is written. A reader reads
+ *nb_written, copies the entries it needs, reads nb_written again and drops
+ *the entries under nb_written-capacity, they may have been overwritten.*/
+typedef struct shm_envelope_level_s {
+	uint32_t decimation; /*samples per entry*/
+	uint32_t capacity; /*entries in the ring*/
+	uint32_t offset; /*of the ring, in bytes from the start of the segment*/
+	volatile uint32_t nb_written; /*entries written since the start*/
+} shm_envelope_level_t;
+
+typedef struct shm_envelope_header_s {
+	uint32_t magic; /*SHM_ENVELOPE_MAGIC once the header is written*/
+	uint32_t nb_channels; /*channels per entry*/
+	uint32_t rate; /*sampling rate of the stream (Hz)*/
+	uint32_t nb_levels;
+	uint64_t first_sample; /*stream index of the first sample of the first entries, valid once an entry is written*/
+	char channel_names[SHM_MAX_CHANNELS][SHM_CHANNEL_NAME_LENGTH];
+	shm_envelope_level_t levels[SHM_ENVELOPE_LEVELS];
+} shm_envelope_header_t;
+
+/*size of an entry: min and max of each channel*/
+#define SHM_ENVELOPE_ENTRY_SIZE(nb_channels) (2*(nb_channels)*sizeof(float))
+
+/*runtime statistics page, in its own segment (<stats_shm_key>)*/
+#define SHM_STATS_MAGIC 0x54415453 /*"STAT", the static fields are written*/
+#define SHM_STATS_NB_PACKET_TYPES 16 /*soft packets are counted by their first nibble*/
+#define SHM_STATS_PACKET_TYPE_NAMES { "invalid", "type_1", "type_2", "type_3", "type_4", "type_5", "type_6", "type_7", \
+	"type_8", "drl_ref", "accel", "battery", "compressed", "error", "uncompressed", "sync" }
+#define SHM_STATS_NB_STAGES 7 /*read, frame, decode, translate, page_fill, page_post, total*/
+#define SHM_STATS_STAGE_NAME_LENGTH 16
+#define SHM_STATS_DEVICE_LENGTH 24 /*hardware type, as in the config*/
+#define SHM_STATS_NB_PERF_STAGES 3 /*preparse, parse, translate*/
+#define SHM_STATS_NB_PERF_COUNTERS 4 /*cycles, instructions, branch misses, cache misses*/
+
+/*time spent in a stage of the data path, the percentiles when the tracing is on (<trace>)*/
+typedef struct shm_stats_stage_s {
+	char name[SHM_STATS_STAGE_NAME_LENGTH];
+	uint64_t count; /*buffers through the stage*/
+	uint64_t total_ns; /*time from the previous stage, summed*/
+	uint64_t p50_ns; /*0 without the tracing, like the other percentiles and the max*/
+	uint64_t p99_ns;
+	uint64_t p999_ns;
+	uint64_t max_ns;
+} shm_stats_stage_t;
+
+/*hardware counters of a decoder stage for one type of soft packet*/
+typedef struct shm_stats_perf_s {
+	uint64_t count; /*packets through the stage*/
+	uint64_t counters[SHM_STATS_NB_PERF_COUNTERS]; /*summed, in user space*/
+} shm_stats_perf_t;
+
+/*the counters only grow, the gauges (reader_lag) are set. Each field is
+ *written with relaxed atomics and must be read the same way, a 64 bits
+ *value may otherwise be torn on 32 bits targets. No lock, no signal: a
+ *reader takes two copies apart in time for the rates.*/
+typedef struct shm_stats_page_s {
+	uint32_t magic; /*SHM_STATS_MAGIC once the static fields are written*/
+	int32_t pid; /*of the interface*/
+	char device[SHM_STATS_DEVICE_LENGTH];
+	int64_t start_ns; /*host time of the start (CLOCK_MONOTONIC_RAW)*/
+	int64_t update_ns; /*host time of the last update of the cpu and the stages*/
+
+	/*received from the hardware*/
+	uint64_t bytes_received;
+	uint64_t buffers_received;
+	uint64_t samples_received; /*decoded, the filled gaps excluded*/
+	uint64_t packet_types[SHM_STATS_NB_PACKET_TYPES]; /*soft packets seen, by type (MUSE_*_PKT)*/
+	uint64_t preparse_errors; /*buffers the soft packets could not be found in*/
+	uint64_t bit_length_mismatches; /*compressed packets with a wrong bit length*/
+	uint64_t dropped_samples; /*reported by the hardware*/
+	uint64_t gap_samples; /*synthesized to fill the dropped samples*/
+
+	/*output*/
+	uint64_t pages_published;
+	uint64_t pages_dropped; /*pages worth of samples dropped, no page was free*/
+	uint64_t samples_dropped; /*by the output, no page was free*/
+	uint64_t reader_lag; /*pages published and not read yet*/
+
+	/*link*/
+	uint64_t connect_attempts;
+	uint64_t connections;
+	uint64_t disconnections; /*links lost, hung up or stalled*/
+	uint64_t stalls; /*links without data for <stall_timeout_ms>*/
+
+	/*cpu*/
+	uint64_t cpu_ns; /*of the process*/
+	uint64_t read_cpu_ns; /*of the thread reading the hardware*/
+	uint64_t trace_lost; /*trace events dropped on full rings*/
+	shm_stats_stage_t stages[SHM_STATS_NB_STAGES];
+
+	/*hardware counters (<perf_counters>), by stage and by type of packet*/
+	uint64_t perf_status; /*PERF_OFF, PERF_COUNTING or PERF_UNAVAILABLE*/
+	shm_stats_perf_t perf[SHM_STATS_NB_PERF_STAGES][SHM_STATS_NB_PACKET_TYPES];
+} shm_stats_page_t;
+
+/*offset of the metadata array, aligned on 8 bytes*/
+#define SHM_PAGE_META_OFFSET(page_size, nb_pages) \
+		((((page_size)*(nb_pages))+7)&~7)
+
+/*offset of the stream header*/
+#define SHM_STREAM_HEADER_OFFSET(page_size, nb_pages) \
+		(SHM_PAGE_META_OFFSET(page_size, nb_pages)+(nb_pages)*sizeof(shm_page_meta_t))
+
+/*total size of the shared segment*/
+#define SHM_SEGMENT_SIZE(page_size, nb_pages) \
+		(SHM_STREAM_HEADER_OFFSET(page_size, nb_pages)+sizeof(shm_stream_header_t))
+
+#endif
@@ -19,6 +19,8 @@
 #include <sys/ipc.h>
 #include <sys/shm.h>
 #include <sys/sem.h>
+
+#include "shm_page_def.h"
 	
 typedef struct shm_wrt_s{
 	
@@ -28,13 +30,18 @@ typedef struct shm_wrt_s{
 	int samples_count; /*keeps track of the number of samples that have been written in the page*/
 	int current_page; /*keeps track of the page to be written into*/
 	char page_opened; /*flags indicate if the page is being written into*/
+	uint64_t sample_idx; /*stream index of the next sample to be written*/
+	int sample_size; /*bytes per value in the pages*/
+	int nb_dropped; /*samples dropped since the last page counted as dropped*/
 	char* shm_buf; /*pointer to the beginning of the shared buffer*/
+	shm_page_meta_t* page_meta; /*pointer to the metadata of the pages*/
 	struct sembuf *sops; /*pointer to operations to perform*/
 	
 }shm_wrt_t;
  
 void* shm_wrt_init(void *param);
 int shm_wrt_write_in_buf(void *param, void *input);
+int shm_wrt_write_block_in_buf(void *param, void *input);
 int shm_wrt_cleanup(void *param);
 
 
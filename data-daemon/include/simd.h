@@ -0,0 +1,99 @@
+#ifndef SIMD_H
+#define SIMD_H
+/**
+ * @file simd.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Portable SIMD helpers, built on the gcc vector extensions. They compile
+ *        to SSE on x86 and NEON on the Raspberry Pi (when the fpu allows it),
+ *        and to plain scalar code otherwise.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SIMD_WIDTH 4 /*floats per vector*/
+#define SIMD_ALIGN 16 /*alignment of the vectors, in bytes*/
+
+/*vector of 4 floats, aligned*/
+typedef float v4sf __attribute__ ((vector_size (16), may_alias));
+
+/*vector of 4 floats, for unaligned accesses*/
+typedef float v4sf_u __attribute__ ((vector_size (16), aligned (4), may_alias));
+
+/*vector of 4 ints, aligned, result of the comparisons of v4sf*/
+typedef int v4si __attribute__ ((vector_size (16), may_alias));
+
+/*vector of 4 ints, for unaligned accesses*/
+typedef int v4si_u __attribute__ ((vector_size (16), aligned (4), may_alias));
+
+/*vector of 4 unsigned ints, aligned, for wrapping integer arithmetic*/
+typedef unsigned int v4su __attribute__ ((vector_size (16), may_alias));
+
+/*vector of 4 unsigned ints, for unaligned accesses*/
+typedef unsigned int v4su_u __attribute__ ((vector_size (16), aligned (4), may_alias));
+
+/*rounds a number of floats up to a multiple of the vector width*/
+#define SIMD_ROUND_UP(n) ((((n)+SIMD_WIDTH-1)/SIMD_WIDTH)*SIMD_WIDTH)
+
+/**
+ * void* simd_malloc(size_t size)
+ * @brief Allocates zeroed memory aligned for vectors
+ * @param size, in bytes
+ * @return pointer to the memory, NULL on error
+ */
+static inline void* simd_malloc(size_t size)
+{
+	void* ptr = NULL;
+
+	if (posix_memalign(&ptr, SIMD_ALIGN, size) != 0) {
+		return NULL;
+	}
+	memset(ptr, 0, size);
+
+	return ptr;
+}
+
+/**
+ * v4sf simd_splat(float x)
+ * @brief Vector with x in every lane
+ */
+static inline v4sf simd_splat(float x)
+{
+	v4sf v = { x, x, x, x };
+	return v;
+}
+
+/**
+ * v4sf simd_select(v4si mask, v4sf a, v4sf b)
+ * @brief Lane by lane, a where the mask is set, b elsewhere
+ */
+static inline v4sf simd_select(v4si mask, v4sf a, v4sf b)
+{
+	return (v4sf)(((v4si)a & mask) | ((v4si)b & ~mask));
+}
+
+/**
+ * float simd_dot(const float* a, const float* b, int n)
+ * @brief Dot product, a must be aligned, n a multiple of 8
+ * @param a, aligned array
+ * @param b, array
+ * @param n, length of the arrays
+ * @return sum of a[i]*b[i]
+ */
+static inline float simd_dot(const float* a, const float* b, int n)
+{
+	int i;
+	v4sf acc0 = { 0, 0, 0, 0 };
+	v4sf acc1 = { 0, 0, 0, 0 };
+
+	/*two accumulators hide the latency of the adds*/
+	for (i = 0; i < n; i += 2*SIMD_WIDTH) {
+		acc0 += *(const v4sf*)&(a[i]) * *(const v4sf_u*)&(b[i]);
+		acc1 += *(const v4sf*)&(a[i+SIMD_WIDTH]) * *(const v4sf_u*)&(b[i+SIMD_WIDTH]);
+	}
+	acc0 += acc1;
+
+	return acc0[0]+acc0[1]+acc0[2]+acc0[3];
+}
+
+#endif
@@ -4,7 +4,9 @@
  * @brief Contains socket header stuff 
  */ 
 
+#define SOCKET_UNIX_PREFIX "unix:" /*remote address of an emulator, unix:<path>*/
+
 int get_socket_fd();
 void set_socket_fd();
-int setup_socket(unsigned char addr_mac[]);
+int setup_socket(unsigned char addr_mac[], int timeout_ms);
 void close_sockets();
@@ -0,0 +1,32 @@
+#ifndef STATS_H
+#define STATS_H
+/**
+ * @file stats.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Runtime statistics of the interface, published in a shared memory
+ *        page (shm_stats_page_t) that `datactl stats` reads. The counters are
+ *        updated in place with relaxed atomics. Without <stats_shm_key>, they
+ *        go to a private page, so the updates never need a check.
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "shm_page_def.h"
+#include "xml.h"
+
+#define STATS_UPDATE_PERIOD_MS 1000 /*cpu times and stages*/
+
+#define STATS_ADD(counter, value) \
+		__atomic_fetch_add(&(stats_page->counter), (uint64_t)(value), __ATOMIC_RELAXED)
+
+#define STATS_SET(counter, value) \
+		__atomic_store_n(&(stats_page->counter), (uint64_t)(value), __ATOMIC_RELAXED)
+
+extern shm_stats_page_t* stats_page;
+
+int stats_init(appconfig_t* config);
+void stats_set_read_thread(pthread_t thread);
+void stats_cleanup(void);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+/**
+ * @file timer_wheel.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Periodic tasks of the interface (keep alive, statistics), run by the
+ *        thread reading the hardware instead of a thread each. The timers
+ *        hang in the slots of a wheel of TIMER_WHEEL_TICK_MS ticks, a timerfd
+ *        is armed on the next slot that holds one. The reading thread waits
+ *        on its device and on the timerfd together (timer_wheel_wait), the
+ *        timers run there, between two reads.
+ *
+ *        The callbacks must be short, they delay the data.
+ *
+ *        timer_wheel_stop (Ctrl C) makes the waits return and the reading
+ *        loops with them, the wheel is cleaned up once they have.
+ */
+
+#include <stdint.h>
+
+#define TIMER_WHEEL_TICK_MS 10
+#define TIMER_WHEEL_NB_SLOTS 256 /*a power of 2, a lap of 2.56s, the longer timers wait for several laps*/
+
+/*same form as the functions of the hardware*/
+typedef int (*timer_callback_t) (void *);
+
+typedef struct wheel_timer_s {
+
+	timer_callback_t callback;
+	void* param;
+	uint64_t expiry_tick;
+	uint32_t period_ticks; /*0 for a single shot*/
+	uint32_t rounds; /*laps of the wheel left before it expires*/
+	volatile char armed;
+
+	struct wheel_timer_s* next;
+	struct wheel_timer_s** prev; /*link that points to it, NULL when out of the wheel*/
+	struct wheel_timer_s* next_due;
+
+} wheel_timer_t;
+
+int timer_wheel_init(void);
+void timer_wheel_add(wheel_timer_t* timer, int delay_ms, int period_ms, timer_callback_t callback, void* param);
+void timer_wheel_cancel(wheel_timer_t* timer);
+int timer_wheel_wait(int fd, int64_t timeout_ns);
+void timer_wheel_poll(void);
+void timer_wheel_stop(void);
+int timer_wheel_stopped(void);
+void timer_wheel_cleanup(void);
+
+#endif
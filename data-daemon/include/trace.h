@@ -0,0 +1,47 @@
+#ifndef TRACE_H
+#define TRACE_H
+/**
+ * @file trace.h
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Latency tracing of the data path. Each thread timestamps the stages
+ *        a buffer goes through (read, framing, decode, translate, page fill,
+ *        page post) in its own ring, without lock. A thread of the tracer
+ *        drains the rings into a histogram per stage: the time since the
+ *        previous stage of the same buffer, and the total from the read to
+ *        the last stage.
+ *
+ *        Tracing is set by <trace>TRUE</trace>. When it is off, a trace point
+ *        only adds the time of its stage to a count and a sum per stage, a
+ *        read of the clock and two relaxed adds: the statistics always have
+ *        the time of each stage, the percentiles need the tracing.
+ */
+
+#include <stdint.h>
+
+#include "histogram.h"
+
+typedef enum { TRACE_READ, TRACE_FRAME, TRACE_DECODE, TRACE_TRANSLATE, TRACE_PAGE_FILL, TRACE_PAGE_POST,
+	TRACE_NB_STAGES } trace_stage_t;
+
+#define TRACE_STAGE_NAMES { "read", "frame", "decode", "translate", "page_fill", "page_post", "total" }
+#define TRACE_TOTAL TRACE_NB_STAGES /*histogram of the read to the last stage of a buffer*/
+#define TRACE_NB_HISTOGRAMS (TRACE_NB_STAGES+1)
+
+#define TRACE_RING_SIZE 4096 /*events per thread, a power of 2*/
+#define TRACE_MAX_THREADS 8 /*threads traced, the others are ignored*/
+#define TRACE_DRAIN_PERIOD_MS 100
+
+#define TRACE_POINT(stage) \
+		do { if (trace_enabled) trace_point(stage); else trace_count(stage); } while (0)
+
+extern int trace_enabled;
+
+int trace_init(int enabled);
+void trace_point(trace_stage_t stage);
+void trace_count(trace_stage_t stage);
+void trace_request_dump(void);
+uint64_t trace_get_histograms(histogram_t* histograms);
+void trace_get_counts(uint64_t* counts, uint64_t* sums_ns);
+void trace_cleanup(void);
+
+#endif
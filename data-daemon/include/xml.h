@@ -19,12 +19,55 @@
 #define MMAP_OUTPUT 3
 #define SHM_OUTPUT 4  
 
+#define SAMPLE_FLOAT32 0 /*values in physical units*/
+#define SAMPLE_INT16 1 /*raw codes of the hardware*/
+
+#define GAP_FILL_HOLD 0
+#define GAP_FILL_INTERP 1
+#define GAP_FILL_NAN 2
+
 #define MAX_CHAR_FIELD_LENGTH 18
+#define MAX_PATH_LENGTH 256
+#define MAX_MERGE_SOURCES 8
+#define MAX_FEATURE_BANDS 8
+#define MAX_PIPELINE_STAGES 8
+#define MAX_MONTAGE_ROWS 32
+#define MAX_MONTAGE_TERMS 16
+
+/*shared memory ring of a device feeding the merge*/
+typedef struct merge_source_s {
+	int shm_key;
+	int sem_key;
+	int nb_data_channels;
+	int window_size;
+	int nb_pages;
+} merge_source_t;
+
+/*frequency band of the band power features*/
+typedef struct feature_band_s {
+	float low; /*Hz, included*/
+	float high; /*Hz, excluded*/
+} feature_band_t;
+
+/*montages*/
+#define MONTAGE_NONE 0
+#define MONTAGE_CAR 1 /*common average reference*/
+#define MONTAGE_LINKED 2 /*referenced to the mean of two electrodes*/
+#define MONTAGE_BIPOLAR 3 /*differences of pairs of electrodes*/
+#define MONTAGE_CUSTOM 4 /*weighted sums of electrodes*/
+
+/*one derivation of the montage, a weighted sum of input channels*/
+typedef struct montage_row_s {
+	char name[MAX_CHAR_FIELD_LENGTH]; /*empty to name it from its inputs*/
+	int nb_terms;
+	int inputs[MAX_MONTAGE_TERMS];
+	float weights[MAX_MONTAGE_TERMS];
+} montage_row_t;
 
 typedef struct appconfig_s {
 	unsigned char interface[MAX_CHAR_FIELD_LENGTH];
 	unsigned char device[MAX_CHAR_FIELD_LENGTH];
-	unsigned char remote_addr[MAX_CHAR_FIELD_LENGTH];
+	unsigned char remote_addr[MAX_PATH_LENGTH]; /*bluetooth address, or unix:<path> of an emulator*/
 	int shm_key;
 	int sem_key;
 	int nb_data_channels;
@@ -35,10 +78,46 @@ typedef struct appconfig_s {
 	uint32_t process_data:1;
 	uint32_t buffer:1;
 	uint32_t output_format:3;
+	uint32_t gap_fill:2;
+	uint32_t pipeline_set:1; /*the stages are listed, otherwise they follow the options*/
+	uint32_t montage_type:3;
+	uint32_t sample_format:1; /*SAMPLE_FLOAT32 or SAMPLE_INT16*/
+	uint32_t trace:1; /*latency tracing of the data path (trace.h)*/
+	uint32_t perf_counters:1; /*hardware counters of the decoder (perf_counters.h)*/
+	uint32_t log_output:1; /*LOGGER_STDERR or LOGGER_SYSLOG (logger.h)*/
 	uint16_t samples;
 	uint16_t number_runs;
 	uint16_t keep_time;
 	uint16_t conn_attempts;
+	char record_file[MAX_PATH_LENGTH]; /*recording of the BINARY output*/
+	char capture_file[MAX_PATH_LENGTH]; /*capture of the raw bytes received, empty if none*/
+	int output_rate; /*rate of the output, 0 for the hardware rate*/
+	int notch_freq; /*filters applied when process_data is set, 0 when unused*/
+	float highpass_freq;
+	float bandpass_low;
+	float bandpass_high;
+	int feature_shm_key; /*ring of the band power features, 0 when unused*/
+	int feature_sem_key; /*semaphores of the feature ring, 0 to share the set of sem_key*/
+	int nb_feature_bands;
+	feature_band_t feature_bands[MAX_FEATURE_BANDS];
+	int quality_shm_key; /*signal quality status page, 0 when unused*/
+	int quality_update_rate; /*updates of the status page per second*/
+	int envelope_shm_key; /*min/max envelope pyramid, 0 when unused*/
+	int envelope_duration; /*seconds kept in each level of the pyramid*/
+	int stats_shm_key; /*runtime statistics page, 0 when unused*/
+	int connect_timeout_ms; /*link to the device (connection.h), 0 for the defaults*/
+	int stall_timeout_ms;
+	int backoff_max_ms;
+	int nb_pipeline_stages;
+	char pipeline_stages[MAX_PIPELINE_STAGES][MAX_CHAR_FIELD_LENGTH];
+	int montage_refs[2]; /*electrodes of the linked reference*/
+	int nb_montage_rows; /*derivations of the bipolar and custom montages*/
+	montage_row_t montage_rows[MAX_MONTAGE_ROWS];
+	char replay_file[MAX_PATH_LENGTH]; /*capture replayed by the REPLAY hardware*/
+	float replay_speed; /*1 for the original timing, 0 as fast as possible*/
+	int merge_rate;
+	int nb_merge_sources;
+	merge_source_t merge_sources[MAX_MERGE_SOURCES];
 } appconfig_t;
 
 appconfig_t *xml_initialize(char *filename);
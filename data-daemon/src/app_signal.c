@@ -16,17 +16,27 @@
 #include "app_signal.h"
 #include "hardware.h"
 #include "socket.h"
-
-extern void app_cleanup(void);
+#include "trace.h"
+#include "timer_wheel.h"
 
 /**
  * ctrl_c_handler(int signal)
- * @brief Ctrl C signal handler
- * @param signal
+ * @brief Ctrl C signal handler, stops the wheel: the reading thread returns
+ *        and main cleans up once it has joined it. A second Ctrl C kills.
+ * @param signo
  */ 
-void ctrl_c_handler(int signal)
+void ctrl_c_handler(int signo)
+{
+	timer_wheel_stop();
+	(void)signal(signo, SIG_DFL);
+}
+
+/**
+ * trace_dump_handler(int signal)
+ * @brief SIGUSR1 signal handler, the tracer prints the latencies
+ * @param signal
+ */
+void trace_dump_handler(int signal __attribute__ ((unused)))
 {
-	fprintf(stdout, "Interrupt caught[NO: %d ]\n", signal);
-	app_cleanup();
-	exit(0);
+	trace_request_dump();
 }
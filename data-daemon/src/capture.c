@@ -0,0 +1,213 @@
+/**
+ * @file capture.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Capture of the raw bytes received from the hardware. The ring holds
+ *        the records in the layout of the file, the writer thread only has to
+ *        copy what lies between tail and head. The producer publishes head
+ *        with a release store once the record is complete, the consumer
+ *        publishes tail once the bytes are written, no lock is taken.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clock_sync.h"
+#include "capture.h"
+
+static void* capture_writer(void* param);
+static void capture_ring_copy(capture_t* capture, uint64_t pos, const void* data, int length);
+static uint64_t capture_drain(capture_t* capture);
+
+/**
+ * int capture_init(capture_t* capture, char* filename, char* device)
+ * @brief Creates the capture file and starts the writer thread
+ * @param capture, the capture
+ * @param filename, of the capture file
+ * @param device, device type written in the header
+ * @return 0 for success, -1 otherwise
+ */
+int capture_init(capture_t* capture, char* filename, char* device){
+
+	capture_file_header_t header;
+
+	capture->head = 0;
+	capture->tail = 0;
+	capture->nb_dropped = 0;
+	capture->running = 0;
+
+	capture->file = fopen(filename, "wb");
+	if(capture->file==NULL){
+		perror("fopen");
+		return (-1);
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = CAPTURE_MAGIC;
+	header.version = CAPTURE_VERSION;
+	strncpy(header.device, device, CAPTURE_DEVICE_LENGTH-1);
+	header.start_ns = clock_sync_now_ns();
+
+	if(fwrite(&header, sizeof(header), 1, capture->file)!=1){
+		perror("fwrite");
+		fclose(capture->file);
+		capture->file = NULL;
+		return (-1);
+	}
+
+	capture->running = 1;
+	if(pthread_create(&(capture->writer), NULL, capture_writer, (void*)capture)!=0){
+		fprintf(stderr, "capture: can't start the writer\n");
+		capture->running = 0;
+		fclose(capture->file);
+		capture->file = NULL;
+		return (-1);
+	}
+
+	return 0;
+}
+
+/**
+ * void capture_write(capture_t* capture, const uint8_t* buffer, int length, int64_t timestamp_ns)
+ * @brief Queues a buffer received, from the reading thread. Drops it if the
+ *        ring is full.
+ * @param capture, the capture
+ * @param buffer, bytes received
+ * @param length, number of bytes
+ * @param timestamp_ns, host time of the reception
+ */
+void capture_write(capture_t* capture, const uint8_t* buffer, int length, int64_t timestamp_ns){
+
+	capture_record_t record;
+	uint64_t head = capture->head;
+	uint64_t tail = __atomic_load_n(&(capture->tail), __ATOMIC_ACQUIRE);
+
+	if(!capture->running || length<=0){
+		return;
+	}
+
+	if(head-tail+sizeof(capture_record_t)+length>CAPTURE_RING_SIZE){
+		capture->nb_dropped++;
+		return;
+	}
+
+	record.timestamp_ns = timestamp_ns;
+	record.length = length;
+	record.nb_dropped = capture->nb_dropped;
+	capture->nb_dropped = 0;
+
+	capture_ring_copy(capture, head, &record, sizeof(capture_record_t));
+	capture_ring_copy(capture, head+sizeof(capture_record_t), buffer, length);
+
+	/*the record is complete, the writer can take it*/
+	__atomic_store_n(&(capture->head), head+sizeof(capture_record_t)+length, __ATOMIC_RELEASE);
+}
+
+/**
+ * void capture_cleanup(capture_t* capture)
+ * @brief Stops the writer, once the ring is written, and closes the file
+ * @param capture, the capture
+ */
+void capture_cleanup(capture_t* capture){
+
+	capture_record_t record;
+
+	if(capture->file==NULL){
+		return;
+	}
+
+	capture->running = 0;
+	pthread_join(capture->writer, NULL);
+
+	/*the buffers dropped at the end get an empty record*/
+	if(capture->nb_dropped>0){
+		record.timestamp_ns = clock_sync_now_ns();
+		record.length = 0;
+		record.nb_dropped = capture->nb_dropped;
+		if(fwrite(&record, sizeof(record), 1, capture->file)!=1){
+			perror("fwrite");
+		}
+	}
+
+	fclose(capture->file);
+	capture->file = NULL;
+}
+
+/**
+ * void* capture_writer(void* param)
+ * @brief Writer thread, appends the ring to the file until the capture stops
+ * @param param, the capture
+ */
+static void* capture_writer(void* param){
+
+	capture_t* capture = (capture_t*)param;
+	struct timespec period = { 0, CAPTURE_WRITER_PERIOD_NS };
+
+	while(capture->running){
+		if(capture_drain(capture)==0){
+			nanosleep(&period, NULL);
+		}
+	}
+
+	/*what was queued before the stop*/
+	capture_drain(capture);
+
+	return NULL;
+}
+
+/**
+ * uint64_t capture_drain(capture_t* capture)
+ * @brief Writes the records queued in the ring
+ * @param capture, the capture
+ * @return number of bytes written
+ */
+static uint64_t capture_drain(capture_t* capture){
+
+	uint64_t tail = capture->tail;
+	uint64_t head = __atomic_load_n(&(capture->head), __ATOMIC_ACQUIRE);
+	uint64_t start = tail%CAPTURE_RING_SIZE;
+	uint64_t length = head-tail;
+	uint64_t first = length;
+
+	if(length==0){
+		return 0;
+	}
+
+	/*the queued bytes may wrap around the end of the ring*/
+	if(start+length>CAPTURE_RING_SIZE){
+		first = CAPTURE_RING_SIZE-start;
+	}
+
+	if(fwrite(&(capture->ring[start]), 1, first, capture->file)!=first ||
+	   (length>first && fwrite(capture->ring, 1, length-first, capture->file)!=length-first)){
+		perror("fwrite");
+	}
+	fflush(capture->file);
+
+	/*the space can be used again*/
+	__atomic_store_n(&(capture->tail), head, __ATOMIC_RELEASE);
+
+	return length;
+}
+
+/**
+ * void capture_ring_copy(capture_t* capture, uint64_t pos, const void* data, int length)
+ * @brief Copies bytes in the ring, wrapping around its end
+ * @param capture, the capture
+ * @param pos, running position in the ring
+ * @param data
+ * @param length
+ */
+static void capture_ring_copy(capture_t* capture, uint64_t pos, const void* data, int length){
+
+	uint64_t start = pos%CAPTURE_RING_SIZE;
+	int first = length;
+
+	if(start+length>CAPTURE_RING_SIZE){
+		first = CAPTURE_RING_SIZE-start;
+	}
+
+	memcpy(&(capture->ring[start]), data, first);
+	memcpy(capture->ring, (const uint8_t*)data+first, length-first);
+}
@@ -0,0 +1,155 @@
+/**
+ * @file clock_sync.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Estimates the relation between the device sample index and the host
+ *        clock (CLOCK_MONOTONIC_RAW). A line is fitted on (sample index, arrival time)
+ *        pairs with exponentially weighted least squares. Late arrivals (bluetooth
+ *        bursts) are down-weighted, so the fit follows the earliest arrivals and
+ *        the timestamps it predicts are free of the burst jitter.
+ *
+ *        The sums are re-centered on the latest observation at every update, which
+ *        keeps the numbers small and the fit well conditioned over long sessions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "clock_sync.h"
+
+#define CLOCK_SYNC_FORGET 0.999 /*forgetting factor, ~1000 observations of memory*/
+#define CLOCK_SYNC_MIN_OBS 16 /*observations required before the period is fitted*/
+#define CLOCK_SYNC_MAX_DRIFT 0.01 /*the fitted period stays within 1% of nominal*/
+#define CLOCK_SYNC_MIN_SPREAD_NS 250000.0 /*floor on the residual spread (0.25 ms)*/
+
+/**
+ * void clock_sync_init(clock_sync_t* clock_sync, double nominal_rate)
+ * @brief Initializes the estimator
+ * @param clock_sync, the estimator
+ * @param nominal_rate, sampling rate announced by the device, in Hz
+ */
+void clock_sync_init(clock_sync_t* clock_sync, double nominal_rate){
+
+	memset(clock_sync, 0, sizeof(clock_sync_t));
+
+	clock_sync->nominal_period_ns = 1e9/nominal_rate;
+	clock_sync->period_ns = clock_sync->nominal_period_ns;
+	clock_sync->spread_ns = CLOCK_SYNC_MIN_SPREAD_NS;
+}
+
+/**
+ * void clock_sync_update(clock_sync_t* clock_sync, uint64_t sample_idx, int64_t host_ns)
+ * @brief Adds an observation: the sample sample_idx had arrived at host_ns.
+ * @param clock_sync, the estimator
+ * @param sample_idx, index of the last sample received
+ * @param host_ns, host time of the reception
+ */
+void clock_sync_update(clock_sync_t* clock_sync, uint64_t sample_idx, int64_t host_ns){
+
+	double dx, dy;
+	double residual;
+	double weight = 1.0;
+	double det;
+
+	/*first observation, anchor the model on it*/
+	if(clock_sync->nb_obs==0){
+		clock_sync->ref_idx = sample_idx;
+		clock_sync->ref_ns = host_ns;
+		clock_sync->s0 = 1.0;
+		clock_sync->nb_obs = 1;
+		return;
+	}
+
+	/*move the reference to the new observation*/
+	dx = (double)(int64_t)(sample_idx-clock_sync->ref_idx);
+	dy = (double)(host_ns-clock_sync->ref_ns);
+
+	/*distance to the current model, positive when late*/
+	residual = dy-(clock_sync->intercept_ns+dx*clock_sync->period_ns);
+
+	/*late arrivals are queued data, they carry little timing information*/
+	if(residual>clock_sync->spread_ns){
+		weight = clock_sync->spread_ns/residual;
+		weight = weight*weight;
+	}
+
+	/*track the spread of the residuals*/
+	clock_sync->spread_ns = 0.99*clock_sync->spread_ns+0.01*fabs(residual);
+	if(clock_sync->spread_ns<CLOCK_SYNC_MIN_SPREAD_NS){
+		clock_sync->spread_ns = CLOCK_SYNC_MIN_SPREAD_NS;
+	}
+
+	/*re-center the sums on the new observation (x' = x-dx, y' = y-dy)*/
+	clock_sync->sxx = clock_sync->sxx-2*dx*clock_sync->sx+dx*dx*clock_sync->s0;
+	clock_sync->sxy = clock_sync->sxy-dx*clock_sync->sy-dy*clock_sync->sx+dx*dy*clock_sync->s0;
+	clock_sync->sx = clock_sync->sx-dx*clock_sync->s0;
+	clock_sync->sy = clock_sync->sy-dy*clock_sync->s0;
+	clock_sync->ref_idx = sample_idx;
+	clock_sync->ref_ns = host_ns;
+
+	/*forget and add the observation, which sits at (0,0)*/
+	clock_sync->s0 = CLOCK_SYNC_FORGET*clock_sync->s0+weight;
+	clock_sync->sx *= CLOCK_SYNC_FORGET;
+	clock_sync->sy *= CLOCK_SYNC_FORGET;
+	clock_sync->sxx *= CLOCK_SYNC_FORGET;
+	clock_sync->sxy *= CLOCK_SYNC_FORGET;
+	clock_sync->nb_obs++;
+
+	/*fit the period, once enough observations are in*/
+	det = clock_sync->s0*clock_sync->sxx-clock_sync->sx*clock_sync->sx;
+	if(clock_sync->nb_obs>=CLOCK_SYNC_MIN_OBS && det>0){
+		clock_sync->period_ns = (clock_sync->s0*clock_sync->sxy-clock_sync->sx*clock_sync->sy)/det;
+
+		/*a device clock can't drift that much, the fit is off*/
+		if(fabs(clock_sync->period_ns/clock_sync->nominal_period_ns-1.0)>CLOCK_SYNC_MAX_DRIFT){
+			clock_sync->period_ns = clock_sync->nominal_period_ns;
+		}
+	}
+
+	/*intercept for the current period*/
+	clock_sync->intercept_ns = (clock_sync->sy-clock_sync->period_ns*clock_sync->sx)/clock_sync->s0;
+}
+
+/**
+ * int64_t clock_sync_predict(clock_sync_t* clock_sync, uint64_t sample_idx)
+ * @brief Returns the drift-corrected host time of a sample
+ * @param clock_sync, the estimator
+ * @param sample_idx, index of the sample
+ * @return host time in ns (CLOCK_MONOTONIC_RAW), current time if nothing was observed yet
+ */
+int64_t clock_sync_predict(clock_sync_t* clock_sync, uint64_t sample_idx){
+
+	double dx;
+
+	if(clock_sync->nb_obs==0){
+		return clock_sync_now_ns();
+	}
+
+	dx = (double)(int64_t)(sample_idx-clock_sync->ref_idx);
+	return clock_sync->ref_ns+(int64_t)(clock_sync->intercept_ns+dx*clock_sync->period_ns);
+}
+
+/**
+ * double clock_sync_period(clock_sync_t* clock_sync)
+ * @brief Returns the estimated sampling period
+ * @param clock_sync, the estimator
+ * @return period in ns
+ */
+double clock_sync_period(clock_sync_t* clock_sync){
+	return clock_sync->period_ns;
+}
+
+/**
+ * int64_t clock_sync_now_ns(void)
+ * @brief Reads the host clock used for timestamping
+ * @return CLOCK_MONOTONIC_RAW in ns
+ */
+int64_t clock_sync_now_ns(void){
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+
+	return (int64_t)now.tv_sec*1000000000LL+now.tv_nsec;
+}
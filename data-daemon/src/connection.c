@@ -0,0 +1,161 @@
+/**
+ * @file connection.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief State of the link to a device: backoff between the attempts and
+ *        watchdog of the data. The connection itself is done by the device
+ *        (setup_socket), the state only gives it its timeout. The waits go
+ *        through the timer wheel, its timers run meanwhile.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <poll.h>
+
+#include "clock_sync.h"
+#include "connection.h"
+#include "timer_wheel.h"
+
+/**
+ * conn_init(conn_t* conn, appconfig_t* config)
+ * @brief Initializes the state, disconnected, with the timeouts of the config
+ * @param conn
+ * @param config, the timeouts left to 0 take their default
+ */
+void conn_init(conn_t* conn, appconfig_t* config)
+{
+	conn->state = CONN_DISCONNECTED;
+	conn->nb_failures = 0;
+	conn->retry_ns = 0;
+	conn->last_data_ns = 0;
+	conn->receiving = 0;
+	conn->lost_ns = 0;
+
+	conn->connect_timeout_ms = config->connect_timeout_ms > 0 ? config->connect_timeout_ms : CONN_DEFAULT_CONNECT_TIMEOUT_MS;
+	conn->stall_timeout_ms = config->stall_timeout_ms > 0 ? config->stall_timeout_ms : CONN_DEFAULT_STALL_TIMEOUT_MS;
+	conn->backoff_max_ms = config->backoff_max_ms > 0 ? config->backoff_max_ms : CONN_DEFAULT_BACKOFF_MAX_MS;
+}
+
+/**
+ * conn_connecting(conn_t* conn)
+ * @brief An attempt starts
+ * @param conn
+ */
+void conn_connecting(conn_t* conn)
+{
+	conn->state = CONN_CONNECTING;
+}
+
+/**
+ * conn_connected(conn_t* conn)
+ * @brief The attempt succeeded, the watchdog starts from now
+ * @param conn
+ */
+void conn_connected(conn_t* conn)
+{
+	conn->nb_failures = 0;
+	conn->last_data_ns = clock_sync_now_ns();
+	conn->receiving = 0;
+	conn->state = CONN_CONNECTED;
+}
+
+/**
+ * conn_failed(conn_t* conn)
+ * @brief The attempt failed, the next one waits for the backoff, doubled at
+ *        each failure in a row
+ * @param conn
+ */
+void conn_failed(conn_t* conn)
+{
+	int64_t backoff_ms = CONN_BACKOFF_MIN_MS;
+	int i;
+
+	for (i = 0; i < conn->nb_failures && backoff_ms < conn->backoff_max_ms; i++) {
+		backoff_ms *= 2;
+	}
+	if (backoff_ms > conn->backoff_max_ms) {
+		backoff_ms = conn->backoff_max_ms;
+	}
+
+	conn->nb_failures++;
+	conn->retry_ns = clock_sync_now_ns()+backoff_ms*1000000;
+	conn->state = CONN_BACKOFF;
+}
+
+/**
+ * conn_lost(conn_t* conn)
+ * @brief The link was lost, it is tried again at once
+ * @param conn
+ */
+void conn_lost(conn_t* conn)
+{
+	conn->lost_ns = clock_sync_now_ns();
+	conn->nb_failures = 0;
+	conn->retry_ns = conn->lost_ns;
+	conn->state = CONN_BACKOFF;
+}
+
+/**
+ * conn_wait_retry(conn_t* conn)
+ * @brief Waits for the end of the backoff, or for the wheel to stop
+ * @param conn
+ */
+void conn_wait_retry(conn_t* conn)
+{
+	int64_t delay_ns = conn->retry_ns-clock_sync_now_ns();
+
+	if (conn->state != CONN_BACKOFF || delay_ns <= 0) {
+		return;
+	}
+
+	timer_wheel_wait(-1, delay_ns);
+}
+
+/**
+ * conn_wait(conn_t* conn, int fd)
+ * @brief Waits for data on the link, until the watchdog expires
+ * @param conn
+ * @param fd, of the link
+ * @return CONN_DATA when fd can be read, CONN_STALLED when no data came for
+ *         stall_timeout_ms (connect_timeout_ms for the first data),
+ *         CONN_HUNG_UP when the link is closed, CONN_STOPPED when the
+ *         wheel is stopped
+ */
+conn_event_t conn_wait(conn_t* conn, int fd)
+{
+	int events;
+	int64_t remaining_ns, timeout_ms;
+
+	timeout_ms = conn->receiving ? conn->stall_timeout_ms : conn->connect_timeout_ms;
+
+	for (;;) {
+
+		remaining_ns = conn->last_data_ns+timeout_ms*1000000-clock_sync_now_ns();
+		if (remaining_ns <= 0) {
+			return CONN_STALLED;
+		}
+
+		events = timer_wheel_wait(fd, remaining_ns);
+		if (timer_wheel_stopped()) {
+			return CONN_STOPPED;
+		}
+		if (events < 0) {
+			return CONN_HUNG_UP;
+		}
+
+		/*the data left before a hang up is read first*/
+		if (events > 0) {
+			return (events & POLLIN) ? CONN_DATA : CONN_HUNG_UP;
+		}
+	}
+}
+
+/**
+ * conn_data(conn_t* conn)
+ * @brief Data was received, the watchdog starts over
+ * @param conn
+ */
+void conn_data(conn_t* conn)
+{
+	conn->last_data_ns = clock_sync_now_ns();
+	conn->receiving = 1;
+}
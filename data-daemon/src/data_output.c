@@ -14,22 +14,85 @@
 #include "data_output.h"
 
 #include "shm_wrt_buf.h"
+#include "rec_wrt_file.h"
+#include "shsem_def.h"
+#include "pipeline.h"
+#include "hardware.h"
 #include "xml.h"
 
-void init_shm_mem_options(appconfig_t *config, shm_mem_options_t* shm_mem_options);
-void init_csv_output_options(appconfig_t *config, csv_output_options_t* csv_output_options);
+void init_shm_mem_options(appconfig_t *config, stage_format_t* format, shm_mem_options_t* shm_mem_options,
+                          float* scale, float* offset);
+void init_csv_output_options(int nb_data_channels, csv_output_options_t* csv_output_options);
+void init_rec_file_options(appconfig_t *config, stage_format_t* format, rec_file_options_t* rec_file_options,
+                           float* scale, float* offset);
+int csv_write_block_per_sample(void *param, void *input);
 
 /**
  * int init_data_output(char *output_type)
- * @brief Setup function pointers for the data output
+ * @brief Setup function pointers for the data output. The processing stages
+ *        are set first, the output takes the stream coming out of them.
  * @param output_type, identifies the type of output to init
  * @return EXIT_FAILURE for unknown type, EXIT_SUCCESS for known/success
  */
 void* init_data_output(appconfig_t *config){
 
+	int i;
+	float min, max, lsb;
+	void* output = NULL;
+	pipeline_t* pipeline;
+	stage_format_t format;
+
 	_INIT_DATA_OUTPUT_FC = NULL;
 	_COPY_DATA_IN = NULL;
+	_COPY_BLOCK_IN = NULL;
 	_TERMINATE_DATA_OUTPUT_FC = NULL;
+
+	/*stream of the hardware*/
+	format.nb_channels = config->nb_data_channels;
+	format.nb_signals = config->nb_data_channels;
+	format.rate = get_hardware_sampling_rate((char *)config->device);
+
+	/*the validity mask of the merge is not a signal*/
+	if(strcmp((char *)config->device, "MERGE") == 0){
+		format.nb_signals--;
+	}
+
+	if(format.nb_channels>SHM_MAX_CHANNELS){
+		fprintf(stderr, "Too many channels\n");
+		return NULL;
+	}
+
+	memset(format.channel_names, 0, sizeof(format.channel_names));
+	for(i=0;i<format.nb_channels;i++){
+		get_hardware_channel_name((char *)config->device, i, format.channel_names[i], SHM_CHANNEL_NAME_LENGTH);
+	}
+
+	/*the raw codes are only known for the muse, and the stages work in physical units*/
+	if(config->sample_format==SAMPLE_INT16 && strcmp(get_hardware_source((char *)config->device), "MUSE")!=0 &&
+	   strcmp(get_hardware_source((char *)config->device), "FAKE_MUSE")!=0){
+		fprintf(stderr, "INT16 samples are not supported by %s\n", (char *)config->device);
+		return NULL;
+	}
+
+	/*each channel must be one of the hardware, the header tells the range of its codes*/
+	for(i=0;config->sample_format==SAMPLE_INT16 && i<format.nb_channels;i++){
+		if(get_hardware_range((char *)config->device, i, &min, &max, &lsb)<0){
+			fprintf(stderr, "INT16 samples: %s has no channel %i\n", (char *)config->device, i);
+			return NULL;
+		}
+	}
+
+	/*processing stages, the format becomes the stream out of the chain*/
+	pipeline = pipeline_init(config, &format);
+	if(pipeline==NULL){
+		return NULL;
+	}
+
+	if(config->sample_format==SAMPLE_INT16 && pipeline->nb_stages>0){
+		fprintf(stderr, "INT16 samples can't go through processing stages\n");
+		pipeline_cleanup(pipeline);
+		return NULL;
+	}
 		
 	/*output to colum separated values (CSV) file (only for debug purpose for now)*/
 	if(config->output_format == CSV_OUTPUT) {
@@ -39,56 +102,186 @@ void* init_data_output(appconfig_t *config){
 		/*set function pointers accordingly*/
 		_INIT_DATA_OUTPUT_FC = &csv_init_file;
 		_COPY_DATA_IN = &csv_write_in_file;
+		_COPY_BLOCK_IN = &csv_write_block_per_sample;
 		_TERMINATE_DATA_OUTPUT_FC = &csv_close_file;
 		
-		/*init and return*/
-		init_csv_output_options(config, &csv_output_options);
-		return INIT_DATA_OUTPUT_FC((void*)&csv_output_options);
+		/*init*/
+		init_csv_output_options(format.nb_channels, &csv_output_options);
+		output = INIT_DATA_OUTPUT_FC((void*)&csv_output_options);
 	}
 	/*output to shared memory*/
 	else if(config->output_format == SHM_OUTPUT) {
 		
 		shm_mem_options_t shm_mem_options;
+		float scale[SHM_MAX_CHANNELS];
+		float offset[SHM_MAX_CHANNELS];
 		
 		/*set function pointers accordingly*/
 		_INIT_DATA_OUTPUT_FC = &shm_wrt_init;
 		_COPY_DATA_IN = &shm_wrt_write_in_buf;
+		_COPY_BLOCK_IN = &shm_wrt_write_block_in_buf;
 		_TERMINATE_DATA_OUTPUT_FC = &shm_wrt_cleanup;
 		
-		/*init and return*/
-		init_shm_mem_options(config, &shm_mem_options);
-		return INIT_DATA_OUTPUT_FC((void*)&shm_mem_options);
+		/*init*/
+		init_shm_mem_options(config, &format, &shm_mem_options, scale, offset);
+		output = INIT_DATA_OUTPUT_FC((void*)&shm_mem_options);
+		
+	}
+	/*output to a compressed recording*/
+	else if(config->output_format == BINARY_OUTPUT) {
+		
+		rec_file_options_t rec_file_options;
+		float scale[SHM_MAX_CHANNELS];
+		float offset[SHM_MAX_CHANNELS];
+		
+		/*set function pointers accordingly*/
+		_INIT_DATA_OUTPUT_FC = &rec_wrt_init;
+		_COPY_DATA_IN = &rec_wrt_write_in_buf;
+		_COPY_BLOCK_IN = &rec_wrt_write_block_in_buf;
+		_TERMINATE_DATA_OUTPUT_FC = &rec_wrt_cleanup;
 		
+		/*init*/
+		init_rec_file_options(config, &format, &rec_file_options, scale, offset);
+		output = INIT_DATA_OUTPUT_FC((void*)&rec_file_options);
 		
 	}
 	/*Error, wrong type of output*/
 	else{
 		fprintf(stderr, "Unknown output type\n");
-		return NULL;
 	}
-	return NULL;
+
+	/*no stage, the hardware writes directly in the output*/
+	if(output==NULL || pipeline->nb_stages==0){
+		pipeline_cleanup(pipeline);
+		return output;
+	}
+
+	/*otherwise, the hardware writes in the chain*/
+	pipeline_connect(pipeline, output);
+	_COPY_DATA_IN = &pipeline_write_in_buf;
+	_COPY_BLOCK_IN = &pipeline_write_block_in_buf;
+	_TERMINATE_DATA_OUTPUT_FC = &pipeline_cleanup;
+
+	return (void*)pipeline;
+}
+
+/**
+ * int csv_write_block_per_sample(void *param, void *input)
+ * @brief The csv file only accepts one sample at a time. Pushes the samples
+ *        of the block one after the other.
+ * @param param, output interface
+ * @param input, refers to a data_block_t pointer
+ * @return EXIT_SUCCESS
+ */
+int csv_write_block_per_sample(void *param, void *input){
+	
+	int i;
+	data_block_t* block = (data_block_t*)input;
+	data_t data_struct;
+	
+	data_struct.nb_data = block->nb_data;
+	
+	for(i=0;i<block->nb_samples;i++){
+		data_struct.ptr = &(block->ptr[i*block->nb_data]);
+		csv_write_in_file(param, &data_struct);
+	}
+	
+	return EXIT_SUCCESS;
 }
 
 
-void init_shm_mem_options(appconfig_t *config, shm_mem_options_t* shm_mem_options){
+/**
+ * void init_shm_mem_options(appconfig_t *config, stage_format_t* format, shm_mem_options_t* shm_mem_options,
+ *                           float* scale, float* offset)
+ * @brief Options of the shared memory. With INT16 samples, the pages hold the
+ *        codes of the hardware and the header tells how to get the values.
+ * @param config
+ * @param format, the stream out of the chain
+ * @param (out)shm_mem_options
+ * @param (out)scale, SHM_MAX_CHANNELS steps, referred by the options
+ * @param (out)offset, SHM_MAX_CHANNELS offsets, referred by the options
+ */
+void init_shm_mem_options(appconfig_t *config, stage_format_t* format, shm_mem_options_t* shm_mem_options,
+                          float* scale, float* offset){
+	
+	int i;
+	float max;
+	int sample_size = sizeof(float);
+	
+	shm_mem_options->sample_format = SHM_SAMPLE_FLOAT32;
+	shm_mem_options->scale = NULL;
+	shm_mem_options->offset = NULL;
+	
+	if(config->sample_format==SAMPLE_INT16){
+		for(i=0;i<format->nb_channels;i++){
+			if(get_hardware_range((char *)config->device, i, &(offset[i]), &max, &(scale[i]))<0){
+				scale[i] = 0;
+				offset[i] = 0;
+			}
+		}
+		shm_mem_options->sample_format = SHM_SAMPLE_INT16;
+		shm_mem_options->scale = scale;
+		shm_mem_options->offset = offset;
+		sample_size = sizeof(int16_t);
+	}
 	
 	/*Copy info from xml to dataoutput options structure*/
 	shm_mem_options->shm_key = config->shm_key;
 	shm_mem_options->sem_key = config->sem_key;
-	shm_mem_options->nb_data_channels = config->nb_data_channels;
+	shm_mem_options->nb_data_channels = format->nb_channels;
 	shm_mem_options->window_size = config->window_size;
 	shm_mem_options->nb_pages = config->nb_pages;
-	shm_mem_options->page_size = shm_mem_options->window_size*shm_mem_options->nb_data_channels*sizeof(float);
+	shm_mem_options->page_size = shm_mem_options->window_size*shm_mem_options->nb_data_channels*sample_size;
 	shm_mem_options->buffer_size = shm_mem_options->page_size*shm_mem_options->nb_pages;
+	shm_mem_options->rate = format->rate;
+	shm_mem_options->channel_names = (char*)format->channel_names;
+	shm_mem_options->sem_page_free = PREPROC_IN_READY;
+	shm_mem_options->sem_page_written = INTERFACE_OUT_READY;
+	shm_mem_options->sem_owner = 0x01;
 	
 }
 
 
 
-void init_csv_output_options(appconfig_t *config, csv_output_options_t* csv_output_options){
+void init_csv_output_options(int nb_data_channels, csv_output_options_t* csv_output_options){
 	
 	strcpy(csv_output_options->filename,"eeg_data.csv");
-	csv_output_options->nb_data_channels = config->nb_data_channels;
+	csv_output_options->nb_data_channels = nb_data_channels;
 	csv_output_options->data_type = FLOAT_DATA;
 	
 }
+
+
+/**
+ * void init_rec_file_options(appconfig_t *config, stage_format_t* format, rec_file_options_t* rec_file_options,
+ *                            float* scale, float* offset)
+ * @brief Options of the recording. The channels are stored as codes on the
+ *        grid of the hardware when their values allow it.
+ * @param config
+ * @param format, the stream out of the chain
+ * @param (out)rec_file_options
+ * @param (out)scale, SHM_MAX_CHANNELS steps, referred by the options
+ * @param (out)offset, SHM_MAX_CHANNELS offsets, referred by the options
+ */
+void init_rec_file_options(appconfig_t *config, stage_format_t* format, rec_file_options_t* rec_file_options,
+                           float* scale, float* offset){
+	
+	int i;
+	float max;
+	
+	for(i=0;i<format->nb_channels;i++){
+		if(get_hardware_range((char *)config->device, i, &(offset[i]), &max, &(scale[i]))<0){
+			scale[i] = 0;
+			offset[i] = 0;
+		}
+	}
+	
+	rec_file_options->filename = config->record_file;
+	rec_file_options->nb_data_channels = format->nb_channels;
+	rec_file_options->rate = format->rate;
+	rec_file_options->channel_names = (char*)format->channel_names;
+	rec_file_options->scale = scale;
+	rec_file_options->offset = offset;
+	rec_file_options->raw_codes = (config->sample_format==SAMPLE_INT16);
+	
+}
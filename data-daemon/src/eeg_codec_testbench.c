@@ -0,0 +1,369 @@
+/**
+ * @file eeg_codec_testbench.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Round trip and speed of the lossless codec. Given a recording
+ *        (BINARY output), every block is decoded, encoded again and compared,
+ *        and the index is checked by seeking to every block; without one, a
+ *        Muse-like session of 10 bits codes is synthesized, and a session of
+ *        Muse-like values is recorded and decoded back to its floats.
+ *
+ *        gcc -O2 -fcommon -Iinclude src/eeg_codec_testbench.c src/supported_data_output/eeg_codec.c \
+ *            src/supported_data_output/rec_rd_file.c src/supported_data_output/rec_wrt_file.c \
+ *            src/trace.c src/histogram.c src/clock_sync.c -lm -lpthread
+ *        ./a.out [recording.eegr]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include "eeg_codec.h"
+#include "rec_rd_file.h"
+#include "rec_wrt_file.h"
+#include "stats.h"
+
+#define SYNTH_CHANNELS 4
+#define SYNTH_RATE 220
+#define SYNTH_DURATION 600 /*seconds*/
+#define SYNTH_BLOCK 256
+#define SYNTH_MUSE_STEP ((float)(1682.0/1023)) /*microvolts per code, as muse.c converts*/
+#define SYNTH_OFF_GRID 4 /*channel of codes converted another way, mostly off the grid*/
+#define SYNTH_GAP_START 20000 /*samples missing (nan) in channel 0*/
+#define SYNTH_GAP_LENGTH 50
+#define SYNTH_WRITE_SIZE 100 /*samples given to the writer at a time, not a block*/
+
+/*the writer counts its pages, not published here*/
+static shm_stats_page_t testbench_stats_page;
+shm_stats_page_t* stats_page = &testbench_stats_page;
+
+int test_synthetic_session(void);
+int test_decoded_values(void);
+int test_recording(char* filename);
+double elapsed_s(struct timespec* start);
+
+int main(int argc, char** argv)
+{
+	if(argc>1){
+		return test_recording(argv[1]);
+	}
+
+	return test_synthetic_session()|test_decoded_values();
+}
+
+/**
+ * int test_synthetic_session(void)
+ * @brief 10 minutes of 4 channels of Muse codes: alpha, line noise and a slow
+ *        drift, with the noise of the converter
+ */
+int test_synthetic_session(void){
+
+	int i, c, b, n;
+	int nb_samples = SYNTH_RATE*SYNTH_DURATION;
+	int nb_blocks = (nb_samples+SYNTH_BLOCK-1)/SYNTH_BLOCK;
+	int32_t* codes = (int32_t*)malloc(SYNTH_CHANNELS*nb_samples*sizeof(int32_t));
+	int32_t decoded[SYNTH_BLOCK];
+	uint8_t* encoded = (uint8_t*)malloc(SYNTH_CHANNELS*nb_blocks*EEG_CODEC_MAX_BYTES(SYNTH_BLOCK));
+	int* sizes = (int*)malloc(SYNTH_CHANNELS*nb_blocks*sizeof(int));
+	long total = 0, pos;
+	int errors = 0;
+	double t, encode_s, decode_s;
+	struct timespec start;
+
+	/*channel after channel*/
+	for(c=0;c<SYNTH_CHANNELS;c++){
+		for(i=0;i<nb_samples;i++){
+			t = (double)i/SYNTH_RATE;
+			codes[c*nb_samples+i] = (int32_t)lrint(512+20*sin(2*M_PI*10*t+c)+8*sin(2*M_PI*60*t)+30*sin(2*M_PI*0.05*t)
+			                                       +(rand()%7)-3);
+		}
+	}
+
+	/*encode*/
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(b=0;b<nb_blocks;b++){
+		n = (b==nb_blocks-1)?nb_samples-b*SYNTH_BLOCK:SYNTH_BLOCK;
+		for(c=0;c<SYNTH_CHANNELS;c++){
+			sizes[b*SYNTH_CHANNELS+c] = eeg_codec_encode(&(codes[c*nb_samples+b*SYNTH_BLOCK]), n, &(encoded[total]));
+			total += sizes[b*SYNTH_CHANNELS+c];
+		}
+	}
+	encode_s = elapsed_s(&start);
+
+	/*decode and compare*/
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pos = 0;
+	for(b=0;b<nb_blocks;b++){
+		n = (b==nb_blocks-1)?nb_samples-b*SYNTH_BLOCK:SYNTH_BLOCK;
+		for(c=0;c<SYNTH_CHANNELS;c++){
+			if(eeg_codec_decode(&(encoded[pos]), sizes[b*SYNTH_CHANNELS+c], decoded, n)!=sizes[b*SYNTH_CHANNELS+c] ||
+			   memcmp(decoded, &(codes[c*nb_samples+b*SYNTH_BLOCK]), n*sizeof(int32_t))!=0){
+				errors++;
+			}
+			pos += sizes[b*SYNTH_CHANNELS+c];
+		}
+	}
+	decode_s = elapsed_s(&start);
+
+	printf("\n\n");
+	printf("*************************\n");
+	printf("Synthetic session        \n");
+	printf("*************************\n");
+	printf("Samples: %i x %i channels\n", nb_samples, SYNTH_CHANNELS);
+	printf("Encoded: %li bytes, %.2f bits/sample\n", total, 8.0*total/nb_samples/SYNTH_CHANNELS);
+	printf("Ratio vs float32: %.2f:1\n", (double)nb_samples*SYNTH_CHANNELS*sizeof(float)/total);
+	printf("Encode: %.1f MB/s of float32\n", nb_samples*SYNTH_CHANNELS*sizeof(float)/encode_s/1e6);
+	printf("Decode: %.1f MB/s of float32\n", nb_samples*SYNTH_CHANNELS*sizeof(float)/decode_s/1e6);
+	printf("Round trip errors: %i\n", errors);
+
+	free(codes);
+	free(encoded);
+	free(sizes);
+
+	return errors?1:0;
+}
+
+/**
+ * int test_decoded_values(void)
+ * @brief Records a session of Muse-like values, 10 bits codes converted to
+ *        microvolts as muse.c does, with a channel converted another way and a
+ *        gap in another, then decodes it and compares the floats to the input,
+ *        to the bit. Only the values that their code gives back exactly are
+ *        stored as codes, the others as floats.
+ */
+int test_decoded_values(void){
+
+	int i, c, n;
+	int code;
+	int nb_channels = SYNTH_CHANNELS+1;
+	int nb_samples = SYNTH_RATE*SYNTH_DURATION;
+	float* values = (float*)malloc(nb_channels*nb_samples*sizeof(float));
+	float decoded[EEG_CODEC_MAX_SAMPLES*(SYNTH_CHANNELS+1)];
+	float scale[SYNTH_CHANNELS+1];
+	float offset[SYNTH_CHANNELS+1];
+	char filename[] = "/tmp/eeg_codec_testbench_XXXXXX";
+	double t;
+	long nb_decoded = 0, nb_blocks = 0, nb_coded_blocks = 0, nb_float_blocks = 0;
+	int errors = 0;
+	int fd;
+	rec_file_options_t options;
+	data_block_t data_block;
+	rec_wrt_t* rec_wrt;
+	rec_rd_t* rec_rd;
+	rec_rd_block_t block;
+
+	fd = mkstemp(filename);
+	if(fd<0){
+		perror("mkstemp");
+		free(values);
+		return 1;
+	}
+	close(fd);
+
+	for(c=0;c<nb_channels;c++){
+		scale[c] = SYNTH_MUSE_STEP;
+		offset[c] = 0;
+	}
+
+	/*sample after sample, as the daemon gives them*/
+	for(i=0;i<nb_samples;i++){
+		t = (double)i/SYNTH_RATE;
+		for(c=0;c<nb_channels;c++){
+			code = (int)lrint(512+20*sin(2*M_PI*10*t+c)+8*sin(2*M_PI*60*t)+30*sin(2*M_PI*0.05*t)+(rand()%7)-3);
+			values[i*nb_channels+c] = (c==SYNTH_OFF_GRID)?(float)code/1023*1682:(float)code*SYNTH_MUSE_STEP;
+		}
+	}
+	for(i=SYNTH_GAP_START;i<SYNTH_GAP_START+SYNTH_GAP_LENGTH;i++){
+		values[i*nb_channels] = NAN;
+	}
+
+	/*record*/
+	memset(&options, 0, sizeof(rec_file_options_t));
+	options.filename = filename;
+	options.nb_data_channels = nb_channels;
+	options.rate = SYNTH_RATE;
+	options.scale = scale;
+	options.offset = offset;
+
+	rec_wrt = (rec_wrt_t*)rec_wrt_init(&options);
+	if(rec_wrt==NULL){
+		free(values);
+		unlink(filename);
+		return 1;
+	}
+
+	memset(&data_block, 0, sizeof(data_block_t));
+	data_block.nb_data = nb_channels;
+	for(i=0;i<nb_samples;i+=n){
+		n = (nb_samples-i<SYNTH_WRITE_SIZE)?nb_samples-i:SYNTH_WRITE_SIZE;
+		data_block.nb_samples = n;
+		data_block.ptr = &(values[i*nb_channels]);
+		data_block.first_sample = i;
+		rec_wrt_write_block_in_buf(rec_wrt, &data_block);
+	}
+	rec_wrt_cleanup(rec_wrt);
+
+	/*decode and compare to the input, nan included*/
+	rec_rd = rec_rd_open(filename);
+	if(rec_rd==NULL){
+		free(values);
+		unlink(filename);
+		return 1;
+	}
+
+	while(rec_rd_next_block(rec_rd, &block)){
+
+		n = rec_rd_decode_block(rec_rd, &block, decoded);
+		if(n<0 || block.header->first_sample+n>(uint64_t)nb_samples){
+			errors++;
+			break;
+		}
+
+		if(memcmp(decoded, &(values[block.header->first_sample*nb_channels]), n*nb_channels*sizeof(float))!=0){
+			errors++;
+		}
+
+		for(c=0;c<nb_channels;c++){
+			if(block.header->float_channels&((uint64_t)1<<c)){
+				nb_float_blocks++;
+			} else {
+				nb_coded_blocks++;
+			}
+		}
+
+		nb_decoded += n;
+		nb_blocks++;
+	}
+
+	/*the grid of muse.c must be the one of the recording, only the gap is off*/
+	if(nb_decoded!=nb_samples || nb_coded_blocks<nb_blocks*SYNTH_CHANNELS-1){
+		errors++;
+	}
+
+	printf("\n\n");
+	printf("*************************\n");
+	printf("Decoded values           \n");
+	printf("*************************\n");
+	printf("Samples: %li of %i x %i channels\n", nb_decoded, nb_samples, nb_channels);
+	printf("Ratio vs float32: %.2f:1\n", (double)nb_samples*nb_channels*sizeof(float)/rec_rd->size);
+	printf("Channel blocks stored as codes: %li, as floats: %li\n", nb_coded_blocks, nb_float_blocks);
+	printf("Decode errors: %i\n", errors);
+
+	rec_rd_close(rec_rd);
+	unlink(filename);
+	free(values);
+
+	return errors?1:0;
+}
+
+/**
+ * int test_recording(char* filename)
+ * @brief Decodes a recording, block after block, encodes it again and checks
+ *        that the payload is unchanged. Then seeks to every indexed block,
+ *        by sample and by time, and to the middle of every block.
+ */
+int test_recording(char* filename){
+
+	int c;
+	int nb_bytes;
+	int errors = 0, seek_errors = 0;
+	long nb_samples = 0, nb_coded = 0, nb_seeks = 0;
+	double decode_s = 0, encode_s = 0, seek_s = 0;
+	struct timespec start;
+	rec_rd_t* rec_rd;
+	rec_rd_block_t block;
+	rec_rd_block_t found;
+	uint8_t encoded[EEG_CODEC_MAX_BYTES(EEG_CODEC_MAX_SAMPLES)];
+	int32_t decoded[EEG_CODEC_MAX_SAMPLES];
+	uint32_t pos;
+	uint64_t target;
+
+	rec_rd = rec_rd_open(filename);
+	if(rec_rd==NULL){
+		return 1;
+	}
+
+	while(rec_rd_next_block(rec_rd, &block)){
+
+		pos = 0;
+		for(c=0;c<(int)rec_rd->header->nb_channels;c++){
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			nb_bytes = eeg_codec_decode(&(block.payload[pos]), block.header->payload_size-pos, decoded, block.header->nb_samples);
+			decode_s += elapsed_s(&start);
+
+			if(nb_bytes<0){
+				errors++;
+				break;
+			}
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			if(eeg_codec_encode(decoded, block.header->nb_samples, encoded)!=nb_bytes ||
+			   memcmp(encoded, &(block.payload[pos]), nb_bytes)!=0){
+				errors++;
+			}
+			encode_s += elapsed_s(&start);
+
+			if(!(block.header->float_channels&((uint64_t)1<<c))){
+				nb_coded += block.header->nb_samples;
+			}
+			pos += nb_bytes;
+		}
+
+		nb_samples += block.header->nb_samples;
+	}
+
+	/*random access, each seek must land on the block holding the sample*/
+	rec_rd_seek_sample(rec_rd, 0);
+	while(rec_rd_next_block(rec_rd, &block)){
+
+		target = block.header->first_sample+block.header->nb_samples/2;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if(rec_rd_seek_sample(rec_rd, target)<0 || !rec_rd_next_block(rec_rd, &found) || found.header!=block.header){
+			seek_errors++;
+		}
+		if(block.header->timestamp_ns &&
+		   (rec_rd_seek_time(rec_rd, block.header->timestamp_ns)<0 || !rec_rd_next_block(rec_rd, &found) ||
+		    found.header!=block.header)){
+			seek_errors++;
+		}
+		seek_s += elapsed_s(&start);
+		nb_seeks++;
+
+		/*back after the block*/
+		rec_rd_seek_sample(rec_rd, block.header->first_sample+block.header->nb_samples);
+	}
+
+	printf("\n\n");
+	printf("*************************\n");
+	printf("Recording %s\n", filename);
+	printf("*************************\n");
+	printf("Samples: %li x %i channels (%li values coded)\n", nb_samples, rec_rd->header->nb_channels, nb_coded);
+	printf("Index: %lu entries%s\n", (unsigned long)rec_rd->nb_entries, rec_rd->index_rebuilt?", rebuilt (no footer)":"");
+	printf("Ratio vs float32: %.2f:1\n", (double)nb_samples*rec_rd->header->nb_channels*sizeof(float)/rec_rd->size);
+	printf("Encode: %.1f MB/s of float32\n", nb_samples*rec_rd->header->nb_channels*sizeof(float)/encode_s/1e6);
+	printf("Decode: %.1f MB/s of float32\n", nb_samples*rec_rd->header->nb_channels*sizeof(float)/decode_s/1e6);
+	printf("Seek: %.2f us\n", nb_seeks?seek_s/nb_seeks*1e6:0);
+	printf("Round trip errors: %i\n", errors);
+	printf("Seek errors: %i\n", seek_errors);
+
+	rec_rd_close(rec_rd);
+
+	return (errors||seek_errors)?1:0;
+}
+
+/**
+ * double elapsed_s(struct timespec* start)
+ * @brief Seconds since start
+ */
+double elapsed_s(struct timespec* start){
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec-start->tv_sec)+(now.tv_nsec-start->tv_nsec)*1e-9;
+}
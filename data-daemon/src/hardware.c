@@ -22,6 +22,9 @@
 #include "muse.h"
 #include "fake_muse.h"
 #include "openbci.h"
+#include "merge.h"
+#include "replay.h"
+#include "xml.h"
 
 /**
  * init_hardware()
@@ -76,6 +79,28 @@ int init_hardware(char *hardware_type)
 		_DEVICE_CONNECTION_FC = &fake_muse_connect_dev;
 		_DEVICE_CLEANUP_FC = &fake_muse_cleanup;
 
+	/*Merge of the streams of several data interfaces*/
+	} else if (strcmp(hardware_type, "MERGE") == 0) {
+
+		_INIT_HARDWARE_FC = &merge_init_hardware;
+		_KEEP_ALIVE_FC = &merge_send_keep_alive_pkt;
+		_SEND_PKT_FC = &merge_send_pkt;
+		_RECV_PKT_FC = &merge_read_pkt;
+		_TRANS_PKT_FC = &merge_translate_pkt;
+		_PROCESS_PKT_FC = &merge_process_pkt;
+		_DEVICE_CONNECTION_FC = &merge_connect_dev;
+		_DEVICE_CLEANUP_FC = &merge_cleanup;
+
+	/*Replay of a captured session, the decoder is set by the capture*/
+	} else if (strcmp(hardware_type, "REPLAY") == 0) {
+
+		_INIT_HARDWARE_FC = &replay_init_hardware;
+		_KEEP_ALIVE_FC = &replay_send_keep_alive_pkt;
+		_SEND_PKT_FC = &replay_send_pkt;
+		_RECV_PKT_FC = &replay_read_pkt;
+		_DEVICE_CONNECTION_FC = &replay_connect_dev;
+		_DEVICE_CLEANUP_FC = &replay_cleanup;
+
 	} else {
 		fprintf(stderr, "Unknown hardware type\n");
 		return (-1);
@@ -84,3 +109,165 @@ int init_hardware(char *hardware_type)
 	/*init the hardware and return*/
 	return INIT_HARDWARE_FC();
 }
+
+/**
+ * get_hardware_source()
+ * @brief Hardware producing the samples, the device of the capture for a
+ *        replay
+ * @param hardware_type
+ * @return the hardware type of the samples
+ */
+char *get_hardware_source(char *hardware_type)
+{
+	if (strcmp(hardware_type, "REPLAY") == 0) {
+		return replay_get_device();
+	}
+
+	return hardware_type;
+}
+
+/**
+ * get_hardware_sampling_rate()
+ * @brief Nominal sampling rate of the hardware
+ * @param hardware_type
+ * @return the rate in Hz, -1 for unknown type
+ */
+int get_hardware_sampling_rate(char *hardware_type)
+{
+	hardware_type = get_hardware_source(hardware_type);
+
+	if (strcmp(hardware_type, "MUSE") == 0) {
+		return MUSE_SAMPLING_RATE;
+	} else if (strcmp(hardware_type, "OPENBCI") == 0) {
+		return OPENBCI_SAMPLING_RATE;
+	} else if (strcmp(hardware_type, "FAKE_MUSE") == 0) {
+		return FAKE_MUSE_SAMPLING_RATE;
+	} else if (strcmp(hardware_type, "MERGE") == 0) {
+		return get_appconfig()->merge_rate;
+	}
+
+	return (-1);
+}
+
+/**
+ * get_hardware_keep_alive_period()
+ * @brief Period of the keep alive the hardware needs
+ * @param hardware_type
+ * @return the period in ms, 0 for none
+ */
+int get_hardware_keep_alive_period(char *hardware_type)
+{
+	if (strcmp(hardware_type, "MUSE") == 0) {
+		return MUSE_KEEP_ALIVE_PERIOD_MS;
+	}
+
+	return (0);
+}
+
+/**
+ * get_hardware_channel_name()
+ * @brief Name of a channel of the hardware
+ * @param hardware_type
+ * @param channel, index of the channel
+ * @param (out)name, the name
+ * @param length, size of name
+ * @return 0 for success, -1 for unknown type
+ */
+int get_hardware_channel_name(char *hardware_type, int channel, char *name, int length)
+{
+	const char *muse_channel_names[] = MUSE_CHANNEL_NAMES;
+	appconfig_t *config;
+	int i;
+
+	hardware_type = get_hardware_source(hardware_type);
+
+	if (strcmp(hardware_type, "MUSE") == 0 || strcmp(hardware_type, "FAKE_MUSE") == 0) {
+
+		if (channel < MUSE_NB_CHANNELS) {
+			snprintf(name, length, "%s", muse_channel_names[channel]);
+		} else {
+			snprintf(name, length, "CH%d", channel+1);
+		}
+
+	} else if (strcmp(hardware_type, "OPENBCI") == 0) {
+
+		snprintf(name, length, "CH%d", channel+1);
+
+	/*channels of the sources, followed by the validity mask*/
+	} else if (strcmp(hardware_type, "MERGE") == 0) {
+
+		config = get_appconfig();
+		snprintf(name, length, "VALID");
+		for (i = 0; i < config->nb_merge_sources; i++) {
+			if (channel < config->merge_sources[i].nb_data_channels) {
+				snprintf(name, length, "S%d.CH%d", i+1, channel+1);
+				break;
+			}
+			channel -= config->merge_sources[i].nb_data_channels;
+		}
+
+	} else {
+		return (-1);
+	}
+
+	return (0);
+}
+
+/**
+ * get_hardware_range()
+ * @brief Range of the values of a channel, as written in the output
+ * @param hardware_type
+ * @param channel, index of the channel
+ * @param (out)min, lowest value
+ * @param (out)max, highest value
+ * @param (out)lsb, step between two values
+ * @return 0 for success, -1 if the range is unknown
+ */
+int get_hardware_range(char *hardware_type, int channel, float *min, float *max, float *lsb)
+{
+	hardware_type = get_hardware_source(hardware_type);
+
+	if (strcmp(hardware_type, "MUSE") == 0 || strcmp(hardware_type, "FAKE_MUSE") == 0) {
+
+		if (channel >= MUSE_NB_CHANNELS) {
+			return (-1);
+		}
+		*min = 0;
+		*max = MUSE_FULL_SCALE;
+		*lsb = MUSE_CODE_STEP;
+
+	} else if (strcmp(hardware_type, "OPENBCI") == 0) {
+
+		if (channel >= OPENBCI_NB_EEG_CHANNELS) {
+			return (-1);
+		}
+		*min = -OPENBCI_FULL_SCALE;
+		*max = OPENBCI_FULL_SCALE;
+		*lsb = OPENBCI_FULL_SCALE/OPENBCI_ADC_MAX;
+
+	/*the sources may be anything*/
+	} else {
+		return (-1);
+	}
+
+	return (0);
+}
+
+/**
+ * get_hardware_drl_ref()
+ * @brief Last DRL/REF values of the hardware, when it reports them
+ * @param hardware_type
+ * @param (out)drl, driven right leg
+ * @param (out)ref, reference
+ * @return 0 for success, -1 if unavailable
+ */
+int get_hardware_drl_ref(char *hardware_type, float *drl, float *ref)
+{
+	hardware_type = get_hardware_source(hardware_type);
+
+	if (strcmp(hardware_type, "MUSE") == 0) {
+		return muse_get_drl_ref(drl, ref);
+	}
+
+	return (-1);
+}
@@ -0,0 +1,146 @@
+/**
+ * @file histogram.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Log-linear histogram of durations. A value below 2^HISTOGRAM_SUB_BITS
+ *        has its own bucket, above, the bucket is given by the position of the
+ *        most significant bit and the HISTOGRAM_SUB_BITS bits that follow it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "histogram.h"
+
+static int histogram_index(uint64_t value);
+static uint64_t histogram_bucket_value(int index);
+
+/**
+ * void histogram_init(histogram_t* histogram)
+ * @brief Empties the histogram
+ * @param histogram
+ */
+void histogram_init(histogram_t* histogram){
+
+	memset(histogram, 0, sizeof(histogram_t));
+	histogram->min = UINT64_MAX;
+}
+
+/**
+ * void histogram_record(histogram_t* histogram, int64_t value)
+ * @brief Counts a value, the negative values count as 0
+ * @param histogram
+ * @param value
+ */
+void histogram_record(histogram_t* histogram, int64_t value){
+
+	uint64_t v = value>0 ? (uint64_t)value : 0;
+
+	histogram->buckets[histogram_index(v)]++;
+	histogram->count++;
+	histogram->sum += v;
+
+	if(v<histogram->min){
+		histogram->min = v;
+	}
+	if(v>histogram->max){
+		histogram->max = v;
+	}
+}
+
+/**
+ * void histogram_merge(histogram_t* histogram, const histogram_t* other)
+ * @brief Adds the counts of another histogram
+ * @param histogram
+ * @param other
+ */
+void histogram_merge(histogram_t* histogram, const histogram_t* other){
+
+	int i;
+
+	for(i=0;i<HISTOGRAM_NB_BUCKETS;i++){
+		histogram->buckets[i] += other->buckets[i];
+	}
+	histogram->count += other->count;
+	histogram->sum += other->sum;
+
+	if(other->min<histogram->min){
+		histogram->min = other->min;
+	}
+	if(other->max>histogram->max){
+		histogram->max = other->max;
+	}
+}
+
+/**
+ * uint64_t histogram_percentile(const histogram_t* histogram, double percentile)
+ * @brief Value under which the percentile of the counts fall, the highest
+ *        value of its bucket (never above the maximum recorded)
+ * @param histogram
+ * @param percentile, 0-100
+ * @return the value, 0 if the histogram is empty
+ */
+uint64_t histogram_percentile(const histogram_t* histogram, double percentile){
+
+	int i;
+	uint64_t rank, total = 0;
+	uint64_t value;
+
+	if(histogram->count==0){
+		return 0;
+	}
+
+	/*rank of the count, from 1*/
+	rank = (uint64_t)(percentile/100.0*histogram->count+0.5);
+	if(rank<1){
+		rank = 1;
+	}
+	if(rank>histogram->count){
+		rank = histogram->count;
+	}
+
+	for(i=0;i<HISTOGRAM_NB_BUCKETS;i++){
+		total += histogram->buckets[i];
+		if(total>=rank){
+			break;
+		}
+	}
+
+	value = histogram_bucket_value(i);
+	return value<histogram->max ? value : histogram->max;
+}
+
+/**
+ * int histogram_index(uint64_t value)
+ * @brief Bucket of a value
+ */
+static int histogram_index(uint64_t value){
+
+	int msb;
+
+	if(value<HISTOGRAM_SUB_BUCKETS){
+		return (int)value;
+	}
+
+	msb = 63-__builtin_clzll(value);
+	return (msb-HISTOGRAM_SUB_BITS+1)*HISTOGRAM_SUB_BUCKETS+
+	       (int)((value>>(msb-HISTOGRAM_SUB_BITS))&(HISTOGRAM_SUB_BUCKETS-1));
+}
+
+/**
+ * uint64_t histogram_bucket_value(int index)
+ * @brief Highest value of a bucket
+ */
+static uint64_t histogram_bucket_value(int index){
+
+	int shift;
+	uint64_t low;
+
+	if(index<HISTOGRAM_SUB_BUCKETS){
+		return (uint64_t)index;
+	}
+
+	shift = index/HISTOGRAM_SUB_BUCKETS-1;
+	low = (uint64_t)(HISTOGRAM_SUB_BUCKETS+index%HISTOGRAM_SUB_BUCKETS)<<shift;
+	return low+((uint64_t)1<<shift)-1;
+}
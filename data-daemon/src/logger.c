@@ -0,0 +1,279 @@
+/**
+ * @file logger.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Logging of the data path. The ring has many writers and one reader:
+ *        each slot carries a sequence number, a writer claims a slot by
+ *        moving the head and publishes it by moving the sequence of the slot,
+ *        the reader frees it by moving the sequence one lap ahead. The
+ *        sequences are kept less the index of their slot, the ring starts
+ *        free at zero.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "clock_sync.h"
+#include "logger.h"
+
+typedef struct logger_slot_s {
+	uint64_t sequence; /*less the index: position + 1 once written, position + LOGGER_RING_SIZE once read*/
+	int64_t ns;
+	int32_t message;
+	int32_t args[LOGGER_NB_ARGS];
+} logger_slot_t;
+
+/*text of a message, with LOGGER_NB_ARGS %d at most*/
+typedef struct logger_format_s {
+	int priority; /*of syslog*/
+	const char* name;
+	const char* text;
+} logger_format_t;
+
+/*coalescing of a message, in the current period*/
+typedef struct logger_window_s {
+	int64_t start_ns;
+	uint64_t nb_written;
+	uint64_t nb_coalesced;
+	int32_t last_args[LOGGER_NB_ARGS];
+} logger_window_t;
+
+static const logger_format_t logger_formats[LOGGER_NB_MESSAGES] = {
+	{ LOG_WARNING, "samples_dropped", "Samples were dropped by the hardware: %d" },
+	{ LOG_WARNING, "preparse_error", "Pre-Parsing error at byte %d: 0x%02x" },
+	{ LOG_ERR, "bit_length_mismatch", "Error parsing compressed packet, expected_bits_length: %d, parsed_bits_length: %d" },
+	{ LOG_WARNING, "packet_too_small", "Invalid packet - too small: %d bytes" },
+	{ LOG_WARNING, "merge_no_timestamp", "Merge: page without timestamp from source %d, skipped" },
+	{ LOG_ERR, "merge_bad_format", "Merge: source %d publishes sample_format %d, only FLOAT32 is merged, source ignored" },
+	{ LOG_ERR, "merge_bad_channels", "Merge: source %d publishes %d channels, %d configured, source ignored" },
+	{ LOG_ERR, "merge_bad_layout", "Merge: ring of source %d is %d bytes, %d expected from window_size and nb_pages, source ignored" },
+	{ LOG_WARNING, "link_stalled", "No data from the device for %d ms, reconnecting" },
+	{ LOG_WARNING, "link_hung_up", "The device hung up (errno %d), reconnecting" },
+	{ LOG_WARNING, "link_restored", "Link restored after %d ms and %d attempts, %d samples filled" },
+	{ LOG_INFO, "link_closed", "Socket %d closed" }
+};
+
+static logger_slot_t logger_ring[LOGGER_RING_SIZE];
+static uint64_t logger_head = 0; /*next position claimed by a writer*/
+static uint64_t logger_tail = 0; /*next position read, by the logger only*/
+static uint64_t logger_nb_lost = 0;
+
+static logger_window_t logger_windows[LOGGER_NB_MESSAGES];
+static logger_output_t logger_output = LOGGER_STDERR;
+static int64_t logger_start_ns = 0;
+static int64_t logger_lost_ns = 0; /*last count of the lost records*/
+
+static pthread_t logger_thread;
+static volatile char logger_running = 0;
+
+static void* logger_run(void* param);
+static void logger_drain(char flush);
+static void logger_write(int priority, const char* name, int64_t ns, const char* text);
+
+/**
+ * logger_init(appconfig_t* config)
+ * @brief Starts the logger, the records pushed so far are written
+ * @param config, for <log_output>
+ * @return 0 for success, -1 for error
+ */
+int logger_init(appconfig_t* config)
+{
+	logger_output = (logger_output_t)config->log_output;
+	logger_start_ns = clock_sync_now_ns();
+	if (logger_output == LOGGER_SYSLOG) {
+		openlog("data_interface", LOG_PID, LOG_DAEMON);
+	}
+
+	logger_running = 1;
+	if (pthread_create(&logger_thread, NULL, &logger_run, NULL) != 0) {
+		printf("Unable to start the logger\n");
+		logger_running = 0;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/**
+ * logger_record(logger_message_t message, int32_t arg0, int32_t arg1, int32_t arg2)
+ * @brief Pushes a record in the ring, never waits. Called through
+ *        LOGGER_RECORD, from any thread.
+ * @param message
+ * @param arg0-arg2, of the text of the message
+ */
+void logger_record(logger_message_t message, int32_t arg0, int32_t arg1, int32_t arg2)
+{
+	uint64_t position, index, sequence;
+	int64_t diff;
+	logger_slot_t* slot;
+
+	position = __atomic_load_n(&logger_head, __ATOMIC_RELAXED);
+	for (;;) {
+		index = position&(LOGGER_RING_SIZE-1);
+		slot = &(logger_ring[index]);
+		sequence = __atomic_load_n(&(slot->sequence), __ATOMIC_ACQUIRE)+index;
+		diff = (int64_t)(sequence-position);
+
+		/*free, claimed if no other writer took it first*/
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&logger_head, &position, position+1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		/*not read yet, the ring is full*/
+		} else if (diff < 0) {
+			__atomic_fetch_add(&logger_nb_lost, 1, __ATOMIC_RELAXED);
+			return;
+		} else {
+			position = __atomic_load_n(&logger_head, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->ns = clock_sync_now_ns();
+	slot->message = message;
+	slot->args[0] = arg0;
+	slot->args[1] = arg1;
+	slot->args[2] = arg2;
+	__atomic_store_n(&(slot->sequence), position+1-index, __ATOMIC_RELEASE);
+}
+
+/**
+ * logger_cleanup()
+ * @brief Stops the logger, after writing the records left
+ */
+void logger_cleanup(void)
+{
+	if (!logger_running) {
+		return;
+	}
+
+	logger_running = 0;
+	pthread_join(logger_thread, NULL);
+
+	/*with the coalesced counts of the periods in progress*/
+	logger_drain(1);
+
+	if (logger_output == LOGGER_SYSLOG) {
+		closelog();
+	}
+}
+
+/**
+ * logger_run(void* param)
+ * @brief Logger: drains the ring every LOGGER_DRAIN_PERIOD_MS
+ */
+static void* logger_run(void* param __attribute__ ((unused)))
+{
+	struct timespec period = { 0, LOGGER_DRAIN_PERIOD_MS*1000000 };
+
+	while (logger_running) {
+		logger_drain(0);
+		nanosleep(&period, NULL);
+	}
+
+	return NULL;
+}
+
+/**
+ * logger_drain(char flush)
+ * @brief Writes the records of the ring, LOGGER_BURST per message and per
+ *        period, then the counts of the periods that ended
+ * @param flush, ends all the periods
+ */
+static void logger_drain(char flush)
+{
+	int i;
+	uint64_t index, nb_lost;
+	int64_t now_ns;
+	char text[256];
+	char coalesced[320];
+	logger_slot_t* slot;
+	logger_window_t* window;
+	const logger_format_t* format;
+
+	for (;;) {
+
+		index = logger_tail&(LOGGER_RING_SIZE-1);
+		slot = &(logger_ring[index]);
+		if (__atomic_load_n(&(slot->sequence), __ATOMIC_ACQUIRE)+index != logger_tail+1) {
+			break;
+		}
+
+		if (slot->message >= 0 && slot->message < LOGGER_NB_MESSAGES) {
+
+			format = &(logger_formats[slot->message]);
+			window = &(logger_windows[slot->message]);
+
+			/*first record of a period*/
+			if (window->nb_written == 0 && window->nb_coalesced == 0) {
+				window->start_ns = slot->ns;
+			}
+
+			if (window->nb_written < LOGGER_BURST) {
+				snprintf(text, sizeof(text), format->text, slot->args[0], slot->args[1], slot->args[2]);
+				logger_write(format->priority, format->name, slot->ns, text);
+				window->nb_written++;
+			} else {
+				window->nb_coalesced++;
+				memcpy(window->last_args, slot->args, sizeof(window->last_args));
+			}
+		}
+
+		__atomic_store_n(&(slot->sequence), logger_tail+LOGGER_RING_SIZE-index, __ATOMIC_RELEASE);
+		logger_tail++;
+	}
+
+	/*periods that ended, the coalesced records are counted with the last one*/
+	now_ns = clock_sync_now_ns();
+	for (i = 0; i < LOGGER_NB_MESSAGES; i++) {
+
+		window = &(logger_windows[i]);
+		if ((window->nb_written == 0 && window->nb_coalesced == 0) ||
+		    (!flush && now_ns-window->start_ns < (int64_t)LOGGER_PERIOD_MS*1000000)) {
+			continue;
+		}
+
+		if (window->nb_coalesced > 0) {
+			format = &(logger_formats[i]);
+			snprintf(text, sizeof(text), format->text, window->last_args[0], window->last_args[1], window->last_args[2]);
+			snprintf(coalesced, sizeof(coalesced), "%s (%llu more in %dms)", text,
+			         (unsigned long long)window->nb_coalesced, LOGGER_PERIOD_MS);
+			logger_write(format->priority, format->name, now_ns, coalesced);
+		}
+
+		memset(window, 0, sizeof(logger_window_t));
+	}
+
+	/*the lost records are counted over a period too*/
+	if (!flush && now_ns-logger_lost_ns < (int64_t)LOGGER_PERIOD_MS*1000000) {
+		return;
+	}
+	nb_lost = __atomic_exchange_n(&logger_nb_lost, 0, __ATOMIC_RELAXED);
+	if (nb_lost > 0) {
+		logger_lost_ns = now_ns;
+		snprintf(text, sizeof(text), "%llu records lost, the ring was full", (unsigned long long)nb_lost);
+		logger_write(LOG_WARNING, "logger", now_ns, text);
+	}
+}
+
+/**
+ * logger_write(int priority, const char* name, int64_t ns, const char* text)
+ * @brief Writes a line, with the level, the time since the start and the
+ *        name of the message
+ * @param priority, of syslog
+ * @param name
+ * @param ns, host time of the record
+ * @param text
+ */
+static void logger_write(int priority, const char* name, int64_t ns, const char* text)
+{
+	if (logger_output == LOGGER_SYSLOG) {
+		syslog(priority, "%s: %s", name, text);
+		return;
+	}
+
+	fprintf(stderr, "%.3f %s %s: %s\n", (ns-logger_start_ns)/1e9,
+	        priority == LOG_ERR ? "error" : (priority == LOG_INFO ? "info" : "warning"), name, text);
+}
@@ -26,6 +26,12 @@
 #include "xml.h"
 #include "ipc_status_comm.h"
 #include "debug.h"
+#include "trace.h"
+#include "stats.h"
+#include "perf_counters.h"
+#include "logger.h"
+#include "connection.h"
+#include "timer_wheel.h"
 
 #define CONFIG_NAME "config/data_config.xml"
 
@@ -66,12 +72,17 @@ void* dataout_interface;
 int main(int argc __attribute__ ((unused)), char **argv __attribute__ ((unused)))
 {
 	param_t param_ptr = { 0 };
-	pthread_t readT, writeT;
-	int iret1 __attribute__ ((unused)), iret2 __attribute__ ((unused)), ret = 0, attempts = 0;
+	pthread_t readT;
+	conn_t pairing;
+	wheel_timer_t keep_alive_timer;
+	int iret1 __attribute__ ((unused)), ret = 0, attempts = 0, keep_alive_ms;
 
 	/*Set up ctrl c signal handler*/
 	(void)signal(SIGINT, ctrl_c_handler);
 
+	/*a link lost while writing is seen by the reader, not as a signal*/
+	(void)signal(SIGPIPE, SIG_IGN);
+
 	/*read the config from the xml*/
 	appconfig_t *config = (appconfig_t *) xml_initialize(which_config(argc, argv));
 	if (config == NULL) {
@@ -79,6 +90,37 @@ int main(int argc __attribute__ ((unused)), char **argv __attribute__ ((unused))
 		return (-1);
 	}
 	
+	/*messages of the data path, written off the reading thread*/
+	if (logger_init(config) < 0) {
+		printf("Error initializing the logger\n");
+		return (-1);
+	}
+
+	/*latency tracing, the latencies are printed on SIGUSR1*/
+	if (trace_init(config->trace) < 0) {
+		printf("Error initializing the tracing\n");
+		return (-1);
+	}
+	(void)signal(SIGUSR1, trace_dump_handler);
+
+	/*periodic tasks, run by the thread reading the hardware*/
+	if (timer_wheel_init() < 0) {
+		printf("Error initializing the timer wheel\n");
+		return (-1);
+	}
+
+	/*runtime statistics, read by datactl*/
+	if (stats_init(config) < 0) {
+		printf("Error initializing the statistics\n");
+		return (-1);
+	}
+
+	/*hardware counters of the decoder, published with the statistics*/
+	if (perf_init(config->perf_counters) < 0) {
+		printf("Error initializing the hardware counters\n");
+		return (-1);
+	}
+
 	/*init inter-process status communication channel*/
 	ipc_comm.sem_key=config->sem_key;
 	ipc_comm_init(&ipc_comm);
@@ -101,18 +143,28 @@ int main(int argc __attribute__ ((unused)), char **argv __attribute__ ((unused))
 	output_interface_array.output_interface = (void**)malloc(sizeof(void*)*1);
 	output_interface_array.output_interface[0] = dataout_interface;
 	
-	/*will try to pair indefinitely*/
+	/*will try to pair indefinitely, the attempts are spaced by a backoff*/
 	param_ptr.ptr = (void *)get_appconfig()->remote_addr;
+	conn_init(&pairing, config);
 	for (;;) {
 		
 		printf("Data interface->Searching for hardware...\n");
 		
 		attempts++;
+		STATS_ADD(connect_attempts, 1);
 		
 		if ((ret = DEVICE_CONNECTION_FC(&param_ptr)) == 0){
+			STATS_ADD(connections, 1);
 			break;
 		}
-		sleep(1);
+		conn_failed(&pairing);
+		conn_wait_retry(&pairing);
+
+		/*Ctrl C while pairing*/
+		if (timer_wheel_stopped()) {
+			app_cleanup();
+			return 0;
+		}
 	}
 	printf("Data interface->Hardware found...\n");
 	
@@ -122,17 +174,21 @@ int main(int argc __attribute__ ((unused)), char **argv __attribute__ ((unused))
 	/*if everything is fine so far*/
 	if (ret == 0) {
 
+		/*if keep_alive, sent from the thread reading the hardware*/
+		keep_alive_ms = get_hardware_keep_alive_period((char *)config->device);
+		if (get_appconfig()->keep_alive && keep_alive_ms > 0) {
+			timer_wheel_add(&keep_alive_timer, keep_alive_ms, keep_alive_ms, _KEEP_ALIVE_FC, NULL);
+		}
+
 		/*init the thread that picks up the bluetooth packets*/
 		iret1 = pthread_create(&readT, NULL, (void *)_RECV_PKT_FC, (void*)&output_interface_array);
-
-		/*if keep_alive*/
-		if (get_appconfig()->keep_alive) {
-			/*init the thread that implements the watchdog*/
-			iret2 = pthread_create(&writeT, NULL, (void *)_KEEP_ALIVE_FC, NULL);
-			pthread_join(writeT, NULL);
-		}
+		stats_set_read_thread(readT);
 		pthread_join(readT, NULL);
 
+		/*the hardware stopped by itself (end of a replay) or the reading
+		  thread returned on Ctrl C, nothing runs the wheel anymore*/
+		app_cleanup();
+
 	} else {
 		printf("Unable to connect to hardware\n");
 	}
@@ -147,8 +203,13 @@ void app_cleanup(void)
 	printf("Cleaning up!\n");
 	fflush(stdout);
 	/*clean up*/
+	trace_cleanup();
+	perf_cleanup();
+	stats_cleanup();
+	timer_wheel_cleanup();
 	ipc_comm_cleanup(&ipc_comm);
 	DEVICE_CLEANUP_FC();
 	TERMINATE_DATA_OUTPUT_FC(dataout_interface);
 	free(output_interface_array.output_interface);
+	logger_cleanup();
 }
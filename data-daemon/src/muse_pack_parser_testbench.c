@@ -1,6 +1,7 @@
 
 
 #include "muse_pack_parser.h"
+#include "muse_pack_encoder.h"
 
 
 void compressed_test_report(int* medians, int* expected_medians, 
@@ -12,6 +13,9 @@ void test_compressed_packet_1(void);
 void test_compressed_packet_2(void);
 void test_uncompressed_packet(void);
 void test_preparse_packet(void);
+void test_encoder_compressed_packet(void);
+void test_encoder_uncompressed_packet(void);
+void test_encoder_stream(int max_channel_bits);
 
 int main(void)
 {
@@ -20,6 +24,10 @@ int main(void)
 	//test_compressed_packet_2();
 	//test_uncompressed_packet();
 	test_preparse_packet();
+	test_encoder_compressed_packet();
+	test_encoder_uncompressed_packet();
+	test_encoder_stream(0);
+	test_encoder_stream(48);
 	
 	return 0x00;
 }
@@ -44,7 +52,7 @@ void test_preparse_packet(void){
 	int soft_packets_headers[10];		
 	int soft_packets_types[10];			       
 	
-	nb_of_soft_packets = preparse_packet(packet, 61, soft_packets_headers, soft_packets_types);
+	nb_of_soft_packets = preparse_packet(packet, 61, soft_packets_headers, soft_packets_types, NULL);
 
 	printf("\n\n");
 	printf("*************************\n");
@@ -147,7 +155,7 @@ void test_uncompressed_packet(void){
 	int expected_eeg_values[4] = {535,538,568,529};
 	
 	dropped_flag = get_flag_value(packet[0]);
-	uncompressed_parse_values(&(packet[1]), eeg_values);
+	parse_uncompressed_packet(&(packet[1]), eeg_values);
 	
 	printf("\n\n");
 	printf("*************************\n");
@@ -245,3 +253,230 @@ void compressed_test_report(int* medians, int* expected_medians,
 	
 }
 
+
+/**
+ * void test_encoder_compressed_packet(void)
+ * 
+ * @brief encodes random compressed packets, from small to large deltas, at all
+ *        quantizations and parses them back
+ */ 
+void test_encoder_compressed_packet(void){
+	
+	int i,j,k;
+	int nb_errors = 0;
+	int length = 0;
+	int powers[4];
+	int deltas[16*4];
+	int parsed_deltas[16*4];
+	int soft_packet_headers[MAX_NB_SOFT_PACKETS];
+	int soft_packet_types[MAX_NB_SOFT_PACKETS];
+	unsigned char packet[MUSE_ENCODER_MAX_BUFFER];
+	
+	srand(1);
+	
+	for(k=0;k<10000;k++){
+		
+		/*deltas up to 2^0 to 2^11*/
+		for(i=0;i<4;i++){
+			powers[i] = rand()%(MUSE_MAX_QUANTIZATION_POWER+1);
+			for(j=0;j<16;j++){
+				deltas[j+i*16] = (rand()%(1<<(k%12+1))-(1<<(k%12)))/(1<<powers[i])*(1<<powers[i]);
+			}
+		}
+		
+		length = encode_compressed_packet(deltas, powers, packet);
+		
+		/*the packet length is read from the packet*/
+		if(preparse_packet(packet, length, soft_packet_headers, soft_packet_types, NULL)!=1 ||
+		   soft_packet_types[0]!=MUSE_COMPRESSED_PKT){
+			nb_errors++;
+			continue;
+		}
+		
+		parse_compressed_packet(packet, parsed_deltas, NULL);
+		
+		if(memcmp(deltas, parsed_deltas, sizeof(deltas))!=0){
+			nb_errors++;
+		}
+	}
+	
+	printf("\n\n");
+	printf("*************************\n");
+	printf("Encoder, compressed      \n");
+	printf("*************************\n");
+	printf("\n");
+	printf("packets:%i errors:%i ",k,nb_errors);
+	
+	if(nb_errors==0){
+		printf("OK\n");
+	}
+	else{
+		printf("bug!\n");
+	}
+}
+
+/**
+ * void test_encoder_uncompressed_packet(void)
+ * 
+ * @brief encodes the values of test_uncompressed_packet() and a dropped 
+ *        samples count and parses them back
+ */ 
+void test_encoder_uncompressed_packet(void){
+	
+	int i;
+	int values[4] = {535,538,568,529};
+	int parsed_values[4];
+	unsigned char expected_packet[6] = {0xe0, 0x17, 0x6a, 0x88, 0x63, 0x84};
+	unsigned char packet[8];
+	int length;
+	char ok = 1;
+	
+	length = encode_uncompressed_packet(values, 0, packet);
+	if(length!=6 || memcmp(packet, expected_packet, 6)!=0){
+		ok = 0;
+	}
+	
+	length = encode_uncompressed_packet(values, 300, packet);
+	parse_uncompressed_packet(&(packet[1+DROPPED_SAMPLES_LENGTH]), parsed_values);
+	if(length!=8 || get_dropped_samples(packet)!=300){
+		ok = 0;
+	}
+	for(i=0;i<4;i++){
+		if(parsed_values[i]!=values[i]){
+			ok = 0;
+		}
+	}
+	
+	printf("\n\n");
+	printf("*************************\n");
+	printf("Encoder, uncompressed    \n");
+	printf("*************************\n");
+	printf("\n");
+	
+	if(ok){
+		printf("OK\n");
+	}
+	else{
+		printf("bug!\n");
+	}
+}
+
+/**
+ * void test_encoder_stream(int max_channel_bits)
+ * 
+ * @brief encodes a random walk with the stream encoder and rebuilds it from
+ *        the buffers. Lossless, the signal must come back as is, lossy, the
+ *        decoder must follow the encoder.
+ * @param max_channel_bits, bits allowed to a channel, 0 for lossless
+ */ 
+void test_encoder_stream(int max_channel_bits){
+	
+	int i,j,k,n;
+	int nb_errors = 0;
+	int nb_buffers = 0;
+	int nb_bytes = 0;
+	int nb_samples = 0;
+	int max_error = 0;
+	int length;
+	int offset;
+	int nb_soft_packets;
+	int sample[4] = {512,512,512,512};
+	int history[16*4];
+	int nb_history = 0;
+	int values[4] = {0,0,0,0};
+	int deltas[16*4];
+	int drl, ref;
+	int soft_packet_headers[MAX_NB_SOFT_PACKETS];
+	int soft_packet_types[MAX_NB_SOFT_PACKETS];
+	unsigned char buffer[MUSE_ENCODER_MAX_BUFFER];
+	muse_encoder_t encoder;
+	
+	srand(2);
+	muse_encoder_init(&encoder, 10, 220, max_channel_bits);
+	muse_encoder_set_drl_ref(&encoder, 300, 700);
+	
+	for(n=0;n<100000;n++){
+		
+		/*random walk, with a jump once in a while*/
+		for(i=0;i<4;i++){
+			sample[i] += rand()%21-10;
+			if(rand()%500==0){
+				sample[i] += rand()%801-400;
+			}
+			sample[i] = sample[i]<0 ? 0 : (sample[i]>1023 ? 1023 : sample[i]);
+		}
+		
+		/*and a few dropped samples*/
+		if(rand()%5000==0){
+			muse_encoder_drop(&encoder, 1+rand()%30);
+			nb_history = 0;
+		}
+		
+		memcpy(&(history[nb_history*4]), sample, sizeof(sample));
+		nb_history++;
+		
+		length = muse_encoder_push(&encoder, sample, buffer);
+		if(length==0){
+			continue;
+		}
+		
+		nb_buffers++;
+		nb_bytes += length;
+		nb_soft_packets = preparse_packet(buffer, length, soft_packet_headers, soft_packet_types, NULL);
+		
+		for(k=0;k<nb_soft_packets;k++){
+			
+			offset = soft_packet_headers[k];
+			
+			switch(soft_packet_types[k]){
+				
+				case MUSE_UNCOMPRESS_PKT:
+					parse_uncompressed_packet(&(buffer[offset+1+(get_flag_value(buffer[offset]) ? DROPPED_SAMPLES_LENGTH : 0)]), values);
+					nb_samples++;
+					if(memcmp(values, &(history[(nb_history-1)*4]), sizeof(values))!=0){
+						nb_errors++;
+					}
+				break;
+				
+				case MUSE_COMPRESSED_PKT:
+					parse_compressed_packet(&(buffer[offset]), deltas, NULL);
+					for(j=0;j<16;j++){
+						for(i=0;i<4;i++){
+							values[i] += deltas[i*16+j];
+							if(abs(values[i]-history[j*4+i])>max_error){
+								max_error = abs(values[i]-history[j*4+i]);
+							}
+						}
+						nb_samples++;
+					}
+					if(memcmp(values, encoder.values, sizeof(values))!=0){
+						nb_errors++;
+					}
+				break;
+				
+				case MUSE_DRLREF_PKT:
+					parse_drlref_packet(&(buffer[offset]), &drl, &ref);
+					if(drl!=300 || ref!=700){
+						nb_errors++;
+					}
+				break;
+			}
+		}
+		
+		nb_history = 0;
+	}
+	
+	printf("\n\n");
+	printf("*************************\n");
+	printf("Encoder, stream (%i bits)\n",max_channel_bits);
+	printf("*************************\n");
+	printf("\n");
+	printf("buffers:%i bytes:%i samples:%i max error:%i errors:%i ",nb_buffers,nb_bytes,nb_samples,max_error,nb_errors);
+	
+	if(nb_errors==0 && (max_channel_bits>0 || max_error==0)){
+		printf("OK\n");
+	}
+	else{
+		printf("bug!\n");
+	}
+}
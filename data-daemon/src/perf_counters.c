@@ -0,0 +1,227 @@
+/**
+ * @file perf_counters.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Hardware counters of the decoder stages. The group of a thread is
+ *        opened on its first sample, the cycles lead it and are pinned: the
+ *        group is counted as a whole or not at all. A counter the processor
+ *        does not have (cache misses on some cores) reads as zero. The groups
+ *        are closed with the process.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "stats.h"
+#include "perf_counters.h"
+
+int perf_enabled = 0;
+
+static const uint64_t perf_configs[PERF_NB_COUNTERS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES };
+
+/*group of the thread*/
+static __thread int perf_group_fd = -1;
+static __thread char perf_thread_opened = 0;
+static __thread int perf_nb_events = 0;
+static __thread int perf_event_index[PERF_NB_COUNTERS]; /*in the group read, -1 when not counted*/
+static __thread uint64_t perf_overhead[PERF_NB_COUNTERS]; /*of a sample*/
+
+static int perf_open_group(void);
+static void perf_calibrate(void);
+static long perf_event_open(struct perf_event_attr* attr, int group_fd);
+
+/**
+ * perf_init(int enabled)
+ * @brief Enables the counters. Called after stats_init(), they are published
+ *        in its page.
+ * @param enabled
+ * @return 0 for success
+ */
+int perf_init(int enabled)
+{
+	if (!enabled) {
+		STATS_SET(perf_status, PERF_OFF);
+		return (0);
+	}
+
+	STATS_SET(perf_status, PERF_COUNTING);
+	perf_enabled = 1;
+	return (0);
+}
+
+/**
+ * perf_sample(perf_sample_t* sample)
+ * @brief Reads the counters of the calling thread. Called through
+ *        PERF_SAMPLE, only when the counters are enabled.
+ * @param (out)sample, not valid if the thread can't count
+ */
+void perf_sample(perf_sample_t* sample)
+{
+	int i;
+	uint64_t group[1+PERF_NB_COUNTERS];
+	ssize_t length;
+
+	sample->valid = 0;
+
+	if (!perf_thread_opened) {
+		perf_thread_opened = 1;
+		if (perf_open_group() < 0) {
+			return;
+		}
+		perf_calibrate();
+	}
+
+	if (perf_group_fd < 0) {
+		return;
+	}
+
+	/*nr, then the values in the order of the opening*/
+	length = read(perf_group_fd, group, sizeof(uint64_t)*(1+perf_nb_events));
+	if (length != (ssize_t)(sizeof(uint64_t)*(1+perf_nb_events))) {
+		return;
+	}
+
+	for (i = 0; i < PERF_NB_COUNTERS; i++) {
+		sample->values[i] = perf_event_index[i] >= 0 ? group[1+perf_event_index[i]] : 0;
+	}
+	sample->valid = 1;
+}
+
+/**
+ * perf_record(perf_stage_t stage, int packet_type, const perf_sample_t* begin,
+ *             const perf_sample_t* end, int share)
+ * @brief Adds the counts between two samples to a stage, the cost of a
+ *        sample taken off
+ * @param stage
+ * @param packet_type, MUSE_*_PKT
+ * @param begin
+ * @param end
+ * @param share, the counts are split between that many packets (a preparse
+ *        finds all the packets of a buffer)
+ */
+void perf_record(perf_stage_t stage, int packet_type, const perf_sample_t* begin, const perf_sample_t* end, int share)
+{
+	int i;
+	uint64_t count;
+	shm_stats_perf_t* perf;
+
+	if (!begin->valid || !end->valid || share < 1) {
+		return;
+	}
+
+	perf = &(stats_page->perf[stage][packet_type&(SHM_STATS_NB_PACKET_TYPES-1)]);
+
+	for (i = 0; i < PERF_NB_COUNTERS; i++) {
+		count = end->values[i]-begin->values[i];
+		count = count > perf_overhead[i] ? count-perf_overhead[i] : 0;
+		__atomic_fetch_add(&(perf->counters[i]), count/share, __ATOMIC_RELAXED);
+	}
+	__atomic_fetch_add(&(perf->count), 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * perf_cleanup()
+ * @brief Stops the counting
+ */
+void perf_cleanup(void)
+{
+	perf_enabled = 0;
+}
+
+/**
+ * perf_open_group()
+ * @brief Opens and starts the group of the calling thread
+ * @return 0 for success, -1 if the cycles can't be counted
+ */
+static int perf_open_group(void)
+{
+	int i, fd;
+	struct perf_event_attr attr;
+
+	for (i = 0; i < PERF_NB_COUNTERS; i++) {
+
+		perf_event_index[i] = -1;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = perf_configs[i];
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.exclude_kernel = 1; /*allowed to a user by the default perf_event_paranoid*/
+		attr.exclude_hv = 1;
+		attr.disabled = (i == PERF_CYCLES);
+		attr.pinned = (i == PERF_CYCLES);
+
+		fd = (int)perf_event_open(&attr, perf_group_fd);
+		if (fd < 0) {
+			if (i == PERF_CYCLES) {
+				printf("Hardware counters unavailable: %s\n", strerror(errno));
+				STATS_SET(perf_status, PERF_UNAVAILABLE);
+				return (-1);
+			}
+			continue;
+		}
+
+		if (i == PERF_CYCLES) {
+			perf_group_fd = fd;
+		}
+		perf_event_index[i] = perf_nb_events++;
+	}
+
+	ioctl(perf_group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(perf_group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+	return (0);
+}
+
+/**
+ * perf_calibrate()
+ * @brief Measures the cost of a sample: the least counts between two samples
+ *        back to back
+ */
+static void perf_calibrate(void)
+{
+	int i, j;
+	perf_sample_t first, second;
+
+	for (i = 0; i < PERF_NB_COUNTERS; i++) {
+		perf_overhead[i] = UINT64_MAX;
+	}
+
+	for (j = 0; j < PERF_CALIBRATION_READS; j++) {
+		perf_sample(&first);
+		perf_sample(&second);
+		if (!first.valid || !second.valid) {
+			continue;
+		}
+		for (i = 0; i < PERF_NB_COUNTERS; i++) {
+			if (second.values[i]-first.values[i] < perf_overhead[i]) {
+				perf_overhead[i] = second.values[i]-first.values[i];
+			}
+		}
+	}
+
+	for (i = 0; i < PERF_NB_COUNTERS; i++) {
+		if (perf_overhead[i] == UINT64_MAX) {
+			perf_overhead[i] = 0;
+		}
+	}
+}
+
+/**
+ * perf_event_open(struct perf_event_attr* attr, int group_fd)
+ * @brief Counter of the calling thread, on any cpu. The libc has no wrapper.
+ * @param attr
+ * @param group_fd, -1 for a leader
+ * @return file descriptor, -1 for error
+ */
+static long perf_event_open(struct perf_event_attr* attr, int group_fd)
+{
+	return syscall(__NR_perf_event_open, attr, 0, -1, group_fd, 0);
+}
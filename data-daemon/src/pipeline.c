@@ -0,0 +1,319 @@
+/**
+ * @file pipeline.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Chain of processing stages between the translation of the packets and
+ *        the data output. The stages are listed in the configuration:
+ *        <pipeline>
+ *          <stage type="FILTER"/>
+ *          <stage type="RESAMPLER"/>
+ *        </pipeline>
+ *        Without a list, the chain follows the options set (quality_shm_key,
+ *        montage, process_data, output_rate, feature_shm_key, envelope_shm_key).
+ *
+ *        Stages own their output buffers, allocated at init. A stage that does
+ *        not change the samples hands its input block to the next stage as is.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "data_output.h"
+#include "pipeline.h"
+#include "filter_bank.h"
+#include "resampler.h"
+#include "band_power.h"
+#include "montage.h"
+#include "quality.h"
+#include "envelope.h"
+
+static int pipeline_set_stage_ops(stage_ops_t* ops, char* stage_type);
+static int pipeline_default_stages(appconfig_t* config, stage_format_t* format, char stage_types[][MAX_CHAR_FIELD_LENGTH]);
+static void pipeline_run(pipeline_t* pipeline, int stage_idx, data_block_t* block);
+
+/**
+ * pipeline_t* pipeline_init(appconfig_t* config, stage_format_t* format)
+ * @brief Initializes the stages of the chain
+ * @param config, stages and their options
+ * @param (in/out)format, in, the stream of the hardware; out, the stream out of the chain
+ * @return the chain (possibly without stage), NULL on error
+ */
+pipeline_t* pipeline_init(appconfig_t* config, stage_format_t* format){
+
+	int i;
+	int nb_stages = config->nb_pipeline_stages;
+	char (*stage_types)[MAX_CHAR_FIELD_LENGTH] = config->pipeline_stages;
+	char default_types[MAX_PIPELINE_STAGES][MAX_CHAR_FIELD_LENGTH];
+	pipeline_t* pipeline = (pipeline_t*)malloc(sizeof(pipeline_t));
+
+	memset(pipeline, 0, sizeof(pipeline_t));
+
+	/*no list, the stages follow the options*/
+	if(!config->pipeline_set){
+		nb_stages = pipeline_default_stages(config, format, default_types);
+		stage_types = default_types;
+	}
+
+	for(i=0;i<nb_stages;i++){
+
+		if(pipeline_set_stage_ops(&(pipeline->ops[i]), stage_types[i])<0){
+			pipeline_cleanup(pipeline);
+			return NULL;
+		}
+
+		/*the stage takes the format out of the previous one*/
+		pipeline->stages[i] = pipeline->ops[i].init(config, format);
+		if(pipeline->stages[i]==NULL){
+			fprintf(stderr, "pipeline: unable to init the %s stage\n", stage_types[i]);
+			pipeline_cleanup(pipeline);
+			return NULL;
+		}
+		pipeline->nb_stages++;
+	}
+
+	memcpy(&(pipeline->format), format, sizeof(stage_format_t));
+
+	return pipeline;
+}
+
+/**
+ * void pipeline_connect(pipeline_t* pipeline, void* next)
+ * @brief Places the chain in front of the output. The output functions in place
+ *        are kept, the processed stream is forwarded to them.
+ * @param pipeline
+ * @param next, the output receiving the processed stream
+ */
+void pipeline_connect(pipeline_t* pipeline, void* next){
+
+	pipeline->next = next;
+	pipeline->next_copy_block = _COPY_BLOCK_IN;
+	pipeline->next_terminate = _TERMINATE_DATA_OUTPUT_FC;
+}
+
+/**
+ * int pipeline_write_in_buf(void *param, void *input)
+ * @brief Pushes one sample in the chain
+ * @param param, the chain
+ * @param input, refers to a data_t pointer
+ * @return EXIT_SUCCESS
+ */
+int pipeline_write_in_buf(void *param, void *input){
+
+	data_t* data = (data_t*)input;
+	data_block_t data_block;
+
+	pipeline_t* pipeline = (pipeline_t*)param;
+
+	/*single samples carry no stream information*/
+	data_block.nb_samples = 1;
+	data_block.nb_data = data->nb_data;
+	data_block.ptr = (float*)data->ptr;
+	data_block.first_sample = pipeline->next_sample;
+	data_block.timestamp_ns = 0;
+	data_block.sample_period_ns = 0;
+	data_block.flags = 0;
+
+	return pipeline_write_block_in_buf(param, &data_block);
+}
+
+/**
+ * int pipeline_write_block_in_buf(void *param, void *input)
+ * @brief Pushes a block in the chain
+ * @param param, the chain
+ * @param input, refers to a data_block_t pointer
+ * @return EXIT_SUCCESS
+ */
+int pipeline_write_block_in_buf(void *param, void *input){
+
+	pipeline_t* pipeline = (pipeline_t*)param;
+	data_block_t* block = (data_block_t*)input;
+
+	pipeline_run(pipeline, 0, block);
+	pipeline->next_sample = block->first_sample+block->nb_samples;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int pipeline_cleanup(void *param)
+ * @brief Flushes the samples held by the stages, frees them and terminates the
+ *        output behind the chain
+ * @param param, the chain
+ * @return EXIT_SUCCESS
+ */
+int pipeline_cleanup(void *param){
+
+	int i;
+	data_block_t flushed;
+	pipeline_t* pipeline = (pipeline_t*)param;
+
+	/*a stage is flushed once the previous ones have pushed their samples in it*/
+	if(pipeline->next!=NULL){
+		for(i=0;i<pipeline->nb_stages;i++){
+			if(pipeline->ops[i].flush!=NULL && pipeline->ops[i].flush(pipeline->stages[i], &flushed)>0){
+				pipeline_run(pipeline, i+1, &flushed);
+			}
+		}
+		pipeline->next_terminate(pipeline->next);
+	}
+
+	for(i=0;i<pipeline->nb_stages;i++){
+		pipeline->ops[i].cleanup(pipeline->stages[i]);
+	}
+	free(pipeline);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void pipeline_run(pipeline_t* pipeline, int stage_idx, data_block_t* block)
+ * @brief Processes a block from a stage to the end of the chain. The block is
+ *        cut in pieces a stage can take, each piece goes through the rest of
+ *        the chain before the next one, so the stages can reuse their buffers.
+ * @param pipeline
+ * @param stage_idx, first stage to run
+ * @param block, input of the stage
+ */
+static void pipeline_run(pipeline_t* pipeline, int stage_idx, data_block_t* block){
+
+	int nb_done = 0;
+	data_block_t chunk;
+	data_block_t output;
+
+	/*end of the chain*/
+	if(stage_idx>=pipeline->nb_stages){
+		pipeline->next_copy_block(pipeline->next, block);
+		return;
+	}
+
+	memcpy(&chunk, block, sizeof(data_block_t));
+
+	while(nb_done<block->nb_samples){
+
+		chunk.nb_samples = block->nb_samples-nb_done;
+		if(chunk.nb_samples>PIPELINE_BLOCK_SIZE){
+			chunk.nb_samples = PIPELINE_BLOCK_SIZE;
+		}
+		chunk.ptr = &(block->ptr[nb_done*block->nb_data]);
+		chunk.first_sample = block->first_sample+nb_done;
+		if(block->timestamp_ns){
+			chunk.timestamp_ns = block->timestamp_ns+(int64_t)(nb_done*block->sample_period_ns);
+		}
+
+		if(pipeline->ops[stage_idx].process_block(pipeline->stages[stage_idx], &chunk, &output)>0){
+			pipeline_run(pipeline, stage_idx+1, &output);
+		}
+
+		nb_done += chunk.nb_samples;
+	}
+}
+
+/**
+ * int pipeline_default_stages(appconfig_t* config, stage_format_t* format, char stage_types[][MAX_CHAR_FIELD_LENGTH])
+ * @brief Lists the stages implied by the options, when the configuration has no list
+ * @param config
+ * @param format, the stream of the hardware
+ * @param (out)stage_types, the stages
+ * @return the number of stages
+ */
+static int pipeline_default_stages(appconfig_t* config, stage_format_t* format, char stage_types[][MAX_CHAR_FIELD_LENGTH]){
+
+	int nb_stages = 0;
+
+	/*signal quality on the stream as translated, against the rails of the hardware*/
+	if(config->quality_shm_key){
+		strcpy(stage_types[nb_stages++], "QUALITY");
+	}
+
+	/*derivations, the next stages only process the channels kept*/
+	if(config->montage_type!=MONTAGE_NONE){
+		strcpy(stage_types[nb_stages++], "MONTAGE");
+	}
+
+	/*filters at the rate of the hardware*/
+	if(config->process_data){
+		strcpy(stage_types[nb_stages++], "FILTER");
+	}
+
+	/*resampler, when the rates differ*/
+	if(config->output_rate>0 && config->output_rate!=format->rate){
+		strcpy(stage_types[nb_stages++], "RESAMPLER");
+	}
+
+	/*features, on the stream as written in the output*/
+	if(config->feature_shm_key){
+		strcpy(stage_types[nb_stages++], "BAND_POWER");
+	}
+
+	/*envelope of the stream as written in the output, for the viewers*/
+	if(config->envelope_shm_key){
+		strcpy(stage_types[nb_stages++], "ENVELOPE");
+	}
+
+	return nb_stages;
+}
+
+/**
+ * int pipeline_set_stage_ops(stage_ops_t* ops, char* stage_type)
+ * @brief Setup the callbacks of a stage
+ * @param (out)ops, the callbacks
+ * @param stage_type
+ * @return -1 for unknown type, 0 for known/success
+ */
+static int pipeline_set_stage_ops(stage_ops_t* ops, char* stage_type){
+
+	/*biquad filters (notch, high-pass, band-pass)*/
+	if(strcmp(stage_type, "FILTER") == 0){
+
+		ops->init = &filter_bank_stage_init;
+		ops->process_block = &filter_bank_stage_process;
+		ops->flush = NULL;
+		ops->cleanup = &filter_bank_stage_cleanup;
+
+	/*change of sampling rate*/
+	} else if(strcmp(stage_type, "RESAMPLER") == 0){
+
+		ops->init = &resampler_stage_init;
+		ops->process_block = &resampler_stage_process;
+		ops->flush = &resampler_stage_flush;
+		ops->cleanup = &resampler_stage_cleanup;
+
+	/*re-referencing and derivations*/
+	} else if(strcmp(stage_type, "MONTAGE") == 0){
+
+		ops->init = &montage_stage_init;
+		ops->process_block = &montage_stage_process;
+		ops->flush = NULL;
+		ops->cleanup = &montage_stage_cleanup;
+
+	/*band power features, published in their own ring*/
+	} else if(strcmp(stage_type, "BAND_POWER") == 0){
+
+		ops->init = &band_power_stage_init;
+		ops->process_block = &band_power_stage_process;
+		ops->flush = NULL;
+		ops->cleanup = &band_power_stage_cleanup;
+
+	/*signal quality, published in a status page*/
+	} else if(strcmp(stage_type, "QUALITY") == 0){
+
+		ops->init = &quality_stage_init;
+		ops->process_block = &quality_stage_process;
+		ops->flush = NULL;
+		ops->cleanup = &quality_stage_cleanup;
+
+	/*min/max envelope pyramid, published in its own segment*/
+	} else if(strcmp(stage_type, "ENVELOPE") == 0){
+
+		ops->init = &envelope_stage_init;
+		ops->process_block = &envelope_stage_process;
+		ops->flush = NULL;
+		ops->cleanup = &envelope_stage_cleanup;
+
+	} else {
+		fprintf(stderr, "pipeline: unknown stage type %s\n", stage_type);
+		return (-1);
+	}
+
+	return (0);
+}
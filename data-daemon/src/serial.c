@@ -18,6 +18,7 @@
 #include <bluetooth/rfcomm.h>
 
 #include "xml.h"
+#include "serial.h"
 
 static int sport;
 
@@ -44,20 +45,22 @@ void set_serial_fd(int fd)
 /**
  * setup_serial(unsigned char dev_name[])
  * @brief Setup serial terminal
- * @param dev_name
+ * @param dev_name, path of the device (<remote_addr>), /dev/ttyUSB0 if empty
  * @return 0 for success, else -1 for error
  */
 int setup_serial(unsigned char dev_name[])
 {
 	int fd, rc;
-	char* dev_name_debug = "/dev/ttyUSB0";
+	const char* dev_path = (const char *)dev_name;
 
+	if (dev_path[0] == '\0') {
+		dev_path = SERIAL_DEFAULT_DEVICE;
+	}
 
-	//fd = open((const char *)dev_name, O_RDWR | O_NOCTTY | O_NONBLOCK);
-	fd = open((const char *)dev_name_debug, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	fd = open(dev_path, O_RDWR | O_NOCTTY | O_NONBLOCK);
 	
 	if (fd == -1) {
-		printf("open_port: Unable to open %s - ", dev_name_debug);
+		printf("open_port: Unable to open %s - ", dev_path);
 		
 		printf("Oh dear, something went wrong with read()! %s\n", strerror(errno));
 		
@@ -66,7 +69,14 @@ int setup_serial(unsigned char dev_name[])
 	} 
 	set_serial_fd(fd);
 
+	/*start from the settings of the device, only the fields below change*/
 	struct termios toptions;
+	if (tcgetattr(fd, &toptions) < 0) {
+		fprintf(stderr, "failed to get attr: %d, %s\n", fd, strerror(errno));
+		close(fd);
+		return (-1);
+	}
+
     cfsetispeed(&toptions, B115200);
     cfsetospeed(&toptions, B115200);
 
@@ -9,13 +9,21 @@
 #include <pthread.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/rfcomm.h>
 
+#include "logger.h"
 #include "socket.h"
 
-static int sock;
+static int sock = -1;
+
+static int setup_unix_socket(const char *path, int timeout_ms);
+static int connect_timeout(int fd, struct sockaddr *addr, socklen_t length, int timeout_ms);
 
 /**
  * get_socket_fd()
@@ -35,11 +43,14 @@ void set_socket_fd(int fd) {
 }
 
 /**
- * setup_socket(char addr_mac[])
- * @brief Sets up socket file descriptor
+ * setup_socket(char addr_mac[], int timeout_ms)
+ * @brief Sets up socket file descriptor. An address of the form unix:<path>
+ *        connects to a local emulator instead of a bluetooth device.
+ * @param addr_mac
+ * @param timeout_ms, the connection is given up after that time
  * @return 0 for success, -1 for error
  */ 
-int setup_socket(unsigned char addr_mac[]) {
+int setup_socket(unsigned char addr_mac[], int timeout_ms) {
 
 	struct sockaddr_rc addr = { 0 };
 	//struct sockaddr_rc laddr = { 0 };
@@ -47,7 +58,15 @@ int setup_socket(unsigned char addr_mac[]) {
 	int fd = 0;
 	//char* my_addr = "5C:F3:70:74:9A:01";
 
+	if (strncmp((char *)addr_mac, SOCKET_UNIX_PREFIX, strlen(SOCKET_UNIX_PREFIX)) == 0) {
+		return setup_unix_socket((char *)addr_mac+strlen(SOCKET_UNIX_PREFIX), timeout_ms);
+	}
+
 	fd = socket(AF_BLUETOOTH, SOCK_STREAM, BTPROTO_RFCOMM);
+	if (fd < 0) {
+		perror("socket");
+		return (-1);
+	}
 	
 	addr.rc_family = AF_BLUETOOTH;
 	//addr.rc_channel = addr_mac[15]%2+1;
@@ -64,21 +83,112 @@ int setup_socket(unsigned char addr_mac[]) {
 	//	return -1;
 	//}
 	
-	status = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+	status = connect_timeout(fd, (struct sockaddr *)&addr, sizeof(addr), timeout_ms);
 	
 	if (status != 0) {
+		close(fd);
 		return (-1);
 	}
 	
 	set_socket_fd(fd);
 	return (0);
 }
+
+/**
+ * setup_unix_socket(const char *path, int timeout_ms)
+ * @brief Connects to an emulator listening on a unix socket. The socket keeps
+ *        the boundaries of the messages, each read returns one buffer like
+ *        an RFCOMM frame.
+ * @param path, of the socket
+ * @param timeout_ms
+ * @return 0 for success, -1 for error
+ */ 
+static int setup_unix_socket(const char *path, int timeout_ms) {
+
+	struct sockaddr_un addr = { 0 };
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		printf("Socket path too long: %s\n", path);
+		return (-1);
+	}
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (fd < 0) {
+		perror("socket");
+		return (-1);
+	}
+
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+
+	if (connect_timeout(fd, (struct sockaddr *)&addr, sizeof(addr), timeout_ms) != 0) {
+		close(fd);
+		return (-1);
+	}
+
+	set_socket_fd(fd);
+	return (0);
+}
+
+/**
+ * connect_timeout(int fd, struct sockaddr *addr, socklen_t length, int timeout_ms)
+ * @brief Connects without blocking longer than timeout_ms: the connection is
+ *        started on a non-blocking socket and waited for. The socket is
+ *        blocking again once connected.
+ * @param fd
+ * @param addr
+ * @param length, of addr
+ * @param timeout_ms
+ * @return 0 for success, -1 for error or timeout
+ */ 
+static int connect_timeout(int fd, struct sockaddr *addr, socklen_t length, int timeout_ms) {
+
+	int flags, error = 0;
+	socklen_t error_length = sizeof(error);
+	struct pollfd pfd;
+
+	flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		return (-1);
+	}
+
+	if (connect(fd, addr, length) != 0) {
+
+		/*a unix socket with a full backlog says EAGAIN, tried again later*/
+		if (errno != EINPROGRESS) {
+			return (-1);
+		}
+
+		pfd.fd = fd;
+		pfd.events = POLLOUT;
+		do {
+			error = poll(&pfd, 1, timeout_ms);
+		} while (error < 0 && errno == EINTR);
+
+		if (error <= 0) {
+			return (-1);
+		}
+
+		error = 0;
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_length) != 0 || error != 0) {
+			return (-1);
+		}
+	}
+
+	return fcntl(fd, F_SETFL, flags) < 0 ? (-1) : (0);
+}
 /**
  * close_sockets()
  * @brief Closes file descriptor for socket communication
  */
 void close_sockets(void)
 {
-	close(get_socket_fd());
-	fprintf(stdout, "Close sockets\n");
+	int fd = get_socket_fd();
+
+	if (fd >= 0) {
+		close(fd);
+		LOGGER_RECORD(LOGGER_LINK_CLOSED, fd, 0, 0);
+	}
+	set_socket_fd(-1);
 }
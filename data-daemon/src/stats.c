@@ -0,0 +1,181 @@
+/**
+ * @file stats.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Runtime statistics page. The counters are updated by the code that
+ *        sees the events, a timer of the wheel updates the cpu times and the
+ *        time spent in each stage every STATS_UPDATE_PERIOD_MS: its count
+ *        and sum always, its percentiles from the tracer when the tracing
+ *        is on.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "clock_sync.h"
+#include "histogram.h"
+#include "trace.h"
+#include "timer_wheel.h"
+#include "stats.h"
+
+/*counters of the interface when the page is not published*/
+static shm_stats_page_t stats_private_page;
+
+shm_stats_page_t* stats_page = &stats_private_page;
+
+static int stats_shmid = -1;
+static wheel_timer_t stats_timer;
+static char stats_running = 0;
+static pthread_t stats_read_thread;
+static volatile char stats_read_thread_set = 0;
+
+static int stats_run(void* param);
+static void stats_update(void);
+static int64_t stats_cpu_ns(clockid_t clock);
+
+/**
+ * stats_init(appconfig_t* config)
+ * @brief Creates the statistics page, if <stats_shm_key> is set, and starts
+ *        its updates, on the timer wheel
+ * @param config
+ * @return 0 for success, -1 for error
+ */
+int stats_init(appconfig_t* config)
+{
+	int i;
+	shm_stats_page_t* page;
+	const char* names[SHM_STATS_NB_STAGES] = TRACE_STAGE_NAMES;
+
+	if (config->stats_shm_key == 0) {
+		return (0);
+	}
+
+	if ((stats_shmid = shmget(config->stats_shm_key, sizeof(shm_stats_page_t), IPC_CREAT | 0666)) < 0) {
+		perror("shmget");
+		return (-1);
+	}
+
+	if ((page = (shm_stats_page_t*)shmat(stats_shmid, NULL, 0)) == (shm_stats_page_t*)-1) {
+		perror("shmat");
+		shmctl(stats_shmid, IPC_RMID, 0);
+		stats_shmid = -1;
+		return (-1);
+	}
+
+	memset((void*)page, 0, sizeof(shm_stats_page_t));
+	page->pid = getpid();
+	strncpy(page->device, (char *)config->device, SHM_STATS_DEVICE_LENGTH-1);
+	page->start_ns = clock_sync_now_ns();
+	for (i = 0; i < SHM_STATS_NB_STAGES; i++) {
+		strncpy(page->stages[i].name, names[i], SHM_STATS_STAGE_NAME_LENGTH-1);
+	}
+
+	/*the magic goes last, readers check it before trusting the page*/
+	__sync_synchronize();
+	page->magic = SHM_STATS_MAGIC;
+	stats_page = page;
+
+	stats_running = 1;
+	timer_wheel_add(&stats_timer, STATS_UPDATE_PERIOD_MS, STATS_UPDATE_PERIOD_MS, &stats_run, NULL);
+
+	return (0);
+}
+
+/**
+ * stats_set_read_thread(pthread_t thread)
+ * @brief Thread reading the hardware, its cpu time is published
+ * @param thread
+ */
+void stats_set_read_thread(pthread_t thread)
+{
+	stats_read_thread = thread;
+	__sync_synchronize();
+	stats_read_thread_set = 1;
+}
+
+/**
+ * stats_cleanup()
+ * @brief Stops the updates and removes the page. It stays attached, the
+ *        threads of the hardware may still count.
+ */
+void stats_cleanup(void)
+{
+	if (stats_running) {
+		stats_running = 0;
+		timer_wheel_cancel(&stats_timer);
+	}
+
+	if (stats_shmid >= 0) {
+		shmctl(stats_shmid, IPC_RMID, 0);
+		stats_shmid = -1;
+	}
+}
+
+/**
+ * stats_run(void* param)
+ * @brief Timer of the updates, every STATS_UPDATE_PERIOD_MS
+ */
+static int stats_run(void* param __attribute__ ((unused)))
+{
+	stats_update();
+	return (0);
+}
+
+/**
+ * stats_update()
+ * @brief Publishes the cpu times and the time of the stages so far
+ */
+static void stats_update(void)
+{
+	int i;
+	clockid_t clock;
+	histogram_t histograms[TRACE_NB_HISTOGRAMS];
+	uint64_t counts[TRACE_NB_HISTOGRAMS], sums_ns[TRACE_NB_HISTOGRAMS];
+
+	STATS_SET(cpu_ns, stats_cpu_ns(CLOCK_PROCESS_CPUTIME_ID));
+
+	if (stats_read_thread_set && pthread_getcpuclockid(stats_read_thread, &clock) == 0) {
+		STATS_SET(read_cpu_ns, stats_cpu_ns(clock));
+	}
+
+	if (trace_enabled) {
+		STATS_SET(trace_lost, trace_get_histograms(histograms));
+		for (i = 0; i < TRACE_NB_HISTOGRAMS && i < SHM_STATS_NB_STAGES; i++) {
+			STATS_SET(stages[i].count, histograms[i].count);
+			STATS_SET(stages[i].total_ns, histograms[i].sum);
+			STATS_SET(stages[i].p50_ns, histogram_percentile(&(histograms[i]), 50));
+			STATS_SET(stages[i].p99_ns, histogram_percentile(&(histograms[i]), 99));
+			STATS_SET(stages[i].p999_ns, histogram_percentile(&(histograms[i]), 99.9));
+			STATS_SET(stages[i].max_ns, histograms[i].max);
+		}
+	} else {
+		trace_get_counts(counts, sums_ns);
+		for (i = 0; i < TRACE_NB_HISTOGRAMS && i < SHM_STATS_NB_STAGES; i++) {
+			STATS_SET(stages[i].count, counts[i]);
+			STATS_SET(stages[i].total_ns, sums_ns[i]);
+		}
+	}
+
+	__atomic_store_n(&(stats_page->update_ns), clock_sync_now_ns(), __ATOMIC_RELAXED);
+}
+
+/**
+ * stats_cpu_ns(clockid_t clock)
+ * @brief CPU time of a clock
+ * @param clock, of the process or of a thread
+ * @return time in ns
+ */
+static int64_t stats_cpu_ns(clockid_t clock)
+{
+	struct timespec now;
+
+	if (clock_gettime(clock, &now) != 0) {
+		return 0;
+	}
+	return (int64_t)now.tv_sec*1000000000+now.tv_nsec;
+}
@@ -0,0 +1,324 @@
+/**
+ * @file eeg_codec.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Lossless codec for blocks of integer samples, see eeg_codec.h for the
+ *        format. The residuals and their zigzag mapping are computed with SIMD,
+ *        for the four predictors, on the encode side; the decoder reads the
+ *        Rice codes with a 64 bits window and undoes the mapping with SIMD
+ *        before integrating the predictor.
+ *
+ *        The arithmetic wraps on 32 bits, so any 32 bits pattern (float bits
+ *        included) survives a round trip.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simd.h"
+#include "eeg_codec.h"
+
+/*bits going out, most significant first*/
+typedef struct bit_writer_s {
+	uint8_t* ptr;
+	int pos;
+	uint64_t acc;
+	int nb_bits;
+} bit_writer_t;
+
+/*bits coming in, left aligned in the window*/
+typedef struct bit_reader_s {
+	const uint8_t* ptr;
+	int length;
+	int pos;
+	uint64_t window;
+	int nb_bits;
+	int consumed; /*bits*/
+} bit_reader_t;
+
+static void eeg_codec_residuals(const uint32_t* samples, int nb_samples, int order, uint32_t* residuals);
+
+/**
+ * void put_bits(bit_writer_t* writer, uint32_t value, int nb_bits)
+ * @brief Writes the nb_bits (32 at most) low bits of value
+ */
+static inline void put_bits(bit_writer_t* writer, uint32_t value, int nb_bits){
+
+	if(nb_bits==0){
+		return;
+	}
+
+	writer->acc = (writer->acc<<nb_bits)|(value&(0xFFFFFFFFu>>(32-nb_bits)));
+	writer->nb_bits += nb_bits;
+
+	while(writer->nb_bits>=8){
+		writer->nb_bits -= 8;
+		writer->ptr[writer->pos++] = (uint8_t)(writer->acc>>writer->nb_bits);
+	}
+}
+
+/**
+ * void refill(bit_reader_t* reader)
+ * @brief Tops the window up, zeros past the end of the input
+ */
+static inline void refill(bit_reader_t* reader){
+
+	while(reader->nb_bits<=56){
+		if(reader->pos<reader->length){
+			reader->window |= (uint64_t)reader->ptr[reader->pos]<<(56-reader->nb_bits);
+		}
+		reader->pos++;
+		reader->nb_bits += 8;
+	}
+}
+
+/**
+ * uint32_t get_bits(bit_reader_t* reader, int nb_bits)
+ * @brief Reads nb_bits (32 at most)
+ */
+static inline uint32_t get_bits(bit_reader_t* reader, int nb_bits){
+
+	uint32_t value;
+
+	if(nb_bits==0){
+		return 0;
+	}
+
+	refill(reader);
+	value = (uint32_t)(reader->window>>(64-nb_bits));
+	reader->window <<= nb_bits;
+	reader->nb_bits -= nb_bits;
+	reader->consumed += nb_bits;
+
+	return value;
+}
+
+/**
+ * int eeg_codec_encode(const int32_t* samples, int nb_samples, uint8_t* output)
+ * @brief Encodes the samples of one channel
+ * @param samples, the samples
+ * @param nb_samples, at most EEG_CODEC_MAX_SAMPLES
+ * @param (out)output, at least EEG_CODEC_MAX_BYTES(nb_samples) bytes
+ * @return number of bytes written, -1 on error
+ */
+int eeg_codec_encode(const int32_t* samples, int nb_samples, uint8_t* output){
+
+	int i, order, best_order = 0, k = 0;
+	int nb_residuals;
+	uint32_t q, u;
+	uint64_t sum, best_sum = UINT64_MAX;
+	uint32_t residuals[EEG_CODEC_MAX_SAMPLES];
+	bit_writer_t writer = { output, 0, 0, 0 };
+
+	if(nb_samples<=0 || nb_samples>EEG_CODEC_MAX_SAMPLES){
+		return -1;
+	}
+
+	/*the predictor giving the smallest residuals, on the samples all of them predict*/
+	if(nb_samples>EEG_CODEC_MAX_ORDER){
+		for(order=0;order<=EEG_CODEC_MAX_ORDER;order++){
+
+			eeg_codec_residuals((const uint32_t*)samples, nb_samples, order, residuals);
+
+			sum = 0;
+			for(i=EEG_CODEC_MAX_ORDER-order;i<nb_samples-order;i++){
+				sum += residuals[i];
+			}
+			if(sum<best_sum){
+				best_sum = sum;
+				best_order = order;
+			}
+		}
+	}
+
+	eeg_codec_residuals((const uint32_t*)samples, nb_samples, best_order, residuals);
+	nb_residuals = nb_samples-best_order;
+
+	/*rice parameter, floor(log2(mean))*/
+	sum = 0;
+	for(i=0;i<nb_residuals;i++){
+		sum += residuals[i];
+	}
+	while(k<31 && ((uint64_t)nb_residuals<<(k+1))<=sum){
+		k++;
+	}
+
+	put_bits(&writer, (best_order<<5)|k, 8);
+
+	for(i=0;i<best_order;i++){
+		put_bits(&writer, (uint32_t)samples[i], 32);
+	}
+
+	for(i=0;i<nb_residuals;i++){
+
+		u = residuals[i];
+		q = u>>k;
+
+		if(q<EEG_CODEC_ESCAPE){
+			/*q ones and a zero, then the low bits*/
+			put_bits(&writer, (0xFFFFFFFFu<<1)&(0xFFFFFFFFu>>(31-q)), q+1);
+			put_bits(&writer, u, k);
+		} else {
+			put_bits(&writer, 0xFFFFFFFFu, EEG_CODEC_ESCAPE);
+			put_bits(&writer, u, 32);
+		}
+	}
+
+	/*pad the last byte*/
+	put_bits(&writer, 0, (8-writer.nb_bits)&7);
+
+	return writer.pos;
+}
+
+/**
+ * int eeg_codec_decode(const uint8_t* input, int length, int32_t* samples, int nb_samples)
+ * @brief Decodes the samples of one channel
+ * @param input, the encoded channel
+ * @param length, bytes available in input
+ * @param (out)samples, the samples
+ * @param nb_samples, samples encoded, at most EEG_CODEC_MAX_SAMPLES
+ * @return number of bytes read, -1 on error
+ */
+int eeg_codec_decode(const uint8_t* input, int length, int32_t* samples, int nb_samples){
+
+	int i, order, k, q;
+	int nb_residuals;
+	uint32_t header;
+	uint32_t* out = (uint32_t*)samples;
+	uint32_t residuals[EEG_CODEC_MAX_SAMPLES+SIMD_WIDTH];
+	bit_reader_t reader = { input, length, 0, 0, 0, 0 };
+	v4su_u z;
+
+	if(nb_samples<=0 || nb_samples>EEG_CODEC_MAX_SAMPLES || length<1){
+		return -1;
+	}
+
+	header = get_bits(&reader, 8);
+	order = (header>>5)&0x03;
+	k = header&0x1F;
+	if(order>0 && order>=nb_samples){
+		return -1;
+	}
+	nb_residuals = nb_samples-order;
+
+	for(i=0;i<order;i++){
+		out[i] = get_bits(&reader, 32);
+	}
+
+	for(i=0;i<nb_residuals;i++){
+
+		/*count the ones, the escape bounds the run*/
+		refill(&reader);
+		q = __builtin_clzll(~reader.window|(1ULL<<(63-EEG_CODEC_ESCAPE)));
+
+		if(q<EEG_CODEC_ESCAPE){
+			reader.window <<= q+1;
+			reader.nb_bits -= q+1;
+			reader.consumed += q+1;
+			residuals[i] = ((uint32_t)q<<k)|get_bits(&reader, k);
+		} else {
+			reader.window <<= EEG_CODEC_ESCAPE;
+			reader.nb_bits -= EEG_CODEC_ESCAPE;
+			reader.consumed += EEG_CODEC_ESCAPE;
+			residuals[i] = get_bits(&reader, 32);
+		}
+	}
+
+	if((reader.consumed+7)/8>length){
+		return -1;
+	}
+
+	/*undo the zigzag mapping, 4 at a time*/
+	for(i=0;i<nb_residuals;i+=SIMD_WIDTH){
+		z = *(v4su_u*)&(residuals[i]);
+		*(v4su_u*)&(residuals[i]) = (z>>1)^(-(z&1));
+	}
+
+	/*integrate the predictor*/
+	switch(order){
+		case 0:
+			memcpy(out, residuals, nb_residuals*sizeof(uint32_t));
+			break;
+		case 1:
+			for(i=1;i<nb_samples;i++){
+				out[i] = residuals[i-1]+out[i-1];
+			}
+			break;
+		case 2:
+			for(i=2;i<nb_samples;i++){
+				out[i] = residuals[i-2]+2*out[i-1]-out[i-2];
+			}
+			break;
+		case 3:
+			for(i=3;i<nb_samples;i++){
+				out[i] = residuals[i-3]+3*out[i-1]-3*out[i-2]+out[i-3];
+			}
+			break;
+	}
+
+	return (reader.consumed+7)/8;
+}
+
+/**
+ * void eeg_codec_residuals(const uint32_t* samples, int nb_samples, int order, uint32_t* residuals)
+ * @brief Zigzag mapped residuals of a predictor, residuals[i-order] for sample i
+ * @param samples, the samples
+ * @param nb_samples
+ * @param order, of the polynomial predictor
+ * @param (out)residuals, nb_samples-order values
+ */
+static void eeg_codec_residuals(const uint32_t* samples, int nb_samples, int order, uint32_t* residuals){
+
+	int i = order;
+	uint32_t r;
+	v4su_u x0, x1, x2, x3, v;
+
+	for(;i+SIMD_WIDTH<=nb_samples;i+=SIMD_WIDTH){
+
+		x0 = *(const v4su_u*)&(samples[i]);
+
+		switch(order){
+			case 0:
+				v = x0;
+				break;
+			case 1:
+				x1 = *(const v4su_u*)&(samples[i-1]);
+				v = x0-x1;
+				break;
+			case 2:
+				x1 = *(const v4su_u*)&(samples[i-1]);
+				x2 = *(const v4su_u*)&(samples[i-2]);
+				v = x0-2*x1+x2;
+				break;
+			default:
+				x1 = *(const v4su_u*)&(samples[i-1]);
+				x2 = *(const v4su_u*)&(samples[i-2]);
+				x3 = *(const v4su_u*)&(samples[i-3]);
+				v = x0-3*x1+3*x2-x3;
+				break;
+		}
+
+		/*zigzag, small magnitudes give small codes*/
+		*(v4su_u*)&(residuals[i-order]) = (v<<1)^(v4su_u)((v4si_u)v>>31);
+	}
+
+	for(;i<nb_samples;i++){
+
+		switch(order){
+			case 0:
+				r = samples[i];
+				break;
+			case 1:
+				r = samples[i]-samples[i-1];
+				break;
+			case 2:
+				r = samples[i]-2*samples[i-1]+samples[i-2];
+				break;
+			default:
+				r = samples[i]-3*samples[i-1]+3*samples[i-2]-samples[i-3];
+				break;
+		}
+
+		residuals[i-order] = (r<<1)^(uint32_t)((int32_t)r>>31);
+	}
+}
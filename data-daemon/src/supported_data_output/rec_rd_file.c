@@ -0,0 +1,397 @@
+/**
+ * @file rec_rd_file.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Reader of the recordings. The whole file is mapped read only, so a
+ *        block is a pointer in the mapping. A seek is a binary search in the
+ *        sparse index followed by a walk of REC_INDEX_INTERVAL blocks at most.
+ *
+ *        When the footer is missing (the daemon did not close the recording),
+ *        the blocks are scanned from their sync marker, on REC_BLOCK_ALIGN
+ *        boundaries, to rebuild the index. A damaged region is skipped up to
+ *        the next valid block, a truncated block at the end is ignored.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "eeg_codec.h"
+#include "rec_rd_file.h"
+
+static char rec_rd_valid_block(rec_rd_t* rec_rd, uint64_t offset, uint64_t limit);
+static uint64_t rec_rd_find_block(rec_rd_t* rec_rd, uint64_t offset);
+static char rec_rd_read_footer(rec_rd_t* rec_rd);
+static void rec_rd_rebuild_index(rec_rd_t* rec_rd);
+
+/**
+ * rec_rd_t* rec_rd_open(const char* filename)
+ * @brief Maps a recording and loads its index, or rebuilds it
+ * @param filename
+ * @return the reader, positioned on the first block, NULL on error
+ */
+rec_rd_t* rec_rd_open(const char* filename){
+
+	struct stat file_stat;
+	rec_rd_t* rec_rd;
+	int fd = open(filename, O_RDONLY);
+
+	if(fd<0){
+		perror("open");
+		return NULL;
+	}
+
+	if(fstat(fd, &file_stat)<0 || (size_t)file_stat.st_size<sizeof(rec_file_header_t)){
+		fprintf(stderr, "%s is not a recording\n", filename);
+		close(fd);
+		return NULL;
+	}
+
+	rec_rd = (rec_rd_t*)malloc(sizeof(rec_rd_t));
+	memset(rec_rd, 0, sizeof(rec_rd_t));
+	rec_rd->fd = fd;
+	rec_rd->size = file_stat.st_size;
+
+	rec_rd->map = (const uint8_t*)mmap(NULL, rec_rd->size, PROT_READ, MAP_SHARED, fd, 0);
+	if(rec_rd->map==MAP_FAILED){
+		perror("mmap");
+		close(fd);
+		free(rec_rd);
+		return NULL;
+	}
+
+	rec_rd->header = (const rec_file_header_t*)rec_rd->map;
+	if(rec_rd->header->magic!=REC_FILE_MAGIC || rec_rd->header->version!=REC_FILE_VERSION ||
+	   rec_rd->header->nb_channels==0 || rec_rd->header->nb_channels>SHM_MAX_CHANNELS){
+		fprintf(stderr, "%s is not a recording of version %i\n", filename, REC_FILE_VERSION);
+		rec_rd_close(rec_rd);
+		return NULL;
+	}
+
+	if(!rec_rd_read_footer(rec_rd)){
+		rec_rd_rebuild_index(rec_rd);
+	}
+
+	rec_rd->pos = rec_rd_find_block(rec_rd, sizeof(rec_file_header_t));
+
+	return rec_rd;
+}
+
+/**
+ * int rec_rd_seek_sample(rec_rd_t* rec_rd, uint64_t sample)
+ * @brief Positions the reader on the block holding a sample, or on the next
+ *        block if the sample is missing
+ * @param rec_rd, the reader
+ * @param sample, stream index
+ * @return 0 on success, -1 if the recording ends before the sample
+ */
+int rec_rd_seek_sample(rec_rd_t* rec_rd, uint64_t sample){
+
+	int64_t low = 0, high = (int64_t)rec_rd->nb_entries-1, mid;
+	uint64_t offset = sizeof(rec_file_header_t);
+	const rec_block_header_t* block;
+
+	/*last entry starting at or before the sample*/
+	while(low<=high){
+		mid = (low+high)/2;
+		if(rec_rd->index[mid].first_sample<=sample){
+			offset = rec_rd->index[mid].offset;
+			low = mid+1;
+		} else {
+			high = mid-1;
+		}
+	}
+
+	/*then block after block*/
+	offset = rec_rd_find_block(rec_rd, offset);
+	while(offset<rec_rd->data_end){
+		block = (const rec_block_header_t*)&(rec_rd->map[offset]);
+		if(block->first_sample+block->nb_samples>sample){
+			break;
+		}
+		offset = rec_rd_find_block(rec_rd, offset+REC_BLOCK_FILE_SIZE(block->payload_size));
+	}
+
+	rec_rd->pos = offset;
+
+	return (offset<rec_rd->data_end)?0:-1;
+}
+
+/**
+ * int rec_rd_seek_time(rec_rd_t* rec_rd, int64_t timestamp_ns)
+ * @brief Positions the reader on the block holding a host time, or on the
+ *        next block. The blocks must be timestamped.
+ * @param rec_rd, the reader
+ * @param timestamp_ns, host time (CLOCK_MONOTONIC_RAW)
+ * @return 0 on success, -1 if the recording ends before this time
+ */
+int rec_rd_seek_time(rec_rd_t* rec_rd, int64_t timestamp_ns){
+
+	int64_t low = 0, high = (int64_t)rec_rd->nb_entries-1, mid;
+	uint64_t offset = sizeof(rec_file_header_t);
+	const rec_block_header_t* block;
+
+	while(low<=high){
+		mid = (low+high)/2;
+		if(rec_rd->index[mid].timestamp_ns<=timestamp_ns){
+			offset = rec_rd->index[mid].offset;
+			low = mid+1;
+		} else {
+			high = mid-1;
+		}
+	}
+
+	offset = rec_rd_find_block(rec_rd, offset);
+	while(offset<rec_rd->data_end){
+		block = (const rec_block_header_t*)&(rec_rd->map[offset]);
+		if(block->timestamp_ns+(int64_t)(block->nb_samples*block->sample_period_ns)>timestamp_ns){
+			break;
+		}
+		offset = rec_rd_find_block(rec_rd, offset+REC_BLOCK_FILE_SIZE(block->payload_size));
+	}
+
+	rec_rd->pos = offset;
+
+	return (offset<rec_rd->data_end)?0:-1;
+}
+
+/**
+ * int rec_rd_next_block(rec_rd_t* rec_rd, rec_rd_block_t* block)
+ * @brief Returns the block at the position of the reader, without copy, and
+ *        moves to the next one
+ * @param rec_rd, the reader
+ * @param (out)block, valid until the reader is closed
+ * @return 1 if a block is returned, 0 at the end of the recording
+ */
+int rec_rd_next_block(rec_rd_t* rec_rd, rec_rd_block_t* block){
+
+	if(rec_rd->pos>=rec_rd->data_end){
+		return 0;
+	}
+
+	block->header = (const rec_block_header_t*)&(rec_rd->map[rec_rd->pos]);
+	block->payload = &(rec_rd->map[rec_rd->pos+sizeof(rec_block_header_t)]);
+
+	rec_rd->pos = rec_rd_find_block(rec_rd, rec_rd->pos+REC_BLOCK_FILE_SIZE(block->header->payload_size));
+
+	return 1;
+}
+
+/**
+ * int rec_rd_decode_block(rec_rd_t* rec_rd, rec_rd_block_t* block, float* values)
+ * @brief Decodes a block to the values of its samples
+ * @param rec_rd, the reader
+ * @param block, returned by rec_rd_next_block
+ * @param (out)values, nb_samples samples of nb_channels values, sample after sample
+ * @return number of samples, -1 if the block is corrupted
+ */
+int rec_rd_decode_block(rec_rd_t* rec_rd, rec_rd_block_t* block, float* values){
+
+	int c, i;
+	int nb_bytes;
+	uint32_t pos = 0;
+	int nb_samples = block->header->nb_samples;
+	int nb_channels = rec_rd->header->nb_channels;
+	int32_t codes[EEG_CODEC_MAX_SAMPLES];
+
+	for(c=0;c<nb_channels;c++){
+
+		nb_bytes = eeg_codec_decode(&(block->payload[pos]), block->header->payload_size-pos, codes, nb_samples);
+		if(nb_bytes<0){
+			return -1;
+		}
+		pos += nb_bytes;
+
+		if(block->header->float_channels&((uint64_t)1<<c)){
+			for(i=0;i<nb_samples;i++){
+				memcpy(&(values[i*nb_channels+c]), &(codes[i]), sizeof(float));
+			}
+		} else {
+			for(i=0;i<nb_samples;i++){
+				values[i*nb_channels+c] = REC_CODE_VALUE(rec_rd->header->offset[c], rec_rd->header->scale[c], codes[i]);
+			}
+		}
+	}
+
+	return nb_samples;
+}
+
+/**
+ * int rec_rd_write_index(rec_rd_t* rec_rd, const char* filename)
+ * @brief Completes a recording that was not closed: drops what follows the
+ *        last complete block and appends the rebuilt index and its footer
+ * @param rec_rd, the reader of the recording
+ * @param filename, of the recording
+ * @return EXIT_SUCCESS, EXIT_FAILURE on error
+ */
+int rec_rd_write_index(rec_rd_t* rec_rd, const char* filename){
+
+	int fd;
+	rec_file_footer_t footer;
+	size_t index_size = rec_rd->nb_entries*sizeof(rec_index_entry_t);
+
+	if(!rec_rd->index_rebuilt){
+		return EXIT_SUCCESS;
+	}
+
+	footer.magic = REC_INDEX_MAGIC;
+	footer.interval = REC_INDEX_INTERVAL;
+	footer.index_offset = rec_rd->data_end;
+	footer.nb_entries = rec_rd->nb_entries;
+	footer.end_sample = rec_rd->end_sample;
+
+	fd = open(filename, O_WRONLY);
+	if(fd<0){
+		perror("open");
+		return EXIT_FAILURE;
+	}
+
+	if(ftruncate(fd, rec_rd->data_end)<0 ||
+	   pwrite(fd, rec_rd->index, index_size, rec_rd->data_end)!=(ssize_t)index_size ||
+	   pwrite(fd, &footer, sizeof(footer), rec_rd->data_end+index_size)!=(ssize_t)sizeof(footer)){
+		perror("write");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	close(fd);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void rec_rd_close(rec_rd_t* rec_rd)
+ * @brief Unmaps the recording, the blocks returned are no longer valid
+ * @param rec_rd, the reader
+ */
+void rec_rd_close(rec_rd_t* rec_rd){
+
+	if(rec_rd->index_rebuilt){
+		free((void*)rec_rd->index);
+	}
+
+	munmap((void*)rec_rd->map, rec_rd->size);
+	close(rec_rd->fd);
+	free(rec_rd);
+}
+
+/**
+ * char rec_rd_valid_block(rec_rd_t* rec_rd, uint64_t offset, uint64_t limit)
+ * @brief Checks that a complete block starts at an offset
+ * @param rec_rd, the reader
+ * @param offset, of the block header
+ * @param limit, where the blocks end
+ * @return 1 if the block is valid, 0 otherwise
+ */
+static char rec_rd_valid_block(rec_rd_t* rec_rd, uint64_t offset, uint64_t limit){
+
+	const rec_block_header_t* block;
+
+	if(offset+sizeof(rec_block_header_t)>limit){
+		return 0;
+	}
+
+	block = (const rec_block_header_t*)&(rec_rd->map[offset]);
+
+	return block->sync==REC_BLOCK_SYNC && block->nb_samples>0 && block->nb_samples<=EEG_CODEC_MAX_SAMPLES &&
+	       offset+REC_BLOCK_FILE_SIZE(block->payload_size)<=limit;
+}
+
+/**
+ * uint64_t rec_rd_find_block(rec_rd_t* rec_rd, uint64_t offset)
+ * @brief First valid block at or after an offset
+ * @param rec_rd, the reader
+ * @param offset, aligned on REC_BLOCK_ALIGN
+ * @return offset of the block, data_end if there is none
+ */
+static uint64_t rec_rd_find_block(rec_rd_t* rec_rd, uint64_t offset){
+
+	while(offset<rec_rd->data_end && !rec_rd_valid_block(rec_rd, offset, rec_rd->data_end)){
+		offset += REC_BLOCK_ALIGN;
+	}
+
+	return (offset<rec_rd->data_end)?offset:rec_rd->data_end;
+}
+
+/**
+ * char rec_rd_read_footer(rec_rd_t* rec_rd)
+ * @brief Loads the index of a closed recording, in place
+ * @param rec_rd, the reader
+ * @return 1 if the footer is valid, 0 otherwise
+ */
+static char rec_rd_read_footer(rec_rd_t* rec_rd){
+
+	const rec_file_footer_t* footer;
+
+	if(rec_rd->size<sizeof(rec_file_header_t)+sizeof(rec_file_footer_t)){
+		return 0;
+	}
+
+	footer = (const rec_file_footer_t*)&(rec_rd->map[rec_rd->size-sizeof(rec_file_footer_t)]);
+
+	if(footer->magic!=REC_INDEX_MAGIC || footer->index_offset<sizeof(rec_file_header_t) ||
+	   footer->index_offset%REC_BLOCK_ALIGN ||
+	   footer->nb_entries>(rec_rd->size-sizeof(rec_file_footer_t))/sizeof(rec_index_entry_t) ||
+	   footer->index_offset+footer->nb_entries*sizeof(rec_index_entry_t)+sizeof(rec_file_footer_t)!=rec_rd->size){
+		return 0;
+	}
+
+	rec_rd->data_end = footer->index_offset;
+	rec_rd->end_sample = footer->end_sample;
+	rec_rd->index = (const rec_index_entry_t*)&(rec_rd->map[footer->index_offset]);
+	rec_rd->nb_entries = footer->nb_entries;
+	rec_rd->index_rebuilt = 0;
+
+	return 1;
+}
+
+/**
+ * void rec_rd_rebuild_index(rec_rd_t* rec_rd)
+ * @brief Scans the blocks of a recording that was not closed and indexes
+ *        them like the recorder does
+ * @param rec_rd, the reader
+ */
+static void rec_rd_rebuild_index(rec_rd_t* rec_rd){
+
+	uint64_t offset = sizeof(rec_file_header_t);
+	uint64_t nb_blocks = 0;
+	uint64_t capacity = 64;
+	rec_index_entry_t* index = (rec_index_entry_t*)malloc(capacity*sizeof(rec_index_entry_t));
+	const rec_block_header_t* block;
+
+	rec_rd->nb_entries = 0;
+	rec_rd->data_end = offset;
+
+	while(offset<rec_rd->size){
+
+		/*skip up to the next sync marker*/
+		if(!rec_rd_valid_block(rec_rd, offset, rec_rd->size)){
+			offset += REC_BLOCK_ALIGN;
+			continue;
+		}
+
+		block = (const rec_block_header_t*)&(rec_rd->map[offset]);
+
+		if(nb_blocks%REC_INDEX_INTERVAL==0){
+			if(rec_rd->nb_entries>=capacity){
+				capacity *= 2;
+				index = (rec_index_entry_t*)realloc(index, capacity*sizeof(rec_index_entry_t));
+			}
+			index[rec_rd->nb_entries].first_sample = block->first_sample;
+			index[rec_rd->nb_entries].timestamp_ns = block->timestamp_ns;
+			index[rec_rd->nb_entries].offset = offset;
+			rec_rd->nb_entries++;
+		}
+
+		nb_blocks++;
+		offset += REC_BLOCK_FILE_SIZE(block->payload_size);
+		rec_rd->data_end = offset;
+		rec_rd->end_sample = block->first_sample+block->nb_samples;
+	}
+
+	rec_rd->index = index;
+	rec_rd->index_rebuilt = 1;
+}
@@ -0,0 +1,368 @@
+/**
+ * @file rec_wrt_file.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Recording output. The samples are gathered in blocks of REC_BLOCK_SIZE
+ *        consecutive samples. When a block is full (or the stream jumps), each
+ *        channel is brought back to the ADC codes of the hardware, using the
+ *        scale and offset of the recording, and encoded by the lossless codec.
+ *        A channel of the block whose values are not all on the grid of codes
+ *        (filtered, gaps filled with nan, flags) is encoded as the bits of its
+ *        floats instead, so the recording never loses information. A value
+ *        is on the grid only when its code gives it back to the bit
+ *        (REC_CODE_VALUE), the drivers keep the codes and convert each sample
+ *        so (muse_code_value).
+ *
+ *        Every REC_INDEX_INTERVAL blocks, the position of the block is kept in
+ *        the index, written with the footer when the recording is closed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "data_output.h"
+#include "eeg_codec.h"
+#include "rec_wrt_file.h"
+#include "trace.h"
+#include "stats.h"
+
+static void rec_wrt_flush(rec_wrt_t* rec_wrt);
+static void rec_wrt_index_block(rec_wrt_t* rec_wrt, rec_block_header_t* block_header);
+static void rec_wrt_write_index(rec_wrt_t* rec_wrt);
+static char rec_wrt_quantize(rec_wrt_t* rec_wrt, int channel);
+
+/**
+ * void* rec_wrt_init(void *param)
+ * @brief Creates the recording and writes its header
+ * @param param, refers to a rec_file_options_t
+ * @return initialized recording output, NULL otherwise
+ */
+void* rec_wrt_init(void *param){
+
+	int c;
+	rec_file_options_t* options = (rec_file_options_t*)param;
+	rec_wrt_t* rec_wrt;
+
+	if(options->nb_data_channels<=0 || options->nb_data_channels>SHM_MAX_CHANNELS){
+		fprintf(stderr, "recording: invalid number of channels\n");
+		return NULL;
+	}
+
+	rec_wrt = (rec_wrt_t*)malloc(sizeof(rec_wrt_t));
+	memset(rec_wrt, 0, sizeof(rec_wrt_t));
+
+	rec_wrt->file = fopen(options->filename, "wb");
+	if(rec_wrt->file==NULL){
+		perror("fopen");
+		free(rec_wrt);
+		return NULL;
+	}
+
+	/*description of the recording*/
+	rec_wrt->header.magic = REC_FILE_MAGIC;
+	rec_wrt->header.version = REC_FILE_VERSION;
+	rec_wrt->header.nb_channels = options->nb_data_channels;
+	rec_wrt->header.rate = (options->rate>0)?options->rate:0;
+	rec_wrt->header.block_size = REC_BLOCK_SIZE;
+	rec_wrt->raw_codes = options->raw_codes;
+	for(c=0;c<options->nb_data_channels;c++){
+		if(options->scale!=NULL){
+			rec_wrt->header.scale[c] = options->scale[c];
+			rec_wrt->header.offset[c] = options->offset[c];
+		}
+		/*raw codes of an unknown hardware are read back as they are*/
+		if(rec_wrt->raw_codes && rec_wrt->header.scale[c]<=0){
+			rec_wrt->header.scale[c] = 1;
+			rec_wrt->header.offset[c] = 0;
+		}
+		if(options->channel_names!=NULL){
+			memcpy(rec_wrt->header.channel_names[c], &(options->channel_names[c*SHM_CHANNEL_NAME_LENGTH]), SHM_CHANNEL_NAME_LENGTH);
+		}
+	}
+
+	rec_wrt->samples = (float*)malloc(REC_BLOCK_SIZE*options->nb_data_channels*sizeof(float));
+	rec_wrt->codes = (int32_t*)malloc(REC_BLOCK_SIZE*sizeof(int32_t));
+	rec_wrt->payload = (uint8_t*)malloc(options->nb_data_channels*EEG_CODEC_MAX_BYTES(REC_BLOCK_SIZE)+REC_BLOCK_ALIGN);
+	rec_wrt->offset = sizeof(rec_file_header_t);
+
+	if(fwrite(&(rec_wrt->header), sizeof(rec_file_header_t), 1, rec_wrt->file)!=1){
+		perror("fwrite");
+		rec_wrt_cleanup((void*)rec_wrt);
+		return NULL;
+	}
+
+	return (void*)rec_wrt;
+}
+
+/**
+ * int rec_wrt_write_in_buf(void *param, void *input)
+ * @brief Adds one sample to the recording
+ * @param param, the recording output
+ * @param input, refers to a data_t pointer
+ * @return EXIT_SUCCESS
+ */
+int rec_wrt_write_in_buf(void *param, void *input){
+
+	data_t* data = (data_t*)input;
+	data_block_t data_block;
+
+	rec_wrt_t* rec_wrt = (rec_wrt_t*)param;
+
+	/*single samples carry no stream information*/
+	data_block.nb_samples = 1;
+	data_block.nb_data = data->nb_data;
+	data_block.ptr = (float*)data->ptr;
+	data_block.first_sample = rec_wrt->sample_idx;
+	data_block.timestamp_ns = 0;
+	data_block.sample_period_ns = 0;
+	data_block.flags = 0;
+
+	return rec_wrt_write_block_in_buf(param, &data_block);
+}
+
+/**
+ * int rec_wrt_write_block_in_buf(void *param, void *input)
+ * @brief Adds a block of samples to the recording, the completed blocks are
+ *        encoded and written
+ * @param param, the recording output
+ * @param input, refers to a data_block_t pointer
+ * @return EXIT_SUCCESS
+ */
+int rec_wrt_write_block_in_buf(void *param, void *input){
+
+	int nb_written = 0;
+	int nb_to_write;
+	int nb_channels;
+
+	rec_wrt_t* rec_wrt = (rec_wrt_t*)param;
+	data_block_t* block = (data_block_t*)input;
+
+	nb_channels = rec_wrt->header.nb_channels;
+
+	/*a block holds consecutive samples, close it if the stream jumps*/
+	if(rec_wrt->nb_samples>0 && block->first_sample!=rec_wrt->sample_idx){
+		rec_wrt_flush(rec_wrt);
+	}
+
+	while(nb_written<block->nb_samples){
+
+		/*the block starts here, it takes the timing*/
+		if(rec_wrt->nb_samples==0){
+			rec_wrt->first_sample = block->first_sample+nb_written;
+			rec_wrt->timestamp_ns = 0;
+			if(block->timestamp_ns){
+				rec_wrt->timestamp_ns = block->timestamp_ns+(int64_t)(nb_written*block->sample_period_ns);
+			}
+			rec_wrt->sample_period_ns = block->sample_period_ns;
+			rec_wrt->flags = 0;
+		}
+
+		nb_to_write = REC_BLOCK_SIZE-rec_wrt->nb_samples;
+		if(nb_to_write>block->nb_samples-nb_written){
+			nb_to_write = block->nb_samples-nb_written;
+		}
+
+		memcpy(&(rec_wrt->samples[rec_wrt->nb_samples*nb_channels]), &(block->ptr[nb_written*block->nb_data]),
+		       nb_to_write*nb_channels*sizeof(float));
+		rec_wrt->nb_samples += nb_to_write;
+		rec_wrt->flags |= block->flags;
+		nb_written += nb_to_write;
+		TRACE_POINT(TRACE_PAGE_FILL);
+
+		if(rec_wrt->nb_samples>=REC_BLOCK_SIZE){
+			rec_wrt_flush(rec_wrt);
+		}
+	}
+
+	rec_wrt->sample_idx = block->first_sample+block->nb_samples;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int rec_wrt_cleanup(void *param)
+ * @brief Writes the last block, the index and closes the recording
+ * @param param, the recording output
+ * @return EXIT_SUCCESS
+ */
+int rec_wrt_cleanup(void *param){
+
+	rec_wrt_t* rec_wrt = (rec_wrt_t*)param;
+
+	rec_wrt_flush(rec_wrt);
+	rec_wrt_write_index(rec_wrt);
+	fclose(rec_wrt->file);
+
+	free(rec_wrt->index);
+	free(rec_wrt->samples);
+	free(rec_wrt->codes);
+	free(rec_wrt->payload);
+	free(rec_wrt);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void rec_wrt_flush(rec_wrt_t* rec_wrt)
+ * @brief Encodes the block in progress, channel after channel, and writes it
+ * @param rec_wrt, the recording output
+ */
+static void rec_wrt_flush(rec_wrt_t* rec_wrt){
+
+	int c, i;
+	int nb_bytes;
+	float value;
+	uint64_t file_size;
+	int nb_channels = rec_wrt->header.nb_channels;
+	rec_block_header_t block_header;
+
+	if(rec_wrt->nb_samples==0){
+		return;
+	}
+
+	block_header.sync = REC_BLOCK_SYNC;
+	block_header.payload_size = 0;
+	block_header.first_sample = rec_wrt->first_sample;
+	block_header.timestamp_ns = rec_wrt->timestamp_ns;
+	block_header.sample_period_ns = rec_wrt->sample_period_ns;
+	block_header.float_channels = 0;
+	block_header.nb_samples = rec_wrt->nb_samples;
+	block_header.flags = rec_wrt->flags;
+
+	for(c=0;c<nb_channels;c++){
+
+		/*back to the codes, or the bits of the floats*/
+		if(!rec_wrt_quantize(rec_wrt, c)){
+			for(i=0;i<rec_wrt->nb_samples;i++){
+				value = rec_wrt->samples[i*nb_channels+c];
+				/*raw codes are read in the unit of the scale, as the coded channels*/
+				if(rec_wrt->raw_codes){
+					value = REC_CODE_VALUE(rec_wrt->header.offset[c], rec_wrt->header.scale[c], value);
+				}
+				memcpy(&(rec_wrt->codes[i]), &value, sizeof(int32_t));
+			}
+			block_header.float_channels |= (uint64_t)1<<c;
+		}
+
+		nb_bytes = eeg_codec_encode(rec_wrt->codes, rec_wrt->nb_samples, &(rec_wrt->payload[block_header.payload_size]));
+		block_header.payload_size += nb_bytes;
+	}
+
+	/*zeros up to the next block*/
+	file_size = REC_BLOCK_FILE_SIZE(block_header.payload_size)-sizeof(rec_block_header_t);
+	memset(&(rec_wrt->payload[block_header.payload_size]), 0, file_size-block_header.payload_size);
+
+	rec_wrt_index_block(rec_wrt, &block_header);
+
+	if(fwrite(&block_header, sizeof(rec_block_header_t), 1, rec_wrt->file)!=1 ||
+	   fwrite(rec_wrt->payload, 1, file_size, rec_wrt->file)!=file_size){
+		perror("fwrite");
+	}
+	TRACE_POINT(TRACE_PAGE_POST);
+	STATS_ADD(pages_published, 1);
+
+	rec_wrt->offset += REC_BLOCK_FILE_SIZE(block_header.payload_size);
+	rec_wrt->nb_blocks++;
+	rec_wrt->nb_samples = 0;
+}
+
+/**
+ * void rec_wrt_index_block(rec_wrt_t* rec_wrt, rec_block_header_t* block_header)
+ * @brief Keeps the position of the block about to be written, every
+ *        REC_INDEX_INTERVAL blocks
+ * @param rec_wrt, the recording output
+ * @param block_header, of the block
+ */
+static void rec_wrt_index_block(rec_wrt_t* rec_wrt, rec_block_header_t* block_header){
+
+	rec_index_entry_t* entry;
+
+	if(rec_wrt->nb_blocks%REC_INDEX_INTERVAL){
+		return;
+	}
+
+	if(rec_wrt->nb_entries>=rec_wrt->index_capacity){
+		rec_wrt->index_capacity = rec_wrt->index_capacity?2*rec_wrt->index_capacity:64;
+		rec_wrt->index = (rec_index_entry_t*)realloc(rec_wrt->index, rec_wrt->index_capacity*sizeof(rec_index_entry_t));
+	}
+
+	entry = &(rec_wrt->index[rec_wrt->nb_entries++]);
+	entry->first_sample = block_header->first_sample;
+	entry->timestamp_ns = block_header->timestamp_ns;
+	entry->offset = rec_wrt->offset;
+}
+
+/**
+ * void rec_wrt_write_index(rec_wrt_t* rec_wrt)
+ * @brief Writes the index and the footer after the last block
+ * @param rec_wrt, the recording output
+ */
+static void rec_wrt_write_index(rec_wrt_t* rec_wrt){
+
+	rec_file_footer_t footer;
+
+	footer.magic = REC_INDEX_MAGIC;
+	footer.interval = REC_INDEX_INTERVAL;
+	footer.index_offset = rec_wrt->offset;
+	footer.nb_entries = rec_wrt->nb_entries;
+	footer.end_sample = rec_wrt->sample_idx;
+
+	if((rec_wrt->nb_entries>0 &&
+	    fwrite(rec_wrt->index, sizeof(rec_index_entry_t), rec_wrt->nb_entries, rec_wrt->file)!=rec_wrt->nb_entries) ||
+	   fwrite(&footer, sizeof(rec_file_footer_t), 1, rec_wrt->file)!=1){
+		perror("fwrite");
+	}
+}
+
+/**
+ * char rec_wrt_quantize(rec_wrt_t* rec_wrt, int channel)
+ * @brief Converts a channel of the block in progress to ADC codes. A value is
+ *        kept as a code only when the code gives it back to the bit: raw
+ *        codes must be integers, the other values REC_CODE_VALUE of their
+ *        code. A missing value or an interpolated one keeps the channel out
+ *        of the grid.
+ * @param rec_wrt, the recording output
+ * @param channel
+ * @return 1 if every value is on the grid of codes, 0 otherwise
+ */
+static char rec_wrt_quantize(rec_wrt_t* rec_wrt, int channel){
+
+	int i;
+	float x;
+	double code;
+	float scale = rec_wrt->header.scale[channel];
+	float offset = rec_wrt->header.offset[channel];
+	int nb_channels = rec_wrt->header.nb_channels;
+
+	if(rec_wrt->raw_codes){
+		for(i=0;i<rec_wrt->nb_samples;i++){
+			x = rec_wrt->samples[i*nb_channels+channel];
+			code = nearbyint(x);
+			/*nan fails the test*/
+			if(!(code==x) || fabs(code)>INT32_MAX){
+				return 0;
+			}
+			rec_wrt->codes[i] = (int32_t)code;
+		}
+		return 1;
+	}
+
+	if(scale<=0){
+		return 0;
+	}
+
+	for(i=0;i<rec_wrt->nb_samples;i++){
+
+		x = rec_wrt->samples[i*nb_channels+channel];
+		code = nearbyint(((double)x-offset)/scale);
+
+		/*nan fails the test*/
+		if(!(fabs(code)<=INT32_MAX) || REC_CODE_VALUE(offset, scale, (int32_t)code)!=x){
+			return 0;
+		}
+		rec_wrt->codes[i] = (int32_t)code;
+	}
+
+	return 1;
+}
@@ -16,6 +16,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
@@ -24,6 +25,8 @@
 #include "data_output.h"
 #include "shsem_def.h"
 #include "shm_wrt_buf.h"
+#include "trace.h"
+#include "stats.h"
 
 /* arg for semctl system calls. */
 union semun {
@@ -34,6 +37,12 @@ union semun {
 		void *__pad;
 };
 
+static char shm_wrt_open_page(shm_wrt_t* shm_wrt);
+static void shm_wrt_close_page(shm_wrt_t* shm_wrt);
+static void shm_wrt_write_header(shm_wrt_t* shm_wrt);
+static void shm_wrt_copy(shm_wrt_t* shm_wrt, char* page_ptr, float* values, int nb_values);
+static void shm_wrt_drop(shm_wrt_t* shm_wrt, int nb_samples);
+
 /**
  * int shm_wrt_init(void *param)
  * @brief Setups the shared memory output (memory allocation, linking and semaphores)
@@ -51,7 +60,9 @@ void* shm_wrt_init(void *param){
 	memcpy((void*)&(shm_wrt->shm_options),param,sizeof(shm_mem_options_t));	           
 		        
     /*initialise the shared memory array*/
-	if((shm_wrt->shmid = shmget(shm_wrt->shm_options.shm_key, shm_wrt->shm_options.buffer_size, IPC_CREAT | 0666)) < 0) {
+	if((shm_wrt->shmid = shmget(shm_wrt->shm_options.shm_key, 
+	                            SHM_SEGMENT_SIZE(shm_wrt->shm_options.page_size,shm_wrt->shm_options.nb_pages), 
+	                            IPC_CREAT | 0666)) < 0) {
         perror("shmget");
         return NULL;
     }
@@ -62,15 +73,25 @@ void* shm_wrt_init(void *param){
         return NULL;
     }
     
+    /*the page metadata sits after the pages*/
+    shm_wrt->page_meta = (shm_page_meta_t*)&(shm_wrt->shm_buf[SHM_PAGE_META_OFFSET(shm_wrt->shm_options.page_size,
+                                                                                shm_wrt->shm_options.nb_pages)]);
+    memset((void*)shm_wrt->page_meta, 0, shm_wrt->shm_options.nb_pages*sizeof(shm_page_meta_t));
+    
+    /*then the description of the stream*/
+    shm_wrt_write_header(shm_wrt);
+    
     /*Access the semaphore array*/
 	if ((shm_wrt->semid = semget(shm_wrt->shm_options.sem_key, NB_SEM, IPC_CREAT | 0666)) == -1) {
 		perror("semget failed\n");
 		return NULL;
     } 
 
-	/*set semaphores initial value to 0*/
-    semopts.val = 0;
-    semctl( shm_wrt->semid, 0, SETVAL, semopts);
+	/*set semaphores initial value to 0, by the ring owning the set only*/
+	if (shm_wrt->shm_options.sem_owner) {
+		semopts.val = 0;
+		semctl( shm_wrt->semid, shm_wrt->shm_options.sem_page_written, SETVAL, semopts);
+	}
 	
 	/*allocate the memory for the pointer to semaphore operations*/
 	shm_wrt->sops = (struct sembuf *) malloc(sizeof(struct sembuf));
@@ -79,6 +100,9 @@ void* shm_wrt_init(void *param){
 	shm_wrt->samples_count = 0;
 	shm_wrt->current_page = 0;
 	shm_wrt->page_opened = 0x00;
+	shm_wrt->sample_idx = 0;
+	shm_wrt->sample_size = (shm_wrt->shm_options.sample_format==SHM_SAMPLE_INT16)?sizeof(int16_t):sizeof(float);
+	shm_wrt->nb_dropped = 0;
 
 	return (void*)shm_wrt;
 }
@@ -102,56 +126,278 @@ int shm_wrt_write_in_buf(void *param, void* input){
 	
 	data_t* data = (data_t *) input; 
 	
-	/*check if the page is not opened*/
-	if(!shm_wrt->page_opened){
-		/*if not opened*/
-		/*check if the current page is available (semaphore)*/
-		shm_wrt->sops->sem_num = PREPROC_IN_READY; /*sem that indicates that a page is free to write to*/
-		shm_wrt->sops->sem_op = -1; /*decrement semaphore*/
-		shm_wrt->sops->sem_flg = IPC_NOWAIT; /*undo if fails and non-blocking call*/	
-		if(semop(shm_wrt->semid, shm_wrt->sops, 1) == 0){
-			/*yes, open the page*/
-			shm_wrt->page_opened = 0x01;
-		}
-	}
-	
 	/*if the page is opened*/
-	if(shm_wrt->page_opened){
+	if(shm_wrt_open_page(shm_wrt)){
 		
 		/*compute the write location*/
 		write_ptr = shm_wrt->shm_options.page_size*shm_wrt->current_page+
-		            shm_wrt->shm_options.nb_data_channels*sizeof(float)*shm_wrt->samples_count;
+		            shm_wrt->shm_options.nb_data_channels*shm_wrt->sample_size*shm_wrt->samples_count;
 		
 		/*write data*/
-		memcpy((void*)&(shm_wrt->shm_buf[write_ptr]),(void*)data->ptr, data->nb_data*sizeof(float));
+		shm_wrt_copy(shm_wrt, &(shm_wrt->shm_buf[write_ptr]), (float*)data->ptr, data->nb_data);
+		TRACE_POINT(TRACE_PAGE_FILL);
 				
 		shm_wrt->samples_count++;
 		
 		/*check if the page is full*/
 		if(shm_wrt->samples_count>=shm_wrt->shm_options.window_size){
-		
-			/*close the page*/
-			shm_wrt->page_opened = 0x00;
-			/*change the page*/
-			shm_wrt->current_page = (shm_wrt->current_page+1)%shm_wrt->shm_options.nb_pages;
-			/*reset nb of samples read*/
-			shm_wrt->samples_count = 0; 
-			
-			/*post the semaphore*/
-			shm_wrt->sops->sem_num = INTERFACE_OUT_READY;  /*sem that indicates that a page has been written to*/
-			shm_wrt->sops->sem_op = 1; /*increment semaphore of one*/
-			shm_wrt->sops->sem_flg = IPC_NOWAIT; /*undo if fails and non-blocking call*/
-			semop(shm_wrt->semid, shm_wrt->sops, 1);
+			shm_wrt_close_page(shm_wrt);
 		}
 		
 	}
 	else{
-		/*else drop the sample (do nothing)*/
+		/*else drop the sample*/
+		shm_wrt_drop(shm_wrt, 1);
 	}
 	
+	/*the sample is counted, even if dropped*/
+	shm_wrt->sample_idx++;
+	
 	return EXIT_SUCCESS;
 }
 
+/**
+ * int shm_wrt_write_block_in_buf(void *param, void* input)
+ * @brief Writes a block of samples to the shared memory. Samples are copied
+ *        by runs that fit in the current page. Filled gaps are reported in 
+ *        the metadata of the pages they land in.
+ * @param param, refers to the shm output
+ * @param input, refers to a data_block_t pointer, which contains the data to be written
+ * @return EXIT_SUCCESS
+ */
+int shm_wrt_write_block_in_buf(void *param, void* input){
+	
+	int write_ptr;
+	int nb_written = 0;
+	int nb_to_write;
+	shm_page_meta_t* meta;
+	
+	/*re-cast param for readability*/
+	shm_wrt_t* shm_wrt = (shm_wrt_t*)param;
+	data_block_t* block = (data_block_t*)input;
+	
+	/*the block carries the stream index, resync on it*/
+	shm_wrt->sample_idx = block->first_sample;
+	
+	/*while there are samples left and a page to write them in*/
+	while(nb_written<block->nb_samples && shm_wrt_open_page(shm_wrt)){
+		
+		/*the page starts with this block, it takes its timing*/
+		meta = &(shm_wrt->page_meta[shm_wrt->current_page]);
+		if(shm_wrt->samples_count==0 && block->timestamp_ns){
+			meta->timestamp_ns = block->timestamp_ns+(int64_t)(nb_written*block->sample_period_ns);
+			meta->sample_period_ns = block->sample_period_ns;
+		}
+		
+		/*write as much as the page can take*/
+		nb_to_write = shm_wrt->shm_options.window_size-shm_wrt->samples_count;
+		if(nb_to_write>block->nb_samples-nb_written){
+			nb_to_write = block->nb_samples-nb_written;
+		}
+		
+		/*compute the write location*/
+		write_ptr = shm_wrt->shm_options.page_size*shm_wrt->current_page+
+		            shm_wrt->shm_options.nb_data_channels*shm_wrt->sample_size*shm_wrt->samples_count;
+		
+		/*write data*/
+		shm_wrt_copy(shm_wrt, &(shm_wrt->shm_buf[write_ptr]), &(block->ptr[nb_written*block->nb_data]),
+		             nb_to_write*block->nb_data);
+		TRACE_POINT(TRACE_PAGE_FILL);
+		
+		/*report the gap in the page metadata*/
+		if(block->flags&BLOCK_GAP_FILL){
+			if(meta->nb_gap_samples==0){
+				meta->gap_start = shm_wrt->samples_count;
+			}
+			meta->nb_gaps++;
+			meta->nb_gap_samples += nb_to_write;
+		}
+		
+		shm_wrt->samples_count += nb_to_write;
+		shm_wrt->sample_idx += nb_to_write;
+		nb_written += nb_to_write;
+		
+		/*check if the page is full*/
+		if(shm_wrt->samples_count>=shm_wrt->shm_options.window_size){
+			shm_wrt_close_page(shm_wrt);
+		}
+	}
+	
+	/*samples left are dropped, but still counted*/
+	shm_wrt->sample_idx += block->nb_samples-nb_written;
+	shm_wrt_drop(shm_wrt, block->nb_samples-nb_written);
+	
+	return EXIT_SUCCESS;
+}
+
+/**
+ * char shm_wrt_open_page(shm_wrt_t* shm_wrt)
+ * @brief Makes sure a page is opened for writing. If no page is opened, checks 
+ *        if the current page is available and resets its metadata.
+ * @param shm_wrt, the shm output
+ * @return 1 if a page is opened, 0 otherwise
+ */
+static char shm_wrt_open_page(shm_wrt_t* shm_wrt){
+	
+	shm_page_meta_t* meta;
+	
+	/*check if the page is not opened*/
+	if(!shm_wrt->page_opened){
+		/*if not opened*/
+		/*check if the current page is available (semaphore)*/
+		shm_wrt->sops->sem_num = shm_wrt->shm_options.sem_page_free; /*sem that indicates that a page is free to write to*/
+		shm_wrt->sops->sem_op = -1; /*decrement semaphore*/
+		shm_wrt->sops->sem_flg = IPC_NOWAIT; /*undo if fails and non-blocking call*/	
+		if(semop(shm_wrt->semid, shm_wrt->sops, 1) == 0){
+			/*yes, open the page*/
+			shm_wrt->page_opened = 0x01;
+			
+			/*and start its metadata*/
+			meta = &(shm_wrt->page_meta[shm_wrt->current_page]);
+			meta->first_sample = shm_wrt->sample_idx;
+			meta->nb_samples = 0;
+			meta->nb_gaps = 0;
+			meta->gap_start = 0;
+			meta->nb_gap_samples = 0;
+			meta->timestamp_ns = 0;
+			meta->sample_period_ns = 0;
+		}
+	}
+	
+	return shm_wrt->page_opened;
+}
+
+/**
+ * void shm_wrt_close_page(shm_wrt_t* shm_wrt)
+ * @brief Closes the current page, moves to the next one and informs the reader
+ * @param shm_wrt, the shm output
+ */
+static void shm_wrt_close_page(shm_wrt_t* shm_wrt){
+	
+	/*complete the metadata*/
+	shm_wrt->page_meta[shm_wrt->current_page].nb_samples = shm_wrt->samples_count;
+	
+	/*close the page*/
+	shm_wrt->page_opened = 0x00;
+	/*change the page*/
+	shm_wrt->current_page = (shm_wrt->current_page+1)%shm_wrt->shm_options.nb_pages;
+	/*reset nb of samples read*/
+	shm_wrt->samples_count = 0; 
+	
+	/*post the semaphore*/
+	shm_wrt->sops->sem_num = shm_wrt->shm_options.sem_page_written;  /*sem that indicates that a page has been written to*/
+	shm_wrt->sops->sem_op = 1; /*increment semaphore of one*/
+	shm_wrt->sops->sem_flg = IPC_NOWAIT; /*undo if fails and non-blocking call*/
+	semop(shm_wrt->semid, shm_wrt->sops, 1);
+	TRACE_POINT(TRACE_PAGE_POST);
+	
+	/*the pages posted and not taken yet*/
+	STATS_ADD(pages_published, 1);
+	STATS_SET(reader_lag, semctl(shm_wrt->semid, shm_wrt->shm_options.sem_page_written, GETVAL));
+}
+
+/**
+ * void shm_wrt_drop(shm_wrt_t* shm_wrt, int nb_samples)
+ * @brief Counts the samples dropped for lack of a free page, and a page
+ *        dropped every window_size of them
+ * @param shm_wrt, the shm output
+ * @param nb_samples, dropped
+ */
+static void shm_wrt_drop(shm_wrt_t* shm_wrt, int nb_samples){
+	
+	if(nb_samples<=0){
+		return;
+	}
+	
+	STATS_ADD(samples_dropped, nb_samples);
+	
+	shm_wrt->nb_dropped += nb_samples;
+	if(shm_wrt->nb_dropped>=shm_wrt->shm_options.window_size){
+		STATS_ADD(pages_dropped, shm_wrt->nb_dropped/shm_wrt->shm_options.window_size);
+		shm_wrt->nb_dropped %= shm_wrt->shm_options.window_size;
+	}
+}
+
+/**
+ * void shm_wrt_write_header(shm_wrt_t* shm_wrt)
+ * @brief Writes the description of the stream after the page metadata. The
+ *        magic is written last, readers check it before trusting the header.
+ * @param shm_wrt, the shm output
+ */
+static void shm_wrt_write_header(shm_wrt_t* shm_wrt){
+	
+	int i;
+	int nb_channels = shm_wrt->shm_options.nb_data_channels;
+	shm_stream_header_t* header = (shm_stream_header_t*)&(shm_wrt->shm_buf[SHM_STREAM_HEADER_OFFSET(shm_wrt->shm_options.page_size,
+	                                                                                                shm_wrt->shm_options.nb_pages)]);
+	
+	memset((void*)header, 0, sizeof(shm_stream_header_t));
+	
+	header->nb_channels = nb_channels;
+	header->rate = shm_wrt->shm_options.rate;
+	header->sample_format = shm_wrt->shm_options.sample_format;
+	
+	/*how to get the physical values*/
+	for(i=0;i<nb_channels && i<SHM_MAX_CHANNELS;i++){
+		header->scale[i] = 1;
+		header->offset[i] = 0;
+		if(shm_wrt->shm_options.scale!=NULL){
+			header->scale[i] = shm_wrt->shm_options.scale[i];
+			header->offset[i] = shm_wrt->shm_options.offset[i];
+		}
+	}
+	
+	if(shm_wrt->shm_options.channel_names!=NULL){
+		for(i=0;i<nb_channels && i<SHM_MAX_CHANNELS;i++){
+			strncpy(header->channel_names[i], &(shm_wrt->shm_options.channel_names[i*SHM_CHANNEL_NAME_LENGTH]),
+			        SHM_CHANNEL_NAME_LENGTH-1);
+		}
+	}
+	
+	__sync_synchronize();
+	header->magic = SHM_STREAM_MAGIC;
+	
+	/*the names and scales are only valid during init*/
+	shm_wrt->shm_options.channel_names = NULL;
+	shm_wrt->shm_options.scale = NULL;
+	shm_wrt->shm_options.offset = NULL;
+}
+
+/**
+ * void shm_wrt_copy(shm_wrt_t* shm_wrt, char* page_ptr, float* values, int nb_values)
+ * @brief Copies values in a page, in the format of the pages. The int16 codes
+ *        are rounded, a missing value (nan) is written as SHM_INT16_MISSING.
+ * @param shm_wrt, the shm output
+ * @param page_ptr, where to write in the page
+ * @param values, the values
+ * @param nb_values
+ */
+static void shm_wrt_copy(shm_wrt_t* shm_wrt, char* page_ptr, float* values, int nb_values){
+	
+	int i;
+	long code;
+	int16_t* codes = (int16_t*)page_ptr;
+	
+	if(shm_wrt->shm_options.sample_format!=SHM_SAMPLE_INT16){
+		memcpy((void*)page_ptr, (void*)values, nb_values*sizeof(float));
+		return;
+	}
+	
+	for(i=0;i<nb_values;i++){
+		if(isnan(values[i])){
+			codes[i] = SHM_INT16_MISSING;
+			continue;
+		}
+		code = lrintf(values[i]);
+		if(code<=SHM_INT16_MISSING){
+			code = SHM_INT16_MISSING+1;
+		} else if(code>INT16_MAX){
+			code = INT16_MAX;
+		}
+		codes[i] = (int16_t)code;
+	}
+}
+
 /**
  * int shm_cleanup((void *param)
  * @brief Clean up the shared memory: detach, deallocate mem and sem
@@ -167,8 +413,10 @@ int shm_wrt_cleanup(void *param){
 	shmdt(shm_wrt->shm_buf);
 	/* Deallocate the shared memory segment. */
 	shmctl(shm_wrt->shmid, IPC_RMID, 0);
-	/* Deallocate the semaphore array. */
-	semctl(shm_wrt->semid, 0, IPC_RMID, 0);
+	/* Deallocate the semaphore array, if this ring owns it. */
+	if (shm_wrt->shm_options.sem_owner) {
+		semctl(shm_wrt->semid, 0, IPC_RMID, 0);
+	}
 	
 	return EXIT_SUCCESS;
 }
@@ -2,7 +2,10 @@
  * @file fake_muse.c
  * @author Frederic Simard (frederic.simard.1@outlook.com) || Atlants Embedded
  * @brief Handles all MUSE related function pointers, by implementing a 
- *        fake hardware, for offline testing and debugging.
+ *        fake hardware, for offline testing and debugging. The fake headset
+ *        encodes a synthetic signal in Muse bluetooth buffers (sync, DRL/REF,
+ *        compressed and uncompressed packets) and feeds them to the real
+ *        decoder, muse_process_pkt().
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,9 +19,20 @@
 #include "hardware.h"
 #include "main.h"
 #include "muse.h"
+#include "muse_pack_encoder.h"
 #include "fake_muse.h"
 #include "xml.h"
 #include "data_output.h"
+#include "clock_sync.h"
+#include "trace.h"
+#include "stats.h"
+#include "timer_wheel.h"
+
+/*running index of the next sample produced by the fake headset*/
+static uint64_t sample_idx = 0;
+
+/*encoder of the bluetooth buffers*/
+static muse_encoder_t fake_muse_encoder;
 
 /**
  * fake_muse_init_hardware()
@@ -44,6 +58,8 @@ int fake_muse_cleanup(void *param __attribute__ ((unused)))
  */
 int fake_muse_init_hardware(void *param __attribute__ ((unused)))
 {
+	muse_encoder_init(&fake_muse_encoder, FAKE_MUSE_REFRESH_PERIOD, FAKE_MUSE_SAMPLING_RATE, FAKE_MUSE_CHANNEL_BITS);
+	muse_init_code_value();
 	return 0x00;
 }
 
@@ -54,17 +70,21 @@ int fake_muse_init_hardware(void *param __attribute__ ((unused)))
 int fake_muse_translate_pkt(void *packet,void *output)
 {
 	int i,j;
-	int delta_offset;
 	muse_translt_pkt_t *muse_trslt_pkt_ptr = (muse_translt_pkt_t *) packet;
 	output_interface_array_t *output_intrface_array = (output_interface_array_t *) output;
 	
 	/*new samples might be relative to last sample, we keep the current*/
-	/*eeg data in a persistent output, until it's being replaced.*/
-	static float cur_eeg_values[MUSE_NB_CHANNELS];
+	/*codes in a persistent output, until they are replaced.*/
+	static int cur_eeg_codes[MUSE_NB_CHANNELS];
 	
-	data_t data_struct;
-	data_struct.nb_data = MUSE_NB_CHANNELS;
-	data_struct.ptr = cur_eeg_values;
+	float eeg_block[MUSE_NB_DELTAS*MUSE_NB_CHANNELS];
+	
+	/*the fake headset runs on the host clock, no drift to correct*/
+	data_block_t data_block;
+	data_block.nb_data = MUSE_NB_CHANNELS;
+	data_block.ptr = eeg_block;
+	data_block.sample_period_ns = FAKE_MUSE_PERIOD_NS;
+	data_block.flags = 0;
 	
 	/*Check the type of eeg samples we are receiving*/
 	switch(muse_trslt_pkt_ptr->type){
@@ -73,13 +93,23 @@ int fake_muse_translate_pkt(void *packet,void *output)
 			/*It's an uncompressed packet, we just received the actual eeg values*/
 			/*do nothing, the data is good*/
 			for(i=0;i<MUSE_NB_CHANNELS;i++){
-				cur_eeg_values[i] = (float)muse_trslt_pkt_ptr->eeg_data[i]/1023*1682;
+				cur_eeg_codes[i] = muse_trslt_pkt_ptr->eeg_data[i];
+				eeg_block[i] = muse_code_value(cur_eeg_codes[i]);
 			}
-					
+			
+			/*the samples dropped leave a gap in the index*/
+			sample_idx += muse_trslt_pkt_ptr->nb_dropped;
+			
+			data_block.nb_samples = 1;
+			data_block.first_sample = sample_idx++;
+			data_block.timestamp_ns = clock_sync_now_ns();
+			TRACE_POINT(TRACE_TRANSLATE);
+			STATS_ADD(samples_received, 1);
+			
 			/*Push the new sample in the output*/
 			for(i=0;i<output_intrface_array->nb_output;i++){
 				/*Push the new sample in the output*/
-				COPY_DATA_IN(output_intrface_array->output_interface[i], &data_struct);
+				COPY_BLOCK_IN(output_intrface_array->output_interface[i], &data_block);
 			}
 				
 			break;
@@ -87,21 +117,28 @@ int fake_muse_translate_pkt(void *packet,void *output)
 		case MUSE_COMPRESSED_PKT:
 		
 			/*It's a compressed packet, we just received the variation measured from previous sample*/
-			/*go over all deltas*/
+			/*go over all deltas, they are stored channel after channel*/
 			for(i=0;i<MUSE_NB_DELTAS;i++){
-				delta_offset = i*MUSE_NB_CHANNELS;	
 				
-				/*compute the new value from the previous value*/	
+				/*compute the new code from the previous code*/	
 				for(j=0;j<MUSE_NB_CHANNELS;j++){
-					cur_eeg_values[j] = cur_eeg_values[j]+(float)muse_trslt_pkt_ptr->eeg_data[delta_offset+j]/1023*1682;
-				}
-				
-				/*Push the new sample in the output*/
-				for(j=0;j<output_intrface_array->nb_output;j++){
-					/*Push the new sample in the output*/
-					COPY_DATA_IN(output_intrface_array->output_interface[j], &data_struct);
+					cur_eeg_codes[j] += muse_trslt_pkt_ptr->eeg_data[j*MUSE_NB_DELTAS+i];
+					eeg_block[i*MUSE_NB_CHANNELS+j] = muse_code_value(cur_eeg_codes[j]);
 				}
 			}
+			
+			/*the last sample of the packet was produced now*/
+			data_block.nb_samples = MUSE_NB_DELTAS;
+			data_block.first_sample = sample_idx;
+			data_block.timestamp_ns = clock_sync_now_ns()-(int64_t)(MUSE_NB_DELTAS-1)*FAKE_MUSE_PERIOD_NS;
+			sample_idx += MUSE_NB_DELTAS;
+			TRACE_POINT(TRACE_TRANSLATE);
+			STATS_ADD(samples_received, MUSE_NB_DELTAS);
+			
+			/*Push the new samples in the output*/
+			for(j=0;j<output_intrface_array->nb_output;j++){
+				COPY_BLOCK_IN(output_intrface_array->output_interface[j], &data_block);
+			}
 			break;
 	
 		default:
@@ -113,17 +150,10 @@ int fake_muse_translate_pkt(void *packet,void *output)
 
 /**
  * fake_muse_send_keep_alive_pkt(void)
- * @brief Sends a keep alive repeatedly while sleeping for the required 
- * time-out period.
+ * @brief Nothing to keep alive
  */
 int fake_muse_send_keep_alive_pkt(void *param __attribute__ ((unused)))
 {
-	int status = 0;
-
-	do {
-		sleep(10000);
-	} while (status > 0);
-
 	return (0);
 }
 
@@ -144,31 +174,33 @@ int fake_muse_send_pkt(void *param __attribute__ ((unused)))
 }
 
 /**
- * muse_process_pkt()
- * @brief Processes the packet
- * @param param
+ * fake_muse_process_pkt()
+ * @brief Produces the next sample of the fake headset and, when the encoder
+ *        completes a bluetooth buffer, decodes it like a received one
+ * @param packet, unused, the packets are produced here
+ * @param output
  */
 int fake_muse_process_pkt(void *packet __attribute__ ((unused)),void *output)
 {
-	int i=0;
+	int sample[MUSE_NB_CHANNELS];
+	unsigned char buffer[MUSE_ENCODER_MAX_BUFFER];
+	param_t param_process_pkt;
 	
-	/*This buffer will temporaly keep the decoded eeg data, 
-	  while it is being translated and put in a permanent
-	  container. Make sure the content stays valid until the 
-	  translation process has returned.*/
-	int eeg_data_buffer[MUSE_NB_CHANNELS*MUSE_NB_DELTAS] = { 0 };
-	muse_translt_pkt_t param_translate_pkt;
-	param_translate_pkt.eeg_data = eeg_data_buffer;
-	param_translate_pkt.nb_samples = MUSE_NB_CHANNELS;
-	param_translate_pkt.type = MUSE_UNCOMPRESS_PKT;
+	muse_synth_sample(fake_muse_encoder.nb_samples, FAKE_MUSE_SAMPLING_RATE, sample);
 	
-	/*fill with random values*/
-	for(i=0;i<MUSE_NB_CHANNELS;i++){
-		eeg_data_buffer[i] = rand()%1023;
+	param_process_pkt.ptr = buffer;
+	param_process_pkt.len = muse_encoder_push(&fake_muse_encoder, sample, buffer);
+	
+	/*the sample waits for the rest of its packet*/
+	if(param_process_pkt.len==0){
+		return (0);
 	}
 	
-	/*one packet*/
-	TRANS_PKT_FC(&param_translate_pkt,output);
+	/*through the parser of the real headset, to the translation of the fake*/
+	TRACE_POINT(TRACE_READ);
+	STATS_ADD(bytes_received, param_process_pkt.len);
+	STATS_ADD(buffers_received, 1);
+	muse_process_pkt(&param_process_pkt, output);
 
 	return (0);
 }
@@ -179,19 +211,15 @@ int fake_muse_process_pkt(void *packet __attribute__ ((unused)),void *output)
  */
 int fake_muse_read_pkt(void *output)
 {
-    struct timespec interpacket_time;
-    
-    interpacket_time.tv_sec = 0;
-    interpacket_time.tv_nsec = 4000000; /*sleep for 10 milliseconds*/
-	
 	do {
 
-		nanosleep(&interpacket_time,NULL);
+		/*sleep for 4 milliseconds, the timers run meanwhile*/
+		timer_wheel_wait(-1, FAKE_MUSE_PERIOD_NS);
 		
 		/*call for packet processing*/
 		PROCESS_PKT_FC(NULL,output);
 
-	} while (1);
+	} while (!timer_wheel_stopped());
 	return (0);
 }
 
@@ -0,0 +1,522 @@
+/**
+ * @file merge.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Implements the merge pseudo-hardware. Instead of a headset, it reads the
+ *        shared memory rings of several data interfaces (one per headset) and
+ *        resamples them on a common host-clock grid, using the timestamps found in
+ *        the page metadata. Mixed rates (220 Hz Muse, 250 Hz OpenBCI) thus end on
+ *        the same grid, aligned once, here.
+ *
+ *        A merged sample holds the channels of every device, in the order of the
+ *        configuration, followed by one channel holding the validity mask (bit n
+ *        set when device n contributed valid data to the sample). Channels of an
+ *        invalid device are set to NaN.
+ *
+ *        A grid point is produced as soon as every device has data past it. A device
+ *        that stays late for longer than two pages is declared invalid until it
+ *        catches up, so one lost headset doesn't stall the stream.
+ *
+ *        The merge acts as the reader of the device rings: it waits for
+ *        INTERFACE_OUT_READY and gives the pages back with PREPROC_IN_READY.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/sem.h>
+
+#include "hardware.h"
+#include "xml.h"
+#include "data_output.h"
+#include "shsem_def.h"
+#include "clock_sync.h"
+#include "merge.h"
+#include "logger.h"
+#include "timer_wheel.h"
+
+#define MERGE_INVALID 0 /*no valid data for the grid point*/
+#define MERGE_VALID 1 /*the grid point was interpolated*/
+#define MERGE_WAIT 2 /*the data for the grid point is not in yet*/
+
+static int nb_inputs = 0;
+static merge_input_t inputs[MAX_MERGE_SOURCES];
+
+/*the output grid*/
+static int nb_merged_channels = 0;
+static float* merged_block = NULL;
+static double grid_period_ns = 0;
+static int64_t grid_start_ns = 0;
+static uint64_t grid_idx = 0;
+static int64_t first_data_ns = 0;
+
+static int merge_attach_input(merge_input_t* input);
+static void merge_detach_input(merge_input_t* input);
+static char merge_grid_started(void);
+static int merge_sample_input(merge_input_t* input, int64_t t, int64_t now, float* out);
+
+/**
+ * merge_init_hardware()
+ * @brief Initializes the inputs from the configuration
+ */
+int merge_init_hardware(void *param __attribute__ ((unused)))
+{
+	int i;
+	appconfig_t* config = get_appconfig();
+
+	if (config->nb_merge_sources == 0 || config->merge_rate <= 0) {
+		printf("Merge requires merge_sources and merge_rate\n");
+		return (-1);
+	}
+
+	nb_inputs = config->nb_merge_sources;
+	nb_merged_channels = 0;
+
+	for (i = 0; i < nb_inputs; i++) {
+
+		memset(&(inputs[i]), 0, sizeof(merge_input_t));
+		memcpy(&(inputs[i].options), &(config->merge_sources[i]), sizeof(merge_source_t));
+		inputs[i].page_size = inputs[i].options.window_size*inputs[i].options.nb_data_channels*sizeof(float);
+		inputs[i].channel_offset = nb_merged_channels;
+		inputs[i].max_latency_ns = MERGE_DEFAULT_LATENCY_NS;
+
+		/*allocate the history*/
+		inputs[i].capacity = MERGE_HISTORY_PAGES*inputs[i].options.window_size;
+		inputs[i].values = (float*)malloc(inputs[i].capacity*inputs[i].options.nb_data_channels*sizeof(float));
+		inputs[i].timestamps = (int64_t*)malloc(inputs[i].capacity*sizeof(int64_t));
+		inputs[i].sops = (struct sembuf *) malloc(sizeof(struct sembuf));
+
+		nb_merged_channels += inputs[i].options.nb_data_channels;
+	}
+
+	/*one more channel for the validity mask*/
+	nb_merged_channels += 1;
+
+	if (config->nb_data_channels != nb_merged_channels) {
+		printf("Merge output has %i channels, nb_data_channels is %i\n", nb_merged_channels, config->nb_data_channels);
+		return (-1);
+	}
+
+	merged_block = (float*)malloc(MERGE_BLOCK_SIZE*nb_merged_channels*sizeof(float));
+
+	grid_period_ns = 1e9/config->merge_rate;
+	grid_start_ns = 0;
+	grid_idx = 0;
+	first_data_ns = 0;
+
+	return (0);
+}
+
+/**
+ * merge_connect_dev()
+ * @brief Attaches the rings of all the devices. Fails until every data
+ *        interface is up, the rings rejected are not tried again.
+ */
+int merge_connect_dev(void *param __attribute__ ((unused)))
+{
+	int i;
+
+	for (i = 0; i < nb_inputs; i++) {
+		if (inputs[i].shm_buf == NULL && !inputs[i].rejected && merge_attach_input(&(inputs[i])) < 0) {
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+/**
+ * merge_cleanup()
+ * @brief Detaches from the rings and frees the history
+ */
+int merge_cleanup(void *param __attribute__ ((unused)))
+{
+	int i;
+
+	for (i = 0; i < nb_inputs; i++) {
+		merge_detach_input(&(inputs[i]));
+		free(inputs[i].values);
+		free(inputs[i].timestamps);
+		free(inputs[i].sops);
+	}
+	nb_inputs = 0;
+	free(merged_block);
+	merged_block = NULL;
+
+	return (0);
+}
+
+/**
+ * merge_send_keep_alive_pkt()
+ * @brief Nothing to keep alive
+ */
+int merge_send_keep_alive_pkt(void *param __attribute__ ((unused)))
+{
+	return (0);
+}
+
+/**
+ * merge_send_pkt()
+ * @brief Nothing to send
+ */
+int merge_send_pkt(void *param __attribute__ ((unused)))
+{
+	return (0);
+}
+
+/**
+ * merge_read_pkt()
+ * @brief Polls the rings of the devices and processes the pages as they come in.
+ */
+int merge_read_pkt(void *output)
+{
+	int i;
+	char got_page;
+	merge_page_t page;
+	do {
+
+		got_page = 0x00;
+
+		for (i = 0; i < nb_inputs; i++) {
+
+			if (inputs[i].rejected) {
+				continue;
+			}
+
+			/*is there a page ready to be read?*/
+			inputs[i].sops->sem_num = INTERFACE_OUT_READY;
+			inputs[i].sops->sem_op = -1;
+			inputs[i].sops->sem_flg = IPC_NOWAIT;
+
+			while (semop(inputs[i].semid, inputs[i].sops, 1) == 0) {
+
+				page.input_idx = i;
+				page.page_idx = inputs[i].read_page;
+				PROCESS_PKT_FC(&page, output);
+
+				/*give the page back*/
+				inputs[i].read_page = (inputs[i].read_page+1)%inputs[i].options.nb_pages;
+				inputs[i].sops->sem_num = PREPROC_IN_READY;
+				inputs[i].sops->sem_op = 1;
+				semop(inputs[i].semid, inputs[i].sops, 1);
+
+				inputs[i].sops->sem_num = INTERFACE_OUT_READY;
+				inputs[i].sops->sem_op = -1;
+				got_page = 0x01;
+			}
+		}
+
+		/*late devices might have expired, produce what can be*/
+		if (!got_page) {
+			TRANS_PKT_FC(NULL, output);
+			timer_wheel_wait(-1, MERGE_POLL_NS);
+		} else {
+			timer_wheel_poll();
+		}
+
+	} while (!timer_wheel_stopped());
+
+	return (0);
+}
+
+/**
+ * merge_process_pkt()
+ * @brief Copies a page of a device in its history, then produces the grid points
+ * @param packet, a merge_page_t pointer
+ */
+int merge_process_pkt(void *packet, void *output)
+{
+	int i;
+	merge_page_t* page = (merge_page_t*)packet;
+	merge_input_t* input = &(inputs[page->input_idx]);
+	shm_page_meta_t* meta = &(input->page_meta[page->page_idx]);
+	float* page_values = (float*)&(input->shm_buf[page->page_idx*input->page_size]);
+	int nb_channels = input->options.nb_data_channels;
+	int pos;
+
+	/*without timing, the page can't be placed on the timeline*/
+	if (meta->timestamp_ns == 0 || meta->sample_period_ns <= 0) {
+		LOGGER_RECORD(LOGGER_MERGE_NO_TIMESTAMP, page->input_idx, 0, 0);
+		return (0);
+	}
+
+	input->period_ns = meta->sample_period_ns;
+	input->max_latency_ns = (int64_t)(2*input->options.window_size*input->period_ns)+MERGE_DEFAULT_LATENCY_NS/10;
+
+	if (first_data_ns == 0) {
+		first_data_ns = clock_sync_now_ns();
+	}
+
+	for (i = 0; i < (int)meta->nb_samples; i++) {
+		pos = (int)(input->head%input->capacity);
+		memcpy(&(input->values[pos*nb_channels]), &(page_values[i*nb_channels]), nb_channels*sizeof(float));
+		input->timestamps[pos] = meta->timestamp_ns+(int64_t)(i*meta->sample_period_ns);
+		input->head++;
+	}
+
+	/*produce the grid points*/
+	return TRANS_PKT_FC(NULL, output);
+}
+
+/**
+ * merge_translate_pkt()
+ * @brief Produces every grid point for which all devices have data (or have expired)
+ *        and pushes them to the output, by blocks.
+ */
+int merge_translate_pkt(void *packet __attribute__ ((unused)), void* output)
+{
+	int i, j;
+	int status;
+	int64_t t;
+	int64_t now = clock_sync_now_ns();
+	uint32_t valid_mask;
+	float* sample;
+	output_interface_array_t *output_intrface_array = (output_interface_array_t *) output;
+
+	data_block_t data_block;
+	data_block.nb_samples = 0;
+	data_block.nb_data = nb_merged_channels;
+	data_block.ptr = merged_block;
+	data_block.sample_period_ns = grid_period_ns;
+	data_block.flags = 0;
+
+	if (!merge_grid_started()) {
+		return (0);
+	}
+
+	do {
+
+		t = grid_start_ns+(int64_t)(grid_idx*grid_period_ns);
+		sample = &(merged_block[data_block.nb_samples*nb_merged_channels]);
+		valid_mask = 0;
+		status = MERGE_VALID;
+
+		for (i = 0; i < nb_inputs && status != MERGE_WAIT; i++) {
+
+			status = merge_sample_input(&(inputs[i]), t, now, &(sample[inputs[i].channel_offset]));
+
+			if (status == MERGE_VALID) {
+				valid_mask |= 1<<i;
+			} else if (status == MERGE_INVALID) {
+				for (j = 0; j < inputs[i].options.nb_data_channels; j++) {
+					sample[inputs[i].channel_offset+j] = NAN;
+				}
+			}
+		}
+
+		/*the grid point is complete*/
+		if (status != MERGE_WAIT) {
+			sample[nb_merged_channels-1] = (float)valid_mask;
+			if (data_block.nb_samples == 0) {
+				data_block.first_sample = grid_idx;
+				data_block.timestamp_ns = t;
+			}
+			data_block.nb_samples++;
+			grid_idx++;
+		}
+
+		/*push the block when full or when we have to wait*/
+		if (data_block.nb_samples > 0 && (data_block.nb_samples == MERGE_BLOCK_SIZE || status == MERGE_WAIT)) {
+			for (j = 0; j < output_intrface_array->nb_output; j++) {
+				COPY_BLOCK_IN(output_intrface_array->output_interface[j], &data_block);
+			}
+			data_block.nb_samples = 0;
+		}
+
+	} while (status != MERGE_WAIT);
+
+	return (0);
+}
+
+/**
+ * char merge_grid_started(void)
+ * @brief Starts the grid once every device has data, or once the startup delay
+ *        expired. The grid starts at the latest first sample.
+ * @return 1 if the grid is started, 0 otherwise
+ */
+static char merge_grid_started(void)
+{
+	int i;
+	int nb_ready = 0;
+	int64_t start_ns = 0;
+
+	if (grid_start_ns != 0) {
+		return 0x01;
+	}
+
+	for (i = 0; i < nb_inputs; i++) {
+		if (inputs[i].head > 0) {
+			nb_ready++;
+			if (inputs[i].timestamps[0] > start_ns) {
+				start_ns = inputs[i].timestamps[0];
+			}
+		}
+	}
+
+	if (nb_ready == nb_inputs ||
+	    (nb_ready > 0 && clock_sync_now_ns()-first_data_ns > MERGE_STARTUP_TIMEOUT_NS)) {
+		grid_start_ns = start_ns;
+		return 0x01;
+	}
+
+	return 0x00;
+}
+
+/**
+ * int merge_sample_input(merge_input_t* input, int64_t t, int64_t now, float* out)
+ * @brief Interpolates the device channels at time t
+ * @param input, the device
+ * @param t, grid time
+ * @param now, current host time
+ * @param (out)out, device channels at time t
+ * @return MERGE_VALID, MERGE_INVALID or MERGE_WAIT
+ */
+static int merge_sample_input(merge_input_t* input, int64_t t, int64_t now, float* out)
+{
+	int i;
+	int lo, hi;
+	int nb_channels = input->options.nb_data_channels;
+	uint64_t tail;
+	double ratio;
+
+	/*no data past t yet, wait unless the device is late*/
+	if (input->head == 0 || input->timestamps[(input->head-1)%input->capacity] < t) {
+		if (now-t > input->max_latency_ns) {
+			return MERGE_INVALID;
+		}
+		return MERGE_WAIT;
+	}
+
+	/*t is older than the history, the data is gone*/
+	tail = (input->head > (uint64_t)input->capacity) ? input->head-input->capacity : 0;
+	if (input->timestamps[tail%input->capacity] > t) {
+		return MERGE_INVALID;
+	}
+
+	/*move to the samples surrounding t*/
+	if (input->cursor < tail) {
+		input->cursor = tail;
+	}
+	while (input->cursor+1 < input->head && input->timestamps[(input->cursor+1)%input->capacity] <= t) {
+		input->cursor++;
+	}
+
+	lo = (int)(input->cursor%input->capacity);
+	if (input->timestamps[lo] == t || input->cursor+1 >= input->head) {
+		hi = lo;
+		ratio = 0;
+	} else {
+		hi = (int)((input->cursor+1)%input->capacity);
+
+		/*samples missing in between (pages dropped), can't interpolate*/
+		if (input->timestamps[hi]-input->timestamps[lo] > 1.5*input->period_ns) {
+			return MERGE_INVALID;
+		}
+		ratio = (double)(t-input->timestamps[lo])/(double)(input->timestamps[hi]-input->timestamps[lo]);
+	}
+
+	for (i = 0; i < nb_channels; i++) {
+		out[i] = input->values[lo*nb_channels+i]+
+		         (float)ratio*(input->values[hi*nb_channels+i]-input->values[lo*nb_channels+i]);
+
+		/*gaps filled with NaN stay invalid*/
+		if (!isfinite(out[i])) {
+			return MERGE_INVALID;
+		}
+	}
+
+	return MERGE_VALID;
+}
+
+/**
+ * int merge_attach_input(merge_input_t* input)
+ * @brief Attaches the shared memory and semaphores of a device ring and gives
+ *        all its pages to the writer. The stream header of the ring must
+ *        match the configuration of the source: FLOAT32 values, the same
+ *        channels and the same size. Otherwise the source is rejected, for
+ *        good, and its channels stay invalid.
+ * @param input, the device
+ * @return 0 for success or a rejected ring, -1 if the ring is not available yet
+ */
+static int merge_attach_input(merge_input_t* input)
+{
+	int i, source = (int)(input-inputs);
+	size_t expected_size = SHM_SEGMENT_SIZE(input->page_size, input->options.nb_pages);
+	struct shmid_ds shm_stat;
+	shm_stream_header_t* header;
+
+	/*the ring is created by the data interface of the device, whatever its size*/
+	if ((input->shmid = shmget(input->options.shm_key, 0, 0666)) < 0) {
+		return (-1);
+	}
+
+	if ((input->shm_buf = shmat(input->shmid, NULL, SHM_RDONLY)) == (char *) -1) {
+		perror("shmat");
+		input->shm_buf = NULL;
+		return (-1);
+	}
+
+	/*the stream header ends the segment, whatever the size of the pages*/
+	if (shmctl(input->shmid, IPC_STAT, &shm_stat) < 0 || shm_stat.shm_segsz < sizeof(shm_stream_header_t)) {
+		merge_detach_input(input);
+		return (-1);
+	}
+	header = (shm_stream_header_t*)&(input->shm_buf[shm_stat.shm_segsz-sizeof(shm_stream_header_t)]);
+
+	/*not written yet*/
+	if (header->magic != SHM_STREAM_MAGIC) {
+		merge_detach_input(input);
+		return (-1);
+	}
+
+	/*the source must publish what the merge reads*/
+	if (header->sample_format != SHM_SAMPLE_FLOAT32) {
+		LOGGER_RECORD(LOGGER_MERGE_BAD_FORMAT, source, header->sample_format, 0);
+		input->rejected = 0x01;
+	} else if (header->nb_channels != (uint32_t)input->options.nb_data_channels) {
+		LOGGER_RECORD(LOGGER_MERGE_BAD_CHANNELS, source, header->nb_channels, input->options.nb_data_channels);
+		input->rejected = 0x01;
+	} else if (shm_stat.shm_segsz != expected_size) {
+		LOGGER_RECORD(LOGGER_MERGE_BAD_LAYOUT, source, shm_stat.shm_segsz, expected_size);
+		input->rejected = 0x01;
+	}
+	if (input->rejected) {
+		merge_detach_input(input);
+		return (0);
+	}
+
+	if ((input->semid = semget(input->options.sem_key, NB_SEM, 0666)) == -1) {
+		merge_detach_input(input);
+		return (-1);
+	}
+
+	input->page_meta = (shm_page_meta_t*)&(input->shm_buf[SHM_PAGE_META_OFFSET(input->page_size, input->options.nb_pages)]);
+	input->read_page = 0;
+
+	/*all pages are free to write to*/
+	for (i = 0; i < input->options.nb_pages; i++) {
+		input->sops->sem_num = PREPROC_IN_READY;
+		input->sops->sem_op = 1;
+		input->sops->sem_flg = IPC_NOWAIT;
+		semop(input->semid, input->sops, 1);
+	}
+
+	return (0);
+}
+
+/**
+ * void merge_detach_input(merge_input_t* input)
+ * @brief Detaches the shared memory of a device ring
+ * @param input, the device
+ */
+static void merge_detach_input(merge_input_t* input)
+{
+	if (input->shm_buf != NULL) {
+		shmdt(input->shm_buf);
+		input->shm_buf = NULL;
+	}
+}
@@ -13,6 +13,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <math.h>
 #include <sys/socket.h>
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/rfcomm.h>
@@ -25,8 +26,43 @@
 #include "xml.h"
 #include "muse_pack_parser.h"
 #include "data_output.h"
+#include "clock_sync.h"
+#include "capture.h"
+#include "trace.h"
+#include "stats.h"
+#include "perf_counters.h"
+#include "logger.h"
+#include "connection.h"
+#include "timer_wheel.h"
 
-#define KEEP_TIME 9
+/*running index of the next sample produced by the headset*/
+static uint64_t sample_idx = 0;
+
+/*relation between the headset sample index and the host clock*/
+static clock_sync_t muse_clock;
+
+/*last DRL/REF values received (microvolts), the headset sends them a few times per second*/
+static float muse_drl = 0;
+static float muse_ref = 0;
+static char muse_drl_ref_valid = 0;
+
+/*capture of the bytes received, when <capture_file> is set*/
+static capture_t muse_capture;
+
+/*link to the headset, reconnected by the reading thread when it is lost*/
+static conn_t muse_conn;
+static unsigned char* muse_address = NULL;
+
+/*the output takes the codes (sample_format INT16), read at init*/
+static char muse_raw_codes = 0;
+
+/*last sample translated, the compressed packets are relative to its codes*/
+static int cur_eeg_codes[MUSE_NB_CHANNELS];
+static float cur_eeg_values[MUSE_NB_CHANNELS];
+
+static int muse_reconnect(void *output);
+static void muse_start_streaming(void);
+static int muse_fill_link_gap(void *output);
 
 /**
  * muse_init_hardware()
@@ -35,7 +71,15 @@
 int muse_connect_dev(void *param)
 {
 	param_t *param_ptr = (param_t *) param;
-	return setup_socket((unsigned char *)param_ptr->ptr);
+
+	muse_address = (unsigned char *)param_ptr->ptr;
+	conn_connecting(&muse_conn);
+	if (setup_socket(muse_address, muse_conn.connect_timeout_ms) < 0) {
+		conn_failed(&muse_conn);
+		return (-1);
+	}
+	conn_connected(&muse_conn);
+	return (0);
 }
 
 /**
@@ -45,6 +89,7 @@ int muse_connect_dev(void *param)
 int muse_cleanup(void *param __attribute__ ((unused)))
 {
 	close_sockets();
+	capture_cleanup(&muse_capture);
 	return (0);
 }
 
@@ -54,9 +99,78 @@ int muse_cleanup(void *param __attribute__ ((unused)))
  */
 int muse_init_hardware(void *param __attribute__ ((unused)))
 {
+	muse_init_code_value();
+	clock_sync_init(&muse_clock, MUSE_SAMPLING_RATE);
+	conn_init(&muse_conn, get_appconfig());
+	muse_drl_ref_valid = 0;
+
+	muse_capture.file = NULL;
+	if (get_appconfig()->capture_file[0] != '\0') {
+		return capture_init(&muse_capture, get_appconfig()->capture_file, "MUSE");
+	}
+	return (0);
+}
+
+/**
+ * muse_get_drl_ref()
+ * @brief Last DRL/REF values sent by the headset
+ * @param (out)drl, DRL in microvolts
+ * @param (out)ref, REF in microvolts
+ * @return 0 for success, -1 if none was received
+ */
+int muse_get_drl_ref(float *drl, float *ref)
+{
+	if (!muse_drl_ref_valid) {
+		return (-1);
+	}
+
+	*drl = muse_drl;
+	*ref = muse_ref;
 	return (0);
 }
 
+void muse_fill_gap(float* prev_values, float* next_values, int nb_dropped, void* output);
+
+/**
+ * muse_update_clock()
+ * @brief Tells the clock estimator when the last sample decoded arrived
+ * @param read_ns, host time of the arrival of the packet
+ */
+void muse_update_clock(int64_t read_ns)
+{
+	if (sample_idx > 0) {
+		clock_sync_update(&muse_clock, sample_idx-1, read_ns);
+	}
+}
+
+/**
+ * muse_init_code_value()
+ * @brief Reads the sample format of the output, once, for muse_code_value
+ */
+void muse_init_code_value(void)
+{
+	muse_raw_codes = (get_appconfig()->sample_format == SAMPLE_INT16);
+}
+
+/**
+ * muse_code_value()
+ * @brief Value written in the output for a code. The codes are kept as is
+ *        when the output takes them (sample_format INT16), otherwise they are
+ *        converted to microvolts, on the grid of the recordings
+ *        (code*MUSE_CODE_STEP, the step of get_hardware_range).
+ * @param code
+ * @return the value
+ */
+float muse_code_value(int code)
+{
+	if (muse_raw_codes) {
+		return (float)code;
+	}
+
+	/*10bits encoding -> Range: 0.0 - 1682.0 in microvolts*/
+	return (float)code*MUSE_CODE_STEP;
+}
+
 /** 
  * muse_translate_pkt
  * @brief translate MUSE packet
@@ -69,12 +183,15 @@ int muse_translate_pkt(void *packet, void* output)
 	output_interface_array_t *output_intrface_array = (output_interface_array_t *) output;
 		
 	/*new samples might be relative to last sample, we keep the current*/
-	/*eeg data in a persistent output, until it's being replaced.*/
-	static float cur_eeg_values[MUSE_NB_CHANNELS];
+	/*eeg data in a persistent output (cur_eeg_values), until it's being replaced.*/
+	float new_eeg_values[MUSE_NB_CHANNELS];
+	float eeg_block[MUSE_NB_DELTAS*MUSE_NB_CHANNELS];
 	
-	data_t data_struct;
-	data_struct.nb_data = MUSE_NB_CHANNELS;
-	data_struct.ptr = cur_eeg_values;
+	data_block_t data_block;
+	data_block.nb_data = MUSE_NB_CHANNELS;
+	data_block.ptr = eeg_block;
+	data_block.sample_period_ns = clock_sync_period(&muse_clock);
+	data_block.flags = 0;
 
 	/*Check the type of eeg samples we are receiving*/
 	switch(muse_trslt_pkt_ptr->type){
@@ -83,14 +200,29 @@ int muse_translate_pkt(void *packet, void* output)
 			/*It's an uncompressed packet, we just received the actual eeg values*/
 			/*do nothing, the data is good*/
 			for(i=0;i<MUSE_NB_CHANNELS;i++){
-				/*convert to uV float values*/
-				/*10bits encoding -> Range: 0.0 - 1682.0 in microvolts*/
-				cur_eeg_values[i] = (float)muse_trslt_pkt_ptr->eeg_data[i]/1023*1682;
+				/*convert to uV float values (or keep the codes)*/
+				cur_eeg_codes[i] = muse_trslt_pkt_ptr->eeg_data[i];
+				new_eeg_values[i] = muse_code_value(cur_eeg_codes[i]);
+			}
+			
+			/*the headset dropped samples, fill the gap before this sample*/
+			if(muse_trslt_pkt_ptr->nb_dropped>0){
+				muse_fill_gap(cur_eeg_values, new_eeg_values, muse_trslt_pkt_ptr->nb_dropped, output);
 			}
+			
+			memcpy(cur_eeg_values, new_eeg_values, sizeof(cur_eeg_values));
+			memcpy(eeg_block, new_eeg_values, sizeof(new_eeg_values));
+			
+			data_block.nb_samples = 1;
+			data_block.first_sample = sample_idx;
+			data_block.timestamp_ns = clock_sync_predict(&muse_clock, sample_idx);
+			sample_idx += 1;
+			TRACE_POINT(TRACE_TRANSLATE);
+			STATS_ADD(samples_received, 1);
 				
 			for(i=0;i<output_intrface_array->nb_output;i++){
 				/*Push the new sample in the output*/
-				COPY_DATA_IN(output_intrface_array->output_interface[i], &data_struct);
+				COPY_BLOCK_IN(output_intrface_array->output_interface[i], &data_block);
 			}
 			
 			break;
@@ -102,18 +234,26 @@ int muse_translate_pkt(void *packet, void* output)
 			/*go over all deltas*/
 			for(i=0;i<MUSE_NB_DELTAS;i++){
 				
-				/*compute the new value from the previous value*/
+				/*compute the new code from the previous code*/
 				for(j=0;j<MUSE_NB_CHANNELS;j++){
-					/*convert to uV float values*/
-					//10bits encoding -> Range: 0.0 - 1682.0 in microvolts
-					cur_eeg_values[j] = cur_eeg_values[j]+(float)muse_trslt_pkt_ptr->eeg_data[j*MUSE_NB_DELTAS+i]/1023*1682;		
-				}
-				
-				for(j=0;j<output_intrface_array->nb_output;j++){
-					/*Push the new sample in the output*/
-					COPY_DATA_IN(output_intrface_array->output_interface[j], &data_struct);
+					/*convert to uV float values (or keep the codes)*/
+					cur_eeg_codes[j] += muse_trslt_pkt_ptr->eeg_data[j*MUSE_NB_DELTAS+i];
+					cur_eeg_values[j] = muse_code_value(cur_eeg_codes[j]);
+					eeg_block[i*MUSE_NB_CHANNELS+j] = cur_eeg_values[j];
 				}
 			}
+			
+			data_block.nb_samples = MUSE_NB_DELTAS;
+			data_block.first_sample = sample_idx;
+			data_block.timestamp_ns = clock_sync_predict(&muse_clock, sample_idx);
+			sample_idx += MUSE_NB_DELTAS;
+			TRACE_POINT(TRACE_TRANSLATE);
+			STATS_ADD(samples_received, MUSE_NB_DELTAS);
+			
+			for(j=0;j<output_intrface_array->nb_output;j++){
+				/*Push the new samples in the output*/
+				COPY_BLOCK_IN(output_intrface_array->output_interface[j], &data_block);
+			}
 		
 			break;
 		
@@ -122,20 +262,78 @@ int muse_translate_pkt(void *packet, void* output)
 	return (0);
 }
 
+/** 
+ * muse_fill_gap
+ * @brief Fills the samples dropped by the headset according to the configured
+ *        policy (hold, linear interpolation or NaN) and writes them as one block.
+ *        The running sample index skips over the gap.
+ * @param prev_values, last sample received before the gap
+ * @param next_values, first sample received after the gap
+ * @param nb_dropped, number of samples dropped
+ * @param output, output interface array
+ */
+void muse_fill_gap(float* prev_values, float* next_values, int nb_dropped, void* output)
+{
+	int i,j;
+	float ratio;
+	output_interface_array_t *output_intrface_array = (output_interface_array_t *) output;
+	
+	/*a gap can be as long as the 16 bits count allows*/
+	static float gap_block[MUSE_MAX_DROPPED*MUSE_NB_CHANNELS];
+	
+	data_block_t data_block;
+	data_block.nb_samples = nb_dropped;
+	data_block.nb_data = MUSE_NB_CHANNELS;
+	data_block.ptr = gap_block;
+	data_block.first_sample = sample_idx;
+	data_block.timestamp_ns = clock_sync_predict(&muse_clock, sample_idx);
+	data_block.sample_period_ns = clock_sync_period(&muse_clock);
+	data_block.flags = BLOCK_GAP_FILL;
+	
+	for(i=0;i<nb_dropped;i++){
+		
+		switch(get_appconfig()->gap_fill){
+			
+			case GAP_FILL_INTERP:
+				ratio = (float)(i+1)/(float)(nb_dropped+1);
+				for(j=0;j<MUSE_NB_CHANNELS;j++){
+					gap_block[i*MUSE_NB_CHANNELS+j] = prev_values[j]+(next_values[j]-prev_values[j])*ratio;
+				}
+				break;
+				
+			case GAP_FILL_NAN:
+				for(j=0;j<MUSE_NB_CHANNELS;j++){
+					gap_block[i*MUSE_NB_CHANNELS+j] = NAN;
+				}
+				break;
+				
+			case GAP_FILL_HOLD:
+			default:
+				memcpy(&(gap_block[i*MUSE_NB_CHANNELS]), prev_values, MUSE_NB_CHANNELS*sizeof(float));
+				break;
+		}
+	}
+	
+	sample_idx += nb_dropped;
+	STATS_ADD(gap_samples, nb_dropped);
+	
+	for(i=0;i<output_intrface_array->nb_output;i++){
+		COPY_BLOCK_IN(output_intrface_array->output_interface[i], &data_block);
+	}
+}
+
 /**
  * send_keep_alive_pkt(void)
- * @brief Sends a keep alive repeatedly while sleeping for the required 
- * time-out period.
+ * @brief Sends a keep alive, every MUSE_KEEP_ALIVE_PERIOD_MS from the timer
+ * wheel. Nothing is sent while the link is being restored.
  */
 int muse_send_keep_alive_pkt(void *param __attribute__ ((unused)))
 {
 	const char *msg = MUSE_KEEP_ALIVE;
-	int status = 0;
 
-	do {
-		status = send(get_socket_fd(), msg, 3, 0);
-		sleep(KEEP_TIME);
-	} while (status >= 0);
+	if (muse_conn.state == CONN_CONNECTED) {
+		send(get_socket_fd(), msg, 3, MSG_NOSIGNAL);
+	}
 
 	return (0);
 }
@@ -151,7 +349,7 @@ int muse_send_pkt(void *param)
 	param_t *param_ptr = (param_t *) param;
 	int status = 0;
 
-	status = send(get_socket_fd(), param_ptr->ptr, param_ptr->len, 0);
+	status = send(get_socket_fd(), param_ptr->ptr, param_ptr->len, MSG_NOSIGNAL);
 
 	if (status < 0) {
 		printf("error sending pkt\n");
@@ -170,6 +368,10 @@ int muse_process_pkt(void *packet, void *output)
 	int nb_of_soft_packets;
 	int soft_packets_headers[MAX_NB_SOFT_PACKETS];		
 	int soft_packets_types[MAX_NB_SOFT_PACKETS];	
+	int values_offset;
+	int drl, ref;
+	muse_parse_errors_t parse_errors;
+	perf_sample_t perf_begin, perf_end;
 	
 	/*This buffer will temporaly keep the decoded eeg data, 
 	  while it is being translated and put in a permanent
@@ -179,6 +381,7 @@ int muse_process_pkt(void *packet, void *output)
 	muse_translt_pkt_t param_translate_pkt;
 	param_translate_pkt.eeg_data = eeg_data_buffer;
 	param_translate_pkt.nb_samples = MUSE_NB_CHANNELS;
+	param_translate_pkt.nb_dropped = 0;
 	
 	// Uncompressed or raw at this point
 	param_t *packet_ptr = (param_t *)packet;
@@ -187,40 +390,99 @@ int muse_process_pkt(void *packet, void *output)
 		
 		/*pre-parse the bluetooth packet to know how many soft packets*/
 		/*are present*/	
-		nb_of_soft_packets = preparse_packet((unsigned char *)packet_ptr->ptr, packet_ptr->len, soft_packets_headers, soft_packets_types);
+		PERF_SAMPLE(&perf_begin);
+		nb_of_soft_packets = preparse_packet((unsigned char *)packet_ptr->ptr, packet_ptr->len, soft_packets_headers, soft_packets_types,
+		                                     &parse_errors);
+		PERF_SAMPLE(&perf_end);
+		TRACE_POINT(TRACE_FRAME);
+		if(nb_of_soft_packets==0){
+			LOGGER_RECORD(LOGGER_PREPARSE_ERROR, parse_errors.position, parse_errors.byte, 0);
+			STATS_ADD(preparse_errors, 1);
+		}
+
+		/*the preparse cost is shared by the packets it found*/
+		for(i=0;perf_enabled && i<nb_of_soft_packets;i++){
+			perf_record(PERF_PREPARSE, soft_packets_types[i], &perf_begin, &perf_end, nb_of_soft_packets);
+		}
 	
 		/*process each individual packet*/
 		for(i=0;i<nb_of_soft_packets;i++){
+			
+			STATS_ADD(packet_types[soft_packets_types[i]&(SHM_STATS_NB_PACKET_TYPES-1)], 1);
 			       
 			switch(soft_packets_types[i]){
 				case MUSE_UNCOMPRESS_PKT:
 
+					/*the dropped samples count, if present, sits before the values*/
+					param_translate_pkt.nb_dropped = get_dropped_samples((unsigned char *)&(packet_ptr->ptr[soft_packets_headers[i]]));
+					STATS_ADD(dropped_samples, param_translate_pkt.nb_dropped);
+					values_offset = 1;
+					if(get_flag_value(packet_ptr->ptr[soft_packets_headers[i]])){
+						LOGGER_RECORD(LOGGER_SAMPLES_DROPPED, param_translate_pkt.nb_dropped, 0, 0);
+						values_offset += DROPPED_SAMPLES_LENGTH;
+					}
+
 					/*Extract EEG values*/
-					parse_uncompressed_packet((unsigned char *)&(packet_ptr->ptr[soft_packets_headers[i]+1]), eeg_data_buffer);
+					PERF_SAMPLE(&perf_begin);
+					parse_uncompressed_packet((unsigned char *)&(packet_ptr->ptr[soft_packets_headers[i]+values_offset]), eeg_data_buffer);
+					PERF_SAMPLE(&perf_end);
+					PERF_RECORD(PERF_PARSE, MUSE_UNCOMPRESS_PKT, &perf_begin, &perf_end, 1);
+					TRACE_POINT(TRACE_DECODE);
 				
 					/*Send them to the translator*/
 					param_translate_pkt.type = MUSE_UNCOMPRESS_PKT;
+					PERF_SAMPLE(&perf_begin);
 					TRANS_PKT_FC(&param_translate_pkt, output);
+					PERF_SAMPLE(&perf_end);
+					PERF_RECORD(PERF_TRANSLATE, MUSE_UNCOMPRESS_PKT, &perf_begin, &perf_end, 1);
 
 				break;
 		
 				case MUSE_COMPRESSED_PKT:	
 
 					/*Extract delta values values*/
-					parse_compressed_packet((unsigned char *)&(packet_ptr->ptr[soft_packets_headers[i]]), eeg_data_buffer);
+					PERF_SAMPLE(&perf_begin);
+					if(parse_compressed_packet((unsigned char *)&(packet_ptr->ptr[soft_packets_headers[i]]), eeg_data_buffer,
+					                           &parse_errors)!=EXIT_SUCCESS){
+						LOGGER_RECORD(LOGGER_BIT_LENGTH_MISMATCH, parse_errors.expected_bits_length, parse_errors.parsed_bits_length, 0);
+						STATS_ADD(bit_length_mismatches, 1);
+					}
+					PERF_SAMPLE(&perf_end);
+					PERF_RECORD(PERF_PARSE, MUSE_COMPRESSED_PKT, &perf_begin, &perf_end, 1);
+					TRACE_POINT(TRACE_DECODE);
 
 					/*Send them to the translator*/
 					param_translate_pkt.type = MUSE_COMPRESSED_PKT;
+					param_translate_pkt.nb_dropped = 0;
+					PERF_SAMPLE(&perf_begin);
 					TRANS_PKT_FC(&param_translate_pkt, output);
+					PERF_SAMPLE(&perf_end);
+					PERF_RECORD(PERF_TRANSLATE, MUSE_COMPRESSED_PKT, &perf_begin, &perf_end, 1);
 
 
 				break;
+
+				case MUSE_DRLREF_PKT:
+
+					/*the packet is 4 bytes, it may be cut at the end of the buffer*/
+					if(soft_packets_headers[i]+4 > packet_ptr->len){
+						break;
+					}
+
+					/*keep the last values, for the signal quality*/
+					parse_drlref_packet((unsigned char *)&(packet_ptr->ptr[soft_packets_headers[i]]), &drl, &ref);
+					muse_drl = (float)drl/MUSE_ADC_MAX*MUSE_FULL_SCALE;
+					muse_ref = (float)ref/MUSE_ADC_MAX*MUSE_FULL_SCALE;
+					muse_drl_ref_valid = 1;
+
+				break;
 			}
 			
 		}
 		
 	} else {
-		printf("Invalid packet - too small\n");
+		LOGGER_RECORD(LOGGER_PACKET_TOO_SMALL, packet_ptr->len, 0, 0);
+		STATS_ADD(preparse_errors, 1);
 	}
 
 	return (0);
@@ -228,87 +490,163 @@ int muse_process_pkt(void *packet, void *output)
 
 /**
  * muse_read_pkt()
- * @brief Reads incoming packets from the socket
+ * @brief Reads incoming packets from the socket. A link that hangs up or
+ *        brings no data for <stall_timeout_ms> is closed and connected
+ *        again, after a backoff, while the output goes on. Returns once the
+ *        wheel is stopped.
  */
 int muse_read_pkt(void *output)
 {
 	int bytes_read = 0;
+	int64_t read_ns;
 	unsigned char buf[BUFSIZE] = { 0 };
-	param_t param_start_transmission = { MUSE_START_TRANSMISSION, 3 };
-	param_t param_request_transmission = { MUSE_VERSION, 5};
-	param_t param_preset_transmission = { MUSE_PRESET, 6};
-	param_t param_host_transmission = { MUSE_SET_HOST_PLATFORM, 5};
 	param_t param_process_pkt = { 0 };
 
-	muse_send_pkt((void *)&param_request_transmission);
-	muse_send_pkt((void *)&param_host_transmission);
-	muse_send_pkt((void *)&param_preset_transmission);
-	muse_send_pkt((void *)&param_start_transmission);
+	muse_start_streaming();
 
 	do {
 
-		bytes_read = recv(get_socket_fd(), buf, BUFSIZE, 0);
+		/*the link was lost, restored before reading again*/
+		if (muse_conn.state != CONN_CONNECTED) {
+			muse_reconnect(output);
+			continue;
+		}
+
+		switch (conn_wait(&muse_conn, get_socket_fd())) {
+			case CONN_STALLED:
+				LOGGER_RECORD(LOGGER_LINK_STALLED, (clock_sync_now_ns()-muse_conn.last_data_ns)/1000000, 0, 0);
+				STATS_ADD(stalls, 1);
+				STATS_ADD(disconnections, 1);
+				close_sockets();
+				conn_lost(&muse_conn);
+				continue;
+			case CONN_STOPPED:
+				continue;
+			case CONN_HUNG_UP:
+				bytes_read = 0;
+				break;
+			case CONN_DATA:
+			default:
+				bytes_read = recv(get_socket_fd(), buf, BUFSIZE, MSG_DONTWAIT);
+				break;
+		}
 
 		if (bytes_read <= 0) {
-			int tmp = errno;
-			//fprintf(stdout, "Error reading socket: %d\n", bytes_read);
-			/*
-			switch(tmp){
-				
-				case EWOULDBLOCK:
-					fprintf(stdout, "EWOULDBLOCK\n");
-				 	break;
-				
-				case EBADF:
-					fprintf(stdout, "EBADF\n");
-					break;
-					
-				case ECONNREFUSED:
-					fprintf(stdout, "ECONNREFUSED\n");
-					break;
-				
-				case EFAULT:
-					fprintf(stdout, "EFAULT\n");
-					break;
-					
-				case EINTR:
-					fprintf(stdout, "EINTR\n");
-					break;
-					
-				case EINVAL:
-					fprintf(stdout, "EINVAL\n");
-					break;
-					
-				case ENOTCONN:
-					fprintf(stdout, "ENOTCONN\n");
-					break;
-					
-				case ENOTSOCK:
-					fprintf(stdout, "ENOTSOCK\n");
-					break;
-					
-				case ENOMEM:
-					fprintf(stdout, "ENOMEM\n");
-					break;
-					
-				default:
-					fprintf(stdout, "something else! %d\n",tmp);
-					break;
-					
+
+			/*nothing yet*/
+			if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+				continue;
 			}
-			*/
-			
+
+			LOGGER_RECORD(LOGGER_LINK_HUNG_UP, bytes_read < 0 ? errno : 0, 0, 0);
+			STATS_ADD(disconnections, 1);
+			close_sockets();
+			conn_lost(&muse_conn);
 			continue;
 		}
 
+		/*time of arrival of the bytes*/
+		read_ns = clock_sync_now_ns();
+		conn_data(&muse_conn);
+		TRACE_POINT(TRACE_READ);
+		STATS_ADD(bytes_received, bytes_read);
+		STATS_ADD(buffers_received, 1);
+
+		if (muse_capture.file != NULL) {
+			capture_write(&muse_capture, buf, bytes_read, read_ns);
+		}
+
 		/*build the param structure containing the hard packet*/
 		param_process_pkt.ptr = buf;
 		param_process_pkt.len = bytes_read;
 		/*send the packet for processing*/
 		PROCESS_PKT_FC(&param_process_pkt, output);
+
+		/*the last sample decoded had arrived by then*/
+		muse_update_clock(read_ns);
 		memset(buf, 0, bytes_read);
-		
-	} while (1);
+
+	} while (!timer_wheel_stopped());
 	return (0);
 }
 
+/**
+ * muse_reconnect()
+ * @brief One attempt to restore the link, after the backoff. Once connected,
+ *        the streaming is started again and the samples lost meanwhile are
+ *        filled, the output keeps its timeline.
+ * @param output
+ * @return 0 for success, -1 for error
+ */
+static int muse_reconnect(void *output)
+{
+	int nb_attempts, nb_filled;
+
+	conn_wait_retry(&muse_conn);
+	if (timer_wheel_stopped()) {
+		return (-1);
+	}
+
+	STATS_ADD(connect_attempts, 1);
+	nb_attempts = muse_conn.nb_failures+1;
+	conn_connecting(&muse_conn);
+	if (setup_socket(muse_address, muse_conn.connect_timeout_ms) < 0) {
+		conn_failed(&muse_conn);
+		return (-1);
+	}
+	conn_connected(&muse_conn);
+	STATS_ADD(connections, 1);
+
+	muse_start_streaming();
+	nb_filled = muse_fill_link_gap(output);
+
+	LOGGER_RECORD(LOGGER_LINK_RESTORED, (clock_sync_now_ns()-muse_conn.lost_ns)/1000000, nb_attempts, nb_filled);
+	return (0);
+}
+
+/**
+ * muse_start_streaming()
+ * @brief Asks the headset for its version, sets its preset and starts the
+ *        streaming
+ */
+static void muse_start_streaming(void)
+{
+	param_t param_start_transmission = { MUSE_START_TRANSMISSION, 3 };
+	param_t param_request_transmission = { MUSE_VERSION, 5};
+	param_t param_preset_transmission = { MUSE_PRESET, 6};
+	param_t param_host_transmission = { MUSE_SET_HOST_PLATFORM, 5};
+
+	muse_send_pkt((void *)&param_request_transmission);
+	muse_send_pkt((void *)&param_host_transmission);
+	muse_send_pkt((void *)&param_preset_transmission);
+	muse_send_pkt((void *)&param_start_transmission);
+}
+
+/**
+ * muse_fill_link_gap()
+ * @brief Fills the samples the headset produced while the link was down,
+ *        from the clock, with the last values (NaN with <gap_fill>NAN)
+ * @param output
+ * @return number of samples filled
+ */
+static int muse_fill_link_gap(void *output)
+{
+	int64_t nb_missed, nb_filled = 0;
+	int nb_block;
+
+	if (sample_idx == 0) {
+		return (0);
+	}
+
+	nb_missed = (int64_t)((clock_sync_now_ns()-clock_sync_predict(&muse_clock, sample_idx))/clock_sync_period(&muse_clock));
+
+	while (nb_missed > 0) {
+		nb_block = nb_missed > MUSE_MAX_DROPPED ? MUSE_MAX_DROPPED : (int)nb_missed;
+		muse_fill_gap(cur_eeg_values, cur_eeg_values, nb_block, output);
+		nb_missed -= nb_block;
+		nb_filled += nb_block;
+	}
+
+	return (int)nb_filled;
+}
+
@@ -0,0 +1,544 @@
+/**
+ * @file muse_pack_encoder.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Encoder of the Muse bluetooth packets. Each delta of a compressed
+ *        packet is divided by the quantization of its channel and written as:
+ *        - quotient by the median: unary (ones, then a zero), or 15 ones
+ *          followed by the Elias gamma code of the quotient when it reaches 15
+ *        - remainder: truncated binary on floor(log2(median)) bits, one more
+ *          for the largest remainders (a single 0 when the median is 1)
+ *        - sign: 1 for negative
+ *
+ *        The medians are never 0: compressed_parse_deltas() does not reload
+ *        its current byte after skipping a channel of zeros, a median of 1
+ *        costs 3 bits per delta instead.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "muse_pack_parser.h"
+#include "muse_pack_encoder.h"
+
+#define ELIAS_QUOTIENT 15 /*quotients from this value are Elias gamma coded*/
+
+/*quantization bits for each power of 2, the bits multiply by 2, 4, 8 and 16*/
+static const int quantization_codes[MUSE_MAX_QUANTIZATION_POWER+1] =
+	{0x0, 0x1, 0x2, 0x4, 0x8, 0x9, 0xA, 0xC, 0xD, 0xE, 0xF};
+
+/*stream of bits, most significant first, only counted when ptr is NULL*/
+typedef struct bit_writer_s {
+	unsigned char* ptr;
+	int nb_bits;
+} bit_writer_t;
+
+static void put_bits(bit_writer_t* writer, unsigned int value, int nb_bits);
+static int floor_log2(unsigned int value);
+static int channel_median(const int* steps);
+static int encode_channel(bit_writer_t* writer, const int* steps, int median);
+static int quantize_channel(muse_encoder_t* encoder, int channel, int power, int* steps);
+static int write_compressed_packet(const int* steps, const int* quantization_powers, const int* medians, unsigned char* packet);
+
+/**
+ * void muse_encoder_init(muse_encoder_t* encoder, int refresh_period, int sync_period, int max_channel_bits)
+ *
+ * @brief Initializes the encoder, the first sample goes in an uncompressed packet
+ * @param encoder
+ * @param refresh_period, compressed packets between two uncompressed packets, 0 for none
+ * @param sync_period, samples between two sync packets, 0 for none
+ * @param max_channel_bits, bits allowed to a channel of a compressed packet, 0 for lossless
+ */
+void muse_encoder_init(muse_encoder_t* encoder, int refresh_period, int sync_period, int max_channel_bits)
+{
+	memset(encoder, 0, sizeof(muse_encoder_t));
+
+	encoder->refresh_period = refresh_period;
+	encoder->sync_period = sync_period;
+	encoder->max_channel_bits = max_channel_bits;
+	encoder->drl = MUSE_ENCODER_ADC_MAX/2;
+	encoder->ref = MUSE_ENCODER_ADC_MAX/2;
+}
+
+/**
+ * void muse_encoder_set_drl_ref(muse_encoder_t* encoder, int drl, int ref)
+ *
+ * @brief Sets the DRL/REF codes sent with the next sync packets
+ * @param encoder
+ * @param drl, DRL code (10 bits)
+ * @param ref, REF code (10 bits)
+ */
+void muse_encoder_set_drl_ref(muse_encoder_t* encoder, int drl, int ref)
+{
+	encoder->drl = drl;
+	encoder->ref = ref;
+}
+
+/**
+ * void muse_encoder_drop(muse_encoder_t* encoder, int nb_samples)
+ *
+ * @brief Drops samples, like the headset does when the link is saturated.
+ *        The samples waiting for a compressed packet are dropped as well, the
+ *        next sample goes in an uncompressed packet that reports the count.
+ * @param encoder
+ * @param nb_samples, samples dropped
+ */
+void muse_encoder_drop(muse_encoder_t* encoder, int nb_samples)
+{
+	encoder->nb_dropped += encoder->nb_pending+nb_samples;
+	encoder->nb_samples += nb_samples;
+	encoder->nb_pending = 0;
+}
+
+/**
+ * void muse_encoder_lost(muse_encoder_t* encoder, int nb_samples)
+ *
+ * @brief The last buffer built was lost on the link. The decoder no longer
+ *        follows the encoder, the next sample goes in an uncompressed packet
+ *        that reports the samples lost.
+ * @param encoder
+ * @param nb_samples, samples of the buffer lost
+ */
+void muse_encoder_lost(muse_encoder_t* encoder, int nb_samples)
+{
+	encoder->nb_dropped += nb_samples;
+}
+
+/**
+ * int muse_encoder_push(muse_encoder_t* encoder, const int* sample, unsigned char* buffer)
+ *
+ * @brief Adds a sample to the stream and builds the bluetooth buffer when a
+ *        packet is complete
+ * @param encoder
+ * @param sample, codes of the 4 channels (0-1023)
+ * @param (out)buffer, bluetooth buffer, MUSE_ENCODER_MAX_BUFFER bytes
+ * @return length of the buffer, 0 if the sample waits for the next packet
+ */
+int muse_encoder_push(muse_encoder_t* encoder, const int* sample, unsigned char* buffer)
+{
+	int i,j;
+	int length = 0;
+	int code;
+	int steps[MUSE_ENCODER_NB_DELTAS*MUSE_ENCODER_NB_CHANNELS];
+	int powers[MUSE_ENCODER_NB_CHANNELS];
+	int medians[MUSE_ENCODER_NB_CHANNELS];
+	char uncompressed;
+
+	encoder->nb_samples++;
+
+	/*start of the stream, samples dropped or time for a refresh*/
+	uncompressed = !encoder->started || encoder->nb_dropped>0 ||
+				   (encoder->nb_pending==0 && encoder->refresh_period>0 &&
+				    encoder->nb_compressed>=encoder->refresh_period);
+
+	if(!uncompressed){
+
+		for(i=0;i<MUSE_ENCODER_NB_CHANNELS;i++){
+			code = sample[i];
+			code = code<0 ? 0 : (code>MUSE_ENCODER_ADC_MAX ? MUSE_ENCODER_ADC_MAX : code);
+			encoder->samples[encoder->nb_pending*MUSE_ENCODER_NB_CHANNELS+i] = code;
+		}
+		encoder->nb_pending++;
+
+		if(encoder->nb_pending<MUSE_ENCODER_NB_DELTAS){
+			return 0;
+		}
+	}
+
+	/*the sync and DRL/REF packets lead the buffer*/
+	if(encoder->sync_period>0 && encoder->nb_samples>encoder->next_sync){
+		length += encode_sync_packet(&(buffer[length]));
+		length += encode_drlref_packet(encoder->drl, encoder->ref, &(buffer[length]));
+		encoder->next_sync += encoder->sync_period;
+	}
+
+	if(uncompressed){
+
+		for(i=0;i<MUSE_ENCODER_NB_CHANNELS;i++){
+			code = sample[i];
+			encoder->values[i] = code<0 ? 0 : (code>MUSE_ENCODER_ADC_MAX ? MUSE_ENCODER_ADC_MAX : code);
+		}
+
+		length += encode_uncompressed_packet(encoder->values, encoder->nb_dropped, &(buffer[length]));
+
+		encoder->started = 1;
+		encoder->nb_dropped = 0;
+		encoder->nb_compressed = 0;
+		return length;
+	}
+
+	/*for each channel, the finest quantization that fits the bits allowed*/
+	for(i=0;i<MUSE_ENCODER_NB_CHANNELS;i++){
+
+		for(powers[i]=0;powers[i]<MUSE_MAX_QUANTIZATION_POWER;powers[i]++){
+			if(encoder->max_channel_bits==0 ||
+			   quantize_channel(encoder, i, powers[i], &(steps[i*MUSE_ENCODER_NB_DELTAS]))<=encoder->max_channel_bits){
+				break;
+			}
+		}
+
+		/*the steps of the retained quantization, the decoder values follow*/
+		quantize_channel(encoder, i, powers[i], &(steps[i*MUSE_ENCODER_NB_DELTAS]));
+		medians[i] = channel_median(&(steps[i*MUSE_ENCODER_NB_DELTAS]));
+
+		for(j=0;j<MUSE_ENCODER_NB_DELTAS;j++){
+			encoder->values[i] += steps[i*MUSE_ENCODER_NB_DELTAS+j]*(1<<powers[i]);
+		}
+	}
+
+	length += write_compressed_packet(steps, powers, medians, &(buffer[length]));
+
+	encoder->nb_pending = 0;
+	encoder->nb_compressed++;
+	return length;
+}
+
+/**
+ * int encode_sync_packet(unsigned char* packet)
+ *
+ * @brief Writes a sync packet
+ * @param (out)packet
+ * @return length of the packet
+ */
+int encode_sync_packet(unsigned char* packet)
+{
+	packet[0] = 0xFF;
+	packet[1] = 0xFF;
+	packet[2] = 0xAA;
+	packet[3] = 0x55;
+
+	return MUSE_SYNC_PKT_LENGTH;
+}
+
+/**
+ * int encode_drlref_packet(int drl, int ref, unsigned char* packet)
+ *
+ * @brief Writes a DRL/REF packet, the reverse of parse_drlref_packet()
+ * @param drl, DRL code (10 bits)
+ * @param ref, REF code (10 bits)
+ * @param (out)packet
+ * @return length of the packet
+ */
+int encode_drlref_packet(int drl, int ref, unsigned char* packet)
+{
+	packet[0] = MUSE_DRLREF_PKT<<4;
+	packet[1] = drl&0xFF;
+	packet[2] = ((drl>>8)&0x03) | ((ref&0x3F)<<2);
+	packet[3] = (ref>>6)&0x0F;
+
+	return MUSE_DRLREF_PKT_LENGTH;
+}
+
+/**
+ * int encode_uncompressed_packet(const int* values, int nb_dropped, unsigned char* packet)
+ *
+ * @brief Writes an uncompressed packet, the reverse of parse_uncompressed_packet()
+ * @param values, codes of the 4 channels (10 bits)
+ * @param nb_dropped, samples dropped before this one, the count is written when >0
+ * @param (out)packet
+ * @return length of the packet
+ */
+int encode_uncompressed_packet(const int* values, int nb_dropped, unsigned char* packet)
+{
+	int length = 1;
+
+	packet[0] = MUSE_UNCOMPRESS_PKT<<4;
+
+	/*the count is on 16 bits, most significant byte first*/
+	if(nb_dropped>0){
+		if(nb_dropped>0xFFFF){
+			nb_dropped = 0xFFFF;
+		}
+		packet[0] |= 0x08;
+		packet[1] = (nb_dropped>>8)&0xFF;
+		packet[2] = nb_dropped&0xFF;
+		length += DROPPED_SAMPLES_LENGTH;
+	}
+
+	/*XXXX XXXX*/
+	/*YYYY YYXX*/
+	/*XXXX YYYY*/
+	/*YYXX XXXX*/
+	/*YYYY YYYY*/
+	packet[length] = values[0]&0xFF;
+	packet[length+1] = ((values[0]>>8)&0x03) | ((values[1]&0x3F)<<2);
+	packet[length+2] = ((values[1]>>6)&0x0F) | ((values[2]&0x0F)<<4);
+	packet[length+3] = ((values[2]>>4)&0x3F) | ((values[3]&0x03)<<6);
+	packet[length+4] = (values[3]>>2)&0xFF;
+
+	return length+5;
+}
+
+/**
+ * int encode_compressed_packet(const int* deltas, const int* quantization_powers, unsigned char* packet)
+ *
+ * @brief Writes a compressed packet, the reverse of parse_compressed_packet().
+ *        The medians are taken from the deltas.
+ * @param deltas, 16 deltas per channel, channel after channel, multiples of the quantization
+ * @param quantization_powers, quantization of each channel, as a power of 2 (0-10)
+ * @param (out)packet, must hold the packet and one byte more
+ * @return length of the packet
+ */
+int encode_compressed_packet(const int* deltas, const int* quantization_powers, unsigned char* packet)
+{
+	int i,j;
+	int steps[MUSE_ENCODER_NB_DELTAS*MUSE_ENCODER_NB_CHANNELS];
+	int medians[MUSE_ENCODER_NB_CHANNELS];
+
+	for(i=0;i<MUSE_ENCODER_NB_CHANNELS;i++){
+		for(j=0;j<MUSE_ENCODER_NB_DELTAS;j++){
+			steps[j+i*MUSE_ENCODER_NB_DELTAS] = deltas[j+i*MUSE_ENCODER_NB_DELTAS]/(1<<quantization_powers[i]);
+		}
+		medians[i] = channel_median(&(steps[i*MUSE_ENCODER_NB_DELTAS]));
+	}
+
+	return write_compressed_packet(steps, quantization_powers, medians, packet);
+}
+
+/**
+ * int write_compressed_packet(const int* steps, const int* quantization_powers, const int* medians, unsigned char* packet)
+ *
+ * @brief Writes the header and the deltas of a compressed packet
+ * @param steps, deltas divided by the quantization, channel after channel
+ * @param quantization_powers, quantization of each channel, as a power of 2
+ * @param medians, median of each channel (1-63)
+ * @param (out)packet
+ * @return length of the packet
+ */
+static int write_compressed_packet(const int* steps, const int* quantization_powers, const int* medians, unsigned char* packet)
+{
+	int i;
+	int q[MUSE_ENCODER_NB_CHANNELS];
+	bit_writer_t writer;
+
+	for(i=0;i<MUSE_ENCODER_NB_CHANNELS;i++){
+		q[i] = quantization_codes[quantization_powers[i]];
+	}
+
+	packet[0] = MUSE_COMPRESSED_PKT<<4;
+
+	/*byte[0]:QQMM MMMM*/
+	/*byte[1]:MMMM MMQQ*/
+	/*byte[2]:MMMM QQQQ*/
+	/*byte[3]:MMQQ QQMM*/
+	/*byte[4]:QQQQ MMMM*/
+	packet[1] = (medians[0]&0x3F) | ((q[0]&0x03)<<6);
+	packet[2] = ((q[0]>>2)&0x03) | ((medians[1]&0x3F)<<2);
+	packet[3] = (q[1]&0x0F) | ((medians[2]&0x0F)<<4);
+	packet[4] = ((medians[2]>>4)&0x03) | ((q[2]&0x0F)<<2) | ((medians[3]&0x03)<<6);
+	packet[5] = ((medians[3]>>2)&0x0F) | ((q[3]&0x0F)<<4);
+
+	/*counts the bits, to clear the bytes of the deltas*/
+	writer.ptr = NULL;
+	writer.nb_bits = 0;
+	for(i=0;i<MUSE_ENCODER_NB_CHANNELS;i++){
+		encode_channel(&writer, &(steps[i*MUSE_ENCODER_NB_DELTAS]), medians[i]);
+	}
+	memset(&(packet[MUSE_COMPRESSED_HEADER_LENGTH]), 0, (writer.nb_bits+7)/8);
+
+	/*the deltas, channel after channel*/
+	writer.ptr = &(packet[MUSE_COMPRESSED_HEADER_LENGTH]);
+	writer.nb_bits = 0;
+	for(i=0;i<MUSE_ENCODER_NB_CHANNELS;i++){
+		encode_channel(&writer, &(steps[i*MUSE_ENCODER_NB_DELTAS]), medians[i]);
+	}
+
+	/*bit length, most significant byte first*/
+	packet[6] = (writer.nb_bits>>8)&0xFF;
+	packet[7] = writer.nb_bits&0xFF;
+
+	return MUSE_COMPRESSED_HEADER_LENGTH+(writer.nb_bits+7)/8;
+}
+
+/**
+ * int quantize_channel(muse_encoder_t* encoder, int channel, int power, int* steps)
+ *
+ * @brief Computes the steps of a channel from the values rebuilt by the
+ *        decoder, each step rounded to the quantization
+ * @param encoder
+ * @param channel
+ * @param power, quantization as a power of 2
+ * @param (out)steps, 16 steps
+ * @return bits of the encoded channel
+ */
+static int quantize_channel(muse_encoder_t* encoder, int channel, int power, int* steps)
+{
+	int i;
+	int quantization = 1<<power;
+	int value = encoder->values[channel];
+	int diff;
+	bit_writer_t counter = { NULL, 0 };
+
+	for(i=0;i<MUSE_ENCODER_NB_DELTAS;i++){
+
+		/*rounded to the nearest multiple*/
+		diff = encoder->samples[i*MUSE_ENCODER_NB_CHANNELS+channel]-value;
+		if(diff>=0){
+			steps[i] = (diff+quantization/2)/quantization;
+		}
+		else{
+			steps[i] = -((-diff+quantization/2)/quantization);
+		}
+
+		value += steps[i]*quantization;
+	}
+
+	return encode_channel(&counter, steps, channel_median(steps));
+}
+
+/**
+ * int channel_median(const int* steps)
+ *
+ * @brief Median of the magnitude of the steps of a channel, as sent in the
+ *        packet header
+ * @param steps, 16 steps
+ * @return the median, 1-63
+ */
+static int channel_median(const int* steps)
+{
+	int i,j;
+	int sorted[MUSE_ENCODER_NB_DELTAS];
+	int magnitude;
+
+	/*insertion sort of the magnitudes*/
+	for(i=0;i<MUSE_ENCODER_NB_DELTAS;i++){
+		magnitude = abs(steps[i]);
+		for(j=i;j>0 && sorted[j-1]>magnitude;j--){
+			sorted[j] = sorted[j-1];
+		}
+		sorted[j] = magnitude;
+	}
+
+	magnitude = sorted[MUSE_ENCODER_NB_DELTAS/2-1];
+
+	if(magnitude<1){
+		return 1;
+	}
+	if(magnitude>MUSE_MAX_MEDIAN){
+		return MUSE_MAX_MEDIAN;
+	}
+	return magnitude;
+}
+
+/**
+ * int encode_channel(bit_writer_t* writer, const int* steps, int median)
+ *
+ * @brief Writes the 16 steps of a channel
+ * @param writer
+ * @param steps
+ * @param median
+ * @return bits written
+ */
+static int encode_channel(bit_writer_t* writer, const int* steps, int median)
+{
+	int i;
+	int start = writer->nb_bits;
+	unsigned int magnitude, quotient, remainder;
+	int remainder_bits = floor_log2(median);
+	unsigned int max1less = (2u<<remainder_bits)-median;
+
+	for(i=0;i<MUSE_ENCODER_NB_DELTAS;i++){
+
+		magnitude = abs(steps[i]);
+		quotient = magnitude/median;
+		remainder = magnitude%median;
+
+		/*quotient, unary or Elias gamma past 15*/
+		if(quotient<ELIAS_QUOTIENT){
+			put_bits(writer, ((1u<<quotient)-1)<<1, quotient+1);
+		}
+		else{
+			put_bits(writer, (1u<<ELIAS_QUOTIENT)-1, ELIAS_QUOTIENT);
+			put_bits(writer, 0, floor_log2(quotient));
+			put_bits(writer, quotient, floor_log2(quotient)+1);
+		}
+
+		/*remainder, truncated binary*/
+		if(median==1){
+			put_bits(writer, 0, 1);
+		}
+		else if(remainder<max1less){
+			put_bits(writer, remainder, remainder_bits);
+		}
+		else{
+			put_bits(writer, remainder+max1less, remainder_bits+1);
+		}
+
+		/*sign*/
+		put_bits(writer, steps[i]<0, 1);
+	}
+
+	return writer->nb_bits-start;
+}
+
+/**
+ * void put_bits(bit_writer_t* writer, unsigned int value, int nb_bits)
+ *
+ * @brief Appends the nb_bits lowest bits of value, most significant first.
+ *        The stream must be zeroed.
+ * @param writer
+ * @param value
+ * @param nb_bits
+ */
+static void put_bits(bit_writer_t* writer, unsigned int value, int nb_bits)
+{
+	int i;
+
+	if(writer->ptr!=NULL){
+		for(i=nb_bits-1;i>=0;i--){
+			if((value>>i)&0x01){
+				writer->ptr[(writer->nb_bits+nb_bits-1-i)/8] |= 0x80>>((writer->nb_bits+nb_bits-1-i)%8);
+			}
+		}
+	}
+
+	writer->nb_bits += nb_bits;
+}
+
+/**
+ * int floor_log2(unsigned int value)
+ *
+ * @brief floor(log2(value)), for value>0
+ */
+static int floor_log2(unsigned int value)
+{
+	int n = 0;
+
+	while(value>>=1){
+		n++;
+	}
+	return n;
+}
+
+/**
+ * void muse_synth_sample(uint64_t n, double sampling_rate, int* sample)
+ *
+ * @brief Synthetic eeg, in codes: an alpha rhythm over noise around mid
+ *        scale, with a blink on the frontal channels every few seconds
+ * @param n, index of the sample
+ * @param sampling_rate, Hz
+ * @param (out)sample, codes of the 4 channels
+ */
+void muse_synth_sample(uint64_t n, double sampling_rate, int* sample)
+{
+	int i;
+	double t = (double)n/sampling_rate;
+	double blink = 0;
+	double value;
+
+	/*a 200 ms blink every 4 seconds*/
+	if(fmod(t, 4.0)<0.2){
+		blink = 150*sin(M_PI*fmod(t, 4.0)/0.2);
+	}
+
+	for(i=0;i<MUSE_ENCODER_NB_CHANNELS;i++){
+		value = MUSE_ENCODER_ADC_MAX/2+20*sin(2*M_PI*10*t+i)+rand()%9-4;
+
+		/*AF7 and AF8*/
+		if(i==1 || i==2){
+			value += blink;
+		}
+
+		sample[i] = (int)value;
+	}
+}
@@ -33,6 +33,25 @@ void compressed_parse_medians(unsigned char* medians_header, int* quantizations,
 int compressed_parse_bit_length(unsigned char* bit_length_header);
 int compressed_parse_deltas(unsigned char* bits_header, int* median, int* quantization, int* deltas);
 
+/**
+ * void parse_drlref_packet(unsigned char* packet_header, int* drl, int* ref)
+ * 
+ * @brief parse out the DRL and REF values of a DRL/REF packet
+ * @param packet_header, pointer to the header of the packet
+ * @param (out)drl, DRL value (10 bits)
+ * @param (out)ref, REF value (10 bits)
+ */ 
+void parse_drlref_packet(unsigned char* packet_header, int* drl, int* ref)
+{
+	/*the two values follow the header, packed like the first two values of*/
+	/*an uncompressed packet:*/
+	/*XXXX XXXX*/
+	/*YYYY YYXX*/
+	/*0000 YYYY*/
+	(*drl) = (unsigned int)(((packet_header[2]&0x03)<<8)|(packet_header[1]&0xFF));
+	(*ref) = (unsigned int)(((packet_header[3]&0x0F)<<6)|((packet_header[2]&0xFC)>>2));
+}
+
 void shift_one_bit(char* cur_byte, int* byteshift, int* bitshift, unsigned char* bits_header);
 
 
@@ -42,14 +61,16 @@ void shift_one_bit(char* cur_byte, int* byteshift, int* bitshift, unsigned char*
  * @brief find the beginning of soft packets in the raw packet
  * @param raw_packet_header, pointer to the beginning of the packet
  * @param (out)soft_packet_headers, pointers to the beginning of the soft packets
- * @return number of packets found
+ * @param (out)errors, position and value of the invalid byte on an error, may be NULL
+ * @return number of packets found, 0 on an error
  */ 
  
  
 #define COMP_BITLENGTH_OFFSET 6
  
 
-int preparse_packet(unsigned char* raw_packet_header, int packet_length, int *soft_packet_headers, int *soft_packet_types)
+int preparse_packet(unsigned char* raw_packet_header, int packet_length, int *soft_packet_headers, int *soft_packet_types,
+                    muse_parse_errors_t* errors)
 {
 	int position = 0;
 	int nb_packets = 0;
@@ -74,7 +95,6 @@ int preparse_packet(unsigned char* raw_packet_header, int packet_length, int *so
 			
 				if(get_flag_value(raw_packet_header[position])){
 					position += 8;
-					printf("Samples were dropped!\n");
 				}
 				else{
 					position += 6;
@@ -125,7 +145,10 @@ int preparse_packet(unsigned char* raw_packet_header, int packet_length, int *so
 			
 			case MUSE_INVALID:
 			default:
-				printf("Pre-Parsing error!\n");
+				if(errors!=NULL){
+					errors->position = position;
+					errors->byte = raw_packet_header[position];
+				}
 				return 0;
 		}
 	
@@ -162,15 +185,34 @@ int get_flag_value(unsigned char first_byte)
 }
 
 
+/**
+ * int get_dropped_samples(unsigned char* packet_header)
+ * 
+ * @brief decodes the number of samples dropped by the headset before this packet
+ * @param packet_header, address to the first byte of the packet
+ * @return number of dropped samples, 0 if the flag is not set
+ */ 
+int get_dropped_samples(unsigned char* packet_header)
+{
+	if(!get_flag_value(packet_header[0])){
+		return 0;
+	}
+	
+	/*count is on 16 bits, most significant byte first*/
+	return (int)(packet_header[DROPPED_SAMPLES_OFFSET]<<8 | (packet_header[DROPPED_SAMPLES_OFFSET+1]&0xFF));
+}
+
+
 /**
  * int parse_compressed_packet(unsigned char* packet_header, char* deltas)
  * 
  * @brief extracts the dropped packet flag value
  * @param packet_header, address to the first byte of the packet
  * @param (out)deltas, array containing the deltas extracted from the packet must be 16*4 sizeof(int) in size
+ * @param (out)errors, bit lengths expected and parsed on a mismatch, may be NULL
  * @return success or fail
  */ 
-int parse_compressed_packet(unsigned char* packet_header, int* deltas)
+int parse_compressed_packet(unsigned char* packet_header, int* deltas, muse_parse_errors_t* errors)
 {
 	int medians[4];
 	int quantizations[4];
@@ -187,9 +229,11 @@ int parse_compressed_packet(unsigned char* packet_header, int* deltas)
 	/*error, the number of bits parser doesn't equal the declarations (usually a major bug)*/
 	if(expected_bits_length!=parsed_bits_length){
 	
-		printf("error, parsing compressed packet\n");
-		printf("expected_bits_length: %i\n",expected_bits_length);
-		printf("parsed_bits_length: %i\n",parsed_bits_length);
+		if(errors!=NULL){
+			errors->expected_bits_length = expected_bits_length;
+			errors->parsed_bits_length = parsed_bits_length;
+		}
+		return EXIT_FAILURE;
 	}
 	
 	return EXIT_SUCCESS;
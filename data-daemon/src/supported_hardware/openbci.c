@@ -28,6 +28,12 @@
 #include "openbci.h"
 #include "xml.h"
 #include "data_output.h"
+#include "clock_sync.h"
+#include "capture.h"
+#include "trace.h"
+#include "stats.h"
+#include "logger.h"
+#include "timer_wheel.h"
 
 #include <termios.h>
 #include <stdio.h>
@@ -37,10 +43,11 @@
 #include <sys/types.h>
 
 #define STANDARD_HEADER 0xA0
+#define STANDARD_FOOTER 0xC0 /*high nibble of the stop byte*/
 
-#define DEFAULT_EEG_SCALE 4.5/24/(pow(2,23) - 1)
+#define DEFAULT_EEG_SCALE (OPENBCI_FULL_SCALE/OPENBCI_ADC_MAX)
 #define DEFAULT_ACCEL_SCALE 0.002/pow(2,4)
-#define NB_EEG_CHANNELS 8
+#define NB_EEG_CHANNELS OPENBCI_NB_EEG_CHANNELS
 //#define NB_ACCEL_CHANNELS 3
 
 #define EEG_CHAN_START_IDX 2
@@ -50,6 +57,15 @@
 //#define ACCEL_CHAN_INCREMENT 2
 
 
+/*running index of the next sample produced by the board*/
+static uint64_t sample_idx = 0;
+
+/*relation between the board sample index and the host clock*/
+static clock_sync_t openbci_clock;
+
+/*capture of the packets received, when <capture_file> is set*/
+static capture_t openbci_capture;
+
 char parse_openbci_packet(unsigned char* packet, float eeg_data[NB_EEG_CHANNELS]);//, float acc_data[NB_ACCEL_CHANNELS]);
 int interpret16bitAsInt32(char byteArray[2]);
 int interpret24bitAsInt32(char byteArray[3]);
@@ -60,9 +76,27 @@ int interpret24bitAsInt32(char byteArray[3]);
  */
 int openbci_init_hardware(void *param __attribute__ ((unused)))
 {
+	clock_sync_init(&openbci_clock, OPENBCI_SAMPLING_RATE);
+
+	openbci_capture.file = NULL;
+	if (get_appconfig()->capture_file[0] != '\0') {
+		return capture_init(&openbci_capture, get_appconfig()->capture_file, "OPENBCI");
+	}
 	return (0);
 }
 
+/**
+ * openbci_update_clock()
+ * @brief Tells the clock estimator when the last sample decoded arrived
+ * @param read_ns, host time of the arrival of the packet
+ */
+void openbci_update_clock(int64_t read_ns)
+{
+	if (sample_idx > 0) {
+		clock_sync_update(&openbci_clock, sample_idx-1, read_ns);
+	}
+}
+
 /**
  * openbci_init_hardware()
  * @brief Initializes muse hardware related variables
@@ -82,6 +116,7 @@ int openbci_cleanup(void *param __attribute__ ((unused)))
 	param_t param_stop_transmission = { OPENBCI_HALT_TRANSMISSION, 1 };
 	openbci_send_pkt(&param_stop_transmission);
 	close_serial();
+	capture_cleanup(&openbci_capture);
 	return (0);
 }
 
@@ -134,10 +169,13 @@ int openbci_process_pkt(void *packet, void* output)
 	
 	static unsigned char packet_nb; 
 	static float data[NB_EEG_CHANNELS];	
+	unsigned char nb_skipped;
 	
-	data_t data_struct;
-	data_struct.nb_data = NB_EEG_CHANNELS;
-	data_struct.ptr = data;
+	data_block_t data_block;
+	data_block.nb_samples = 1;
+	data_block.nb_data = NB_EEG_CHANNELS;
+	data_block.ptr = data;
+	data_block.flags = 0;
 	
 	if (_TRANS_PKT_FC) {
 		
@@ -147,13 +185,30 @@ int openbci_process_pkt(void *packet, void* output)
 			/*standard packet*/
 			case STANDARD_HEADER:
 				
+				/*sample numbers skipped by the board, the timeline goes on*/
+				nb_skipped = (unsigned char)(packet_ptr->ptr[1]-packet_nb-1);
+				if (sample_idx > 0 && nb_skipped > 0) {
+					sample_idx += nb_skipped;
+					STATS_ADD(dropped_samples, nb_skipped);
+					LOGGER_RECORD(LOGGER_SAMPLES_DROPPED, nb_skipped, 0, 0);
+				}
 				packet_nb = packet_ptr->ptr[1];
 				
 				/*depacket eeg-acc data*/
 				parse_openbci_packet(packet_ptr->ptr, &(data[0]));//, &(data[8]));
+				TRACE_POINT(TRACE_DECODE);
+				
+				/*timestamp the sample*/
+				data_block.first_sample = sample_idx;
+				data_block.timestamp_ns = clock_sync_predict(&openbci_clock, sample_idx);
+				data_block.sample_period_ns = clock_sync_period(&openbci_clock);
+				sample_idx++;
+				TRACE_POINT(TRACE_TRANSLATE);
+				STATS_ADD(samples_received, 1);
+				
 				/*not need to translate*/
 				for(i=0;i<output_intrface_array->nb_output;i++){
-					COPY_DATA_IN(output_intrface_array->output_interface[i], &data_struct);
+					COPY_BLOCK_IN(output_intrface_array->output_interface[i], &data_block);
 				}
 			break;
 			
@@ -182,7 +237,9 @@ int openbci_read_pkt(void* output)
 
 	int fd = get_serial_fd();
 	int check = 0;
-	int num, offset = 0, bytes_expected = 130;
+	int i, num, offset = 0, bytes_expected = 130;
+	char reading = 0x00;
+	int64_t read_ns;
 
 	/********************************/
 	/* OpenBCI comms initialization */
@@ -196,6 +253,9 @@ int openbci_read_pkt(void* output)
 	// If you care about the $$$ prompt
 	do {
 		num = read(fd, buf + offset, 255);
+		if (num <= 0) {
+			break;
+		}
 
 		if (buf[num - 1] == '$') {
 			check++;
@@ -224,46 +284,70 @@ int openbci_read_pkt(void* output)
 	
 	int samples = 0;
 	
-	unsigned char header_found = 0x00;
-	unsigned char next_packet = 0x00;
-	unsigned char this_byte = 0x00;
-	unsigned char prev_byte = 0x00;
-	
 	bytes_expected = DATA_PACKET_LENGTH;
+	offset = 0;
 	do {
 		
-		header_found = 0x00;
-		this_byte = 0x00;
-		prev_byte = 0x00;
-		
-		/*wait to find the header*/
-		while(!header_found){
-			prev_byte = this_byte;
-			if(read(fd, &this_byte, 1)){			
-				if(this_byte == next_packet && prev_byte == 0xA0){
-					header_found = 0x01;
+		/*fill the packet, from a header whatever its sample number: the
+		  numbers skipped are counted by openbci_process_pkt*/
+		while (offset < bytes_expected) {
+
+			/*the port does not block, the timers run while the bytes are awaited*/
+			num = read(fd, buf + offset, bytes_expected - offset);
+			if (num <= 0) {
+				if (timer_wheel_stopped()) {
+					return (0);
 				}
+				timer_wheel_wait(fd, -1);
+				continue;
+			}
+			offset += num;
+
+			/*the frame stage covers the hunt, from the first byte*/
+			if (!reading) {
+				TRACE_POINT(TRACE_READ);
+				reading = 0x01;
+			}
+
+			/*the bytes before the header are dropped*/
+			for (i = 0; i < offset && (unsigned char)buf[i] != STANDARD_HEADER; i++);
+			if (i > 0) {
+				memmove(buf, buf + i, offset - i);
+				offset -= i;
 			}
-			
 		}
-		
-		/*move on with the rest of the packet*/
-		buf[0] = prev_byte;
-		buf[1] = this_byte;
-		offset = 2;
-		
-		do {
-			offset += read(fd, buf + offset, 1);
-		} while (offset<bytes_expected);
+
+		/*a header found in the samples, the hunt starts over from the next one*/
+		if (((unsigned char)buf[bytes_expected-1] & 0xF0) != STANDARD_FOOTER) {
+			LOGGER_RECORD(LOGGER_PREPARSE_ERROR, bytes_expected-1, (unsigned char)buf[bytes_expected-1], 0);
+			STATS_ADD(preparse_errors, 1);
+			for (i = 1; i < offset && (unsigned char)buf[i] != STANDARD_HEADER; i++);
+			memmove(buf, buf + i, offset - i);
+			offset -= i;
+			continue;
+		}
+
+		/*time of arrival of the packet, framed by the header search*/
+		read_ns = clock_sync_now_ns();
+		TRACE_POINT(TRACE_FRAME);
+		STATS_ADD(bytes_received, offset);
+		STATS_ADD(buffers_received, 1);
+
+		if (openbci_capture.file != NULL) {
+			capture_write(&openbci_capture, (unsigned char *)buf, offset, read_ns);
+		}
 
 		param_process_pkt.ptr = buf;
 		param_process_pkt.len = offset;
 
 		PROCESS_PKT_FC(&param_process_pkt,output);
+		
+		/*the sample decoded had arrived by then*/
+		openbci_update_clock(read_ns);
+		offset = 0;
+		reading = 0x00;
 
-		next_packet++;
-
-	} while(1);
+	} while(!timer_wheel_stopped());
 	printf("Samples taken: %d\n", samples);
 	return (0);
 }
@@ -0,0 +1,221 @@
+/**
+ * @file replay.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Implements the replay pseudo-hardware. It reads a capture file
+ *        (capture.h) and feeds the buffers to the real decoder of the device
+ *        that was captured (muse_process_pkt, openbci_process_pkt), so a field
+ *        session goes through the framing and the decompression again.
+ *
+ *        At <replay_speed> N, the buffers are delivered at N times their
+ *        original pace and the host clock estimators see the delivery times.
+ *        At speed 0, the buffers are delivered as fast as possible and the
+ *        estimators see the capture times, so every replay gives the same
+ *        samples and the same timestamps.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "hardware.h"
+#include "xml.h"
+#include "clock_sync.h"
+#include "capture.h"
+#include "muse.h"
+#include "openbci.h"
+#include "replay.h"
+#include "trace.h"
+#include "stats.h"
+#include "timer_wheel.h"
+
+#define REPLAY_MAX_BUFFER 65536 /*bytes, longest buffer accepted in a capture*/
+
+static FILE* replay_file = NULL;
+static capture_file_header_t replay_header;
+static char replay_device[CAPTURE_DEVICE_LENGTH] = "";
+
+/*decoder of the captured device, to feed the arrival times*/
+static void (*replay_update_clock)(int64_t) = NULL;
+
+static void replay_wait_until(int64_t target_ns);
+
+/**
+ * replay_init_hardware()
+ * @brief Opens the capture and sets the decoder of the captured device
+ */
+int replay_init_hardware(void *param __attribute__ ((unused)))
+{
+	appconfig_t* config = get_appconfig();
+
+	/*the decoder would capture the replay*/
+	if (config->capture_file[0] != '\0') {
+		printf("Replay can't be captured, remove capture_file\n");
+		return (-1);
+	}
+
+	replay_file = fopen(config->replay_file, "rb");
+	if (replay_file == NULL) {
+		perror("fopen");
+		return (-1);
+	}
+
+	if (fread(&replay_header, sizeof(capture_file_header_t), 1, replay_file) != 1 ||
+	    replay_header.magic != CAPTURE_MAGIC || replay_header.version != CAPTURE_VERSION) {
+		printf("%s is not a capture\n", config->replay_file);
+		fclose(replay_file);
+		replay_file = NULL;
+		return (-1);
+	}
+
+	memcpy(replay_device, replay_header.device, CAPTURE_DEVICE_LENGTH);
+	replay_device[CAPTURE_DEVICE_LENGTH-1] = '\0';
+
+	if (strcmp(replay_device, "MUSE") == 0) {
+
+		_TRANS_PKT_FC = &muse_translate_pkt;
+		_PROCESS_PKT_FC = &muse_process_pkt;
+		replay_update_clock = &muse_update_clock;
+		return muse_init_hardware(NULL);
+
+	} else if (strcmp(replay_device, "OPENBCI") == 0) {
+
+		_TRANS_PKT_FC = &openbci_translate_pkt;
+		_PROCESS_PKT_FC = &openbci_process_pkt;
+		replay_update_clock = &openbci_update_clock;
+		return openbci_init_hardware(NULL);
+	}
+
+	printf("Replay of %s captures is not supported\n", replay_device);
+	return (-1);
+}
+
+/**
+ * replay_get_device()
+ * @brief Hardware type of the capture replayed
+ * @return the hardware type, empty before the capture is opened
+ */
+char *replay_get_device(void)
+{
+	return replay_device;
+}
+
+/**
+ * replay_connect_dev()
+ * @brief Nothing to connect to
+ */
+int replay_connect_dev(void *param __attribute__ ((unused)))
+{
+	return (0);
+}
+
+/**
+ * replay_cleanup()
+ * @brief Closes the capture
+ */
+int replay_cleanup(void *param __attribute__ ((unused)))
+{
+	if (replay_file != NULL) {
+		fclose(replay_file);
+		replay_file = NULL;
+	}
+
+	return (0);
+}
+
+/**
+ * replay_send_keep_alive_pkt()
+ * @brief Nothing to keep alive
+ */
+int replay_send_keep_alive_pkt(void *param __attribute__ ((unused)))
+{
+	return (0);
+}
+
+/**
+ * replay_send_pkt()
+ * @brief Nothing to send, the capture holds what the device sent back
+ */
+int replay_send_pkt(void *param __attribute__ ((unused)))
+{
+	return (0);
+}
+
+/**
+ * replay_read_pkt()
+ * @brief Feeds the buffers of the capture to the decoder, at the pace set by
+ *        replay_speed, until the end of the capture
+ */
+int replay_read_pkt(void *output)
+{
+	capture_record_t record;
+	param_t param_process_pkt = { 0 };
+	unsigned char *buf = (unsigned char *)malloc(REPLAY_MAX_BUFFER);
+	float speed = get_appconfig()->replay_speed;
+	int64_t first_ns = 0, start_ns = 0, read_ns;
+	uint64_t nb_buffers = 0, nb_dropped = 0;
+	char started = 0x00;
+
+	while (!timer_wheel_stopped() && fread(&record, sizeof(capture_record_t), 1, replay_file) == 1) {
+
+		if (record.length > REPLAY_MAX_BUFFER ||
+		    fread(buf, 1, record.length, replay_file) != record.length) {
+			printf("Replay: capture truncated or corrupted\n");
+			break;
+		}
+
+		/*buffers the capture could not keep, the decoder sees the gap*/
+		nb_dropped += record.nb_dropped;
+		if (record.length == 0) {
+			continue;
+		}
+
+		if (!started) {
+			first_ns = record.timestamp_ns;
+			start_ns = clock_sync_now_ns();
+			started = 0x01;
+		}
+
+		/*time of arrival of the buffer in the replay*/
+		read_ns = record.timestamp_ns;
+		if (speed > 0) {
+			read_ns = start_ns+(int64_t)((record.timestamp_ns-first_ns)/speed);
+			replay_wait_until(read_ns);
+		} else {
+			timer_wheel_poll();
+		}
+		TRACE_POINT(TRACE_READ);
+		STATS_ADD(bytes_received, record.length);
+		STATS_ADD(buffers_received, 1);
+
+		param_process_pkt.ptr = buf;
+		param_process_pkt.len = record.length;
+		PROCESS_PKT_FC(&param_process_pkt, output);
+
+		replay_update_clock(read_ns);
+		nb_buffers++;
+	}
+
+	printf("Replay: %lu buffers, %lu dropped by the capture\n", (unsigned long)nb_buffers, (unsigned long)nb_dropped);
+	fflush(stdout);
+
+	free(buf);
+	return (0);
+}
+
+/**
+ * replay_wait_until()
+ * @brief Sleeps until a host time, the timers run meanwhile
+ * @param target_ns, host time (CLOCK_MONOTONIC_RAW)
+ */
+static void replay_wait_until(int64_t target_ns)
+{
+	int64_t now_ns = clock_sync_now_ns();
+
+	if (target_ns <= now_ns) {
+		timer_wheel_poll();
+		return;
+	}
+
+	timer_wheel_wait(-1, target_ns-now_ns);
+}
@@ -0,0 +1,462 @@
+/**
+ * @file band_power.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Band power features, computed in the daemon. Each window of the stream
+ *        has its mean removed, is tapered by a hann window, zero padded to a power
+ *        of 2 and transformed with a real FFT. The real transform of size N runs
+ *        as a complex transform of size N/2 on the even/odd samples, which is then
+ *        split. Tapers, twiddles and bins are computed once at init.
+ *
+ *        The powers are one sided, normalized so that a sine of amplitude A in a
+ *        band gives a power of A^2/2.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "data_output.h"
+#include "shm_wrt_buf.h"
+#include "shsem_def.h"
+#include "band_power.h"
+
+static void band_power_fft(band_power_t* band_power);
+static void band_power_window(band_power_t* band_power);
+static char* band_power_stage_names(appconfig_t* config, stage_format_t* format);
+
+/**
+ * band_power_t* band_power_init(int nb_channels, int nb_analyzed, int window_size, int rate,
+ *                               feature_band_t* bands, int nb_bands)
+ * @brief Allocates the features and precomputes the transform
+ * @param nb_channels, values per sample
+ * @param nb_analyzed, leading channels analyzed
+ * @param window_size, samples per window
+ * @param rate, sampling rate (Hz)
+ * @param bands, frequency bands
+ * @param nb_bands, number of bands
+ * @return the band power features, NULL on error
+ */
+band_power_t* band_power_init(int nb_channels, int nb_analyzed, int window_size, int rate,
+                              feature_band_t* bands, int nb_bands){
+
+	int i, k, bits;
+	double sum_taper = 0;
+	band_power_t* band_power;
+
+	if(rate<=0 || window_size<2 || nb_analyzed<=0 || nb_analyzed>nb_channels || nb_bands>MAX_FEATURE_BANDS){
+		fprintf(stderr, "band power: invalid stream\n");
+		return NULL;
+	}
+
+	band_power = (band_power_t*)malloc(sizeof(band_power_t));
+	memset(band_power, 0, sizeof(band_power_t));
+
+	band_power->nb_channels = nb_channels;
+	band_power->nb_analyzed = nb_analyzed;
+	band_power->window_size = window_size;
+	band_power->rate = rate;
+
+	/*smallest power of 2 holding the window*/
+	for(bits=1;(1<<bits)<window_size;bits++);
+	band_power->fft_size = 1<<bits;
+	band_power->half_size = band_power->fft_size/2;
+
+	band_power->taper = (float*)malloc(window_size*sizeof(float));
+	band_power->twiddle_re = (float*)malloc(band_power->half_size*sizeof(float));
+	band_power->twiddle_im = (float*)malloc(band_power->half_size*sizeof(float));
+	band_power->post_re = (float*)malloc(band_power->half_size*sizeof(float));
+	band_power->post_im = (float*)malloc(band_power->half_size*sizeof(float));
+	band_power->bit_reverse = (int*)malloc(band_power->half_size*sizeof(int));
+	band_power->bin_scale = (float*)malloc((band_power->half_size+1)*sizeof(float));
+	band_power->window = (float*)malloc(nb_analyzed*window_size*sizeof(float));
+	band_power->work_re = (float*)malloc(band_power->half_size*sizeof(float));
+	band_power->work_im = (float*)malloc(band_power->half_size*sizeof(float));
+	band_power->bin_power = (float*)malloc((band_power->half_size+1)*sizeof(float));
+	band_power->features = (float*)malloc(nb_analyzed*nb_bands*sizeof(float));
+
+	if(band_power->taper==NULL || band_power->twiddle_re==NULL || band_power->twiddle_im==NULL ||
+	   band_power->post_re==NULL || band_power->post_im==NULL || band_power->bit_reverse==NULL ||
+	   band_power->bin_scale==NULL || band_power->window==NULL || band_power->work_re==NULL ||
+	   band_power->work_im==NULL || band_power->bin_power==NULL || band_power->features==NULL){
+		band_power_cleanup(band_power);
+		return NULL;
+	}
+
+	/*hann taper*/
+	for(i=0;i<window_size;i++){
+		band_power->taper[i] = (float)(0.5-0.5*cos(2*M_PI*i/(window_size-1)));
+		sum_taper += band_power->taper[i]*band_power->taper[i];
+	}
+
+	/*twiddles of the complex transform (size M)*/
+	for(k=0;k<band_power->half_size/2;k++){
+		band_power->twiddle_re[k] = (float)cos(2*M_PI*k/band_power->half_size);
+		band_power->twiddle_im[k] = (float)-sin(2*M_PI*k/band_power->half_size);
+	}
+
+	/*twiddles splitting the complex transform in the real one (size N)*/
+	for(k=0;k<band_power->half_size;k++){
+		band_power->post_re[k] = (float)cos(2*M_PI*k/band_power->fft_size);
+		band_power->post_im[k] = (float)-sin(2*M_PI*k/band_power->fft_size);
+	}
+
+	/*input permutation*/
+	for(k=0;k<band_power->half_size;k++){
+		band_power->bit_reverse[k] = 0;
+		for(i=0;i<bits-1;i++){
+			if(k&(1<<i)){
+				band_power->bit_reverse[k] |= 1<<(bits-2-i);
+			}
+		}
+	}
+
+	/*one sided power, the bins between DC and nyquist count twice*/
+	for(k=0;k<=band_power->half_size;k++){
+		band_power->bin_scale[k] = (float)(((k==0 || k==band_power->half_size)?1.0:2.0)/(band_power->fft_size*sum_taper));
+	}
+
+	/*bins of the bands, a bin belongs to the band holding its frequency*/
+	band_power->nb_bands = nb_bands;
+	for(i=0;i<nb_bands;i++){
+		band_power->bins[i].first = (int)ceil(bands[i].low*band_power->fft_size/rate);
+		band_power->bins[i].last = (int)ceil(bands[i].high*band_power->fft_size/rate)-1;
+		if(band_power->bins[i].last>band_power->half_size){
+			band_power->bins[i].last = band_power->half_size;
+		}
+		if(band_power->bins[i].first>band_power->bins[i].last){
+			fprintf(stderr, "band power: the band %.1f-%.1f Hz has no bin, it will read 0\n", bands[i].low, bands[i].high);
+		}
+	}
+
+	return band_power;
+}
+
+/**
+ * int band_power_process(band_power_t* band_power, data_block_t* input, data_block_t* features)
+ * @brief Adds samples to the window, up to its end. When the window is complete,
+ *        its features are computed.
+ * @param band_power
+ * @param input, the input block
+ * @param (out)features, holds one feature vector when the window is complete, none otherwise
+ * @return number of input samples consumed
+ */
+int band_power_process(band_power_t* band_power, data_block_t* input, data_block_t* features){
+
+	int i, c;
+	int nb_samples = band_power->window_size-band_power->window_fill;
+
+	if(nb_samples>input->nb_samples){
+		nb_samples = input->nb_samples;
+	}
+
+	/*a new window takes the timing of its first sample*/
+	if(band_power->window_fill==0){
+		band_power->window_first_sample = input->first_sample;
+		band_power->window_timestamp_ns = input->timestamp_ns;
+		band_power->sample_period_ns = input->sample_period_ns;
+	}
+
+	for(c=0;c<band_power->nb_analyzed;c++){
+		for(i=0;i<nb_samples;i++){
+			band_power->window[c*band_power->window_size+band_power->window_fill+i] = input->ptr[i*input->nb_data+c];
+		}
+	}
+	band_power->window_fill += nb_samples;
+
+	features->nb_samples = 0;
+
+	/*the window is complete*/
+	if(band_power->window_fill==band_power->window_size){
+
+		band_power_window(band_power);
+		band_power->window_fill = 0;
+
+		features->nb_samples = 1;
+		features->nb_data = band_power->nb_analyzed*band_power->nb_bands;
+		features->ptr = band_power->features;
+		features->first_sample = band_power->window_first_sample;
+		features->timestamp_ns = band_power->window_timestamp_ns;
+		features->sample_period_ns = band_power->sample_period_ns;
+		features->flags = 0;
+	}
+
+	return nb_samples;
+}
+
+/**
+ * void band_power_cleanup(band_power_t* band_power)
+ * @brief Frees the band power features
+ */
+void band_power_cleanup(band_power_t* band_power){
+
+	if(band_power==NULL){
+		return;
+	}
+
+	free(band_power->taper);
+	free(band_power->twiddle_re);
+	free(band_power->twiddle_im);
+	free(band_power->post_re);
+	free(band_power->post_im);
+	free(band_power->bit_reverse);
+	free(band_power->bin_scale);
+	free(band_power->window);
+	free(band_power->work_re);
+	free(band_power->work_im);
+	free(band_power->bin_power);
+	free(band_power->features);
+	free(band_power);
+}
+
+/**
+ * void* band_power_stage_init(appconfig_t* config, stage_format_t* format)
+ * @brief Band power stage, one window per page, and opens the feature ring
+ * @param config, the feature ring and bands
+ * @param (in/out)format, the stream, unchanged
+ * @return the band power stage, NULL on error
+ */
+void* band_power_stage_init(appconfig_t* config, stage_format_t* format){
+
+	shm_mem_options_t feature_options;
+	band_power_stage_t* band_power_stage = (band_power_stage_t*)malloc(sizeof(band_power_stage_t));
+
+	/*one window per page*/
+	band_power_stage->band_power = band_power_init(format->nb_channels, format->nb_signals, config->window_size, format->rate,
+	                                               config->feature_bands, config->nb_feature_bands);
+	if(band_power_stage->band_power==NULL){
+		free(band_power_stage);
+		return NULL;
+	}
+
+	/*the feature ring holds one vector per page, between preprocessing and application.
+	  Its semaphores are in the set of the data ring (shsem_def.h), owned by that
+	  ring, unless <feature_sem_key> gives it its own set*/
+	feature_options.shm_key = config->feature_shm_key;
+	feature_options.sem_key = config->sem_key;
+	feature_options.sem_owner = 0x00;
+	if (config->feature_sem_key != 0 && config->feature_sem_key != config->sem_key) {
+		feature_options.sem_key = config->feature_sem_key;
+		feature_options.sem_owner = 0x01;
+	}
+	feature_options.nb_data_channels = format->nb_signals*config->nb_feature_bands;
+	feature_options.window_size = 1;
+	feature_options.nb_pages = config->nb_pages;
+	feature_options.page_size = feature_options.nb_data_channels*sizeof(float);
+	feature_options.buffer_size = feature_options.page_size*feature_options.nb_pages;
+	feature_options.rate = 0;
+	feature_options.channel_names = band_power_stage_names(config, format);
+	feature_options.sample_format = SHM_SAMPLE_FLOAT32;
+	feature_options.scale = NULL;
+	feature_options.offset = NULL;
+	feature_options.sem_page_free = APP_IN_READY;
+	feature_options.sem_page_written = PREPROC_OUT_READY;
+
+	band_power_stage->feature_ring = shm_wrt_init((void*)&feature_options);
+	free(feature_options.channel_names);
+	if(band_power_stage->feature_ring==NULL){
+		band_power_cleanup(band_power_stage->band_power);
+		free(band_power_stage);
+		return NULL;
+	}
+
+	return (void*)band_power_stage;
+}
+
+/**
+ * int band_power_stage_process(void* stage, data_block_t* input, data_block_t* output)
+ * @brief Analyzes a block of the chain and publishes the completed feature
+ *        vectors. The block is handed to the next stage as is.
+ * @param stage, the band power stage
+ * @param input, the input block
+ * @param (out)output, the input block
+ * @return number of output samples
+ */
+int band_power_stage_process(void* stage, data_block_t* input, data_block_t* output){
+
+	int nb_done = 0;
+	data_block_t chunk;
+	data_block_t features;
+
+	band_power_stage_t* band_power_stage = (band_power_stage_t*)stage;
+
+	memcpy(&chunk, input, sizeof(data_block_t));
+
+	/*a block may complete several windows*/
+	while(nb_done<input->nb_samples){
+
+		chunk.nb_samples = input->nb_samples-nb_done;
+		chunk.ptr = &(input->ptr[nb_done*input->nb_data]);
+		chunk.first_sample = input->first_sample+nb_done;
+		if(input->timestamp_ns){
+			chunk.timestamp_ns = input->timestamp_ns+(int64_t)(nb_done*input->sample_period_ns);
+		}
+
+		nb_done += band_power_process(band_power_stage->band_power, &chunk, &features);
+
+		if(features.nb_samples>0){
+			shm_wrt_write_block_in_buf(band_power_stage->feature_ring, &features);
+		}
+	}
+
+	memcpy(output, input, sizeof(data_block_t));
+
+	return output->nb_samples;
+}
+
+/**
+ * void band_power_stage_cleanup(void* stage)
+ * @brief Closes the feature ring and frees the band power stage
+ */
+void band_power_stage_cleanup(void* stage){
+
+	band_power_stage_t* band_power_stage = (band_power_stage_t*)stage;
+
+	shm_wrt_cleanup(band_power_stage->feature_ring);
+	band_power_cleanup(band_power_stage->band_power);
+	free(band_power_stage);
+}
+
+/**
+ * char* band_power_stage_names(appconfig_t* config, stage_format_t* format)
+ * @brief Names the features, channel:low-high
+ * @param config, the bands
+ * @param format, the analyzed stream
+ * @return the names, to be freed, NULL if there are too many
+ */
+static char* band_power_stage_names(appconfig_t* config, stage_format_t* format){
+
+	int c, b;
+	char* names;
+	char name[64];
+
+	if(format->nb_signals*config->nb_feature_bands>SHM_MAX_CHANNELS){
+		return NULL;
+	}
+
+	names = (char*)calloc(format->nb_signals*config->nb_feature_bands, SHM_CHANNEL_NAME_LENGTH);
+	if(names==NULL){
+		return NULL;
+	}
+
+	for(c=0;c<format->nb_signals;c++){
+		for(b=0;b<config->nb_feature_bands;b++){
+			/*long names are cut*/
+			snprintf(name, sizeof(name), "%s:%g-%g", format->channel_names[c],
+			         config->feature_bands[b].low, config->feature_bands[b].high);
+			memcpy(&(names[(c*config->nb_feature_bands+b)*SHM_CHANNEL_NAME_LENGTH]), name, SHM_CHANNEL_NAME_LENGTH-1);
+		}
+	}
+
+	return names;
+}
+
+/**
+ * void band_power_window(band_power_t* band_power)
+ * @brief Computes the features of the complete window, channel by channel
+ * @param band_power
+ */
+static void band_power_window(band_power_t* band_power){
+
+	int c, i, k, b;
+	int n = band_power->window_size;
+	int half_size = band_power->half_size;
+	float* x;
+	float* re = band_power->work_re;
+	float* im = band_power->work_im;
+	float* features;
+	double mean, power;
+	float zk_re, zk_im, zm_re, zm_im;
+	float even_re, even_im, odd_re, odd_im;
+	float xk_re, xk_im;
+	float* bin_power = band_power->bin_power;
+
+	for(c=0;c<band_power->nb_analyzed;c++){
+
+		x = &(band_power->window[c*n]);
+
+		/*the electrode offset would leak in the low bins*/
+		mean = 0;
+		for(i=0;i<n;i++){
+			mean += x[i];
+		}
+		mean /= n;
+
+		/*even samples as real part, odd samples as imaginary part, permuted*/
+		for(k=0;k<half_size;k++){
+			i = band_power->bit_reverse[k];
+			re[k] = (2*i<n)?(float)(x[2*i]-mean)*band_power->taper[2*i]:0;
+			im[k] = (2*i+1<n)?(float)(x[2*i+1]-mean)*band_power->taper[2*i+1]:0;
+		}
+
+		band_power_fft(band_power);
+
+		/*split the complex transform Z in the real transform X:
+		 *X[k] = (Z[k]+conj(Z[M-k]))/2 + exp(-2*pi*i*k/N)*(Z[k]-conj(Z[M-k]))/2i*/
+		bin_power[0] = (re[0]+im[0])*(re[0]+im[0])*band_power->bin_scale[0];
+		bin_power[half_size] = (re[0]-im[0])*(re[0]-im[0])*band_power->bin_scale[half_size];
+		for(k=1;k<half_size;k++){
+			zk_re = re[k];
+			zk_im = im[k];
+			zm_re = re[half_size-k];
+			zm_im = -im[half_size-k];
+
+			even_re = 0.5f*(zk_re+zm_re);
+			even_im = 0.5f*(zk_im+zm_im);
+			odd_re = 0.5f*(zk_im-zm_im);
+			odd_im = -0.5f*(zk_re-zm_re);
+
+			xk_re = even_re+band_power->post_re[k]*odd_re-band_power->post_im[k]*odd_im;
+			xk_im = even_im+band_power->post_re[k]*odd_im+band_power->post_im[k]*odd_re;
+
+			bin_power[k] = (xk_re*xk_re+xk_im*xk_im)*band_power->bin_scale[k];
+		}
+
+		/*sum the bins of each band*/
+		features = &(band_power->features[c*band_power->nb_bands]);
+		for(b=0;b<band_power->nb_bands;b++){
+			power = 0;
+			for(k=band_power->bins[b].first;k<=band_power->bins[b].last;k++){
+				power += bin_power[k];
+			}
+			features[b] = (float)power;
+		}
+	}
+}
+
+/**
+ * void band_power_fft(band_power_t* band_power)
+ * @brief In place radix-2 complex FFT of size M on the work buffers, the input
+ *        is already in bit reversed order
+ * @param band_power
+ */
+static void band_power_fft(band_power_t* band_power){
+
+	int size, half, step, start, k;
+	int half_size = band_power->half_size;
+	float* re = band_power->work_re;
+	float* im = band_power->work_im;
+	float w_re, w_im, t_re, t_im;
+
+	for(size=2;size<=half_size;size*=2){
+
+		half = size/2;
+		step = half_size/size;
+
+		for(start=0;start<half_size;start+=size){
+			for(k=0;k<half;k++){
+
+				w_re = band_power->twiddle_re[k*step];
+				w_im = band_power->twiddle_im[k*step];
+
+				t_re = w_re*re[start+k+half]-w_im*im[start+k+half];
+				t_im = w_re*im[start+k+half]+w_im*re[start+k+half];
+
+				re[start+k+half] = re[start+k]-t_re;
+				im[start+k+half] = im[start+k]-t_im;
+				re[start+k] += t_re;
+				im[start+k] += t_im;
+			}
+		}
+	}
+}
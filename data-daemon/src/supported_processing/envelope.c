@@ -0,0 +1,262 @@
+/**
+ * @file envelope.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Min/max envelope pyramid, maintained as the samples go by. Each level
+ *        reduces 16 entries of the level below (16 samples for the first one)
+ *        to their min and max, so every sample is compared once per level at
+ *        most 1/16 of the time above the first. Completed entries are written
+ *        in the rings of the shared segment, described in shm_page_def.h.
+ *
+ *        Filled gaps (nan) are left out of the min and max.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "data_output.h"
+#include "envelope.h"
+
+static void envelope_reset(envelope_t* envelope, int level);
+static void envelope_close(envelope_t* envelope, int level);
+
+/**
+ * envelope_t* envelope_init(int shm_key, int nb_channels, int rate, int duration, char* channel_names)
+ * @brief Creates the segment of the pyramid
+ * @param shm_key, key of the segment
+ * @param nb_channels, values per sample
+ * @param rate, sampling rate (Hz)
+ * @param duration, seconds kept in each level
+ * @param channel_names, nb_channels names of SHM_CHANNEL_NAME_LENGTH chars, NULL if unknown
+ * @return the envelope, NULL on error
+ */
+envelope_t* envelope_init(int shm_key, int nb_channels, int rate, int duration, char* channel_names){
+
+	int level;
+	uint32_t offset, decimation = 1;
+	shm_envelope_level_t* levels;
+	envelope_t* envelope;
+
+	if(rate<=0 || duration<=0 || nb_channels<=0 || nb_channels>SHM_MAX_CHANNELS){
+		fprintf(stderr, "envelope: invalid stream\n");
+		return NULL;
+	}
+
+	envelope = (envelope_t*)malloc(sizeof(envelope_t));
+	memset(envelope, 0, sizeof(envelope_t));
+	envelope->nb_channels = nb_channels;
+
+	/*size the rings, one after the other behind the header*/
+	envelope->header = (shm_envelope_header_t*)calloc(1, sizeof(shm_envelope_header_t));
+	levels = envelope->header->levels;
+	offset = (sizeof(shm_envelope_header_t)+7)&~7;
+
+	for(level=0;level<SHM_ENVELOPE_LEVELS;level++){
+		decimation *= SHM_ENVELOPE_FACTOR;
+		levels[level].decimation = decimation;
+		levels[level].capacity = (uint32_t)(((uint64_t)duration*rate+decimation-1)/decimation)+1;
+		levels[level].offset = offset;
+		levels[level].nb_written = 0;
+		offset += levels[level].capacity*SHM_ENVELOPE_ENTRY_SIZE(nb_channels);
+
+		envelope->acc[level] = (float*)malloc(SHM_ENVELOPE_ENTRY_SIZE(nb_channels));
+		envelope_reset(envelope, level);
+	}
+
+	if((envelope->shmid = shmget(shm_key, offset, IPC_CREAT | 0666)) < 0){
+		perror("shmget");
+		free(envelope->header);
+		envelope->header = NULL;
+		envelope_cleanup(envelope);
+		return NULL;
+	}
+
+	if((envelope->segment = (char*)shmat(envelope->shmid, NULL, 0)) == (char*)-1){
+		perror("shmat");
+		shmctl(envelope->shmid, IPC_RMID, 0);
+		free(envelope->header);
+		envelope->header = NULL;
+		envelope->segment = NULL;
+		envelope_cleanup(envelope);
+		return NULL;
+	}
+
+	/*the magic goes last, readers check it before trusting the header*/
+	envelope->header->nb_channels = nb_channels;
+	envelope->header->rate = rate;
+	envelope->header->nb_levels = SHM_ENVELOPE_LEVELS;
+	if(channel_names!=NULL){
+		memcpy(envelope->header->channel_names, channel_names, nb_channels*SHM_CHANNEL_NAME_LENGTH);
+	}
+	memcpy(envelope->segment, envelope->header, sizeof(shm_envelope_header_t));
+	free(envelope->header);
+	envelope->header = (shm_envelope_header_t*)envelope->segment;
+	__sync_synchronize();
+	envelope->header->magic = SHM_ENVELOPE_MAGIC;
+
+	return envelope;
+}
+
+/**
+ * void envelope_process(envelope_t* envelope, data_block_t* input)
+ * @brief Adds the samples of a block to the pyramid
+ * @param envelope
+ * @param input, the input block
+ */
+void envelope_process(envelope_t* envelope, data_block_t* input){
+
+	int i, c;
+	float x;
+	float* acc = envelope->acc[0];
+
+	/*the entries count from the first sample seen*/
+	if(!envelope->started){
+		envelope->header->first_sample = input->first_sample;
+		envelope->started = 1;
+	}
+
+	for(i=0;i<input->nb_samples;i++){
+
+		for(c=0;c<envelope->nb_channels;c++){
+			x = input->ptr[i*input->nb_data+c];
+
+			/*comparisons with nan are false, gaps are left out*/
+			if(x<acc[2*c]){
+				acc[2*c] = x;
+			}
+			if(x>acc[2*c+1]){
+				acc[2*c+1] = x;
+			}
+		}
+
+		if(++envelope->acc_count[0]==SHM_ENVELOPE_FACTOR){
+			envelope_close(envelope, 0);
+		}
+	}
+}
+
+/**
+ * void envelope_cleanup(envelope_t* envelope)
+ * @brief Removes the segment and frees the envelope
+ */
+void envelope_cleanup(envelope_t* envelope){
+
+	int level;
+
+	if(envelope==NULL){
+		return;
+	}
+
+	if(envelope->segment!=NULL){
+		shmdt(envelope->segment);
+		shmctl(envelope->shmid, IPC_RMID, 0);
+	}
+
+	for(level=0;level<SHM_ENVELOPE_LEVELS;level++){
+		free(envelope->acc[level]);
+	}
+	free(envelope);
+}
+
+/**
+ * void* envelope_stage_init(appconfig_t* config, stage_format_t* format)
+ * @brief Envelope stage, creates the pyramid of the stream
+ * @param config, the segment and the duration kept
+ * @param (in/out)format, the stream, unchanged
+ * @return the envelope, NULL on error
+ */
+void* envelope_stage_init(appconfig_t* config, stage_format_t* format){
+
+	if(config->envelope_shm_key==0){
+		fprintf(stderr, "envelope: envelope_shm_key is missing\n");
+		return NULL;
+	}
+
+	return (void*)envelope_init(config->envelope_shm_key, format->nb_channels, format->rate, config->envelope_duration,
+	                            (char*)format->channel_names);
+}
+
+/**
+ * int envelope_stage_process(void* stage, data_block_t* input, data_block_t* output)
+ * @brief Adds a block of the chain to the pyramid. The block is handed to the
+ *        next stage as is.
+ * @param stage, the envelope
+ * @param input, the input block
+ * @param (out)output, the input block
+ * @return number of output samples
+ */
+int envelope_stage_process(void* stage, data_block_t* input, data_block_t* output){
+
+	envelope_process((envelope_t*)stage, input);
+	memcpy(output, input, sizeof(data_block_t));
+
+	return output->nb_samples;
+}
+
+/**
+ * void envelope_stage_cleanup(void* stage)
+ * @brief Frees the envelope stage
+ */
+void envelope_stage_cleanup(void* stage){
+	envelope_cleanup((envelope_t*)stage);
+}
+
+/**
+ * void envelope_reset(envelope_t* envelope, int level)
+ * @brief Starts a new entry, empty
+ */
+static void envelope_reset(envelope_t* envelope, int level){
+
+	int c;
+
+	for(c=0;c<envelope->nb_channels;c++){
+		envelope->acc[level][2*c] = INFINITY;
+		envelope->acc[level][2*c+1] = -INFINITY;
+	}
+	envelope->acc_count[level] = 0;
+}
+
+/**
+ * void envelope_close(envelope_t* envelope, int level)
+ * @brief Writes the entry in progress in the ring of its level, and adds it
+ *        to the entry of the level above
+ */
+static void envelope_close(envelope_t* envelope, int level){
+
+	int c;
+	float* acc = envelope->acc[level];
+	float* above;
+	float* entry;
+	shm_envelope_level_t* ring = &(envelope->header->levels[level]);
+
+	/*merge in the level above, before the empty channels become nan*/
+	if(level+1<SHM_ENVELOPE_LEVELS){
+		above = envelope->acc[level+1];
+		for(c=0;c<envelope->nb_channels;c++){
+			if(acc[2*c]<above[2*c]){
+				above[2*c] = acc[2*c];
+			}
+			if(acc[2*c+1]>above[2*c+1]){
+				above[2*c+1] = acc[2*c+1];
+			}
+		}
+	}
+
+	/*write the entry, then publish it*/
+	entry = (float*)&(envelope->segment[ring->offset+(ring->nb_written%ring->capacity)*SHM_ENVELOPE_ENTRY_SIZE(envelope->nb_channels)]);
+	for(c=0;c<envelope->nb_channels;c++){
+		entry[2*c] = (acc[2*c]>acc[2*c+1])?NAN:acc[2*c];
+		entry[2*c+1] = (acc[2*c]>acc[2*c+1])?NAN:acc[2*c+1];
+	}
+	__sync_synchronize();
+	ring->nb_written++;
+
+	envelope_reset(envelope, level);
+
+	if(level+1<SHM_ENVELOPE_LEVELS && ++envelope->acc_count[level+1]==SHM_ENVELOPE_FACTOR){
+		envelope_close(envelope, level+1);
+	}
+}
@@ -0,0 +1,316 @@
+/**
+ * @file filter_bank.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Cascade of biquad filters applied to every channel of the stream.
+ *        Coefficients follow the audio EQ cookbook (R. Bristow-Johnson); the
+ *        high and low pass are 4th order Butterworth, built from 2 biquads.
+ *
+ *        Each biquad runs in transposed direct form II, 4 channels at a time in
+ *        the lanes of a vector. A missing value (NaN) goes through unchanged and
+ *        leaves the state of its channel untouched, so it does not ruin the filter.
+ *        The state of a channel starts in steady state for its first value, which
+ *        avoids the long transient of the high-pass on the electrode offset.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "data_output.h"
+#include "simd.h"
+#include "filter_bank.h"
+
+/*quality factors of the 2 biquads of a 4th order butterworth*/
+static const double butterworth_q[2] = { 0.54119610, 1.30656296 };
+
+typedef enum { BIQUAD_NOTCH, BIQUAD_HIGHPASS, BIQUAD_LOWPASS } biquad_type_t;
+
+static int filter_bank_add_section(filter_bank_t* filter_bank, biquad_type_t type, double freq, double q, int rate);
+static void filter_bank_prime(filter_bank_t* filter_bank, int vector, v4sf x, v4si lanes);
+
+/**
+ * filter_bank_t* filter_bank_init(int nb_channels, int nb_filtered, int rate, filter_options_t* options)
+ * @brief Allocates and designs a filter bank
+ * @param nb_channels, values per sample
+ * @param nb_filtered, leading channels to filter
+ * @param rate, sampling rate (Hz)
+ * @param options, filters to apply
+ * @return the filter bank, NULL on error
+ */
+filter_bank_t* filter_bank_init(int nb_channels, int nb_filtered, int rate, filter_options_t* options){
+
+	int i;
+	int error = 0;
+	filter_bank_t* filter_bank;
+
+	if(rate<=0 || nb_channels<=0 || nb_filtered>nb_channels){
+		fprintf(stderr, "filter bank: invalid stream\n");
+		return NULL;
+	}
+
+	/*holds vectors, must be aligned*/
+	filter_bank = (filter_bank_t*)simd_malloc(sizeof(filter_bank_t));
+	if(filter_bank==NULL){
+		return NULL;
+	}
+
+	filter_bank->nb_channels = nb_channels;
+	filter_bank->nb_filtered = nb_filtered;
+	filter_bank->nb_vectors = SIMD_ROUND_UP(nb_filtered)/SIMD_WIDTH;
+
+	/*notch on the line frequency*/
+	if(options->notch_freq>0){
+		error |= filter_bank_add_section(filter_bank, BIQUAD_NOTCH, options->notch_freq, FILTER_BANK_NOTCH_Q, rate);
+	}
+
+	/*high-pass, removes the drift*/
+	if(options->highpass_freq>0){
+		for(i=0;i<2;i++){
+			error |= filter_bank_add_section(filter_bank, BIQUAD_HIGHPASS, options->highpass_freq, butterworth_q[i], rate);
+		}
+	}
+
+	/*band-pass, as a high-pass followed by a low-pass*/
+	if(options->bandpass_low>0 && options->bandpass_high>0){
+		if(options->bandpass_low>=options->bandpass_high){
+			fprintf(stderr, "filter bank: empty pass band\n");
+			error = 1;
+		}
+		for(i=0;i<2;i++){
+			error |= filter_bank_add_section(filter_bank, BIQUAD_HIGHPASS, options->bandpass_low, butterworth_q[i], rate);
+		}
+		for(i=0;i<2;i++){
+			error |= filter_bank_add_section(filter_bank, BIQUAD_LOWPASS, options->bandpass_high, butterworth_q[i], rate);
+		}
+	}
+
+	filter_bank->state = (v4sf*)simd_malloc(2*filter_bank->nb_sections*filter_bank->nb_vectors*sizeof(v4sf)+SIMD_ALIGN);
+	filter_bank->primed = (v4si*)simd_malloc(filter_bank->nb_vectors*sizeof(v4si)+SIMD_ALIGN);
+	filter_bank->work = (v4sf*)simd_malloc(filter_bank->nb_vectors*sizeof(v4sf)+SIMD_ALIGN);
+	filter_bank->out_buf = (float*)simd_malloc(FILTER_BANK_MAX_IN*nb_channels*sizeof(float));
+
+	if(error || filter_bank->state==NULL || filter_bank->primed==NULL || filter_bank->work==NULL || filter_bank->out_buf==NULL){
+		filter_bank_cleanup(filter_bank);
+		return NULL;
+	}
+
+	return filter_bank;
+}
+
+/**
+ * int filter_bank_process(filter_bank_t* filter_bank, data_block_t* input, data_block_t* output)
+ * @brief Filters a block of at most FILTER_BANK_MAX_IN samples
+ * @param filter_bank
+ * @param input, the input block
+ * @param (out)output, the output block, pointing in the filter bank buffer
+ * @return number of output samples
+ */
+int filter_bank_process(filter_bank_t* filter_bank, data_block_t* input, data_block_t* output){
+
+	int i, v, s;
+	int nb_channels = filter_bank->nb_channels;
+	int nb_vectors = filter_bank->nb_vectors;
+	float* in;
+	float* out;
+	float* work = (float*)filter_bank->work;
+	v4sf x, y, s1, s2;
+	v4si valid, unprimed;
+	v4sf* state;
+	biquad_t* section;
+
+	memcpy(output, input, sizeof(data_block_t));
+	output->ptr = filter_bank->out_buf;
+
+	for(i=0;i<input->nb_samples;i++){
+
+		in = &(input->ptr[i*input->nb_data]);
+		out = &(filter_bank->out_buf[i*nb_channels]);
+
+		/*channels not filtered are copied*/
+		memcpy(out, in, nb_channels*sizeof(float));
+
+		/*spread the sample in the lanes, the padding lanes stay at 0*/
+		filter_bank->work[nb_vectors-1] = simd_splat(0);
+		memcpy(work, in, filter_bank->nb_filtered*sizeof(float));
+
+		for(v=0;v<nb_vectors;v++){
+
+			x = filter_bank->work[v];
+			valid = (x==x);
+			state = &(filter_bank->state[2*v]);
+
+			/*first value of a channel*/
+			unprimed = valid & ~filter_bank->primed[v];
+			if(unprimed[0] | unprimed[1] | unprimed[2] | unprimed[3]){
+				filter_bank_prime(filter_bank, v, x, unprimed);
+				filter_bank->primed[v] |= unprimed;
+			}
+
+			/*each section filters the output of the previous one*/
+			for(s=0;s<filter_bank->nb_sections;s++){
+
+				section = &(filter_bank->sections[s]);
+				s1 = state[0];
+				s2 = state[1];
+
+				y = section->b0*x+s1;
+				state[0] = simd_select(valid, section->b1*x-section->a1*y+s2, s1);
+				state[1] = simd_select(valid, section->b2*x-section->a2*y, s2);
+
+				x = y;
+				state += 2*nb_vectors;
+			}
+
+			filter_bank->work[v] = x;
+		}
+
+		memcpy(out, work, filter_bank->nb_filtered*sizeof(float));
+	}
+
+	return output->nb_samples;
+}
+
+/**
+ * void filter_bank_cleanup(filter_bank_t* filter_bank)
+ * @brief Frees the filter bank
+ */
+void filter_bank_cleanup(filter_bank_t* filter_bank){
+
+	if(filter_bank==NULL){
+		return;
+	}
+
+	free(filter_bank->state);
+	free(filter_bank->primed);
+	free(filter_bank->work);
+	free(filter_bank->out_buf);
+	free(filter_bank);
+}
+
+/**
+ * void* filter_bank_stage_init(appconfig_t* config, stage_format_t* format)
+ * @brief Filter stage, on the signals of the stream
+ * @param config, the filters
+ * @param (in/out)format, the stream, unchanged
+ * @return the filter bank, NULL on error
+ */
+void* filter_bank_stage_init(appconfig_t* config, stage_format_t* format){
+
+	filter_options_t filter_options;
+
+	filter_options.notch_freq = config->notch_freq;
+	filter_options.highpass_freq = config->highpass_freq;
+	filter_options.bandpass_low = config->bandpass_low;
+	filter_options.bandpass_high = config->bandpass_high;
+
+	return (void*)filter_bank_init(format->nb_channels, format->nb_signals, format->rate, &filter_options);
+}
+
+/**
+ * int filter_bank_stage_process(void* stage, data_block_t* input, data_block_t* output)
+ * @brief Filters a block of the chain
+ */
+int filter_bank_stage_process(void* stage, data_block_t* input, data_block_t* output){
+	return filter_bank_process((filter_bank_t*)stage, input, output);
+}
+
+/**
+ * void filter_bank_stage_cleanup(void* stage)
+ * @brief Frees the filter stage
+ */
+void filter_bank_stage_cleanup(void* stage){
+	filter_bank_cleanup((filter_bank_t*)stage);
+}
+
+/**
+ * void filter_bank_prime(filter_bank_t* filter_bank, int vector, v4sf x, v4si lanes)
+ * @brief Sets the state of some lanes as if x had always been the input
+ * @param filter_bank
+ * @param vector, group of channels
+ * @param x, the input
+ * @param lanes, mask of the lanes to set
+ */
+static void filter_bank_prime(filter_bank_t* filter_bank, int vector, v4sf x, v4si lanes){
+
+	int s;
+	v4sf y;
+	v4sf* state = &(filter_bank->state[2*vector]);
+	biquad_t* section;
+
+	for(s=0;s<filter_bank->nb_sections;s++){
+
+		section = &(filter_bank->sections[s]);
+		y = section->dc_gain*x;
+
+		state[1] = simd_select(lanes, section->b2*x-section->a2*y, state[1]);
+		state[0] = simd_select(lanes, section->b1*x-section->a1*y+state[1], state[0]);
+
+		x = y;
+		state += 2*filter_bank->nb_vectors;
+	}
+}
+
+/**
+ * int filter_bank_add_section(filter_bank_t* filter_bank, biquad_type_t type, double freq, double q, int rate)
+ * @brief Designs a biquad and appends it to the cascade
+ * @param filter_bank
+ * @param type, notch, high-pass or low-pass
+ * @param freq, center or cutoff frequency (Hz)
+ * @param q, quality factor
+ * @param rate, sampling rate (Hz)
+ * @return 0 for success, 1 for error
+ */
+static int filter_bank_add_section(filter_bank_t* filter_bank, biquad_type_t type, double freq, double q, int rate){
+
+	double w0, alpha, cos_w0;
+	double b0, b1, b2, a0, a1, a2;
+	biquad_t* section;
+
+	if(freq>=rate/2.0){
+		fprintf(stderr, "filter bank: %.1f Hz is above nyquist\n", freq);
+		return 1;
+	}
+
+	if(filter_bank->nb_sections>=FILTER_BANK_MAX_SECTIONS){
+		fprintf(stderr, "filter bank: too many sections\n");
+		return 1;
+	}
+
+	w0 = 2*M_PI*freq/rate;
+	cos_w0 = cos(w0);
+	alpha = sin(w0)/(2*q);
+
+	a0 = 1+alpha;
+	a1 = -2*cos_w0;
+	a2 = 1-alpha;
+
+	switch(type){
+		case BIQUAD_NOTCH:
+			b0 = 1;
+			b1 = -2*cos_w0;
+			b2 = 1;
+			break;
+		case BIQUAD_HIGHPASS:
+			b0 = (1+cos_w0)/2;
+			b1 = -(1+cos_w0);
+			b2 = (1+cos_w0)/2;
+			break;
+		case BIQUAD_LOWPASS:
+		default:
+			b0 = (1-cos_w0)/2;
+			b1 = 1-cos_w0;
+			b2 = (1-cos_w0)/2;
+			break;
+	}
+
+	section = &(filter_bank->sections[filter_bank->nb_sections++]);
+	section->b0 = simd_splat((float)(b0/a0));
+	section->b1 = simd_splat((float)(b1/a0));
+	section->b2 = simd_splat((float)(b2/a0));
+	section->a1 = simd_splat((float)(a1/a0));
+	section->a2 = simd_splat((float)(a2/a0));
+	section->dc_gain = simd_splat((float)((b0+b1+b2)/(a0+a1+a2)));
+
+	return 0;
+}
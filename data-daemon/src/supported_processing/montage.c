@@ -0,0 +1,339 @@
+/**
+ * @file montage.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Montage stage. The stream is multiplied by a matrix, each row giving
+ *        one derivation. Bipolar and linked montages have a few weights per row
+ *        and run on the non-zero weights only; dense matrices (common average,
+ *        custom) run as SIMD dot products.
+ *
+ *        The channels following the signals (flags) are copied after the
+ *        derivations. The derivations are named after their inputs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "data_output.h"
+#include "simd.h"
+#include "montage.h"
+
+static int montage_build(appconfig_t* config, stage_format_t* format, float* matrix,
+                         char names[][SHM_CHANNEL_NAME_LENGTH]);
+static void montage_name(char* name, const char* input_name, const char* suffix);
+
+/**
+ * montage_t* montage_init(int nb_channels, int nb_inputs, int nb_outputs, const float* matrix)
+ * @brief Allocates the montage and selects its kernel
+ * @param nb_channels, values per sample in
+ * @param nb_inputs, leading channels combined, the others are copied
+ * @param nb_outputs, derivations
+ * @param matrix, nb_outputs rows of nb_inputs weights
+ * @return the montage, NULL on error
+ */
+montage_t* montage_init(int nb_channels, int nb_inputs, int nb_outputs, const float* matrix){
+
+	int r, c, k;
+	int nb_weights = 0;
+	montage_t* montage;
+
+	if(nb_inputs<=0 || nb_outputs<=0 || nb_inputs>nb_channels){
+		fprintf(stderr, "montage: invalid stream\n");
+		return NULL;
+	}
+
+	montage = (montage_t*)malloc(sizeof(montage_t));
+	memset(montage, 0, sizeof(montage_t));
+
+	montage->nb_inputs = nb_inputs;
+	montage->nb_outputs = nb_outputs;
+	montage->nb_flags = nb_channels-nb_inputs;
+	montage->nb_channels = nb_outputs+montage->nb_flags;
+
+	for(k=0;k<nb_outputs*nb_inputs;k++){
+		if(matrix[k]!=0){
+			nb_weights++;
+		}
+	}
+	montage->sparse = (nb_weights<=MONTAGE_SPARSE_DENSITY*nb_outputs*nb_inputs);
+
+	if(montage->sparse){
+
+		montage->row_start = (int*)malloc((nb_outputs+1)*sizeof(int));
+		montage->cols = (int*)malloc((nb_weights+1)*sizeof(int));
+		montage->weights = (float*)malloc((nb_weights+1)*sizeof(float));
+		if(montage->row_start==NULL || montage->cols==NULL || montage->weights==NULL){
+			montage_cleanup(montage);
+			return NULL;
+		}
+
+		k = 0;
+		for(r=0;r<nb_outputs;r++){
+			montage->row_start[r] = k;
+			for(c=0;c<nb_inputs;c++){
+				if(matrix[r*nb_inputs+c]!=0){
+					montage->cols[k] = c;
+					montage->weights[k] = matrix[r*nb_inputs+c];
+					k++;
+				}
+			}
+		}
+		montage->row_start[nb_outputs] = k;
+	}
+	else{
+
+		/*simd_dot takes multiples of 8*/
+		montage->row_length = ((nb_inputs+2*SIMD_WIDTH-1)/(2*SIMD_WIDTH))*(2*SIMD_WIDTH);
+		montage->matrix = (float*)simd_malloc(nb_outputs*montage->row_length*sizeof(float));
+		montage->work = (float*)simd_malloc(montage->row_length*sizeof(float));
+		if(montage->matrix==NULL || montage->work==NULL){
+			montage_cleanup(montage);
+			return NULL;
+		}
+
+		for(r=0;r<nb_outputs;r++){
+			memcpy(&(montage->matrix[r*montage->row_length]), &(matrix[r*nb_inputs]), nb_inputs*sizeof(float));
+		}
+	}
+
+	montage->out_buf = (float*)malloc(PIPELINE_BLOCK_SIZE*montage->nb_channels*sizeof(float));
+	if(montage->out_buf==NULL){
+		montage_cleanup(montage);
+		return NULL;
+	}
+
+	return montage;
+}
+
+/**
+ * int montage_process(montage_t* montage, data_block_t* input, data_block_t* output)
+ * @brief Computes the derivations of a block of at most PIPELINE_BLOCK_SIZE samples
+ * @param montage
+ * @param input, the input block
+ * @param (out)output, the output block, pointing in the montage buffer
+ * @return number of output samples
+ */
+int montage_process(montage_t* montage, data_block_t* input, data_block_t* output){
+
+	int i, r, k;
+	float sum;
+	float* in;
+	float* out;
+
+	memcpy(output, input, sizeof(data_block_t));
+	output->nb_data = montage->nb_channels;
+	output->ptr = montage->out_buf;
+
+	for(i=0;i<input->nb_samples;i++){
+
+		in = &(input->ptr[i*input->nb_data]);
+		out = &(montage->out_buf[i*montage->nb_channels]);
+
+		if(montage->sparse){
+			for(r=0;r<montage->nb_outputs;r++){
+				sum = 0;
+				for(k=montage->row_start[r];k<montage->row_start[r+1];k++){
+					sum += montage->weights[k]*in[montage->cols[k]];
+				}
+				out[r] = sum;
+			}
+		}
+		else{
+			/*the padding of the work sample stays at 0*/
+			memcpy(montage->work, in, montage->nb_inputs*sizeof(float));
+			for(r=0;r<montage->nb_outputs;r++){
+				out[r] = simd_dot(&(montage->matrix[r*montage->row_length]), montage->work, montage->row_length);
+			}
+		}
+
+		/*flags follow the derivations*/
+		memcpy(&(out[montage->nb_outputs]), &(in[montage->nb_inputs]), montage->nb_flags*sizeof(float));
+	}
+
+	return output->nb_samples;
+}
+
+/**
+ * void montage_cleanup(montage_t* montage)
+ * @brief Frees the montage
+ */
+void montage_cleanup(montage_t* montage){
+
+	if(montage==NULL){
+		return;
+	}
+
+	free(montage->row_start);
+	free(montage->cols);
+	free(montage->weights);
+	free(montage->matrix);
+	free(montage->work);
+	free(montage->out_buf);
+	free(montage);
+}
+
+/**
+ * void* montage_stage_init(appconfig_t* config, stage_format_t* format)
+ * @brief Montage stage, on the signals of the stream
+ * @param config, the montage
+ * @param (in/out)format, the stream, takes the derivations
+ * @return the montage, NULL on error
+ */
+void* montage_stage_init(appconfig_t* config, stage_format_t* format){
+
+	int nb_outputs;
+	float* matrix;
+	montage_t* montage;
+	char names[SHM_MAX_CHANNELS][SHM_CHANNEL_NAME_LENGTH];
+
+	matrix = (float*)calloc(SHM_MAX_CHANNELS*format->nb_signals, sizeof(float));
+	if(matrix==NULL){
+		return NULL;
+	}
+
+	memset(names, 0, sizeof(names));
+	nb_outputs = montage_build(config, format, matrix, names);
+	if(nb_outputs<=0){
+		free(matrix);
+		return NULL;
+	}
+
+	montage = montage_init(format->nb_channels, format->nb_signals, nb_outputs, matrix);
+	free(matrix);
+	if(montage==NULL){
+		return NULL;
+	}
+
+	/*the flags keep their names, after the derivations*/
+	memmove(format->channel_names[nb_outputs], format->channel_names[format->nb_signals],
+	        (format->nb_channels-format->nb_signals)*SHM_CHANNEL_NAME_LENGTH);
+	memcpy(format->channel_names, names, nb_outputs*SHM_CHANNEL_NAME_LENGTH);
+
+	format->nb_channels = montage->nb_channels;
+	format->nb_signals = nb_outputs;
+
+	return (void*)montage;
+}
+
+/**
+ * int montage_stage_process(void* stage, data_block_t* input, data_block_t* output)
+ * @brief Computes the derivations of a block of the chain
+ */
+int montage_stage_process(void* stage, data_block_t* input, data_block_t* output){
+	return montage_process((montage_t*)stage, input, output);
+}
+
+/**
+ * void montage_stage_cleanup(void* stage)
+ * @brief Frees the montage stage
+ */
+void montage_stage_cleanup(void* stage){
+	montage_cleanup((montage_t*)stage);
+}
+
+/**
+ * int montage_build(appconfig_t* config, stage_format_t* format, float* matrix,
+ *                   char names[][SHM_CHANNEL_NAME_LENGTH])
+ * @brief Fills the matrix and names the derivations of the configured montage
+ * @param config, the montage
+ * @param format, the input stream
+ * @param (out)matrix, rows of format->nb_signals weights
+ * @param (out)names, names of the derivations
+ * @return the number of derivations, -1 on error
+ */
+static int montage_build(appconfig_t* config, stage_format_t* format, float* matrix,
+                         char names[][SHM_CHANNEL_NAME_LENGTH]){
+
+	int r, c, k;
+	int nb_inputs = format->nb_signals;
+	int nb_outputs = 0;
+	int nb_flags = format->nb_channels-format->nb_signals;
+	int* refs = config->montage_refs;
+	montage_row_t* row;
+
+	switch(config->montage_type){
+
+		/*each electrode minus the mean of all*/
+		case MONTAGE_CAR:
+			for(r=0;r<nb_inputs;r++){
+				for(c=0;c<nb_inputs;c++){
+					matrix[r*nb_inputs+c] = ((r==c)?1.0f:0.0f)-1.0f/nb_inputs;
+				}
+				montage_name(names[r], format->channel_names[r], "-CAR");
+			}
+			nb_outputs = nb_inputs;
+			break;
+
+		/*each electrode, but the references, minus the mean of the references*/
+		case MONTAGE_LINKED:
+			if(refs[0]<0 || refs[0]>=nb_inputs || refs[1]<0 || refs[1]>=nb_inputs || refs[0]==refs[1]){
+				fprintf(stderr, "montage: invalid references\n");
+				return -1;
+			}
+			for(c=0;c<nb_inputs;c++){
+				if(c==refs[0] || c==refs[1]){
+					continue;
+				}
+				matrix[nb_outputs*nb_inputs+c] = 1.0f;
+				matrix[nb_outputs*nb_inputs+refs[0]] = -0.5f;
+				matrix[nb_outputs*nb_inputs+refs[1]] = -0.5f;
+				montage_name(names[nb_outputs], format->channel_names[c], "-LR");
+				nb_outputs++;
+			}
+			break;
+
+		/*rows listed in the configuration*/
+		case MONTAGE_BIPOLAR:
+		case MONTAGE_CUSTOM:
+			for(r=0;r<config->nb_montage_rows;r++){
+				row = &(config->montage_rows[r]);
+				for(k=0;k<row->nb_terms;k++){
+					if(row->inputs[k]<0 || row->inputs[k]>=nb_inputs){
+						fprintf(stderr, "montage: channel %d does not exist\n", row->inputs[k]);
+						return -1;
+					}
+					matrix[r*nb_inputs+row->inputs[k]] += row->weights[k];
+				}
+
+				if(row->name[0]!='\0'){
+					montage_name(names[r], row->name, "");
+				}
+				else if(config->montage_type==MONTAGE_BIPOLAR){
+					montage_name(names[r], format->channel_names[row->inputs[0]], "-");
+					montage_name(names[r], names[r], format->channel_names[row->inputs[1]]);
+				}
+				else{
+					snprintf(names[r], SHM_CHANNEL_NAME_LENGTH, "D%d", r+1);
+				}
+			}
+			nb_outputs = config->nb_montage_rows;
+			break;
+
+		default:
+			fprintf(stderr, "montage: no montage configured\n");
+			return -1;
+	}
+
+	if(nb_outputs==0 || nb_outputs+nb_flags>SHM_MAX_CHANNELS){
+		fprintf(stderr, "montage: invalid number of derivations\n");
+		return -1;
+	}
+
+	return nb_outputs;
+}
+
+/**
+ * void montage_name(char* name, const char* input_name, const char* suffix)
+ * @brief Names a derivation, cut to the length of the names
+ */
+static void montage_name(char* name, const char* input_name, const char* suffix){
+
+	char full_name[2*SHM_CHANNEL_NAME_LENGTH+1];
+
+	strncpy(full_name, input_name, SHM_CHANNEL_NAME_LENGTH);
+	full_name[SHM_CHANNEL_NAME_LENGTH] = '\0';
+	strncat(full_name, suffix, SHM_CHANNEL_NAME_LENGTH);
+
+	memcpy(name, full_name, SHM_CHANNEL_NAME_LENGTH-1);
+	name[SHM_CHANNEL_NAME_LENGTH-1] = '\0';
+}
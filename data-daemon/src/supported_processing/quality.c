@@ -0,0 +1,381 @@
+/**
+ * @file quality.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Online signal quality, computed in the daemon. Each sample updates, per
+ *        channel:
+ *        - an exponentially weighted mean and variance (Welford's update with
+ *          a forgetting factor), with a time constant of about a second,
+ *        - a goertzel filter at the line frequency, giving the line noise power
+ *          over the update,
+ *        - the number of samples at the rails of the hardware,
+ *        - the number of samples equal to the previous one, and the length of
+ *          the current flat run.
+ *
+ *        A few times per second, the statistics are copied in a shared memory
+ *        status page, so a dashboard can poll the state of the electrodes
+ *        without reading the stream. The rails are those of the hardware, the
+ *        stage is meant to see the stream as translated (first in the chain).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "data_output.h"
+#include "hardware.h"
+#include "quality.h"
+
+static void quality_update(quality_t* quality);
+
+/**
+ * quality_t* quality_init(int nb_channels, int nb_signals, int rate, float line_freq, int update_rate)
+ * @brief Allocates the running statistics
+ * @param nb_channels, values per sample
+ * @param nb_signals, leading channels analyzed
+ * @param rate, sampling rate (Hz)
+ * @param line_freq, frequency of the line noise (Hz)
+ * @param update_rate, updates per second
+ * @return the statistics, NULL on error
+ */
+quality_t* quality_init(int nb_channels, int nb_signals, int rate, float line_freq, int update_rate){
+
+	quality_t* quality;
+
+	if(rate<=0 || update_rate<=0 || nb_signals<=0 || nb_signals>nb_channels || nb_signals>SHM_MAX_CHANNELS){
+		fprintf(stderr, "quality: invalid stream\n");
+		return NULL;
+	}
+
+	quality = (quality_t*)malloc(sizeof(quality_t));
+	memset(quality, 0, sizeof(quality_t));
+
+	quality->nb_channels = nb_channels;
+	quality->nb_signals = nb_signals;
+	quality->rate = rate;
+	quality->alpha = 1.0-exp(-1.0/(QUALITY_TIME_CONSTANT*rate));
+	quality->flat_samples = (uint32_t)(QUALITY_FLAT_TIME*rate);
+
+	/*above nyquist, the line noise is not measured*/
+	if(line_freq>0 && line_freq<rate/2.0){
+		quality->coeff = 2*cos(2*M_PI*line_freq/rate);
+		quality->status.line_freq = line_freq;
+	}
+
+	quality->update_samples = rate/update_rate;
+	if(quality->update_samples<1){
+		quality->update_samples = 1;
+	}
+
+	quality->channels = (quality_channel_state_t*)calloc(nb_signals, sizeof(quality_channel_state_t));
+
+	quality->status.nb_channels = nb_signals;
+	quality->status.rate = rate;
+	quality->status.update_samples = quality->update_samples;
+
+	return quality;
+}
+
+/**
+ * void quality_set_range(quality_t* quality, int channel, float min, float max, float lsb)
+ * @brief Sets the rails of a channel, enables the saturation count
+ * @param quality
+ * @param channel, index of the channel
+ * @param min, lowest value
+ * @param max, highest value
+ * @param lsb, step between two values
+ */
+void quality_set_range(quality_t* quality, int channel, float min, float max, float lsb){
+
+	quality_channel_state_t* state = &(quality->channels[channel]);
+
+	/*a value within half a step of the rail is at the rail*/
+	state->has_range = 1;
+	state->min = min+lsb/2;
+	state->max = max-lsb/2;
+	state->flat_tolerance = lsb/2;
+}
+
+/**
+ * int quality_process(quality_t* quality, data_block_t* input, char* updated)
+ * @brief Analyzes the samples of a block, up to the end of the block or of
+ *        the current update
+ * @param quality
+ * @param input, the input block
+ * @param (out)updated, set when the update is complete, status holds it
+ * @return number of input samples consumed
+ */
+int quality_process(quality_t* quality, data_block_t* input, char* updated){
+
+	int i, c;
+	int nb_samples = input->nb_samples;
+	double x, delta, incr, s0;
+	quality_channel_state_t* state;
+
+	/*stop at the end of the update*/
+	if(nb_samples>quality->update_samples-quality->nb_pending){
+		nb_samples = quality->update_samples-quality->nb_pending;
+	}
+
+	for(i=0;i<nb_samples;i++){
+		for(c=0;c<quality->nb_signals;c++){
+
+			x = input->ptr[i*input->nb_data+c];
+			state = &(quality->channels[c]);
+
+			/*filled gaps (nan) are not samples*/
+			if(isnan(x)){
+				continue;
+			}
+
+			if(!state->started){
+				state->mean = x;
+				state->variance = 0;
+				state->started = 1;
+			}
+
+			/*weighted welford update*/
+			delta = x-state->mean;
+			incr = quality->alpha*delta;
+			state->mean += incr;
+			state->variance = (1-quality->alpha)*(state->variance+delta*incr);
+
+			/*goertzel, the mean removed keeps the offset out of the line frequency*/
+			s0 = (x-state->mean)+quality->coeff*state->s1-state->s2;
+			state->s2 = state->s1;
+			state->s1 = s0;
+			state->nb_goertzel++;
+
+			if(state->has_range && (x<=state->min || x>=state->max)){
+				state->nb_saturated++;
+			}
+
+			if(state->has_prev && fabs(x-state->prev)<=state->flat_tolerance){
+				state->nb_flat++;
+				state->flat_run++;
+			} else {
+				state->flat_run = 0;
+			}
+			state->prev = (float)x;
+			state->has_prev = 1;
+		}
+	}
+
+	quality->nb_pending += nb_samples;
+
+	*updated = 0;
+	if(quality->nb_pending>=quality->update_samples){
+
+		quality->status.last_sample = input->first_sample+nb_samples-1;
+		quality->status.timestamp_ns = 0;
+		if(input->timestamp_ns){
+			quality->status.timestamp_ns = input->timestamp_ns+(int64_t)((nb_samples-1)*input->sample_period_ns);
+		}
+
+		quality_update(quality);
+		*updated = 1;
+	}
+
+	return nb_samples;
+}
+
+/**
+ * void quality_cleanup(quality_t* quality)
+ * @brief Frees the statistics
+ */
+void quality_cleanup(quality_t* quality){
+
+	if(quality==NULL){
+		return;
+	}
+
+	free(quality->channels);
+	free(quality);
+}
+
+/**
+ * void* quality_stage_init(appconfig_t* config, stage_format_t* format)
+ * @brief Quality stage, and creates the status page
+ * @param config, the status page and the line frequency
+ * @param (in/out)format, the stream, unchanged
+ * @return the quality stage, NULL on error
+ */
+void* quality_stage_init(appconfig_t* config, stage_format_t* format){
+
+	int c;
+	float min, max, lsb;
+	float line_freq = (config->notch_freq>0)?config->notch_freq:QUALITY_DEFAULT_LINE_FREQ;
+	quality_stage_t* quality_stage;
+
+	if(config->quality_shm_key==0){
+		fprintf(stderr, "quality: quality_shm_key is missing\n");
+		return NULL;
+	}
+
+	quality_stage = (quality_stage_t*)malloc(sizeof(quality_stage_t));
+	quality_stage->hardware_type = (char*)config->device;
+	quality_stage->quality = quality_init(format->nb_channels, format->nb_signals, format->rate, line_freq,
+	                                      config->quality_update_rate);
+	if(quality_stage->quality==NULL){
+		free(quality_stage);
+		return NULL;
+	}
+
+	for(c=0;c<format->nb_signals;c++){
+		if(get_hardware_range(quality_stage->hardware_type, c, &min, &max, &lsb)==0){
+			quality_set_range(quality_stage->quality, c, min, max, lsb);
+		}
+		memcpy(quality_stage->quality->status.channels[c].name, format->channel_names[c], SHM_CHANNEL_NAME_LENGTH);
+	}
+
+	/*the status page, in its own segment*/
+	if((quality_stage->shmid = shmget(config->quality_shm_key, sizeof(shm_quality_page_t), IPC_CREAT | 0666)) < 0){
+		perror("shmget");
+		quality_cleanup(quality_stage->quality);
+		free(quality_stage);
+		return NULL;
+	}
+
+	if((quality_stage->page = (shm_quality_page_t*)shmat(quality_stage->shmid, NULL, 0)) == (shm_quality_page_t*)-1){
+		perror("shmat");
+		shmctl(quality_stage->shmid, IPC_RMID, 0);
+		quality_cleanup(quality_stage->quality);
+		free(quality_stage);
+		return NULL;
+	}
+
+	/*the magic goes last, readers check it before trusting the page*/
+	memset((void*)quality_stage->page, 0, sizeof(shm_quality_page_t));
+	memcpy((void*)quality_stage->page, &(quality_stage->quality->status), sizeof(shm_quality_page_t));
+	__sync_synchronize();
+	quality_stage->page->magic = SHM_QUALITY_MAGIC;
+
+	return (void*)quality_stage;
+}
+
+/**
+ * int quality_stage_process(void* stage, data_block_t* input, data_block_t* output)
+ * @brief Analyzes a block of the chain and publishes the completed updates.
+ *        The block is handed to the next stage as is.
+ * @param stage, the quality stage
+ * @param input, the input block
+ * @param (out)output, the input block
+ * @return number of output samples
+ */
+int quality_stage_process(void* stage, data_block_t* input, data_block_t* output){
+
+	int nb_done = 0;
+	char updated;
+	uint32_t sequence;
+	data_block_t chunk;
+	shm_quality_page_t* status;
+
+	quality_stage_t* quality_stage = (quality_stage_t*)stage;
+	status = &(quality_stage->quality->status);
+
+	memcpy(&chunk, input, sizeof(data_block_t));
+
+	/*a block may complete several updates*/
+	while(nb_done<input->nb_samples){
+
+		chunk.nb_samples = input->nb_samples-nb_done;
+		chunk.ptr = &(input->ptr[nb_done*input->nb_data]);
+		chunk.first_sample = input->first_sample+nb_done;
+		if(input->timestamp_ns){
+			chunk.timestamp_ns = input->timestamp_ns+(int64_t)(nb_done*input->sample_period_ns);
+		}
+
+		nb_done += quality_process(quality_stage->quality, &chunk, &updated);
+
+		if(!updated){
+			continue;
+		}
+
+		status->drl_ref_valid = (get_hardware_drl_ref(quality_stage->hardware_type, &(status->drl), &(status->ref))==0);
+
+		/*sequence lock, odd while the page is written*/
+		sequence = quality_stage->page->sequence;
+		quality_stage->page->sequence = sequence+1;
+		__sync_synchronize();
+
+		memcpy((void*)&(quality_stage->page->nb_channels), &(status->nb_channels),
+		       sizeof(shm_quality_page_t)-offsetof(shm_quality_page_t, nb_channels));
+
+		__sync_synchronize();
+		quality_stage->page->sequence = sequence+2;
+	}
+
+	memcpy(output, input, sizeof(data_block_t));
+
+	return output->nb_samples;
+}
+
+/**
+ * void quality_stage_cleanup(void* stage)
+ * @brief Removes the status page and frees the quality stage
+ */
+void quality_stage_cleanup(void* stage){
+
+	quality_stage_t* quality_stage = (quality_stage_t*)stage;
+
+	shmdt((void*)quality_stage->page);
+	shmctl(quality_stage->shmid, IPC_RMID, 0);
+
+	quality_cleanup(quality_stage->quality);
+	free(quality_stage);
+}
+
+/**
+ * void quality_update(quality_t* quality)
+ * @brief Copies the statistics of the update in the status and starts the
+ *        next update
+ */
+static void quality_update(quality_t* quality){
+
+	int c;
+	double power;
+	quality_channel_state_t* state;
+	shm_quality_channel_t* channel;
+
+	for(c=0;c<quality->nb_signals;c++){
+
+		state = &(quality->channels[c]);
+		channel = &(quality->status.channels[c]);
+
+		channel->mean = (float)state->mean;
+		channel->std = (float)sqrt(state->variance);
+
+		/*|X(w)|^2 of the update, scaled so that a sine of amplitude A gives A^2/2*/
+		channel->line_noise = 0;
+		if(state->nb_goertzel>0 && quality->status.line_freq>0){
+			power = state->s1*state->s1+state->s2*state->s2-quality->coeff*state->s1*state->s2;
+			channel->line_noise = (float)(2*power/((double)state->nb_goertzel*state->nb_goertzel));
+		}
+
+		channel->nb_saturated = state->nb_saturated;
+		channel->nb_flat = state->nb_flat;
+		channel->flat_run = state->flat_run;
+
+		channel->flags = 0;
+		if(state->nb_saturated>0){
+			channel->flags |= QUALITY_SATURATED;
+		}
+		if(state->flat_run>=quality->flat_samples){
+			channel->flags |= QUALITY_FLAT;
+		}
+		if(state->nb_goertzel==0){
+			channel->flags |= QUALITY_NO_DATA;
+		}
+
+		state->s1 = 0;
+		state->s2 = 0;
+		state->nb_goertzel = 0;
+		state->nb_saturated = 0;
+		state->nb_flat = 0;
+	}
+
+	quality->nb_pending = 0;
+}
@@ -0,0 +1,356 @@
+/**
+ * @file resampler.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Rational polyphase FIR resampler. The stream is (conceptually) upsampled
+ *        by up, low-pass filtered and decimated by down. Only the filter phase
+ *        that lands on an output sample is computed, so the cost is nb_taps
+ *        multiply-adds per output sample and channel, whatever the ratio.
+ *
+ *        The history is kept channel after channel, so each output is a
+ *        contiguous dot product, computed with SIMD.
+ *
+ *        Output samples are timestamped from the input timing, corrected for the
+ *        group delay of the filter.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "data_output.h"
+#include "simd.h"
+#include "resampler.h"
+
+static int gcd(int a, int b);
+static double bessel_i0(double x);
+static void resampler_design(resampler_t* resampler);
+
+/**
+ * resampler_t* resampler_init(int nb_channels, int in_rate, int out_rate)
+ * @brief Allocates and designs a resampler
+ * @param nb_channels, values per sample
+ * @param in_rate, input sampling rate (Hz)
+ * @param out_rate, output sampling rate (Hz)
+ * @return the resampler, NULL on error
+ */
+resampler_t* resampler_init(int nb_channels, int in_rate, int out_rate){
+
+	int divisor;
+	resampler_t* resampler;
+
+	if(in_rate<=0 || out_rate<=0 || nb_channels<=0){
+		fprintf(stderr, "resampler: invalid rates\n");
+		return NULL;
+	}
+
+	resampler = (resampler_t*)malloc(sizeof(resampler_t));
+	memset(resampler, 0, sizeof(resampler_t));
+
+	/*reduce the ratio*/
+	divisor = gcd(in_rate, out_rate);
+	resampler->nb_channels = nb_channels;
+	resampler->nb_signals = nb_channels;
+	resampler->up = out_rate/divisor;
+	resampler->down = in_rate/divisor;
+
+	/*design the filter*/
+	resampler_design(resampler);
+
+	/*the history holds the filter span and one input block*/
+	resampler->history_len = SIMD_ROUND_UP(resampler->nb_taps-1+RESAMPLER_MAX_IN);
+	resampler->history = (float*)simd_malloc(nb_channels*resampler->history_len*sizeof(float));
+
+	/*starts with a span of zeros, the first output lands on the first input*/
+	resampler->history_fill = resampler->nb_taps-1;
+	resampler->history_idx = -(int64_t)(resampler->nb_taps-1);
+	resampler->acc = (uint64_t)(resampler->nb_taps-1)*resampler->up;
+
+	resampler->out_capacity = resampler_max_output(resampler, RESAMPLER_MAX_IN);
+	resampler->out_buf = (float*)simd_malloc(resampler->out_capacity*nb_channels*sizeof(float));
+
+	if(resampler->coefs==NULL || resampler->history==NULL || resampler->out_buf==NULL){
+		resampler_cleanup(resampler);
+		return NULL;
+	}
+
+	return resampler;
+}
+
+/**
+ * int resampler_process(resampler_t* resampler, data_block_t* input, data_block_t* output)
+ * @brief Resamples a block of at most RESAMPLER_MAX_IN samples
+ * @param resampler
+ * @param input, the input block
+ * @param (out)output, the output block, pointing in the resampler buffer
+ * @return number of output samples
+ */
+int resampler_process(resampler_t* resampler, data_block_t* input, data_block_t* output){
+
+	int i, c;
+	int nb_out = 0;
+	int n, phase, start, drop, nearest;
+	int nb_taps = resampler->nb_taps;
+	int nb_channels = resampler->nb_channels;
+	float* history;
+	double position;
+
+	/*keep the timing of the input*/
+	if(input->timestamp_ns){
+		resampler->in_ts_idx = input->first_sample;
+		resampler->in_ts_ns = input->timestamp_ns;
+		resampler->in_period_ns = input->sample_period_ns;
+	}
+
+	/*append the input to the history, channel after channel*/
+	for(c=0;c<nb_channels;c++){
+		history = &(resampler->history[c*resampler->history_len+resampler->history_fill]);
+		for(i=0;i<input->nb_samples;i++){
+			history[i] = input->ptr[i*input->nb_data+c];
+		}
+	}
+	resampler->history_fill += input->nb_samples;
+
+	output->nb_data = nb_channels;
+	output->ptr = resampler->out_buf;
+	output->first_sample = resampler->out_idx;
+	output->flags = input->flags;
+
+	/*timing of the first output*/
+	position = (double)resampler->history_idx+(double)resampler->acc/resampler->up-resampler->delay;
+	output->sample_period_ns = resampler->in_period_ns*resampler->down/resampler->up;
+	output->timestamp_ns = 0;
+	if(resampler->in_ts_ns){
+		output->timestamp_ns = resampler->in_ts_ns+(int64_t)((position-(double)resampler->in_ts_idx)*resampler->in_period_ns);
+	}
+
+	/*compute every output whose span is in the history*/
+	while((n = (int)(resampler->acc/resampler->up)) < resampler->history_fill){
+
+		phase = (int)(resampler->acc%resampler->up);
+		start = n-(nb_taps-1);
+
+		for(c=0;c<resampler->nb_signals;c++){
+			resampler->out_buf[nb_out*nb_channels+c] = simd_dot(&(resampler->coefs[phase*nb_taps]),
+			                                                    &(resampler->history[c*resampler->history_len+start]),
+			                                                    nb_taps);
+		}
+
+		/*flags can not be interpolated, they take the nearest sample*/
+		nearest = (int)floor((double)resampler->acc/resampler->up-resampler->delay+0.5);
+		for(c=resampler->nb_signals;c<nb_channels;c++){
+			resampler->out_buf[nb_out*nb_channels+c] = resampler->history[c*resampler->history_len+nearest];
+		}
+
+		resampler->acc += resampler->down;
+		nb_out++;
+	}
+
+	/*drop the samples no output will need*/
+	drop = (int)(resampler->acc/resampler->up)-(nb_taps-1);
+	if(drop>resampler->history_fill){
+		drop = resampler->history_fill;
+	}
+	if(drop>0){
+		for(c=0;c<nb_channels;c++){
+			history = &(resampler->history[c*resampler->history_len]);
+			memmove(history, &(history[drop]), (resampler->history_fill-drop)*sizeof(float));
+		}
+		resampler->history_fill -= drop;
+		resampler->history_idx += drop;
+		resampler->acc -= (uint64_t)drop*resampler->up;
+	}
+
+	output->nb_samples = nb_out;
+	resampler->out_idx += nb_out;
+
+	return nb_out;
+}
+
+/**
+ * int resampler_max_output(resampler_t* resampler, int nb_input)
+ * @brief Upper bound on the number of outputs produced by nb_input samples
+ */
+int resampler_max_output(resampler_t* resampler, int nb_input){
+	return (int)(((int64_t)nb_input*resampler->up)/resampler->down)+2;
+}
+
+/**
+ * void resampler_cleanup(resampler_t* resampler)
+ * @brief Frees the resampler
+ */
+void resampler_cleanup(resampler_t* resampler){
+
+	if(resampler==NULL){
+		return;
+	}
+
+	free(resampler->coefs);
+	free(resampler->history);
+	free(resampler->out_buf);
+	free(resampler);
+}
+
+/**
+ * void* resampler_stage_init(appconfig_t* config, stage_format_t* format)
+ * @brief Resampler stage, from the rate of the stream to output_rate
+ * @param config, the output rate
+ * @param (in/out)format, the stream
+ * @return the resampler, NULL on error
+ */
+void* resampler_stage_init(appconfig_t* config, stage_format_t* format){
+
+	resampler_t* resampler;
+
+	if(config->output_rate<=0){
+		fprintf(stderr, "resampler: output_rate is missing\n");
+		return NULL;
+	}
+
+	resampler = resampler_init(format->nb_channels, format->rate, config->output_rate);
+	if(resampler==NULL){
+		return NULL;
+	}
+	resampler->nb_signals = format->nb_signals;
+
+	format->rate = config->output_rate;
+
+	return (void*)resampler;
+}
+
+/**
+ * int resampler_stage_process(void* stage, data_block_t* input, data_block_t* output)
+ * @brief Resamples a block of the chain
+ */
+int resampler_stage_process(void* stage, data_block_t* input, data_block_t* output){
+	return resampler_process((resampler_t*)stage, input, output);
+}
+
+/**
+ * int resampler_stage_flush(void* stage, data_block_t* output)
+ * @brief Pushes zeros through the filter to get the outputs still held by
+ *        its delay
+ * @param stage, the resampler
+ * @param (out)output, the last samples
+ * @return number of output samples
+ */
+int resampler_stage_flush(void* stage, data_block_t* output){
+
+	int nb_out;
+	resampler_t* resampler = (resampler_t*)stage;
+	data_block_t zeros;
+
+	zeros.nb_samples = (int)ceil(resampler->delay)+1;
+	if(zeros.nb_samples>RESAMPLER_MAX_IN){
+		zeros.nb_samples = RESAMPLER_MAX_IN;
+	}
+	zeros.nb_data = resampler->nb_channels;
+	zeros.ptr = (float*)calloc(zeros.nb_samples*zeros.nb_data, sizeof(float));
+	zeros.first_sample = resampler->history_idx+resampler->history_fill;
+	zeros.timestamp_ns = 0;
+	zeros.sample_period_ns = 0;
+	zeros.flags = 0;
+
+	if(zeros.ptr==NULL){
+		return 0;
+	}
+
+	nb_out = resampler_process(resampler, &zeros, output);
+	free(zeros.ptr);
+
+	return nb_out;
+}
+
+/**
+ * void resampler_stage_cleanup(void* stage)
+ * @brief Frees the resampler stage
+ */
+void resampler_stage_cleanup(void* stage){
+	resampler_cleanup((resampler_t*)stage);
+}
+
+/**
+ * void resampler_design(resampler_t* resampler)
+ * @brief Designs the Kaiser windowed sinc prototype at the upsampled rate and
+ *        splits it in phases. Each phase is stored reversed, so that it lines
+ *        up with the history.
+ */
+static void resampler_design(resampler_t* resampler){
+
+	int i, k, phase;
+	int nb_coefs;
+	int max_factor = (resampler->up > resampler->down)?resampler->up:resampler->down;
+	double cutoff, center, x, window, sum = 0;
+	double* prototype;
+
+	/*cutoff relative to the upsampled rate, under the lowest nyquist*/
+	cutoff = 0.5*RESAMPLER_PASSBAND/max_factor;
+
+	/*enough taps for the sinc to reach its zero crossings*/
+	resampler->nb_taps = (int)ceil(RESAMPLER_ZERO_CROSSINGS/cutoff/resampler->up);
+	resampler->nb_taps = ((resampler->nb_taps+2*SIMD_WIDTH-1)/(2*SIMD_WIDTH))*(2*SIMD_WIDTH);
+	nb_coefs = resampler->nb_taps*resampler->up;
+
+	/*group delay of the prototype, in input samples*/
+	resampler->delay = (double)(nb_coefs-1)/2/resampler->up;
+
+	prototype = (double*)malloc(nb_coefs*sizeof(double));
+	center = (double)(nb_coefs-1)/2;
+
+	for(i=0;i<nb_coefs;i++){
+		x = 2*cutoff*(i-center);
+		window = bessel_i0(RESAMPLER_KAISER_BETA*sqrt(1-pow(2*i/(double)(nb_coefs-1)-1,2)))/bessel_i0(RESAMPLER_KAISER_BETA);
+		prototype[i] = ((x==0)?1.0:sin(M_PI*x)/(M_PI*x))*window;
+		sum += prototype[i];
+	}
+
+	/*split in phases, gain of up to compensate for the zeros inserted*/
+	resampler->coefs = (float*)simd_malloc(nb_coefs*sizeof(float));
+	if(resampler->coefs!=NULL){
+		for(phase=0;phase<resampler->up;phase++){
+			for(k=0;k<resampler->nb_taps;k++){
+				resampler->coefs[phase*resampler->nb_taps+resampler->nb_taps-1-k] =
+				        (float)(prototype[phase+k*resampler->up]*resampler->up/sum);
+			}
+		}
+	}
+
+	free(prototype);
+}
+
+/**
+ * double bessel_i0(double x)
+ * @brief Modified bessel function of order 0, by its series
+ */
+static double bessel_i0(double x){
+
+	int k;
+	double sum = 1, term = 1;
+
+	for(k=1;k<50;k++){
+		term *= (x/(2*k))*(x/(2*k));
+		sum += term;
+		if(term<sum*1e-12){
+			break;
+		}
+	}
+
+	return sum;
+}
+
+/**
+ * int gcd(int a, int b)
+ * @brief Greatest common divisor
+ */
+static int gcd(int a, int b){
+
+	int tmp;
+
+	while(b){
+		tmp = a%b;
+		a = b;
+		b = tmp;
+	}
+
+	return a;
+}
@@ -0,0 +1,420 @@
+/**
+ * @file timer_wheel.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Wheel of timers on a timerfd. A timer expiring at the tick t hangs in
+ *        the slot t modulo TIMER_WHEEL_NB_SLOTS, with the number of laps it
+ *        still has to wait. Adding or removing a timer costs the same for
+ *        any number of timers, and the timerfd is only armed on the next
+ *        slot that holds one: the wheel does not tick while nothing is due.
+ *
+ *        The wheel is on CLOCK_MONOTONIC, the clock of the timerfd.
+ *
+ *        The wheel is stopped by writing to an eventfd that every wait polls
+ *        and nobody reads: the waits return from then on, and the reading
+ *        loops with them.
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+#include "timer_wheel.h"
+
+#define TIMER_WHEEL_TICK_NS ((int64_t)TIMER_WHEEL_TICK_MS*1000000)
+
+static int wheel_fd = -1;
+static int wheel_stop_fd = -1;
+static int wheel_stopped = 0;
+static wheel_timer_t* wheel_slots[TIMER_WHEEL_NB_SLOTS];
+static uint64_t wheel_tick = 0; /*last tick run*/
+static int64_t wheel_start_ns = 0;
+static int64_t wheel_next_ns = 0; /*expiry of the timerfd, 0 when disarmed*/
+static pthread_mutex_t wheel_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void timer_wheel_run(void);
+static void timer_wheel_link(wheel_timer_t* timer, uint64_t expiry_tick);
+static void timer_wheel_unlink(wheel_timer_t* timer);
+static void timer_wheel_arm(void);
+static uint64_t timer_wheel_now_tick(void);
+static int64_t timer_wheel_now_ns(void);
+
+/**
+ * timer_wheel_init()
+ * @brief Creates the timerfd of the wheel, before any timer is added
+ * @return 0 for success, -1 for error
+ */
+int timer_wheel_init(void)
+{
+	if ((wheel_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+		perror("timerfd_create");
+		return (-1);
+	}
+
+	if ((wheel_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+		perror("eventfd");
+		close(wheel_fd);
+		wheel_fd = -1;
+		return (-1);
+	}
+
+	memset(wheel_slots, 0, sizeof(wheel_slots));
+	wheel_tick = 0;
+	wheel_start_ns = timer_wheel_now_ns();
+
+	return (0);
+}
+
+/**
+ * timer_wheel_add(wheel_timer_t* timer, int delay_ms, int period_ms, timer_callback_t callback, void* param)
+ * @brief Arms a timer, again if it already was. Can be called from any
+ *        thread, or from a callback.
+ * @param timer, kept by the caller until it is cancelled
+ * @param delay_ms, before the first expiry, rounded up to the tick
+ * @param period_ms, between the next ones, 0 for a single shot
+ * @param callback, called with param by the thread waiting on the wheel
+ * @param param
+ */
+void timer_wheel_add(wheel_timer_t* timer, int delay_ms, int period_ms, timer_callback_t callback, void* param)
+{
+	uint64_t delay_ticks = delay_ms > 0 ? ((uint64_t)delay_ms+TIMER_WHEEL_TICK_MS-1)/TIMER_WHEEL_TICK_MS : 1;
+	uint64_t now_tick;
+
+	pthread_mutex_lock(&wheel_lock);
+
+	timer_wheel_unlink(timer);
+	timer->callback = callback;
+	timer->param = param;
+	timer->period_ticks = period_ms > 0 ? ((uint32_t)period_ms+TIMER_WHEEL_TICK_MS-1)/TIMER_WHEEL_TICK_MS : 0;
+	timer->armed = 1;
+
+	/*from now, the ticks not run yet are counted in the laps*/
+	now_tick = timer_wheel_now_tick();
+	timer_wheel_link(timer, (now_tick > wheel_tick ? now_tick : wheel_tick)+delay_ticks);
+	timer_wheel_arm();
+
+	pthread_mutex_unlock(&wheel_lock);
+}
+
+/**
+ * timer_wheel_cancel(wheel_timer_t* timer)
+ * @brief Disarms a timer. A callback already running is not waited for.
+ * @param timer
+ */
+void timer_wheel_cancel(wheel_timer_t* timer)
+{
+	pthread_mutex_lock(&wheel_lock);
+
+	timer->armed = 0;
+	timer_wheel_unlink(timer);
+	timer_wheel_arm();
+
+	pthread_mutex_unlock(&wheel_lock);
+}
+
+/**
+ * timer_wheel_wait(int fd, int64_t timeout_ns)
+ * @brief Waits for fd to be readable, running the timers that expire
+ *        meanwhile. Without fd, sleeps for the timeout.
+ * @param fd, -1 for none
+ * @param timeout_ns, -1 to wait without limit
+ * @return the events of fd (POLLIN, POLLHUP...), 0 at the timeout or once
+ *         the wheel is stopped, -1 for error
+ */
+int timer_wheel_wait(int fd, int64_t timeout_ns)
+{
+	int ret;
+	int64_t deadline_ns = -1, remaining_ns;
+	struct timespec timeout;
+	struct pollfd pfd[3];
+
+	if (timeout_ns >= 0) {
+		deadline_ns = timer_wheel_now_ns()+timeout_ns;
+	}
+
+	pfd[0].fd = fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = wheel_fd;
+	pfd[1].events = POLLIN;
+	pfd[2].fd = wheel_stop_fd;
+	pfd[2].events = POLLIN;
+
+	for (;;) {
+
+		if (timer_wheel_stopped()) {
+			return (0);
+		}
+
+		if (deadline_ns >= 0) {
+			remaining_ns = deadline_ns-timer_wheel_now_ns();
+			if (remaining_ns < 0) {
+				remaining_ns = 0;
+			}
+			timeout.tv_sec = remaining_ns/1000000000;
+			timeout.tv_nsec = remaining_ns%1000000000;
+		}
+
+		/*the negative fds are ignored*/
+		ret = ppoll(pfd, 3, deadline_ns >= 0 ? &timeout : NULL, NULL);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (-1);
+		}
+
+		if (pfd[1].revents & POLLIN) {
+			timer_wheel_run();
+		}
+
+		if (fd >= 0 && pfd[0].revents) {
+			return pfd[0].revents;
+		}
+
+		if (ret == 0 || (deadline_ns >= 0 && timer_wheel_now_ns() >= deadline_ns)) {
+			return (0);
+		}
+	}
+}
+
+/**
+ * timer_wheel_poll()
+ * @brief Runs the timers that expired, without waiting. For the loops that
+ *        never wait, nothing but a read of the clock while none is due.
+ */
+void timer_wheel_poll(void)
+{
+	int64_t next_ns = __atomic_load_n(&wheel_next_ns, __ATOMIC_RELAXED);
+
+	if (wheel_fd >= 0 && next_ns > 0 && timer_wheel_now_ns() >= next_ns) {
+		timer_wheel_run();
+	}
+}
+
+/**
+ * timer_wheel_stop()
+ * @brief Stops the wheel: the waits return at once, now and from then on.
+ *        Safe in a signal handler, it only sets a flag and writes to the
+ *        eventfd.
+ */
+void timer_wheel_stop(void)
+{
+	uint64_t one = 1;
+
+	__atomic_store_n(&wheel_stopped, 1, __ATOMIC_RELAXED);
+
+	/*a counter that cannot take more is readable already*/
+	if (wheel_stop_fd >= 0 && write(wheel_stop_fd, &one, sizeof(one)) < 0) {
+		return;
+	}
+}
+
+/**
+ * timer_wheel_stopped()
+ * @brief Tells the reading loops to return
+ * @return 1 once the wheel is stopped, 0 before
+ */
+int timer_wheel_stopped(void)
+{
+	return __atomic_load_n(&wheel_stopped, __ATOMIC_RELAXED);
+}
+
+/**
+ * timer_wheel_cleanup()
+ * @brief Disarms the timers and closes the timerfd, once no thread waits on
+ *        the wheel
+ */
+void timer_wheel_cleanup(void)
+{
+	int i;
+	wheel_timer_t* timer;
+
+	pthread_mutex_lock(&wheel_lock);
+
+	for (i = 0; i < TIMER_WHEEL_NB_SLOTS; i++) {
+		while ((timer = wheel_slots[i]) != NULL) {
+			timer->armed = 0;
+			timer_wheel_unlink(timer);
+		}
+	}
+
+	if (wheel_fd >= 0) {
+		close(wheel_fd);
+		wheel_fd = -1;
+	}
+	if (wheel_stop_fd >= 0) {
+		close(wheel_stop_fd);
+		wheel_stop_fd = -1;
+	}
+	__atomic_store_n(&wheel_next_ns, 0, __ATOMIC_RELAXED);
+
+	pthread_mutex_unlock(&wheel_lock);
+}
+
+/**
+ * timer_wheel_run()
+ * @brief Turns the wheel up to the current tick and calls the timers that
+ *        expired, out of the lock: a callback can add or cancel timers.
+ *        The periodic ones go back in the wheel from their expiry, they do
+ *        not drift.
+ */
+static void timer_wheel_run(void)
+{
+	uint64_t expirations, now_tick;
+	wheel_timer_t *timer, *next, *due = NULL;
+
+	/*the count is not needed, the ticks come from the clock*/
+	if (read(wheel_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+		return;
+	}
+
+	pthread_mutex_lock(&wheel_lock);
+
+	now_tick = timer_wheel_now_tick();
+	while (wheel_tick < now_tick) {
+		wheel_tick++;
+		for (timer = wheel_slots[wheel_tick&(TIMER_WHEEL_NB_SLOTS-1)]; timer != NULL; timer = next) {
+			next = timer->next;
+			if (timer->rounds > 0) {
+				timer->rounds--;
+				continue;
+			}
+			timer_wheel_unlink(timer);
+			if (timer->period_ticks == 0) {
+				timer->armed = 0;
+			}
+			timer->next_due = due;
+			due = timer;
+		}
+	}
+
+	pthread_mutex_unlock(&wheel_lock);
+
+	for (timer = due; timer != NULL; timer = timer->next_due) {
+		timer->callback(timer->param);
+	}
+
+	pthread_mutex_lock(&wheel_lock);
+
+	/*unless cancelled or added again by the callback*/
+	for (timer = due; timer != NULL; timer = timer->next_due) {
+		if (timer->armed && timer->period_ticks > 0 && timer->prev == NULL) {
+			timer_wheel_link(timer, timer->expiry_tick+timer->period_ticks);
+		}
+	}
+	timer_wheel_arm();
+
+	pthread_mutex_unlock(&wheel_lock);
+}
+
+/**
+ * timer_wheel_link(wheel_timer_t* timer, uint64_t expiry_tick)
+ * @brief Hangs a timer in the slot of its expiry, with the laps to wait.
+ *        Called with the lock.
+ * @param timer
+ * @param expiry_tick, a tick already run expires at the next one
+ */
+static void timer_wheel_link(wheel_timer_t* timer, uint64_t expiry_tick)
+{
+	wheel_timer_t** slot;
+
+	if (expiry_tick <= wheel_tick) {
+		expiry_tick = wheel_tick+1;
+	}
+
+	timer->expiry_tick = expiry_tick;
+	timer->rounds = (uint32_t)((expiry_tick-wheel_tick-1)/TIMER_WHEEL_NB_SLOTS);
+
+	slot = &(wheel_slots[expiry_tick&(TIMER_WHEEL_NB_SLOTS-1)]);
+	timer->next = *slot;
+	if (timer->next != NULL) {
+		timer->next->prev = &(timer->next);
+	}
+	timer->prev = slot;
+	*slot = timer;
+}
+
+/**
+ * timer_wheel_unlink(wheel_timer_t* timer)
+ * @brief Takes a timer out of its slot, if it is in one. Called with the lock.
+ * @param timer
+ */
+static void timer_wheel_unlink(wheel_timer_t* timer)
+{
+	if (timer->prev == NULL) {
+		return;
+	}
+
+	*(timer->prev) = timer->next;
+	if (timer->next != NULL) {
+		timer->next->prev = timer->prev;
+	}
+	timer->next = NULL;
+	timer->prev = NULL;
+}
+
+/**
+ * timer_wheel_arm()
+ * @brief Arms the timerfd on the next slot that holds a timer, a lap at most
+ *        ahead. Called with the lock.
+ */
+static void timer_wheel_arm(void)
+{
+	int i;
+	int64_t next_ns = 0;
+	struct itimerspec spec;
+
+	if (wheel_fd < 0) {
+		return;
+	}
+
+	for (i = 1; i <= TIMER_WHEEL_NB_SLOTS; i++) {
+		if (wheel_slots[(wheel_tick+i)&(TIMER_WHEEL_NB_SLOTS-1)] != NULL) {
+			next_ns = wheel_start_ns+(int64_t)(wheel_tick+i)*TIMER_WHEEL_TICK_NS;
+			break;
+		}
+	}
+
+	/*an expiry already passed fires at once, a zero disarms*/
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = next_ns/1000000000;
+	spec.it_value.tv_nsec = next_ns%1000000000;
+	timerfd_settime(wheel_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+
+	__atomic_store_n(&wheel_next_ns, next_ns, __ATOMIC_RELAXED);
+}
+
+/**
+ * timer_wheel_now_tick()
+ * @brief Tick of the wheel at the current time
+ * @return the tick, from the start of the wheel
+ */
+static uint64_t timer_wheel_now_tick(void)
+{
+	if (wheel_fd < 0) {
+		return wheel_tick;
+	}
+
+	return (uint64_t)((timer_wheel_now_ns()-wheel_start_ns)/TIMER_WHEEL_TICK_NS);
+}
+
+/**
+ * timer_wheel_now_ns()
+ * @brief Current time of the wheel
+ * @return CLOCK_MONOTONIC, in ns
+ */
+static int64_t timer_wheel_now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec*1000000000+now.tv_nsec;
+}
@@ -0,0 +1,876 @@
+/**
+ * @file bench.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Benchmark of the Muse data path, stage by stage and end to end. It
+ *        runs the code of the daemon (decoder, translation, output and
+ *        processing stages of the config) on synthetic headsets and prints one
+ *        JSON object per line, to compare the releases on the target.
+ *
+ *        decode     muse_process_pkt on encoded buffers, no translation
+ *        translate  muse_translate_pkt on decoded packets, no output
+ *        output     the output of the config on translated blocks
+ *        pipeline   the three above, buffer by buffer
+ *        e2e        muse_emulator headsets, 1, 2, 4... up to max_devices at
+ *                   once, each read by the driver of the daemon: connected
+ *                   on a unix: address, then muse_read_pkt until the wheel
+ *                   stops it at the end of the measure
+ *
+ *        Each device runs in its own process (the decoder state is static), its
+ *        output goes to <record_file>.<n> or to the shm keys + n. The stage
+ *        latencies are the duration of one call (buffer, packet or block), the
+ *        e2e latency goes from the time the last sample of a block is produced
+ *        to its output, the samples being produced from the start command on.
+ *        The emulator waits on a full socket, a slow driver shows as latency,
+ *        the dropped samples are the ones the headset reports.
+ *
+ *        With -p, the hardware counters of the decoder stages (preparse,
+ *        parse, translate) are added per packet type. They cost a read() on
+ *        each side of a stage, the other measures are then not comparable.
+ *
+ *        bench [-c config.xml] [-b benches] [-n max_devices] [-t seconds]
+ *              [-r rate] [-e emulator] [-p]
+ *        -c  config of the output and of the stages (a MUSE device),
+ *            otherwise a BINARY recording in /tmp
+ *        -b  benches to run, separated by commas (all)
+ *        -n  most devices of the e2e bench (64)
+ *        -t  seconds of each measure (2)
+ *        -r  samples per second of the e2e headsets (220)
+ *        -e  muse_emulator of the e2e bench (the one next to the bench)
+ *        -p  hardware counters (perf_counters.h)
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/utsname.h>
+
+#include "xml.h"
+#include "hardware.h"
+#include "data_output.h"
+#include "main.h"
+#include "clock_sync.h"
+#include "histogram.h"
+#include "muse.h"
+#include "muse_pack_encoder.h"
+#include "socket.h"
+#include "stats.h"
+#include "perf_counters.h"
+#include "timer_wheel.h"
+
+#define BENCH_MAX_DEVICES 64
+#define BENCH_DURATION 2 /*seconds of each measure*/
+#define BENCH_ENCODED_DURATION 10 /*seconds of signal encoded for the stages, replayed in loop*/
+#define BENCH_REFRESH_PERIOD 10 /*compressed packets between two uncompressed, like the headset*/
+#define BENCH_RECORD_FILE "/tmp/bench.eegr"
+#define BENCH_SHM_KEY 7200
+#define BENCH_SEM_KEY 7300
+#define BENCH_EMULATOR "muse_emulator"
+#define BENCH_EMULATOR_SOCKET "/tmp/bench_emulator" /*.<pid of the device>*/
+#define BENCH_EMULATOR_WAIT_NS 2000000000 /*for the emulator to listen*/
+
+typedef enum { BENCH_DECODE, BENCH_TRANSLATE, BENCH_OUTPUT, BENCH_PIPELINE, BENCH_E2E, BENCH_NB } bench_type_t;
+
+static const char* bench_names[BENCH_NB] = { "decode", "translate", "output", "pipeline", "e2e" };
+
+typedef struct bench_options_s {
+	char* config_file;
+	int benches[BENCH_NB];
+	int max_devices;
+	double duration;
+	double rate;
+	char perf_counters;
+	char* emulator;
+} bench_options_t;
+
+/*measure of one device, sent back to the parent*/
+typedef struct bench_result_s {
+	int error;
+	uint64_t nb_samples;
+	uint64_t nb_dropped;
+	int64_t cpu_ns;
+	int64_t wall_ns;
+	histogram_t latency;
+	uint64_t perf_status;
+	shm_stats_perf_t perf[SHM_STATS_NB_PERF_STAGES][SHM_STATS_NB_PACKET_TYPES];
+} bench_result_t;
+
+/*encoded buffers, and what the decoder and the translation made of them*/
+typedef struct bench_data_s {
+
+	unsigned char* bytes;
+	param_t* buffers;
+	int* buffer_samples;
+	int nb_buffers;
+	int current_buffer; /*decoded while preparing*/
+
+	muse_translt_pkt_t* packets;
+	int* packet_values;
+	int nb_packets;
+
+	data_block_t* blocks;
+	float* block_values;
+	int nb_blocks;
+
+	int nb_samples; /*in one pass over the buffers*/
+	int max_samples;
+
+} bench_data_t;
+
+static bench_options_t options = { NULL, { 1, 1, 1, 1, 1 }, BENCH_MAX_DEVICES, BENCH_DURATION, MUSE_SAMPLING_RATE, 0, NULL };
+static char bench_emulator[MAX_PATH_LENGTH];
+
+/*state of the device process, the callbacks of the decoder reach it here*/
+static bench_data_t* bench_data = NULL;
+static bench_result_t* bench_result = NULL;
+static inputfunctionPtr_t bench_output_fc = NULL;
+static int64_t bench_start_ns = 0;
+static double bench_period_ns = 0;
+
+static int bench_parse_list(char* list);
+static appconfig_t* bench_config(int device);
+static void bench_report(bench_type_t type, int nb_devices, appconfig_t* config);
+static void bench_report_perf(bench_result_t* total);
+static int bench_device(bench_type_t type, int device, bench_result_t* result);
+static int bench_prepare(bench_data_t* data, void* output_array);
+static int bench_stage(bench_type_t type, void* output, void* output_array, bench_result_t* result);
+static int bench_e2e(void* output_array, bench_result_t* result);
+static pid_t bench_start_emulator(const char* path);
+static int bench_e2e_end(void* param);
+static int bench_record_packet(void* packet, void* output);
+static int bench_record_block(void* output, void* block);
+static int bench_null_translate(void* packet, void* output);
+static int bench_null_block(void* output, void* block);
+static int bench_e2e_block(void* output, void* block);
+static int64_t bench_cpu_ns(clockid_t clock);
+
+/**
+ * main()
+ * @brief Runs the benches asked for, the stages on one device and the e2e on
+ *        1 to max_devices devices
+ */
+int main(int argc, char** argv)
+{
+	int opt, nb_devices;
+	char* slash;
+	appconfig_t* config;
+
+	while ((opt = getopt(argc, argv, "c:b:n:t:r:e:p")) != -1) {
+		switch (opt) {
+			case 'c': options.config_file = optarg; break;
+			case 'b':
+				if (bench_parse_list(optarg) < 0) {
+					return (-1);
+				}
+				break;
+			case 'n': options.max_devices = atoi(optarg); break;
+			case 't': options.duration = atof(optarg); break;
+			case 'r': options.rate = atof(optarg); break;
+			case 'e': options.emulator = optarg; break;
+			case 'p': options.perf_counters = 1; break;
+			default:
+				printf("usage: %s [-c config.xml] [-b benches] [-n max_devices] [-t seconds] [-r rate] [-e emulator] [-p]\n", argv[0]);
+				return (-1);
+		}
+	}
+
+	if (optind != argc || options.max_devices < 1 || options.duration <= 0 || options.rate <= 0) {
+		printf("usage: %s [-c config.xml] [-b benches] [-n max_devices] [-t seconds] [-r rate] [-e emulator] [-p]\n", argv[0]);
+		return (-1);
+	}
+
+	/*the emulator is built next to the bench*/
+	if (options.emulator == NULL) {
+		slash = strrchr(argv[0], '/');
+		snprintf(bench_emulator, MAX_PATH_LENGTH, "%.*s%s", slash != NULL ? (int)(slash-argv[0]+1) : 0, argv[0], BENCH_EMULATOR);
+		options.emulator = bench_emulator;
+	}
+
+	/*check the config once, before forking the devices*/
+	config = bench_config(0);
+	if (config == NULL) {
+		return (-1);
+	}
+
+	for (opt = BENCH_DECODE; opt < BENCH_E2E; opt++) {
+		if (options.benches[opt]) {
+			bench_report((bench_type_t)opt, 1, config);
+		}
+	}
+
+	if (options.benches[BENCH_E2E]) {
+		for (nb_devices = 1; nb_devices < options.max_devices; nb_devices *= 2) {
+			bench_report(BENCH_E2E, nb_devices, config);
+		}
+		bench_report(BENCH_E2E, options.max_devices, config);
+	}
+
+	return (0);
+}
+
+/**
+ * app_cleanup()
+ * @brief Referred by the daemon code, nothing to clean here
+ */
+void app_cleanup(void)
+{
+}
+
+/**
+ * bench_parse_list(char* list)
+ * @brief Keeps only the benches of a list separated by commas
+ * @param list
+ * @return 0 for success, -1 for an unknown bench
+ */
+static int bench_parse_list(char* list)
+{
+	int i;
+	char* name;
+
+	memset(options.benches, 0, sizeof(options.benches));
+
+	for (name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+		for (i = 0; i < BENCH_NB; i++) {
+			if (strcmp(name, bench_names[i]) == 0) {
+				options.benches[i] = 1;
+				break;
+			}
+		}
+		if (i == BENCH_NB) {
+			printf("Unknown bench %s\n", name);
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+/**
+ * bench_config(int device)
+ * @brief Config of a device, from the file or the default one. Each device
+ *        has its own recording and shared memory.
+ * @param device, index of the device
+ * @return the config, NULL for error
+ */
+static appconfig_t* bench_config(int device)
+{
+	appconfig_t* config;
+	char record_file[MAX_PATH_LENGTH];
+
+	if (options.config_file != NULL) {
+
+		config = xml_initialize(options.config_file);
+		if (config == NULL) {
+			printf("Error initializing XML configuration\n");
+			return NULL;
+		}
+
+		/*the signal is synthesized for the muse decoder*/
+		if (strcmp((char *)config->device, "MUSE") != 0) {
+			printf("The bench needs a MUSE device, not %s\n", (char *)config->device);
+			return NULL;
+		}
+
+	} else {
+
+		config = (appconfig_t*)calloc(1, sizeof(appconfig_t));
+		strcpy((char *)config->device, "MUSE");
+		config->shm_key = BENCH_SHM_KEY;
+		config->sem_key = BENCH_SEM_KEY;
+		config->nb_data_channels = MUSE_NB_CHANNELS;
+		config->window_size = MUSE_SAMPLING_RATE;
+		config->nb_pages = 4;
+		config->output_format = BINARY_OUTPUT;
+		config->gap_fill = GAP_FILL_INTERP;
+		config->sample_format = SAMPLE_FLOAT32;
+		strcpy(config->record_file, BENCH_RECORD_FILE);
+		set_appconfig(config);
+	}
+
+	/*the capture would time the disk*/
+	config->capture_file[0] = '\0';
+
+	config->shm_key += device;
+	config->sem_key += device;
+	if (snprintf(record_file, MAX_PATH_LENGTH, "%s.%d", config->record_file, device) >= MAX_PATH_LENGTH) {
+		printf("record_file is too long\n");
+		return NULL;
+	}
+	strcpy(config->record_file, record_file);
+
+	return config;
+}
+
+/**
+ * bench_report(bench_type_t type, int nb_devices, appconfig_t* config)
+ * @brief Runs a bench on nb_devices processes at once, merges their measures
+ *        and prints them as a JSON object on one line
+ * @param type
+ * @param nb_devices
+ * @param config, of the first device, for the description
+ */
+static void bench_report(bench_type_t type, int nb_devices, appconfig_t* config)
+{
+	int i, j, k, c, nb_read, error = 0;
+	int* pipes = (int*)malloc(sizeof(int)*nb_devices);
+	int fds[2];
+	pid_t pid;
+	bench_result_t result, total;
+	struct utsname machine;
+	int64_t wall_ns = 0;
+	double nb_samples;
+
+	memset(&total, 0, sizeof(total));
+	histogram_init(&(total.latency));
+
+	for (i = 0; i < nb_devices; i++) {
+
+		pipes[i] = -1;
+		if (pipe(fds) != 0 || (pid = fork()) < 0) {
+			perror("fork");
+			error = 1;
+			break;
+		}
+
+		/*device, the messages of the daemon code must not mix with the results*/
+		if (pid == 0) {
+			close(fds[0]);
+			dup2(STDERR_FILENO, STDOUT_FILENO);
+			memset(&result, 0, sizeof(result));
+			histogram_init(&(result.latency));
+			result.error = bench_device(type, i, &result);
+			if (write(fds[1], &result, sizeof(result)) != sizeof(result)) {
+				_exit(1);
+			}
+			_exit(0);
+		}
+
+		close(fds[1]);
+		pipes[i] = fds[0];
+	}
+
+	for (i = 0; i < nb_devices && pipes[i] >= 0; i++) {
+
+		nb_read = 0;
+		while (nb_read < (int)sizeof(result)) {
+			int n = read(pipes[i], (char*)&result+nb_read, sizeof(result)-nb_read);
+			if (n <= 0) {
+				break;
+			}
+			nb_read += n;
+		}
+		close(pipes[i]);
+		wait(NULL);
+
+		if (nb_read != (int)sizeof(result) || result.error) {
+			error = 1;
+			continue;
+		}
+
+		total.nb_samples += result.nb_samples;
+		total.nb_dropped += result.nb_dropped;
+		total.cpu_ns += result.cpu_ns;
+		if (result.wall_ns > wall_ns) {
+			wall_ns = result.wall_ns;
+		}
+		histogram_merge(&(total.latency), &(result.latency));
+
+		if (result.perf_status > total.perf_status) {
+			total.perf_status = result.perf_status;
+		}
+		for (j = 0; j < SHM_STATS_NB_PERF_STAGES; j++) {
+			for (k = 0; k < SHM_STATS_NB_PACKET_TYPES; k++) {
+				total.perf[j][k].count += result.perf[j][k].count;
+				for (c = 0; c < SHM_STATS_NB_PERF_COUNTERS; c++) {
+					total.perf[j][k].counters[c] += result.perf[j][k].counters[c];
+				}
+			}
+		}
+	}
+
+	free(pipes);
+
+	if (error) {
+		fprintf(stderr, "%s on %d devices failed\n", bench_names[type], nb_devices);
+		return;
+	}
+
+	uname(&machine);
+	nb_samples = total.nb_samples > 0 ? (double)total.nb_samples : 1;
+
+	printf("{\"bench\":\"%s\",\"devices\":%d,\"config\":\"%s\",\"output\":%d,\"seconds\":%.3f,"
+	       "\"samples\":%llu,\"samples_per_s\":%.1f,\"cpu_ns_per_sample\":%.1f,"
+	       "\"latency_ns\":{\"p50\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu},"
+	       "\"dropped\":%llu,\"machine\":\"%s\",\"cpus\":%ld",
+	       bench_names[type], nb_devices, options.config_file != NULL ? options.config_file : "default",
+	       config->output_format, wall_ns/1e9,
+	       (unsigned long long)total.nb_samples, total.nb_samples/(wall_ns/1e9), total.cpu_ns/nb_samples,
+	       (unsigned long long)histogram_percentile(&(total.latency), 50),
+	       (unsigned long long)histogram_percentile(&(total.latency), 99),
+	       (unsigned long long)histogram_percentile(&(total.latency), 99.9),
+	       (unsigned long long)total.latency.max,
+	       (unsigned long long)total.nb_dropped, machine.machine, sysconf(_SC_NPROCESSORS_ONLN));
+	if (options.perf_counters) {
+		bench_report_perf(&total);
+	}
+	printf("}\n");
+	fflush(stdout);
+}
+
+/**
+ * bench_report_perf(bench_result_t* total)
+ * @brief Adds the hardware counters to the JSON object of a bench, per
+ *        packet, for each stage and each type of packet seen
+ * @param total, of all the devices
+ */
+static void bench_report_perf(bench_result_t* total)
+{
+	int i, j, k;
+	const char* stage_names[SHM_STATS_NB_PERF_STAGES] = PERF_STAGE_NAMES;
+	const char* counter_names[SHM_STATS_NB_PERF_COUNTERS] = PERF_COUNTER_NAMES;
+	const char* status_names[] = { "off", "counting", "unavailable" };
+	const char* type_names[SHM_STATS_NB_PACKET_TYPES] = SHM_STATS_PACKET_TYPE_NAMES;
+	shm_stats_perf_t* perf;
+
+	printf(",\"perf\":{\"status\":\"%s\"", status_names[total->perf_status <= PERF_UNAVAILABLE ? total->perf_status : PERF_UNAVAILABLE]);
+
+	for (i = 0; i < SHM_STATS_NB_PERF_STAGES; i++) {
+		for (j = 0; j < SHM_STATS_NB_PACKET_TYPES; j++) {
+			perf = &(total->perf[i][j]);
+			if (perf->count == 0) {
+				continue;
+			}
+			printf(",\"%s_%s\":{\"packets\":%llu", stage_names[i], type_names[j], (unsigned long long)perf->count);
+			for (k = 0; k < SHM_STATS_NB_PERF_COUNTERS; k++) {
+				printf(",\"%s\":%.1f", counter_names[k], (double)perf->counters[k]/perf->count);
+			}
+			printf("}");
+		}
+	}
+
+	printf("}");
+}
+
+/**
+ * bench_device(bench_type_t type, int device, bench_result_t* result)
+ * @brief One device, in its own process: sets up the decoder and the output
+ *        like the daemon does, runs the bench and removes what the output left
+ * @param type
+ * @param device, index of the device
+ * @param (out)result
+ * @return 0 for success, -1 for error
+ */
+static int bench_device(bench_type_t type, int device, bench_result_t* result)
+{
+	int ret;
+	void* output;
+	output_interface_array_t output_array;
+	appconfig_t* config = bench_config(device);
+
+	if (config == NULL || init_hardware((char *)config->device) < 0 || muse_init_hardware(NULL) < 0) {
+		return (-1);
+	}
+
+	output = init_data_output(config);
+	if (output == NULL) {
+		printf("Error initializing data output\n");
+		return (-1);
+	}
+
+	output_array.nb_output = 1;
+	output_array.output_interface = &output;
+	bench_output_fc = _COPY_BLOCK_IN;
+	bench_result = result;
+	perf_init(options.perf_counters);
+
+	if (type == BENCH_E2E) {
+		ret = bench_e2e(&output_array, result);
+	} else {
+		ret = bench_stage(type, output, &output_array, result);
+	}
+
+	result->perf_status = stats_page->perf_status;
+	memcpy(result->perf, stats_page->perf, sizeof(result->perf));
+
+	TERMINATE_DATA_OUTPUT_FC(output);
+	if (config->output_format == BINARY_OUTPUT) {
+		unlink(config->record_file);
+	}
+
+	return ret;
+}
+
+/**
+ * bench_prepare(bench_data_t* data, void* output_array)
+ * @brief Encodes BENCH_ENCODED_DURATION seconds of signal, then decodes and
+ *        translates them once, to keep the packets and the blocks each stage
+ *        takes in
+ * @param (out)data
+ * @param output_array, given to the decoder
+ * @return 0 for success, -1 for error
+ */
+static int bench_prepare(bench_data_t* data, void* output_array)
+{
+	int i, length, nb_samples = MUSE_SAMPLING_RATE*BENCH_ENCODED_DURATION;
+	int sample[MUSE_NB_CHANNELS];
+	int offset = 0;
+	muse_encoder_t encoder;
+
+	memset(data, 0, sizeof(bench_data_t));
+	data->max_samples = nb_samples;
+
+	/*at most one buffer per sample, each of them with a sync and a drl/ref packet*/
+	data->bytes = (unsigned char*)malloc(nb_samples*(MUSE_SYNC_PKT_LENGTH+MUSE_DRLREF_PKT_LENGTH+MUSE_UNCOMPRESS_PKT_LENGTH+2)+MUSE_ENCODER_MAX_BUFFER);
+	data->buffers = (param_t*)malloc(sizeof(param_t)*nb_samples);
+	data->buffer_samples = (int*)calloc(nb_samples, sizeof(int));
+	data->packets = (muse_translt_pkt_t*)malloc(sizeof(muse_translt_pkt_t)*nb_samples);
+	data->packet_values = (int*)malloc(sizeof(int)*nb_samples*MUSE_NB_CHANNELS*MUSE_NB_DELTAS);
+	data->blocks = (data_block_t*)malloc(sizeof(data_block_t)*nb_samples);
+	data->block_values = (float*)malloc(sizeof(float)*nb_samples*MUSE_NB_CHANNELS);
+
+	if (data->bytes == NULL || data->buffers == NULL || data->buffer_samples == NULL || data->packets == NULL ||
+	    data->packet_values == NULL || data->blocks == NULL || data->block_values == NULL) {
+		printf("Unable to malloc the bench data\n");
+		return (-1);
+	}
+
+	/*encoded like the headset, lossless*/
+	muse_encoder_init(&encoder, BENCH_REFRESH_PERIOD, MUSE_SAMPLING_RATE, 0);
+	for (i = 0; i < nb_samples; i++) {
+		muse_synth_sample(i, MUSE_SAMPLING_RATE, sample);
+		length = muse_encoder_push(&encoder, sample, &(data->bytes[offset]));
+		if (length > 0) {
+			data->buffers[data->nb_buffers].ptr = &(data->bytes[offset]);
+			data->buffers[data->nb_buffers].len = length;
+			data->nb_buffers++;
+			offset += length;
+		}
+	}
+
+	/*decoded, the packets and the samples of each buffer are kept*/
+	bench_data = data;
+	_TRANS_PKT_FC = &bench_record_packet;
+	for (i = 0; i < data->nb_buffers; i++) {
+		data->current_buffer = i;
+		muse_process_pkt(&(data->buffers[i]), output_array);
+	}
+
+	/*translated, the blocks are kept*/
+	_COPY_BLOCK_IN = &bench_record_block;
+	for (i = 0; i < data->nb_packets; i++) {
+		muse_translate_pkt(&(data->packets[i]), output_array);
+	}
+
+	_TRANS_PKT_FC = &muse_translate_pkt;
+	_COPY_BLOCK_IN = bench_output_fc;
+
+	for (i = 0; i < data->nb_buffers; i++) {
+		data->nb_samples += data->buffer_samples[i];
+	}
+
+	if (data->nb_samples == 0) {
+		printf("Nothing was decoded\n");
+		return (-1);
+	}
+
+	return (0);
+}
+
+/**
+ * bench_stage(bench_type_t type, void* output, void* output_array, bench_result_t* result)
+ * @brief Runs a stage over the prepared data in loop, for the duration of the
+ *        measure, and times each call
+ * @param type, BENCH_DECODE to BENCH_PIPELINE
+ * @param output, of the config
+ * @param output_array, given to the decoder
+ * @param (out)result
+ * @return 0 for success, -1 for error
+ */
+static int bench_stage(bench_type_t type, void* output, void* output_array, bench_result_t* result)
+{
+	int i, nb_items = 0;
+	int64_t start_ns, call_ns, end_ns, cpu_ns;
+	uint64_t offset = 0;
+	bench_data_t data;
+	perf_sample_t perf_begin, perf_end;
+
+	if (bench_prepare(&data, output_array) < 0) {
+		return (-1);
+	}
+
+	/*only the measure is counted*/
+	memset(stats_page->perf, 0, sizeof(stats_page->perf));
+
+	switch (type) {
+		case BENCH_DECODE: nb_items = data.nb_buffers; _TRANS_PKT_FC = &bench_null_translate; break;
+		case BENCH_TRANSLATE: nb_items = data.nb_packets; _COPY_BLOCK_IN = &bench_null_block; break;
+		case BENCH_OUTPUT: nb_items = data.nb_blocks; break;
+		default: nb_items = data.nb_buffers; break;
+	}
+
+	cpu_ns = bench_cpu_ns(CLOCK_PROCESS_CPUTIME_ID);
+	start_ns = clock_sync_now_ns();
+	end_ns = start_ns+(int64_t)(options.duration*1e9);
+
+	do {
+		for (i = 0; i < nb_items; i++) {
+
+			call_ns = clock_sync_now_ns();
+
+			switch (type) {
+				case BENCH_DECODE:
+				case BENCH_PIPELINE:
+					muse_process_pkt(&(data.buffers[i]), output_array);
+					result->nb_samples += data.buffer_samples[i];
+					break;
+				case BENCH_TRANSLATE:
+					PERF_SAMPLE(&perf_begin);
+					muse_translate_pkt(&(data.packets[i]), output_array);
+					PERF_SAMPLE(&perf_end);
+					PERF_RECORD(PERF_TRANSLATE, data.packets[i].type, &perf_begin, &perf_end, 1);
+					result->nb_samples += data.packets[i].type == MUSE_COMPRESSED_PKT ? MUSE_NB_DELTAS : 1;
+					break;
+				default:
+					/*the blocks follow the previous pass*/
+					data.blocks[i].first_sample += offset;
+					data.blocks[i].timestamp_ns += (int64_t)(offset*data.blocks[i].sample_period_ns);
+					bench_output_fc(output, &(data.blocks[i]));
+					data.blocks[i].first_sample -= offset;
+					data.blocks[i].timestamp_ns -= (int64_t)(offset*data.blocks[i].sample_period_ns);
+					result->nb_samples += data.blocks[i].nb_samples;
+					break;
+			}
+
+			histogram_record(&(result->latency), clock_sync_now_ns()-call_ns);
+		}
+		offset += data.nb_samples;
+	} while (clock_sync_now_ns() < end_ns);
+
+	result->wall_ns = clock_sync_now_ns()-start_ns;
+	result->cpu_ns = bench_cpu_ns(CLOCK_PROCESS_CPUTIME_ID)-cpu_ns;
+
+	_TRANS_PKT_FC = &muse_translate_pkt;
+	_COPY_BLOCK_IN = bench_output_fc;
+	return (0);
+}
+
+/**
+ * bench_e2e(void* output_array, bench_result_t* result)
+ * @brief Reads an emulator with the driver of the daemon, for the duration
+ *        of the measure. The CPU time is the one of the reader, not of the
+ *        emulator.
+ * @param output_array, given to the decoder
+ * @param (out)result
+ * @return 0 for success, -1 for error
+ */
+static int bench_e2e(void* output_array, bench_result_t* result)
+{
+	int ret;
+	pid_t emulator;
+	int64_t cpu_ns, deadline_ns;
+	char address[MAX_PATH_LENGTH], *path;
+	param_t param = { 0 };
+	wheel_timer_t end_timer;
+
+	/*unix:<path>, the driver connects like to a headset*/
+	snprintf(address, MAX_PATH_LENGTH, "%s%s.%d", SOCKET_UNIX_PREFIX, BENCH_EMULATOR_SOCKET, (int)getpid());
+	path = address+strlen(SOCKET_UNIX_PREFIX);
+	param.ptr = (unsigned char *)address;
+
+	if (timer_wheel_init() < 0) {
+		return (-1);
+	}
+
+	emulator = bench_start_emulator(path);
+	if (emulator < 0) {
+		timer_wheel_cleanup();
+		return (-1);
+	}
+
+	/*until the emulator listens*/
+	deadline_ns = clock_sync_now_ns()+BENCH_EMULATOR_WAIT_NS;
+	while ((ret = muse_connect_dev(&param)) < 0 && clock_sync_now_ns() < deadline_ns) {
+		usleep(10000);
+	}
+
+	if (ret == 0) {
+
+		/*the emulator produces its samples from the start command, sent
+		  by muse_read_pkt*/
+		bench_start_ns = clock_sync_now_ns();
+		bench_period_ns = 1e9/options.rate;
+		_COPY_BLOCK_IN = &bench_e2e_block;
+		timer_wheel_add(&end_timer, (int)(options.duration*1000), 0, &bench_e2e_end, NULL);
+
+		cpu_ns = bench_cpu_ns(CLOCK_THREAD_CPUTIME_ID);
+		muse_read_pkt(output_array);
+		result->cpu_ns = bench_cpu_ns(CLOCK_THREAD_CPUTIME_ID)-cpu_ns;
+		result->wall_ns = clock_sync_now_ns()-bench_start_ns;
+		result->nb_dropped = stats_page->dropped_samples;
+
+		_COPY_BLOCK_IN = bench_output_fc;
+		close_sockets();
+
+	} else {
+		printf("Unable to connect to the emulator %s\n", options.emulator);
+	}
+
+	kill(emulator, SIGTERM);
+	waitpid(emulator, NULL, 0);
+	unlink(path);
+	timer_wheel_cleanup();
+
+	return ret;
+}
+
+/**
+ * bench_start_emulator(const char* path)
+ * @brief Starts a muse_emulator at the rate of the bench
+ * @param path, of its socket
+ * @return the pid of the emulator, -1 for error
+ */
+static pid_t bench_start_emulator(const char* path)
+{
+	pid_t pid;
+	char rate[32];
+
+	snprintf(rate, sizeof(rate), "%f", options.rate);
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return (-1);
+	}
+
+	if (pid == 0) {
+		execlp(options.emulator, options.emulator, "-r", rate, path, (char *)NULL);
+		perror(options.emulator);
+		_exit(1);
+	}
+
+	return pid;
+}
+
+/**
+ * bench_e2e_end(void* param)
+ * @brief Timer of the end of the e2e measure, muse_read_pkt returns
+ */
+static int bench_e2e_end(void* param __attribute__ ((unused)))
+{
+	timer_wheel_stop();
+	return (0);
+}
+
+/**
+ * bench_record_packet(void* packet, void* output)
+ * @brief Translation that keeps the decoded packets
+ */
+static int bench_record_packet(void* packet, void* output __attribute__ ((unused)))
+{
+	muse_translt_pkt_t* muse_trslt_pkt_ptr = (muse_translt_pkt_t*)packet;
+	muse_translt_pkt_t* copy;
+	int nb_samples = muse_trslt_pkt_ptr->type == MUSE_COMPRESSED_PKT ? MUSE_NB_DELTAS : 1;
+
+	if (bench_data->nb_packets >= bench_data->max_samples) {
+		return (0);
+	}
+
+	copy = &(bench_data->packets[bench_data->nb_packets]);
+	*copy = *muse_trslt_pkt_ptr;
+	copy->eeg_data = &(bench_data->packet_values[bench_data->nb_packets*MUSE_NB_CHANNELS*MUSE_NB_DELTAS]);
+	memcpy(copy->eeg_data, muse_trslt_pkt_ptr->eeg_data, sizeof(int)*MUSE_NB_CHANNELS*MUSE_NB_DELTAS);
+
+	bench_data->nb_packets++;
+	bench_data->buffer_samples[bench_data->current_buffer] += nb_samples;
+
+	return (0);
+}
+
+/**
+ * bench_record_block(void* output, void* block)
+ * @brief Output that keeps the translated blocks
+ */
+static int bench_record_block(void* output __attribute__ ((unused)), void* block)
+{
+	data_block_t* data_block = (data_block_t*)block;
+	data_block_t* copy;
+	int nb_values = data_block->nb_samples*data_block->nb_data;
+	static int nb_block_values = 0;
+
+	if (bench_data->nb_blocks >= bench_data->max_samples ||
+	    nb_block_values+nb_values > bench_data->max_samples*MUSE_NB_CHANNELS) {
+		return (0);
+	}
+
+	copy = &(bench_data->blocks[bench_data->nb_blocks]);
+	*copy = *data_block;
+	copy->ptr = &(bench_data->block_values[nb_block_values]);
+	memcpy(copy->ptr, data_block->ptr, sizeof(float)*nb_values);
+
+	nb_block_values += nb_values;
+	bench_data->nb_blocks++;
+
+	return (0);
+}
+
+/**
+ * bench_null_translate(void* packet, void* output)
+ * @brief Translation that does nothing, to time the decoder alone
+ */
+static int bench_null_translate(void* packet __attribute__ ((unused)), void* output __attribute__ ((unused)))
+{
+	return (0);
+}
+
+/**
+ * bench_null_block(void* output, void* block)
+ * @brief Output that does nothing, to time the translation alone
+ */
+static int bench_null_block(void* output __attribute__ ((unused)), void* block __attribute__ ((unused)))
+{
+	return (0);
+}
+
+/**
+ * bench_e2e_block(void* output, void* block)
+ * @brief Output of the e2e bench: the output of the config, then the latency
+ *        of the last sample of the block. The samples filling a gap were
+ *        never produced, they only count as dropped.
+ */
+static int bench_e2e_block(void* output, void* block)
+{
+	data_block_t* data_block = (data_block_t*)block;
+	int ret = bench_output_fc(output, block);
+	int64_t produced_ns;
+
+	if (data_block->flags & BLOCK_GAP_FILL) {
+		return ret;
+	}
+
+	produced_ns = bench_start_ns+(int64_t)((data_block->first_sample+data_block->nb_samples-1)*bench_period_ns);
+	histogram_record(&(bench_result->latency), clock_sync_now_ns()-produced_ns);
+	bench_result->nb_samples += data_block->nb_samples;
+
+	return ret;
+}
+
+/**
+ * bench_cpu_ns(clockid_t clock)
+ * @brief CPU time of the process or of the thread
+ * @param clock, CLOCK_PROCESS_CPUTIME_ID or CLOCK_THREAD_CPUTIME_ID
+ * @return time in ns
+ */
+static int64_t bench_cpu_ns(clockid_t clock)
+{
+	struct timespec now;
+
+	clock_gettime(clock, &now);
+	return (int64_t)now.tv_sec*1000000000+now.tv_nsec;
+}
@@ -0,0 +1,413 @@
+/**
+ * @file datactl.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Control tool of the data interface. For now, it reads the runtime
+ *        statistics page (shm_stats_page_t) of a running interface. The page
+ *        is only read: the interface is not signalled and does not wait.
+ *
+ *        datactl stats [-c config.xml | -k stats_shm_key] [-i seconds] [-j]
+ *        -c  config of the interface, for its <stats_shm_key>
+ *            (config/data_config.xml)
+ *        -k  key of the statistics page, instead of the config
+ *        -i  prints every <seconds> the rates over the interval, otherwise
+ *            once the rates since the start
+ *        -j  one JSON object per print, for the collection across the fleet
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "shm_page_def.h"
+#include "xml.h"
+#include "clock_sync.h"
+#include "perf_counters.h"
+
+#define DATACTL_CONFIG_NAME "config/data_config.xml"
+
+/*counters of the page, in the order they are printed*/
+typedef struct datactl_counter_s {
+	const char* name;
+	size_t offset;
+	char gauge; /*printed as is, no rate*/
+} datactl_counter_t;
+
+static const datactl_counter_t datactl_counters[] = {
+	{ "bytes_received", offsetof(shm_stats_page_t, bytes_received), 0 },
+	{ "buffers_received", offsetof(shm_stats_page_t, buffers_received), 0 },
+	{ "samples_received", offsetof(shm_stats_page_t, samples_received), 0 },
+	{ "preparse_errors", offsetof(shm_stats_page_t, preparse_errors), 0 },
+	{ "bit_length_mismatches", offsetof(shm_stats_page_t, bit_length_mismatches), 0 },
+	{ "dropped_samples", offsetof(shm_stats_page_t, dropped_samples), 0 },
+	{ "gap_samples", offsetof(shm_stats_page_t, gap_samples), 0 },
+	{ "pages_published", offsetof(shm_stats_page_t, pages_published), 0 },
+	{ "pages_dropped", offsetof(shm_stats_page_t, pages_dropped), 0 },
+	{ "samples_dropped", offsetof(shm_stats_page_t, samples_dropped), 0 },
+	{ "reader_lag", offsetof(shm_stats_page_t, reader_lag), 1 },
+	{ "connect_attempts", offsetof(shm_stats_page_t, connect_attempts), 0 },
+	{ "connections", offsetof(shm_stats_page_t, connections), 0 },
+	{ "disconnections", offsetof(shm_stats_page_t, disconnections), 0 },
+	{ "stalls", offsetof(shm_stats_page_t, stalls), 0 },
+	{ "cpu_ns", offsetof(shm_stats_page_t, cpu_ns), 0 },
+	{ "read_cpu_ns", offsetof(shm_stats_page_t, read_cpu_ns), 0 },
+	{ "trace_lost", offsetof(shm_stats_page_t, trace_lost), 0 }
+};
+#define DATACTL_NB_COUNTERS (int)(sizeof(datactl_counters)/sizeof(datactl_counter_t))
+
+/*soft packets by their first nibble, see muse.h*/
+static const char* datactl_packet_names[SHM_STATS_NB_PACKET_TYPES] = SHM_STATS_PACKET_TYPE_NAMES;
+
+/*copy of the page, field by field*/
+typedef struct datactl_snapshot_s {
+	int64_t now_ns;
+	int64_t start_ns;
+	uint64_t counters[DATACTL_NB_COUNTERS];
+	uint64_t packet_types[SHM_STATS_NB_PACKET_TYPES];
+	shm_stats_stage_t stages[SHM_STATS_NB_STAGES];
+	uint64_t perf_status;
+	shm_stats_perf_t perf[SHM_STATS_NB_PERF_STAGES][SHM_STATS_NB_PACKET_TYPES];
+} datactl_snapshot_t;
+
+static int datactl_stats(int argc, char** argv);
+static shm_stats_page_t* datactl_attach(int key);
+static void datactl_snapshot(const shm_stats_page_t* page, datactl_snapshot_t* snapshot);
+static void datactl_print(const shm_stats_page_t* page, const datactl_snapshot_t* last, const datactl_snapshot_t* first, char json);
+static void datactl_print_perf(const datactl_snapshot_t* last, const datactl_snapshot_t* first, char json);
+static uint64_t datactl_load(const void* field);
+
+/**
+ * main()
+ * @brief Runs a command
+ */
+int main(int argc, char** argv)
+{
+	if (argc >= 2 && strcmp(argv[1], "stats") == 0) {
+		return datactl_stats(argc-1, &(argv[1]));
+	}
+
+	printf("usage: %s stats [-c config.xml | -k stats_shm_key] [-i seconds] [-j]\n", argv[0]);
+	return (-1);
+}
+
+/**
+ * datactl_stats(int argc, char** argv)
+ * @brief Prints the statistics page, once or every interval
+ * @return 0 for success, -1 for error
+ */
+static int datactl_stats(int argc, char** argv)
+{
+	int opt, key = 0;
+	char* config_file = DATACTL_CONFIG_NAME;
+	double interval = 0;
+	char json = 0;
+	appconfig_t* config;
+	shm_stats_page_t* page;
+	datactl_snapshot_t first, last;
+	struct timespec delay;
+
+	while ((opt = getopt(argc, argv, "c:k:i:j")) != -1) {
+		switch (opt) {
+			case 'c': config_file = optarg; break;
+			case 'k': key = atoi(optarg); break;
+			case 'i': interval = atof(optarg); break;
+			case 'j': json = 1; break;
+			default:
+				printf("usage: datactl stats [-c config.xml | -k stats_shm_key] [-i seconds] [-j]\n");
+				return (-1);
+		}
+	}
+
+	if (key == 0) {
+		config = xml_initialize(config_file);
+		if (config == NULL) {
+			printf("Error initializing XML configuration\n");
+			return (-1);
+		}
+		key = config->stats_shm_key;
+		if (key == 0) {
+			printf("%s has no stats_shm_key\n", config_file);
+			return (-1);
+		}
+	}
+
+	page = datactl_attach(key);
+	if (page == NULL) {
+		return (-1);
+	}
+
+	/*once, since the start*/
+	datactl_snapshot(page, &last);
+	if (interval <= 0) {
+		memset(&first, 0, sizeof(first));
+		first.now_ns = last.start_ns;
+		datactl_print(page, &last, &first, json);
+		return (0);
+	}
+
+	/*every interval, over the interval*/
+	delay.tv_sec = (time_t)interval;
+	delay.tv_nsec = (long)((interval-delay.tv_sec)*1e9);
+	for (;;) {
+		first = last;
+		nanosleep(&delay, NULL);
+		datactl_snapshot(page, &last);
+
+		/*the interface restarted, the counters with it*/
+		if (last.start_ns != first.start_ns) {
+			continue;
+		}
+		datactl_print(page, &last, &first, json);
+	}
+
+	return (0);
+}
+
+/**
+ * datactl_attach(int key)
+ * @brief Attaches the statistics page, read only
+ * @param key
+ * @return the page, NULL for error
+ */
+static shm_stats_page_t* datactl_attach(int key)
+{
+	int shmid;
+	struct shmid_ds shm_info;
+	shm_stats_page_t* page;
+
+	if ((shmid = shmget(key, 0, 0)) < 0) {
+		perror("shmget, is the interface running?");
+		return NULL;
+	}
+
+	if (shmctl(shmid, IPC_STAT, &shm_info) != 0 || shm_info.shm_segsz < sizeof(shm_stats_page_t)) {
+		printf("Segment %d is not a statistics page\n", key);
+		return NULL;
+	}
+
+	if ((page = (shm_stats_page_t*)shmat(shmid, NULL, SHM_RDONLY)) == (shm_stats_page_t*)-1) {
+		perror("shmat");
+		return NULL;
+	}
+
+	if (page->magic != SHM_STATS_MAGIC) {
+		printf("Segment %d is not a statistics page\n", key);
+		shmdt((void*)page);
+		return NULL;
+	}
+
+	return page;
+}
+
+/**
+ * datactl_snapshot(const shm_stats_page_t* page, datactl_snapshot_t* snapshot)
+ * @brief Copies the page, each field with a relaxed atomic load like the
+ *        interface writes them
+ * @param page
+ * @param (out)snapshot
+ */
+static void datactl_snapshot(const shm_stats_page_t* page, datactl_snapshot_t* snapshot)
+{
+	int i, j, k;
+
+	snapshot->now_ns = clock_sync_now_ns();
+	snapshot->start_ns = page->start_ns;
+
+	for (i = 0; i < DATACTL_NB_COUNTERS; i++) {
+		snapshot->counters[i] = datactl_load((const char*)page+datactl_counters[i].offset);
+	}
+
+	for (i = 0; i < SHM_STATS_NB_PACKET_TYPES; i++) {
+		snapshot->packet_types[i] = datactl_load(&(page->packet_types[i]));
+	}
+
+	for (i = 0; i < SHM_STATS_NB_STAGES; i++) {
+		memcpy(snapshot->stages[i].name, page->stages[i].name, SHM_STATS_STAGE_NAME_LENGTH);
+		snapshot->stages[i].name[SHM_STATS_STAGE_NAME_LENGTH-1] = '\0';
+		snapshot->stages[i].count = datactl_load(&(page->stages[i].count));
+		snapshot->stages[i].total_ns = datactl_load(&(page->stages[i].total_ns));
+		snapshot->stages[i].p50_ns = datactl_load(&(page->stages[i].p50_ns));
+		snapshot->stages[i].p99_ns = datactl_load(&(page->stages[i].p99_ns));
+		snapshot->stages[i].p999_ns = datactl_load(&(page->stages[i].p999_ns));
+		snapshot->stages[i].max_ns = datactl_load(&(page->stages[i].max_ns));
+	}
+
+	snapshot->perf_status = datactl_load(&(page->perf_status));
+	for (i = 0; i < SHM_STATS_NB_PERF_STAGES; i++) {
+		for (j = 0; j < SHM_STATS_NB_PACKET_TYPES; j++) {
+			snapshot->perf[i][j].count = datactl_load(&(page->perf[i][j].count));
+			for (k = 0; k < SHM_STATS_NB_PERF_COUNTERS; k++) {
+				snapshot->perf[i][j].counters[k] = datactl_load(&(page->perf[i][j].counters[k]));
+			}
+		}
+	}
+}
+
+/**
+ * datactl_print(const shm_stats_page_t* page, const datactl_snapshot_t* last,
+ *               const datactl_snapshot_t* first, char json)
+ * @brief Prints the counters and their rates between two snapshots. The time
+ *        spent in a stage is per buffer, the percentiles since the start.
+ * @param page, for the static fields
+ * @param last
+ * @param first, zeros for the rates since the start
+ * @param json
+ */
+static void datactl_print(const shm_stats_page_t* page, const datactl_snapshot_t* last, const datactl_snapshot_t* first, char json)
+{
+	int i;
+	double seconds = (last->now_ns-first->now_ns)/1e9;
+	double rate;
+	uint64_t count;
+
+	if (seconds <= 0) {
+		seconds = 1;
+	}
+
+	if (json) {
+		printf("{\"pid\":%d,\"device\":\"%.*s\",\"uptime_s\":%.1f,\"interval_s\":%.1f", page->pid,
+		       SHM_STATS_DEVICE_LENGTH, page->device, (last->now_ns-last->start_ns)/1e9, seconds);
+		for (i = 0; i < DATACTL_NB_COUNTERS; i++) {
+			printf(",\"%s\":%llu", datactl_counters[i].name, (unsigned long long)last->counters[i]);
+			if (!datactl_counters[i].gauge) {
+				printf(",\"%s_per_s\":%.1f", datactl_counters[i].name, (last->counters[i]-first->counters[i])/seconds);
+			}
+		}
+		printf(",\"packet_types\":{");
+		for (i = 0, count = 0; i < SHM_STATS_NB_PACKET_TYPES; i++) {
+			if (last->packet_types[i] > 0) {
+				printf("%s\"%s\":%llu", count++ ? "," : "", datactl_packet_names[i],
+				       (unsigned long long)last->packet_types[i]);
+			}
+		}
+		printf("},\"stages\":{");
+		for (i = 0, count = 0; i < SHM_STATS_NB_STAGES; i++) {
+			if (last->stages[i].count > 0) {
+				printf("%s\"%s\":{\"count\":%llu,\"cpu_ns_per_s\":%.0f",
+				       count++ ? "," : "", last->stages[i].name, (unsigned long long)last->stages[i].count,
+				       (last->stages[i].total_ns-first->stages[i].total_ns)/seconds);
+				/*the percentiles come from the tracing*/
+				if (last->stages[i].max_ns > 0) {
+					printf(",\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu",
+					       (unsigned long long)last->stages[i].p50_ns, (unsigned long long)last->stages[i].p99_ns,
+					       (unsigned long long)last->stages[i].p999_ns, (unsigned long long)last->stages[i].max_ns);
+				}
+				printf("}");
+			}
+		}
+		printf("}");
+		datactl_print_perf(last, first, json);
+		printf("}\n");
+		fflush(stdout);
+		return;
+	}
+
+	printf("%.*s, pid %d, up %.1fs, over %.1fs\n", SHM_STATS_DEVICE_LENGTH, page->device, page->pid,
+	       (last->now_ns-last->start_ns)/1e9, seconds);
+
+	for (i = 0; i < DATACTL_NB_COUNTERS; i++) {
+		printf("  %-22s %16llu", datactl_counters[i].name, (unsigned long long)last->counters[i]);
+		if (!datactl_counters[i].gauge) {
+			rate = (last->counters[i]-first->counters[i])/seconds;
+			printf(" %14.1f/s", rate);
+		}
+		printf("\n");
+	}
+
+	for (i = 0; i < SHM_STATS_NB_PACKET_TYPES; i++) {
+		if (last->packet_types[i] > 0) {
+			printf("  packets %-14s %16llu %14.1f/s\n", datactl_packet_names[i],
+			       (unsigned long long)last->packet_types[i], (last->packet_types[i]-first->packet_types[i])/seconds);
+		}
+	}
+
+	for (i = 0; i < SHM_STATS_NB_STAGES; i++) {
+		if (last->stages[i].count > 0) {
+			printf("  stage %-10s %10llu  %6.3f%% time", last->stages[i].name, (unsigned long long)last->stages[i].count,
+			       (last->stages[i].total_ns-first->stages[i].total_ns)/seconds/1e7);
+			if (last->stages[i].max_ns > 0) {
+				printf(" p50 %.1fus p99 %.1fus p999 %.1fus max %.1fus", last->stages[i].p50_ns/1e3,
+				       last->stages[i].p99_ns/1e3, last->stages[i].p999_ns/1e3, last->stages[i].max_ns/1e3);
+			}
+			printf("\n");
+		}
+	}
+	datactl_print_perf(last, first, json);
+	fflush(stdout);
+}
+
+/**
+ * datactl_print_perf(const datactl_snapshot_t* last, const datactl_snapshot_t* first, char json)
+ * @brief Prints the hardware counters of the decoder stages, per packet,
+ *        between two snapshots
+ * @param last
+ * @param first
+ * @param json, the object goes in the one of datactl_print()
+ */
+static void datactl_print_perf(const datactl_snapshot_t* last, const datactl_snapshot_t* first, char json)
+{
+	int i, j, k, nb_printed = 0;
+	uint64_t count;
+	const char* stage_names[SHM_STATS_NB_PERF_STAGES] = PERF_STAGE_NAMES;
+	const char* counter_names[SHM_STATS_NB_PERF_COUNTERS] = PERF_COUNTER_NAMES;
+	const char* status_names[] = { "off", "counting", "unavailable" };
+	const char* type_name;
+	double per_packet[SHM_STATS_NB_PERF_COUNTERS];
+
+	if (json) {
+		printf(",\"perf\":{\"status\":\"%s\"", last->perf_status <= PERF_UNAVAILABLE ? status_names[last->perf_status] : "unknown");
+	} else if (last->perf_status != PERF_OFF) {
+		printf("  hardware counters %s, per packet:\n", last->perf_status <= PERF_UNAVAILABLE ? status_names[last->perf_status] : "unknown");
+	}
+
+	for (i = 0; i < SHM_STATS_NB_PERF_STAGES; i++) {
+		for (j = 0; j < SHM_STATS_NB_PACKET_TYPES; j++) {
+
+			count = last->perf[i][j].count-first->perf[i][j].count;
+			if (count == 0) {
+				continue;
+			}
+
+			type_name = datactl_packet_names[j];
+			for (k = 0; k < SHM_STATS_NB_PERF_COUNTERS; k++) {
+				per_packet[k] = (double)(last->perf[i][j].counters[k]-first->perf[i][j].counters[k])/count;
+			}
+
+			if (json) {
+				printf(",\"%s_%s\":{\"packets\":%llu", stage_names[i], type_name, (unsigned long long)count);
+				for (k = 0; k < SHM_STATS_NB_PERF_COUNTERS; k++) {
+					printf(",\"%s\":%.1f", counter_names[k], per_packet[k]);
+				}
+				printf("}");
+			} else {
+				if (nb_printed++ == 0) {
+					printf("    %-9s %-12s %12s %10s %10s %6s %10s %10s\n", "stage", "packet", "packets",
+					       "cycles", "instr", "ipc", "br_miss", "cache_miss");
+				}
+				printf("    %-9s %-12s %12llu %10.1f %10.1f %6.2f %10.2f %10.2f\n", stage_names[i], type_name,
+				       (unsigned long long)count, per_packet[PERF_CYCLES], per_packet[PERF_INSTRUCTIONS],
+				       per_packet[PERF_CYCLES] > 0 ? per_packet[PERF_INSTRUCTIONS]/per_packet[PERF_CYCLES] : 0,
+				       per_packet[PERF_BRANCH_MISSES], per_packet[PERF_CACHE_MISSES]);
+			}
+		}
+	}
+
+	if (json) {
+		printf("}");
+	}
+}
+
+/**
+ * datactl_load(const void* field)
+ * @brief Reads a 64 bits field of the page in one piece
+ * @param field
+ * @return its value
+ */
+static uint64_t datactl_load(const void* field)
+{
+	return __atomic_load_n((const uint64_t*)field, __ATOMIC_RELAXED);
+}
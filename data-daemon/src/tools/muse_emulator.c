@@ -0,0 +1,430 @@
+/**
+ * @file muse_emulator.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Emulator of the Muse headset, for the integration tests and the
+ *        benchmarks of the real driver. It listens on a unix socket, answers
+ *        the commands of the protocol (v, r, %, s, h, k) and, once started,
+ *        streams the buffers built by muse_pack_encoder from a synthetic
+ *        signal. The daemon connects with <remote_addr>unix:<path></remote_addr>.
+ *
+ *        The socket keeps the boundaries of the messages (SOCK_SEQPACKET):
+ *        each buffer reaches the driver in one read, like an RFCOMM frame.
+ *
+ *        muse_emulator [-r rate] [-j jitter_ms] [-b burst] [-c channel_bits]
+ *                      [-d drop_ratio] [-k keep_alive_s] <socket path>
+ *        -r  samples per second (220)
+ *        -j  each group of buffers is delayed by up to jitter_ms (0)
+ *        -b  buffers sent together (1)
+ *        -c  bits per channel of a compressed packet, 0 for lossless (0)
+ *        -d  ratio of the samples dropped by the headset (0)
+ *        -k  the stream halts without keep alive for keep_alive_s, 0 never (0)
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "clock_sync.h"
+#include "muse_pack_encoder.h"
+
+#define EMULATOR_RATE 220 /*Hz, rate of the headset*/
+#define EMULATOR_REFRESH_PERIOD 10 /*compressed packets between two uncompressed packets*/
+#define EMULATOR_MAX_BURST 64 /*buffers*/
+#define EMULATOR_MAX_COMMAND 64 /*bytes*/
+#define EMULATOR_VERSION "{\"hw\":\"emulator\",\"fw\":\"1.0\",\"proto\":2}\r\n"
+
+typedef struct emulator_options_s {
+	double rate;
+	int64_t jitter_ns;
+	int burst;
+	int channel_bits;
+	double drop_ratio;
+	int64_t keep_alive_ns;
+} emulator_options_t;
+
+/*state of a connection*/
+typedef struct emulator_session_s {
+
+	int fd;
+	char streaming;
+	muse_encoder_t encoder;
+
+	int64_t next_sample_ns; /*time of the next sample*/
+	int64_t send_ns; /*time the buffers queued are sent, 0 if not set*/
+	int64_t keep_alive_ns; /*time of the last keep alive*/
+
+	/*buffers waiting for the burst*/
+	unsigned char buffers[EMULATOR_MAX_BURST][MUSE_ENCODER_MAX_BUFFER];
+	int lengths[EMULATOR_MAX_BURST];
+	int nb_buffers;
+	int nb_queued_samples; /*samples carried by the buffers queued*/
+
+	/*command being received*/
+	char command[EMULATOR_MAX_COMMAND];
+	int command_length;
+
+} emulator_session_t;
+
+static emulator_options_t options = { EMULATOR_RATE, 0, 1, 0, 0, 0 };
+
+static int emulator_listen(const char* path);
+static int emulator_run_session(emulator_session_t* session);
+static int emulator_read_commands(emulator_session_t* session);
+static int emulator_command(emulator_session_t* session, char* command);
+static void emulator_halt(emulator_session_t* session);
+static void emulator_stream(emulator_session_t* session, int64_t now_ns);
+static int emulator_flush(emulator_session_t* session);
+
+/**
+ * main()
+ * @brief Accepts the connections one after the other, a new connection gets
+ *        a headset fresh from power on
+ */
+int main(int argc, char** argv)
+{
+	int opt;
+	int listen_fd;
+	emulator_session_t* session;
+
+	while ((opt = getopt(argc, argv, "r:j:b:c:d:k:")) != -1) {
+		switch (opt) {
+			case 'r': options.rate = atof(optarg); break;
+			case 'j': options.jitter_ns = (int64_t)(atof(optarg)*1000000); break;
+			case 'b': options.burst = atoi(optarg); break;
+			case 'c': options.channel_bits = atoi(optarg); break;
+			case 'd': options.drop_ratio = atof(optarg); break;
+			case 'k': options.keep_alive_ns = (int64_t)(atof(optarg)*1000000000); break;
+			default:
+				printf("usage: %s [-r rate] [-j jitter_ms] [-b burst] [-c channel_bits] [-d drop_ratio] [-k keep_alive_s] <socket path>\n", argv[0]);
+				return (-1);
+		}
+	}
+
+	if (optind != argc-1 || options.rate <= 0 || options.burst < 1 || options.burst > EMULATOR_MAX_BURST) {
+		printf("usage: %s [-r rate] [-j jitter_ms] [-b burst] [-c channel_bits] [-d drop_ratio] [-k keep_alive_s] <socket path>\n", argv[0]);
+		return (-1);
+	}
+
+	listen_fd = emulator_listen(argv[optind]);
+	if (listen_fd < 0) {
+		return (-1);
+	}
+
+	/*the driver may go away at any time*/
+	signal(SIGPIPE, SIG_IGN);
+
+	session = (emulator_session_t*)malloc(sizeof(emulator_session_t));
+
+	for (;;) {
+
+		session->fd = accept(listen_fd, NULL, NULL);
+		if (session->fd < 0) {
+			perror("accept");
+			continue;
+		}
+
+		printf("Emulator: connected\n");
+		fflush(stdout);
+
+		session->streaming = 0;
+		session->nb_buffers = 0;
+		session->nb_queued_samples = 0;
+		session->send_ns = 0;
+		session->command_length = 0;
+		muse_encoder_init(&(session->encoder), EMULATOR_REFRESH_PERIOD, (int)options.rate, options.channel_bits);
+
+		emulator_run_session(session);
+
+		close(session->fd);
+		printf("Emulator: disconnected\n");
+		fflush(stdout);
+	}
+
+	return (0);
+}
+
+/**
+ * emulator_listen(const char* path)
+ * @brief Creates the socket the driver connects to
+ * @param path, of the socket
+ * @return the socket, -1 for error
+ */
+static int emulator_listen(const char* path)
+{
+	struct sockaddr_un addr = { 0 };
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		printf("Socket path too long: %s\n", path);
+		return (-1);
+	}
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (fd < 0) {
+		perror("socket");
+		return (-1);
+	}
+
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 1) != 0) {
+		perror("bind");
+		close(fd);
+		return (-1);
+	}
+
+	return fd;
+}
+
+/**
+ * emulator_run_session(emulator_session_t* session)
+ * @brief Serves a connection until the driver closes it
+ * @param session
+ * @return 0 when the driver closed the connection, -1 for error
+ */
+static int emulator_run_session(emulator_session_t* session)
+{
+	struct pollfd poll_fd;
+	struct timespec timeout;
+	int64_t now_ns, wake_ns;
+	int status;
+
+	poll_fd.fd = session->fd;
+	poll_fd.events = POLLIN;
+
+	for (;;) {
+
+		/*sleep until the next sample or the next send, or a command*/
+		now_ns = clock_sync_now_ns();
+		wake_ns = session->next_sample_ns;
+		if (session->send_ns != 0 && session->send_ns < wake_ns) {
+			wake_ns = session->send_ns;
+		}
+		if (wake_ns < now_ns) {
+			wake_ns = now_ns;
+		}
+		timeout.tv_sec = (wake_ns-now_ns)/1000000000;
+		timeout.tv_nsec = (wake_ns-now_ns)%1000000000;
+
+		status = ppoll(&poll_fd, 1, session->streaming ? &timeout : NULL, NULL);
+		if (status < 0) {
+			perror("ppoll");
+			return (-1);
+		}
+
+		if (poll_fd.revents & (POLLIN|POLLHUP)) {
+			if (emulator_read_commands(session) <= 0) {
+				return (0);
+			}
+		}
+
+		if (!session->streaming) {
+			continue;
+		}
+
+		now_ns = clock_sync_now_ns();
+
+		/*the headset halts without keep alive*/
+		if (options.keep_alive_ns > 0 && now_ns-session->keep_alive_ns > options.keep_alive_ns) {
+			printf("Emulator: no keep alive, halted\n");
+			fflush(stdout);
+			emulator_halt(session);
+			continue;
+		}
+
+		emulator_stream(session, now_ns);
+
+		if (session->send_ns != 0 && now_ns >= session->send_ns) {
+			if (emulator_flush(session) < 0) {
+				return (0);
+			}
+		}
+	}
+}
+
+/**
+ * emulator_read_commands(emulator_session_t* session)
+ * @brief Reads the bytes sent by the driver and runs the complete commands
+ * @param session
+ * @return bytes read, 0 if the driver closed the connection
+ */
+static int emulator_read_commands(emulator_session_t* session)
+{
+	char buf[EMULATOR_MAX_COMMAND];
+	int nb_read, i;
+
+	nb_read = recv(session->fd, buf, sizeof(buf), 0);
+	if (nb_read <= 0) {
+		return 0;
+	}
+
+	/*the commands end with \r\n, a command may come in pieces*/
+	for (i = 0; i < nb_read; i++) {
+
+		if (buf[i] == '\n') {
+			session->command[session->command_length] = '\0';
+			if (emulator_command(session, session->command) < 0) {
+				return 0;
+			}
+			session->command_length = 0;
+		} else if (buf[i] != '\r' && session->command_length < EMULATOR_MAX_COMMAND-1) {
+			session->command[session->command_length++] = buf[i];
+		}
+	}
+
+	return nb_read;
+}
+
+/**
+ * emulator_command(emulator_session_t* session, char* command)
+ * @brief Runs a command of the protocol
+ * @param session
+ * @param command, without the \r\n
+ * @return 0 for success, -1 if the connection is lost
+ */
+static int emulator_command(emulator_session_t* session, char* command)
+{
+	int64_t now_ns = clock_sync_now_ns();
+
+	switch (command[0]) {
+
+		/*version*/
+		case 'v':
+			if (send(session->fd, EMULATOR_VERSION, strlen(EMULATOR_VERSION), MSG_NOSIGNAL) < 0) {
+				return (-1);
+			}
+			break;
+
+		/*host platform, preset, the emulator streams the eeg of preset 10*/
+		case 'r':
+		case '%':
+			break;
+
+		/*start*/
+		case 's':
+			if (!session->streaming) {
+				session->streaming = 1;
+				session->next_sample_ns = now_ns;
+				session->keep_alive_ns = now_ns;
+			}
+			break;
+
+		/*halt, the buffers queued are lost*/
+		case 'h':
+			emulator_halt(session);
+			break;
+
+		/*keep alive*/
+		case 'k':
+			session->keep_alive_ns = now_ns;
+			break;
+
+		default:
+			printf("Emulator: unknown command %s\n", command);
+			fflush(stdout);
+			break;
+	}
+
+	return (0);
+}
+
+/**
+ * emulator_stream(emulator_session_t* session, int64_t now_ns)
+ * @brief Encodes the samples due by now and queues the buffers completed.
+ *        A group of burst buffers is sent after a random delay of up to
+ *        the jitter.
+ * @param session
+ * @param now_ns, host time
+ */
+static void emulator_stream(emulator_session_t* session, int64_t now_ns)
+{
+	int sample[MUSE_ENCODER_NB_CHANNELS];
+	int64_t period_ns = (int64_t)(1000000000/options.rate);
+	int length;
+	int nb_pending;
+
+	while (session->next_sample_ns <= now_ns) {
+
+		/*the queue is full, the jitter gives way*/
+		if (session->nb_buffers == EMULATOR_MAX_BURST) {
+			session->send_ns = now_ns;
+			return;
+		}
+
+		muse_synth_sample(session->encoder.nb_samples, options.rate, sample);
+		session->next_sample_ns += period_ns;
+
+		if (options.drop_ratio > 0 && rand() < options.drop_ratio*RAND_MAX) {
+			muse_encoder_drop(&(session->encoder), 1);
+			continue;
+		}
+
+		nb_pending = session->encoder.nb_pending;
+		length = muse_encoder_push(&(session->encoder), sample, session->buffers[session->nb_buffers]);
+		if (length == 0) {
+			continue;
+		}
+
+		/*the buffer carries the samples that were pending, and this one*/
+		session->nb_queued_samples += nb_pending+1-session->encoder.nb_pending;
+		session->lengths[session->nb_buffers++] = length;
+
+		if (session->nb_buffers >= options.burst && session->send_ns == 0) {
+			session->send_ns = now_ns;
+			if (options.jitter_ns > 0) {
+				session->send_ns += (int64_t)((double)rand()/RAND_MAX*options.jitter_ns);
+			}
+		}
+	}
+}
+
+/**
+ * emulator_flush(emulator_session_t* session)
+ * @brief Sends the buffers queued, one message each
+ * @param session
+ * @return 0 for success, -1 if the connection is lost
+ */
+static int emulator_flush(emulator_session_t* session)
+{
+	int i;
+
+	for (i = 0; i < session->nb_buffers; i++) {
+		if (send(session->fd, session->buffers[i], session->lengths[i], MSG_NOSIGNAL) < 0) {
+			return (-1);
+		}
+	}
+
+	session->nb_buffers = 0;
+	session->nb_queued_samples = 0;
+	session->send_ns = 0;
+	return (0);
+}
+
+/**
+ * emulator_halt(emulator_session_t* session)
+ * @brief Stops the stream, the buffers queued are lost. Their samples, and
+ *        the ones waiting for a packet, are reported by the uncompressed
+ *        packet that restarts the stream, the driver does not apply the next
+ *        deltas to values it never received.
+ * @param session
+ */
+static void emulator_halt(emulator_session_t* session)
+{
+	muse_encoder_lost(&(session->encoder), session->nb_queued_samples);
+	muse_encoder_drop(&(session->encoder), 0);
+
+	session->streaming = 0;
+	session->nb_buffers = 0;
+	session->nb_queued_samples = 0;
+	session->send_ns = 0;
+}
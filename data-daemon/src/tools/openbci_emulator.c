@@ -0,0 +1,371 @@
+/**
+ * @file openbci_emulator.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Emulator of the OpenBCI Cyton board on a pseudo-terminal, for the
+ *        benchmarks and the soak tests of the real driver. It answers the
+ *        reset (v) with the banner and the $$$ prompt, starts (b) and stops
+ *        (s) the stream of 33 bytes packets. The daemon opens the link
+ *        created at <path>, with <remote_addr><path></remote_addr>.
+ *
+ *        The bytes leave at the pace of the serial link when a baud rate is
+ *        given, the packets are corrupted on demand: wrong stop byte, sample
+ *        number skipped.
+ *
+ *        openbci_emulator [-r rate] [-B baud] [-e bad_stop_ratio]
+ *                         [-q skip_ratio] <path>
+ *        -r  samples per second (250)
+ *        -B  bits per second of the link, 8N1, 0 for no pacing (0)
+ *        -e  ratio of the packets with a wrong stop byte (0)
+ *        -q  ratio of the sample numbers skipped (0)
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <math.h>
+#include <time.h>
+#include <termios.h>
+
+#include "clock_sync.h"
+
+#define EMULATOR_RATE 250 /*Hz, rate of the Cyton*/
+#define EMULATOR_NB_CHANNELS 8
+#define EMULATOR_PACKET_LENGTH 33
+#define EMULATOR_HEADER 0xA0
+#define EMULATOR_STOP 0xC0
+#define EMULATOR_OUTPUT_SIZE 65536 /*bytes waiting for the link, the board drops beyond*/
+#define EMULATOR_COUNTS_PER_UV (8388607/(4.5/24)/1000000) /*24 bits over 4.5V at a gain of 24*/
+#define EMULATOR_BANNER "OpenBCI V3 8-16 channel\nADS1299 Device ID: 0x3E\nLIS3DH Device ID: 0x33\nFirmware: v1.0.0 (emulator)\n$$$"
+
+typedef struct emulator_options_s {
+	double rate;
+	int baud;
+	double bad_stop_ratio;
+	double skip_ratio;
+} emulator_options_t;
+
+/*state of the board*/
+typedef struct emulator_board_s {
+
+	int master;
+	char streaming;
+	uint64_t nb_samples; /*produced since the power on*/
+	unsigned char sample_number;
+
+	int64_t next_sample_ns; /*time of the next sample*/
+	int64_t next_byte_ns; /*time the link can take the next byte*/
+
+	/*bytes waiting for the link*/
+	unsigned char output[EMULATOR_OUTPUT_SIZE];
+	int output_start;
+	int output_length;
+	char blocked; /*the link is full, wait until it takes bytes again*/
+	uint64_t nb_dropped; /*bytes*/
+
+} emulator_board_t;
+
+static emulator_options_t options = { EMULATOR_RATE, 0, 0, 0 };
+
+static int emulator_open_pty(const char* path, int* slave);
+static void emulator_command(emulator_board_t* board, unsigned char command);
+static void emulator_queue(emulator_board_t* board, const unsigned char* bytes, int length);
+static void emulator_stream(emulator_board_t* board, int64_t now_ns);
+static void emulator_write(emulator_board_t* board, int64_t now_ns);
+
+/**
+ * main()
+ * @brief Runs the board until killed. The link stays in place when the driver
+ *        closes the device, it may open it again.
+ */
+int main(int argc, char** argv)
+{
+	int opt, i, nb_read;
+	int slave;
+	int64_t now_ns, wake_ns;
+	unsigned char buf[64];
+	struct pollfd poll_fd;
+	struct timespec timeout;
+	emulator_board_t* board;
+
+	while ((opt = getopt(argc, argv, "r:B:e:q:")) != -1) {
+		switch (opt) {
+			case 'r': options.rate = atof(optarg); break;
+			case 'B': options.baud = atoi(optarg); break;
+			case 'e': options.bad_stop_ratio = atof(optarg); break;
+			case 'q': options.skip_ratio = atof(optarg); break;
+			default:
+				printf("usage: %s [-r rate] [-B baud] [-e bad_stop_ratio] [-q skip_ratio] <path>\n", argv[0]);
+				return (-1);
+		}
+	}
+
+	if (optind != argc-1 || options.rate <= 0 || options.baud < 0) {
+		printf("usage: %s [-r rate] [-B baud] [-e bad_stop_ratio] [-q skip_ratio] <path>\n", argv[0]);
+		return (-1);
+	}
+
+	board = (emulator_board_t*)calloc(1, sizeof(emulator_board_t));
+
+	board->master = emulator_open_pty(argv[optind], &slave);
+	if (board->master < 0) {
+		return (-1);
+	}
+
+	poll_fd.fd = board->master;
+
+	for (;;) {
+
+		/*sleep until the next sample or the next byte, or a command*/
+		now_ns = clock_sync_now_ns();
+		wake_ns = board->next_sample_ns;
+		if (board->output_length > 0 && !board->blocked && board->next_byte_ns < wake_ns) {
+			wake_ns = board->next_byte_ns;
+		}
+		poll_fd.events = POLLIN | (board->blocked ? POLLOUT : 0);
+		if (wake_ns < now_ns) {
+			wake_ns = now_ns;
+		}
+		timeout.tv_sec = (wake_ns-now_ns)/1000000000;
+		timeout.tv_nsec = (wake_ns-now_ns)%1000000000;
+
+		if (ppoll(&poll_fd, 1, (board->streaming || (board->output_length > 0 && !board->blocked)) ? &timeout : NULL, NULL) < 0) {
+			perror("ppoll");
+			return (-1);
+		}
+
+		if (poll_fd.revents & POLLOUT) {
+			board->blocked = 0;
+		}
+
+		if (poll_fd.revents & POLLIN) {
+			nb_read = read(board->master, buf, sizeof(buf));
+			for (i = 0; i < nb_read; i++) {
+				emulator_command(board, buf[i]);
+			}
+		}
+
+		now_ns = clock_sync_now_ns();
+
+		if (board->streaming) {
+			emulator_stream(board, now_ns);
+		}
+
+		emulator_write(board, now_ns);
+	}
+
+	return (0);
+}
+
+/**
+ * emulator_open_pty(const char* path, int* slave)
+ * @brief Creates the pseudo-terminal and links its slave side at path. The
+ *        emulator keeps the slave open, so the master survives the driver
+ *        closing it.
+ * @param path, of the link
+ * @param (out)slave, slave side kept open
+ * @return master side, -1 for error
+ */
+static int emulator_open_pty(const char* path, int* slave)
+{
+	int master;
+	char* slave_name;
+	struct termios toptions;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+		perror("posix_openpt");
+		return (-1);
+	}
+
+	slave_name = ptsname(master);
+	*slave = open(slave_name, O_RDWR | O_NOCTTY);
+	if (*slave < 0) {
+		perror("open");
+		close(master);
+		return (-1);
+	}
+
+	/*raw, like the driver sets it, the commands must not echo*/
+	tcgetattr(*slave, &toptions);
+	cfmakeraw(&toptions);
+	tcsetattr(*slave, TCSANOW, &toptions);
+
+	/*the board never waits for the link*/
+	fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+	unlink(path);
+	if (symlink(slave_name, path) != 0) {
+		perror("symlink");
+		close(*slave);
+		close(master);
+		return (-1);
+	}
+
+	printf("Emulator: %s -> %s\n", path, slave_name);
+	fflush(stdout);
+	return master;
+}
+
+/**
+ * emulator_command(emulator_board_t* board, unsigned char command)
+ * @brief Runs a command of the board, the commands are single characters
+ * @param board
+ * @param command
+ */
+static void emulator_command(emulator_board_t* board, unsigned char command)
+{
+	switch (command) {
+
+		/*soft reset, stops the stream and prints the banner*/
+		case 'v':
+			board->streaming = 0;
+			board->output_length = 0;
+			emulator_queue(board, (const unsigned char*)EMULATOR_BANNER, strlen(EMULATOR_BANNER));
+			break;
+
+		/*start, the sample numbers restart at 0*/
+		case 'b':
+			if (!board->streaming) {
+				board->streaming = 1;
+				board->sample_number = 0;
+				board->next_sample_ns = clock_sync_now_ns();
+			}
+			break;
+
+		/*stop*/
+		case 's':
+			board->streaming = 0;
+			break;
+
+		/*channel settings and the like, accepted and ignored*/
+		default:
+			break;
+	}
+}
+
+/**
+ * emulator_stream(emulator_board_t* board, int64_t now_ns)
+ * @brief Produces the packets of the samples due by now: an alpha rhythm
+ *        over noise, in counts
+ * @param board
+ * @param now_ns, host time
+ */
+static void emulator_stream(emulator_board_t* board, int64_t now_ns)
+{
+	int i, count;
+	double t, value;
+	unsigned char packet[EMULATOR_PACKET_LENGTH];
+	int64_t period_ns = (int64_t)(1000000000/options.rate);
+
+	while (board->next_sample_ns <= now_ns) {
+
+		t = (double)board->nb_samples/options.rate;
+		board->nb_samples++;
+		board->next_sample_ns += period_ns;
+
+		/*a sample lost on the radio link, its number is skipped*/
+		if (options.skip_ratio > 0 && rand() < options.skip_ratio*RAND_MAX) {
+			board->sample_number++;
+		}
+
+		memset(packet, 0, sizeof(packet));
+		packet[0] = EMULATOR_HEADER;
+		packet[1] = board->sample_number++;
+
+		/*24 bits, most significant byte first*/
+		for (i = 0; i < EMULATOR_NB_CHANNELS; i++) {
+			value = 10*sin(2*M_PI*10*t+i)+(rand()%200-100)/50.0; /*microvolts*/
+			count = (int)(value*EMULATOR_COUNTS_PER_UV);
+			packet[2+i*3] = (count>>16)&0xFF;
+			packet[3+i*3] = (count>>8)&0xFF;
+			packet[4+i*3] = count&0xFF;
+		}
+
+		packet[EMULATOR_PACKET_LENGTH-1] = EMULATOR_STOP;
+		if (options.bad_stop_ratio > 0 && rand() < options.bad_stop_ratio*RAND_MAX) {
+			packet[EMULATOR_PACKET_LENGTH-1] = EMULATOR_STOP+1+rand()%15;
+		}
+
+		emulator_queue(board, packet, EMULATOR_PACKET_LENGTH);
+	}
+}
+
+/**
+ * emulator_queue(emulator_board_t* board, const unsigned char* bytes, int length)
+ * @brief Queues bytes for the link, drops them when the queue is full
+ * @param board
+ * @param bytes
+ * @param length
+ */
+static void emulator_queue(emulator_board_t* board, const unsigned char* bytes, int length)
+{
+	int i;
+
+	if (board->output_length+length > EMULATOR_OUTPUT_SIZE) {
+		board->nb_dropped += length;
+		return;
+	}
+
+	for (i = 0; i < length; i++) {
+		board->output[(board->output_start+board->output_length+i)%EMULATOR_OUTPUT_SIZE] = bytes[i];
+	}
+	board->output_length += length;
+}
+
+/**
+ * emulator_write(emulator_board_t* board, int64_t now_ns)
+ * @brief Writes the bytes the link can take by now, all of them when the
+ *        link is not paced
+ * @param board
+ * @param now_ns, host time
+ */
+static void emulator_write(emulator_board_t* board, int64_t now_ns)
+{
+	int length = board->output_length;
+	int64_t byte_ns = 0;
+	int nb_written;
+
+	if (length == 0 || board->blocked) {
+		return;
+	}
+
+	/*10 bits per byte, 8N1*/
+	if (options.baud > 0) {
+		byte_ns = (int64_t)10*1000000000/options.baud;
+		if (board->next_byte_ns < now_ns-byte_ns) {
+			board->next_byte_ns = now_ns-byte_ns;
+		}
+		length = (int)((now_ns-board->next_byte_ns)/byte_ns);
+		if (length > board->output_length) {
+			length = board->output_length;
+		}
+	}
+
+	/*up to the end of the queue, the rest on the next call*/
+	if (board->output_start+length > EMULATOR_OUTPUT_SIZE) {
+		length = EMULATOR_OUTPUT_SIZE-board->output_start;
+	}
+	if (length == 0) {
+		return;
+	}
+
+	nb_written = write(board->master, &(board->output[board->output_start]), length);
+	if (nb_written < 0) {
+		if (errno == EAGAIN) {
+			board->blocked = 1;
+		} else {
+			perror("write");
+		}
+		return;
+	}
+
+	board->output_start = (board->output_start+nb_written)%EMULATOR_OUTPUT_SIZE;
+	board->output_length -= nb_written;
+	board->next_byte_ns += nb_written*byte_ns;
+}
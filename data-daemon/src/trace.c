@@ -0,0 +1,348 @@
+/**
+ * @file trace.c
+ * @author Frederic Simard, Atlants Embedded (fred.simard@atlantsembedded.com)
+ * @brief Latency tracing of the data path. The rings have a single writer,
+ *        the thread, and a single reader, the tracer: the writer publishes
+ *        the events by moving the head, the reader frees them by moving the
+ *        tail. A full ring drops the events, the thread never waits.
+ *
+ *        Without the tracing, each thread follows its own buffer and adds
+ *        the stages to the counts and sums shared by all.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "clock_sync.h"
+#include "trace.h"
+
+typedef struct trace_event_s {
+	int64_t ns;
+	int stage;
+} trace_event_t;
+
+typedef struct trace_ring_s {
+
+	trace_event_t events[TRACE_RING_SIZE];
+	uint64_t head; /*moved by the thread*/
+	uint64_t tail; /*moved by the tracer*/
+	uint64_t nb_lost; /*events dropped on a full ring*/
+
+	/*buffer being followed by the tracer*/
+	char span_opened;
+	int64_t span_start_ns;
+	int64_t span_last_ns;
+
+} trace_ring_t;
+
+int trace_enabled = 0;
+
+static trace_ring_t* trace_rings = NULL;
+static int trace_nb_rings = 0;
+static __thread trace_ring_t* trace_thread_ring = NULL;
+static __thread char trace_thread_registered = 0;
+
+/*histograms, drained by the tracer and copied by the readers*/
+static histogram_t trace_histograms[TRACE_NB_HISTOGRAMS];
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*count and time of each stage while the tracing is off*/
+static uint64_t trace_counts[TRACE_NB_HISTOGRAMS];
+static uint64_t trace_sums_ns[TRACE_NB_HISTOGRAMS];
+static __thread char trace_thread_span_opened = 0;
+static __thread int64_t trace_thread_span_start_ns = 0;
+static __thread int64_t trace_thread_span_last_ns = 0;
+
+static pthread_t trace_thread;
+static volatile sig_atomic_t trace_dump_requested = 0;
+static volatile char trace_running = 0;
+
+static void* trace_run(void* param);
+static void trace_drain(void);
+static void trace_dump(void);
+
+/**
+ * trace_init(int enabled)
+ * @brief Allocates the rings and starts the tracer, if the tracing is enabled
+ * @param enabled
+ * @return 0 for success, -1 for error
+ */
+int trace_init(int enabled)
+{
+	int i;
+
+	if (!enabled) {
+		return (0);
+	}
+
+	trace_rings = (trace_ring_t*)calloc(TRACE_MAX_THREADS, sizeof(trace_ring_t));
+	if (trace_rings == NULL) {
+		printf("Unable to malloc the trace rings\n");
+		return (-1);
+	}
+
+	for (i = 0; i < TRACE_NB_HISTOGRAMS; i++) {
+		histogram_init(&(trace_histograms[i]));
+	}
+
+	trace_running = 1;
+	if (pthread_create(&trace_thread, NULL, &trace_run, NULL) != 0) {
+		printf("Unable to start the tracer\n");
+		free(trace_rings);
+		trace_rings = NULL;
+		return (-1);
+	}
+
+	trace_enabled = 1;
+	return (0);
+}
+
+/**
+ * trace_point(trace_stage_t stage)
+ * @brief Timestamps a stage in the ring of the calling thread. Called through
+ *        TRACE_POINT, only when the tracing is enabled.
+ * @param stage, TRACE_READ starts a buffer
+ */
+void trace_point(trace_stage_t stage)
+{
+	int index;
+	uint64_t head;
+	trace_ring_t* ring = trace_thread_ring;
+
+	/*first event of the thread, it takes a ring*/
+	if (ring == NULL) {
+		if (trace_thread_registered) {
+			return;
+		}
+		trace_thread_registered = 1;
+		index = __atomic_fetch_add(&trace_nb_rings, 1, __ATOMIC_RELAXED);
+		if (index >= TRACE_MAX_THREADS) {
+			return;
+		}
+		ring = trace_thread_ring = &(trace_rings[index]);
+	}
+
+	head = ring->head;
+	if (head-__atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE) >= TRACE_RING_SIZE) {
+		__atomic_fetch_add(&(ring->nb_lost), 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	ring->events[head&(TRACE_RING_SIZE-1)].ns = clock_sync_now_ns();
+	ring->events[head&(TRACE_RING_SIZE-1)].stage = stage;
+	__atomic_store_n(&(ring->head), head+1, __ATOMIC_RELEASE);
+}
+
+/**
+ * trace_count(trace_stage_t stage)
+ * @brief Adds the time since the previous stage of the buffer to the count
+ *        and the sum of a stage. Called through TRACE_POINT, when the tracing
+ *        is off. A read closes the previous buffer in the total.
+ * @param stage, TRACE_READ starts a buffer
+ */
+void trace_count(trace_stage_t stage)
+{
+	int64_t now_ns = clock_sync_now_ns();
+
+	if (stage == TRACE_READ) {
+		if (trace_thread_span_opened) {
+			__atomic_fetch_add(&(trace_counts[TRACE_TOTAL]), 1, __ATOMIC_RELAXED);
+			__atomic_fetch_add(&(trace_sums_ns[TRACE_TOTAL]), trace_thread_span_last_ns-trace_thread_span_start_ns, __ATOMIC_RELAXED);
+		}
+		trace_thread_span_opened = 1;
+		trace_thread_span_start_ns = now_ns;
+		trace_thread_span_last_ns = now_ns;
+		return;
+	}
+
+	/*a thread that does not read (merge) has no buffer to follow*/
+	if (!trace_thread_span_opened) {
+		return;
+	}
+
+	__atomic_fetch_add(&(trace_counts[stage]), 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&(trace_sums_ns[stage]), now_ns-trace_thread_span_last_ns, __ATOMIC_RELAXED);
+	trace_thread_span_last_ns = now_ns;
+}
+
+/**
+ * trace_request_dump()
+ * @brief Asks the tracer to print the histograms. Safe in a signal handler.
+ */
+void trace_request_dump(void)
+{
+	trace_dump_requested = 1;
+}
+
+/**
+ * trace_get_histograms(histogram_t* histograms)
+ * @brief Copies the histograms drained so far
+ * @param (out)histograms, TRACE_NB_HISTOGRAMS histograms, indexed by stage
+ * @return number of events dropped on full rings
+ */
+uint64_t trace_get_histograms(histogram_t* histograms)
+{
+	int i, nb_rings;
+	uint64_t nb_lost = 0;
+
+	if (!trace_enabled) {
+		for (i = 0; i < TRACE_NB_HISTOGRAMS; i++) {
+			histogram_init(&(histograms[i]));
+		}
+		return (0);
+	}
+
+	pthread_mutex_lock(&trace_lock);
+	memcpy(histograms, trace_histograms, sizeof(trace_histograms));
+	pthread_mutex_unlock(&trace_lock);
+
+	nb_rings = __atomic_load_n(&trace_nb_rings, __ATOMIC_RELAXED);
+	for (i = 0; i < nb_rings && i < TRACE_MAX_THREADS; i++) {
+		nb_lost += __atomic_load_n(&(trace_rings[i].nb_lost), __ATOMIC_RELAXED);
+	}
+
+	return nb_lost;
+}
+
+/**
+ * trace_get_counts(uint64_t* counts, uint64_t* sums_ns)
+ * @brief Copies the counts and the sums of the stages, taken while the
+ *        tracing is off
+ * @param (out)counts, TRACE_NB_HISTOGRAMS counts, indexed by stage
+ * @param (out)sums_ns, TRACE_NB_HISTOGRAMS sums, in ns
+ */
+void trace_get_counts(uint64_t* counts, uint64_t* sums_ns)
+{
+	int i;
+
+	for (i = 0; i < TRACE_NB_HISTOGRAMS; i++) {
+		counts[i] = __atomic_load_n(&(trace_counts[i]), __ATOMIC_RELAXED);
+		sums_ns[i] = __atomic_load_n(&(trace_sums_ns[i]), __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * trace_cleanup()
+ * @brief Stops the tracer. The rings stay allocated, the threads may still
+ *        be running.
+ */
+void trace_cleanup(void)
+{
+	if (!trace_running) {
+		return;
+	}
+
+	trace_enabled = 0;
+	trace_running = 0;
+	pthread_join(trace_thread, NULL);
+}
+
+/**
+ * trace_run(void* param)
+ * @brief Tracer: drains the rings every TRACE_DRAIN_PERIOD_MS and prints the
+ *        histograms when asked
+ */
+static void* trace_run(void* param __attribute__ ((unused)))
+{
+	struct timespec period = { 0, TRACE_DRAIN_PERIOD_MS*1000000 };
+
+	while (trace_running) {
+
+		nanosleep(&period, NULL);
+		trace_drain();
+
+		if (trace_dump_requested) {
+			trace_dump_requested = 0;
+			trace_dump();
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * trace_drain()
+ * @brief Moves the events of the rings to the histograms. A stage counts from
+ *        the previous stage of the same buffer, a read closes the previous
+ *        buffer in the total.
+ */
+static void trace_drain(void)
+{
+	int i, nb_rings;
+	uint64_t head, tail;
+	trace_ring_t* ring;
+	trace_event_t* event;
+
+	nb_rings = __atomic_load_n(&trace_nb_rings, __ATOMIC_RELAXED);
+	if (nb_rings > TRACE_MAX_THREADS) {
+		nb_rings = TRACE_MAX_THREADS;
+	}
+
+	pthread_mutex_lock(&trace_lock);
+
+	for (i = 0; i < nb_rings; i++) {
+
+		ring = &(trace_rings[i]);
+		head = __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE);
+
+		for (tail = ring->tail; tail != head; tail++) {
+
+			event = &(ring->events[tail&(TRACE_RING_SIZE-1)]);
+
+			if (event->stage == TRACE_READ) {
+				if (ring->span_opened) {
+					histogram_record(&(trace_histograms[TRACE_TOTAL]), ring->span_last_ns-ring->span_start_ns);
+				}
+				ring->span_opened = 1;
+				ring->span_start_ns = event->ns;
+				ring->span_last_ns = event->ns;
+				continue;
+			}
+
+			/*a thread that does not read (merge) has no buffer to follow*/
+			if (!ring->span_opened) {
+				continue;
+			}
+
+			histogram_record(&(trace_histograms[event->stage]), event->ns-ring->span_last_ns);
+			ring->span_last_ns = event->ns;
+		}
+
+		__atomic_store_n(&(ring->tail), head, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/**
+ * trace_dump()
+ * @brief Prints the percentiles of each stage, in microseconds
+ */
+static void trace_dump(void)
+{
+	int i;
+	uint64_t nb_lost;
+	histogram_t histograms[TRACE_NB_HISTOGRAMS];
+	const char* names[TRACE_NB_HISTOGRAMS] = TRACE_STAGE_NAMES;
+
+	nb_lost = trace_get_histograms(histograms);
+
+	printf("Trace: stage       count      p50(us)    p99(us)    p999(us)   max(us)\n");
+	for (i = 0; i < TRACE_NB_HISTOGRAMS; i++) {
+		if (histograms[i].count == 0) {
+			continue;
+		}
+		printf("Trace: %-10s %10llu %10.1f %10.1f %10.1f %10.1f\n", names[i],
+		       (unsigned long long)histograms[i].count,
+		       histogram_percentile(&(histograms[i]), 50)/1000.0,
+		       histogram_percentile(&(histograms[i]), 99)/1000.0,
+		       histogram_percentile(&(histograms[i]), 99.9)/1000.0,
+		       histograms[i].max/1000.0);
+	}
+	printf("Trace: %llu events lost\n", (unsigned long long)nb_lost);
+	fflush(stdout);
+}
@@ -15,9 +15,18 @@
 
 #include "main.h"
 #include "xml.h"
+#include "logger.h"
 
 static int get_app_attributes(ezxml_t app_attribute, appconfig_t * app_info);
 static int sanity_check_app_attributes(ezxml_t app_attribute);
+static int get_merge_attributes(ezxml_t app_attribute, appconfig_t * app_info);
+static int get_filter_attributes(ezxml_t app_attribute, appconfig_t * app_info);
+static int get_feature_attributes(ezxml_t app_attribute, appconfig_t * app_info);
+static int get_quality_attributes(ezxml_t app_attribute, appconfig_t * app_info);
+static int get_envelope_attributes(ezxml_t app_attribute, appconfig_t * app_info);
+static int get_pipeline_attributes(ezxml_t app_attribute, appconfig_t * app_info);
+static int get_montage_attributes(ezxml_t app_attribute, appconfig_t * app_info);
+static int get_replay_attributes(ezxml_t app_attribute, appconfig_t * app_info);
 
 const char *XML_app_elements[] =
 { 
@@ -77,7 +86,11 @@ static int get_app_attributes(ezxml_t app_attribute, appconfig_t * app_info)
 		printf("appAttributes->remote_addr is missing\n");
 		return (-1);
 	}
-	memcpy(app_info->remote_addr, tmp->txt, MAX_CHAR_FIELD_LENGTH);
+	if (strlen(tmp->txt) >= MAX_PATH_LENGTH) {
+		printf("appAttributes->remote_addr is too long\n");
+		return (-1);
+	}
+	strcpy((char *)app_info->remote_addr, tmp->txt);
 
 	/*Get appAttributes/keep_alive*/
 	tmp = ezxml_child(app_attribute, "keep_alive");
@@ -144,10 +157,656 @@ static int get_app_attributes(ezxml_t app_attribute, appconfig_t * app_info)
 		app_info->output_format = CSV_OUTPUT;
 	} else if (strncmp((const char *)tmp->txt, "SHM", 3) == 0) {
 		app_info->output_format = SHM_OUTPUT;
+	} else if (strncmp((const char *)tmp->txt, "BINARY", 6) == 0) {
+		app_info->output_format = BINARY_OUTPUT;
 	} else {
 		app_info->output_format = 0;
 	}
 
+	/*Get appAttributes/sample_format (optional, raw codes or physical units)*/
+	app_info->sample_format = SAMPLE_FLOAT32;
+	tmp = ezxml_child(app_attribute, "sample_format");
+	if (tmp != NULL) {
+		if (strncmp((const char *)tmp->txt, "INT16", 5) == 0) {
+			app_info->sample_format = SAMPLE_INT16;
+		} else if (strncmp((const char *)tmp->txt, "FLOAT32", 7) == 0) {
+			app_info->sample_format = SAMPLE_FLOAT32;
+		} else {
+			printf("appAttributes->sample_format is invalid\n");
+			return (-1);
+		}
+	}
+
+	/*Get appAttributes/record_file (optional, name of the BINARY recording)*/
+	strcpy(app_info->record_file, "eeg_data.eegr");
+	tmp = ezxml_child(app_attribute, "record_file");
+	if (tmp != NULL) {
+		if (strlen(tmp->txt) >= MAX_PATH_LENGTH) {
+			printf("appAttributes->record_file is too long\n");
+			return (-1);
+		}
+		strcpy(app_info->record_file, tmp->txt);
+	}
+
+	/*Get appAttributes/capture_file (optional, capture of the raw bytes received)*/
+	app_info->capture_file[0] = '\0';
+	tmp = ezxml_child(app_attribute, "capture_file");
+	if (tmp != NULL) {
+		if (strlen(tmp->txt) >= MAX_PATH_LENGTH) {
+			printf("appAttributes->capture_file is too long\n");
+			return (-1);
+		}
+		strcpy(app_info->capture_file, tmp->txt);
+	}
+	
+	/*Get appAttributes/gap_fill (optional, defaults to linear interpolation)*/
+	app_info->gap_fill = GAP_FILL_INTERP;
+	tmp = ezxml_child(app_attribute, "gap_fill");
+	if (tmp != NULL) {
+		if (strncmp((const char *)tmp->txt, "HOLD", 4) == 0) {
+			app_info->gap_fill = GAP_FILL_HOLD;
+		} else if (strncmp((const char *)tmp->txt, "NAN", 3) == 0) {
+			app_info->gap_fill = GAP_FILL_NAN;
+		} else if (strncmp((const char *)tmp->txt, "INTERP", 6) == 0) {
+			app_info->gap_fill = GAP_FILL_INTERP;
+		} else {
+			printf("appAttributes->gap_fill is invalid\n");
+			return (-1);
+		}
+	}
+	
+	/*Get appAttributes/trace (optional, latency tracing of the data path)*/
+	app_info->trace = 0;
+	tmp = ezxml_child(app_attribute, "trace");
+	if (tmp != NULL && strncmp(tmp->txt, "TRUE", 4) == 0) {
+		app_info->trace = 1;
+	}
+	
+	/*Get appAttributes/perf_counters (optional, hardware counters of the decoder)*/
+	app_info->perf_counters = 0;
+	tmp = ezxml_child(app_attribute, "perf_counters");
+	if (tmp != NULL && strncmp(tmp->txt, "TRUE", 4) == 0) {
+		app_info->perf_counters = 1;
+	}
+	
+	/*Get appAttributes/log_output (optional, messages of the data path, STDERR or SYSLOG)*/
+	app_info->log_output = LOGGER_STDERR;
+	tmp = ezxml_child(app_attribute, "log_output");
+	if (tmp != NULL) {
+		if (strncmp((const char *)tmp->txt, "SYSLOG", 6) == 0) {
+			app_info->log_output = LOGGER_SYSLOG;
+		} else if (strncmp((const char *)tmp->txt, "STDERR", 6) != 0) {
+			printf("appAttributes->log_output is invalid\n");
+			return (-1);
+		}
+	}
+	
+	/*Get appAttributes/stats_shm_key (optional, runtime statistics page read by datactl)*/
+	app_info->stats_shm_key = 0;
+	tmp = ezxml_child(app_attribute, "stats_shm_key");
+	if (tmp != NULL) {
+		app_info->stats_shm_key = atoi(tmp->txt);
+	}
+	
+	/*Get appAttributes/connect_timeout_ms, stall_timeout_ms and backoff_max_ms (optional, link to the device)*/
+	app_info->connect_timeout_ms = 0;
+	tmp = ezxml_child(app_attribute, "connect_timeout_ms");
+	if (tmp != NULL) {
+		app_info->connect_timeout_ms = atoi(tmp->txt);
+	}
+	app_info->stall_timeout_ms = 0;
+	tmp = ezxml_child(app_attribute, "stall_timeout_ms");
+	if (tmp != NULL) {
+		app_info->stall_timeout_ms = atoi(tmp->txt);
+	}
+	app_info->backoff_max_ms = 0;
+	tmp = ezxml_child(app_attribute, "backoff_max_ms");
+	if (tmp != NULL) {
+		app_info->backoff_max_ms = atoi(tmp->txt);
+	}
+	
+	/*Get appAttributes/output_rate (optional, the output is resampled when set)*/
+	app_info->output_rate = 0;
+	tmp = ezxml_child(app_attribute, "output_rate");
+	if (tmp != NULL) {
+		app_info->output_rate = atoi(tmp->txt);
+		if (app_info->output_rate < 0) {
+			printf("appAttributes->output_rate is invalid\n");
+			return (-1);
+		}
+	}
+	
+	/*Get the merge sources, if any*/
+	if (get_merge_attributes(app_attribute, app_info) < 0) {
+		return (-1);
+	}
+
+	/*Get the replayed capture, if any*/
+	if (get_replay_attributes(app_attribute, app_info) < 0) {
+		return (-1);
+	}
+
+	/*Get the filters, if any*/
+	if (get_filter_attributes(app_attribute, app_info) < 0) {
+		return (-1);
+	}
+
+	/*Get the band power features, if any*/
+	if (get_feature_attributes(app_attribute, app_info) < 0) {
+		return (-1);
+	}
+
+	/*Get the signal quality status page, if any*/
+	if (get_quality_attributes(app_attribute, app_info) < 0) {
+		return (-1);
+	}
+
+	/*Get the envelope pyramid, if any*/
+	if (get_envelope_attributes(app_attribute, app_info) < 0) {
+		return (-1);
+	}
+
+	/*Get the montage, if any*/
+	if (get_montage_attributes(app_attribute, app_info) < 0) {
+		return (-1);
+	}
+
+	/*Get the processing stages, if listed*/
+	if (get_pipeline_attributes(app_attribute, app_info) < 0) {
+		return (-1);
+	}
+
+	return (0);
+}
+
+/**
+ * get_filter_attributes(ezxml_t app_attribute, appconfig_t * app_info)
+ * @brief parse the optional filtering of the data, each filter is disabled
+ *        when absent or 0
+ *        <process_data>TRUE</process_data>
+ *        <notch_freq>60</notch_freq>
+ *        <highpass_freq>0.5</highpass_freq>
+ *        <bandpass_low>1</bandpass_low>
+ *        <bandpass_high>40</bandpass_high>
+ * @param app_attribute, reference to xml file
+ * @param (out)app_info, now contains the filters
+ * @return < 0 for error, 0 for success
+ */
+static int get_filter_attributes(ezxml_t app_attribute, appconfig_t * app_info)
+{
+	ezxml_t tmp;
+
+	app_info->process_data = 0;
+	app_info->notch_freq = 0;
+	app_info->highpass_freq = 0;
+	app_info->bandpass_low = 0;
+	app_info->bandpass_high = 0;
+
+	/*Get appAttributes/process_data*/
+	tmp = ezxml_child(app_attribute, "process_data");
+	if (tmp != NULL && strncmp(tmp->txt, "TRUE", 4) == 0) {
+		app_info->process_data = 1;
+	}
+
+	/*Get appAttributes/notch_freq*/
+	tmp = ezxml_child(app_attribute, "notch_freq");
+	if (tmp != NULL) {
+		app_info->notch_freq = atoi(tmp->txt);
+		if (app_info->notch_freq != 0 && app_info->notch_freq != 50 && app_info->notch_freq != 60) {
+			printf("appAttributes->notch_freq must be 50 or 60\n");
+			return (-1);
+		}
+	}
+
+	/*Get appAttributes/highpass_freq*/
+	tmp = ezxml_child(app_attribute, "highpass_freq");
+	if (tmp != NULL) {
+		app_info->highpass_freq = atof(tmp->txt);
+	}
+
+	/*Get appAttributes/bandpass_low and bandpass_high*/
+	tmp = ezxml_child(app_attribute, "bandpass_low");
+	if (tmp != NULL) {
+		app_info->bandpass_low = atof(tmp->txt);
+	}
+	tmp = ezxml_child(app_attribute, "bandpass_high");
+	if (tmp != NULL) {
+		app_info->bandpass_high = atof(tmp->txt);
+	}
+
+	if (app_info->highpass_freq < 0 || app_info->bandpass_low < 0 || app_info->bandpass_high < 0) {
+		printf("appAttributes->filter frequencies are invalid\n");
+		return (-1);
+	}
+
+	return (0);
+}
+
+/**
+ * get_montage_attributes(ezxml_t app_attribute, appconfig_t * app_info)
+ * @brief parse the optional montage, inputs are channel indexes from 0
+ *        <montage type="CAR"/>
+ *        <montage type="LINKED" ref_a="0" ref_b="3"/>
+ *        <montage type="BIPOLAR">
+ *          <pair a="0" b="1"/>
+ *        </montage>
+ *        <montage type="CUSTOM">
+ *          <row name="AF"><term input="1" weight="0.5"/><term input="2" weight="0.5"/></row>
+ *        </montage>
+ * @param app_attribute, reference to xml file
+ * @param (out)app_info, now contains the montage
+ * @return < 0 for error, 0 for success
+ */
+static int get_montage_attributes(ezxml_t app_attribute, appconfig_t * app_info)
+{
+	ezxml_t row;
+	ezxml_t term;
+	const char *type;
+	const char *attr_a;
+	const char *attr_b;
+	montage_row_t *montage_row;
+
+	app_info->montage_type = MONTAGE_NONE;
+	app_info->nb_montage_rows = 0;
+
+	/*Get appAttributes/montage*/
+	ezxml_t tmp = ezxml_child(app_attribute, "montage");
+	if (tmp == NULL) {
+		return (0);
+	}
+
+	type = ezxml_attr(tmp, "type");
+	if (type == NULL) {
+		printf("appAttributes->montage has no type\n");
+		return (-1);
+	}
+
+	if (strcmp(type, "CAR") == 0) {
+		app_info->montage_type = MONTAGE_CAR;
+
+	} else if (strcmp(type, "LINKED") == 0) {
+		app_info->montage_type = MONTAGE_LINKED;
+		attr_a = ezxml_attr(tmp, "ref_a");
+		attr_b = ezxml_attr(tmp, "ref_b");
+		if (attr_a == NULL || attr_b == NULL) {
+			printf("appAttributes->montage needs ref_a and ref_b\n");
+			return (-1);
+		}
+		app_info->montage_refs[0] = atoi(attr_a);
+		app_info->montage_refs[1] = atoi(attr_b);
+
+	/*each pair is a row with 2 terms*/
+	} else if (strcmp(type, "BIPOLAR") == 0) {
+		app_info->montage_type = MONTAGE_BIPOLAR;
+		for (row = ezxml_child(tmp, "pair"); row != NULL; row = ezxml_next(row)) {
+
+			if (app_info->nb_montage_rows >= MAX_MONTAGE_ROWS) {
+				printf("appAttributes->montage has too many pairs\n");
+				return (-1);
+			}
+
+			attr_a = ezxml_attr(row, "a");
+			attr_b = ezxml_attr(row, "b");
+			if (attr_a == NULL || attr_b == NULL) {
+				printf("appAttributes->montage->pair needs a and b\n");
+				return (-1);
+			}
+
+			montage_row = &(app_info->montage_rows[app_info->nb_montage_rows++]);
+			montage_row->name[0] = '\0';
+			montage_row->nb_terms = 2;
+			montage_row->inputs[0] = atoi(attr_a);
+			montage_row->weights[0] = 1;
+			montage_row->inputs[1] = atoi(attr_b);
+			montage_row->weights[1] = -1;
+		}
+
+	} else if (strcmp(type, "CUSTOM") == 0) {
+		app_info->montage_type = MONTAGE_CUSTOM;
+		for (row = ezxml_child(tmp, "row"); row != NULL; row = ezxml_next(row)) {
+
+			if (app_info->nb_montage_rows >= MAX_MONTAGE_ROWS) {
+				printf("appAttributes->montage has too many rows\n");
+				return (-1);
+			}
+
+			montage_row = &(app_info->montage_rows[app_info->nb_montage_rows++]);
+			montage_row->name[0] = '\0';
+			montage_row->nb_terms = 0;
+			if (ezxml_attr(row, "name") != NULL) {
+				strncpy(montage_row->name, ezxml_attr(row, "name"), MAX_CHAR_FIELD_LENGTH-1);
+				montage_row->name[MAX_CHAR_FIELD_LENGTH-1] = '\0';
+			}
+
+			for (term = ezxml_child(row, "term"); term != NULL; term = ezxml_next(term)) {
+
+				attr_a = ezxml_attr(term, "input");
+				attr_b = ezxml_attr(term, "weight");
+				if (attr_a == NULL || attr_b == NULL || montage_row->nb_terms >= MAX_MONTAGE_TERMS) {
+					printf("appAttributes->montage->row->term is invalid\n");
+					return (-1);
+				}
+
+				montage_row->inputs[montage_row->nb_terms] = atoi(attr_a);
+				montage_row->weights[montage_row->nb_terms] = atof(attr_b);
+				montage_row->nb_terms++;
+			}
+		}
+
+	} else {
+		printf("appAttributes->montage type is invalid\n");
+		return (-1);
+	}
+
+	if ((app_info->montage_type == MONTAGE_BIPOLAR || app_info->montage_type == MONTAGE_CUSTOM) &&
+	    app_info->nb_montage_rows == 0) {
+		printf("appAttributes->montage is empty\n");
+		return (-1);
+	}
+
+	return (0);
+}
+
+/**
+ * get_pipeline_attributes(ezxml_t app_attribute, appconfig_t * app_info)
+ * @brief parse the optional list of processing stages, in order. Without it,
+ *        the stages follow the options (quality_shm_key, montage, process_data,
+ *        output_rate, feature_shm_key, envelope_shm_key).
+ *        <pipeline>
+ *          <stage type="FILTER"/>
+ *          <stage type="RESAMPLER"/>
+ *        </pipeline>
+ * @param app_attribute, reference to xml file
+ * @param (out)app_info, now contains the stages
+ * @return < 0 for error, 0 for success
+ */
+static int get_pipeline_attributes(ezxml_t app_attribute, appconfig_t * app_info)
+{
+	ezxml_t stage;
+	const char *type;
+
+	app_info->pipeline_set = 0;
+	app_info->nb_pipeline_stages = 0;
+
+	/*Get appAttributes/pipeline*/
+	ezxml_t tmp = ezxml_child(app_attribute, "pipeline");
+	if (tmp == NULL) {
+		return (0);
+	}
+	app_info->pipeline_set = 1;
+
+	for (stage = ezxml_child(tmp, "stage"); stage != NULL; stage = ezxml_next(stage)) {
+
+		if (app_info->nb_pipeline_stages >= MAX_PIPELINE_STAGES) {
+			printf("appAttributes->pipeline has too many stages\n");
+			return (-1);
+		}
+
+		type = ezxml_attr(stage, "type");
+		if (type == NULL) {
+			printf("appAttributes->pipeline->stage has no type\n");
+			return (-1);
+		}
+
+		strncpy(app_info->pipeline_stages[app_info->nb_pipeline_stages], type, MAX_CHAR_FIELD_LENGTH-1);
+		app_info->pipeline_stages[app_info->nb_pipeline_stages][MAX_CHAR_FIELD_LENGTH-1] = '\0';
+		app_info->nb_pipeline_stages++;
+	}
+
+	return (0);
+}
+
+/**
+ * get_feature_attributes(ezxml_t app_attribute, appconfig_t * app_info)
+ * @brief parse the optional band power features. The bands default to
+ *        delta, theta, alpha, beta and gamma.
+ *        <feature_shm_key>9012</feature_shm_key>
+ *        <feature_sem_key>9013</feature_sem_key> (optional, the set of
+ *        sem_key is shared otherwise)
+ *        <feature_bands>
+ *          <band low="8" high="13"/>
+ *        </feature_bands>
+ * @param app_attribute, reference to xml file
+ * @param (out)app_info, now contains the features
+ * @return < 0 for error, 0 for success
+ */
+static int get_feature_attributes(ezxml_t app_attribute, appconfig_t * app_info)
+{
+	ezxml_t band;
+	const char *low;
+	const char *high;
+	const feature_band_t default_bands[] = { {1, 4}, {4, 8}, {8, 13}, {13, 30}, {30, 45} };
+	int i;
+
+	app_info->feature_shm_key = 0;
+	app_info->feature_sem_key = 0;
+	app_info->nb_feature_bands = sizeof(default_bands)/sizeof(feature_band_t);
+	for (i = 0; i < app_info->nb_feature_bands; i++) {
+		app_info->feature_bands[i] = default_bands[i];
+	}
+
+	/*Get appAttributes/feature_shm_key*/
+	ezxml_t tmp = ezxml_child(app_attribute, "feature_shm_key");
+	if (tmp != NULL) {
+		app_info->feature_shm_key = atoi(tmp->txt);
+	}
+
+	/*Get appAttributes/feature_sem_key*/
+	tmp = ezxml_child(app_attribute, "feature_sem_key");
+	if (tmp != NULL) {
+		app_info->feature_sem_key = atoi(tmp->txt);
+	}
+
+	/*Get appAttributes/feature_bands*/
+	tmp = ezxml_child(app_attribute, "feature_bands");
+	if (tmp == NULL) {
+		return (0);
+	}
+
+	app_info->nb_feature_bands = 0;
+	for (band = ezxml_child(tmp, "band"); band != NULL; band = ezxml_next(band)) {
+
+		if (app_info->nb_feature_bands >= MAX_FEATURE_BANDS) {
+			printf("appAttributes->feature_bands has too many bands\n");
+			return (-1);
+		}
+
+		low = ezxml_attr(band, "low");
+		high = ezxml_attr(band, "high");
+		if (low == NULL || high == NULL || atof(low) < 0 || atof(low) >= atof(high)) {
+			printf("appAttributes->feature_bands->band is invalid\n");
+			return (-1);
+		}
+
+		app_info->feature_bands[app_info->nb_feature_bands].low = atof(low);
+		app_info->feature_bands[app_info->nb_feature_bands].high = atof(high);
+		app_info->nb_feature_bands++;
+	}
+
+	if (app_info->nb_feature_bands == 0) {
+		printf("appAttributes->feature_bands is empty\n");
+		return (-1);
+	}
+
+	return (0);
+}
+
+/**
+ * get_quality_attributes(ezxml_t app_attribute, appconfig_t * app_info)
+ * @brief parse the optional signal quality status page and its update rate
+ *        (default 4 per second)
+ *        <quality_shm_key>9034</quality_shm_key>
+ *        <quality_update_rate>4</quality_update_rate>
+ * @param app_attribute, reference to xml file
+ * @param (out)app_info, now contains the status page
+ * @return < 0 for error, 0 for success
+ */
+static int get_quality_attributes(ezxml_t app_attribute, appconfig_t * app_info)
+{
+	app_info->quality_shm_key = 0;
+	app_info->quality_update_rate = 4;
+
+	/*Get appAttributes/quality_shm_key*/
+	ezxml_t tmp = ezxml_child(app_attribute, "quality_shm_key");
+	if (tmp != NULL) {
+		app_info->quality_shm_key = atoi(tmp->txt);
+	}
+
+	/*Get appAttributes/quality_update_rate*/
+	tmp = ezxml_child(app_attribute, "quality_update_rate");
+	if (tmp != NULL) {
+		app_info->quality_update_rate = atoi(tmp->txt);
+		if (app_info->quality_update_rate <= 0) {
+			printf("appAttributes->quality_update_rate must be positive\n");
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+/**
+ * get_envelope_attributes(ezxml_t app_attribute, appconfig_t * app_info)
+ * @brief parse the optional min/max envelope pyramid and the seconds kept in
+ *        each of its levels (default 600)
+ *        <envelope_shm_key>9035</envelope_shm_key>
+ *        <envelope_duration>600</envelope_duration>
+ * @param app_attribute, reference to xml file
+ * @param (out)app_info, now contains the envelope
+ * @return < 0 for error, 0 for success
+ */
+static int get_envelope_attributes(ezxml_t app_attribute, appconfig_t * app_info)
+{
+	app_info->envelope_shm_key = 0;
+	app_info->envelope_duration = 600;
+
+	/*Get appAttributes/envelope_shm_key*/
+	ezxml_t tmp = ezxml_child(app_attribute, "envelope_shm_key");
+	if (tmp != NULL) {
+		app_info->envelope_shm_key = atoi(tmp->txt);
+	}
+
+	/*Get appAttributes/envelope_duration*/
+	tmp = ezxml_child(app_attribute, "envelope_duration");
+	if (tmp != NULL) {
+		app_info->envelope_duration = atoi(tmp->txt);
+		if (app_info->envelope_duration <= 0) {
+			printf("appAttributes->envelope_duration must be positive\n");
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+/**
+ * get_replay_attributes(ezxml_t app_attribute, appconfig_t * app_info)
+ * @brief parse the capture replayed by the REPLAY hardware and the speed of
+ *        the replay (default 1, the original timing, 0 as fast as possible)
+ *        <replay_file>session.cap</replay_file>
+ *        <replay_speed>4</replay_speed>
+ * @param app_attribute, reference to xml file
+ * @param (out)app_info, now contains the replay
+ * @return < 0 for error, 0 for success
+ */
+static int get_replay_attributes(ezxml_t app_attribute, appconfig_t * app_info)
+{
+	app_info->replay_file[0] = '\0';
+	app_info->replay_speed = 1;
+
+	/*Get appAttributes/replay_file*/
+	ezxml_t tmp = ezxml_child(app_attribute, "replay_file");
+	if (tmp != NULL) {
+		if (strlen(tmp->txt) >= MAX_PATH_LENGTH) {
+			printf("appAttributes->replay_file is too long\n");
+			return (-1);
+		}
+		strcpy(app_info->replay_file, tmp->txt);
+	}
+
+	/*Get appAttributes/replay_speed*/
+	tmp = ezxml_child(app_attribute, "replay_speed");
+	if (tmp != NULL) {
+		app_info->replay_speed = atof(tmp->txt);
+		if (app_info->replay_speed < 0) {
+			printf("appAttributes->replay_speed is invalid\n");
+			return (-1);
+		}
+	}
+
+	if (strcmp((const char *)app_info->device, "REPLAY") == 0 && app_info->replay_file[0] == '\0') {
+		printf("appAttributes->replay_file is required by the REPLAY device\n");
+		return (-1);
+	}
+
+	return (0);
+}
+
+/**
+ * get_merge_attributes(ezxml_t app_attribute, appconfig_t * app_info)
+ * @brief parse the optional merge configuration: the output rate and the
+ *        shared memory rings of the devices to merge
+ *        <merge_rate>250</merge_rate>
+ *        <merge_sources>
+ *          <source shm_key="5678" sem_key="1234" nb_data_channels="4" window_size="110" nb_pages="2"/>
+ *        </merge_sources>
+ * @param app_attribute, reference to xml file
+ * @param (out)app_info, now contains the merge information
+ * @return < 0 for error, 0 for success
+ */
+static int get_merge_attributes(ezxml_t app_attribute, appconfig_t * app_info)
+{
+	ezxml_t source;
+	const char *attr;
+	merge_source_t *merge_source;
+	const char *source_attributes[] = { "shm_key", "sem_key", "nb_data_channels", "window_size", "nb_pages" };
+	int i;
+
+	app_info->merge_rate = 0;
+	app_info->nb_merge_sources = 0;
+
+	/*Get appAttributes/merge_rate*/
+	ezxml_t tmp = ezxml_child(app_attribute, "merge_rate");
+	if (tmp != NULL) {
+		app_info->merge_rate = atoi(tmp->txt);
+	}
+
+	/*Get appAttributes/merge_sources*/
+	tmp = ezxml_child(app_attribute, "merge_sources");
+	if (tmp == NULL) {
+		return (0);
+	}
+
+	for (source = ezxml_child(tmp, "source"); source != NULL; source = ezxml_next(source)) {
+
+		if (app_info->nb_merge_sources >= MAX_MERGE_SOURCES) {
+			printf("appAttributes->merge_sources has too many sources\n");
+			return (-1);
+		}
+
+		/*all attributes are required*/
+		for (i = 0; i < (int)(sizeof(source_attributes) / sizeof(source_attributes[0])); i++) {
+			if (ezxml_attr(source, source_attributes[i]) == NULL) {
+				printf("appAttributes->merge_sources->source->%s is missing\n", source_attributes[i]);
+				return (-1);
+			}
+		}
+
+		merge_source = &(app_info->merge_sources[app_info->nb_merge_sources]);
+		attr = ezxml_attr(source, "shm_key");
+		merge_source->shm_key = atoi(attr);
+		attr = ezxml_attr(source, "sem_key");
+		merge_source->sem_key = atoi(attr);
+		attr = ezxml_attr(source, "nb_data_channels");
+		merge_source->nb_data_channels = atoi(attr);
+		attr = ezxml_attr(source, "window_size");
+		merge_source->window_size = atoi(attr);
+		attr = ezxml_attr(source, "nb_pages");
+		merge_source->nb_pages = atoi(attr);
+
+		app_info->nb_merge_sources++;
+	}
+
 	return (0);
 }
 